@@ -49,6 +49,7 @@ HEADERS += window/ultragrid_window.hpp \
 	window/log_window.hpp \
 	../../tools/astat.h \
 	../../tools/ipc_frame.h \
+	../../tools/ipc_frame_shm.h \
 	../../tools/ipc_frame_unix.h \
 	../../src/compat/platform_pipe.h \
 	widget/vuMeterWidget.hpp \
@@ -99,6 +100,7 @@ SOURCES += window/ultragrid_window.cpp \
 	util/random_port.cpp \
 	../../tools/astat.cpp \
 	../../tools/ipc_frame.cpp \
+	../../tools/ipc_frame_shm.cpp \
 	../../tools/ipc_frame_unix.cpp \
 	../../src/compat/platform_pipe.cpp \
 	main.cpp
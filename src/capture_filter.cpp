@@ -47,6 +47,7 @@
 #include "module.h"
 #include "utils/color_out.h"
 #include "utils/list.h"
+#include "utils/vf_split.h"
 #include "video.h"
 
 using namespace std;
@@ -54,6 +55,9 @@ using namespace std;
 struct capture_filter {
         struct module mod;
         struct simple_linked_list *filters;
+        /// filters process whole frames, stripes (fragments) from capture are merged first
+        vf_fragment_assembler fragments;
+        shared_ptr<video_frame> merged; ///< frame passed to the filters, kept until the next one is merged
 };
 
 struct capture_filter_instance {
@@ -112,7 +116,7 @@ int capture_filter_init(struct module *parent, const char *cfg, struct capture_f
                 return 1;
         }
 
-        struct capture_filter *s = (struct capture_filter *) calloc(1, sizeof(struct capture_filter));
+        auto *s = new struct capture_filter();
         char *item, *save_ptr;
         assert(s);
         char *filter_list_str = NULL,
@@ -135,7 +139,7 @@ int capture_filter_init(struct module *parent, const char *cfg, struct capture_f
                         if (ret != 0) {
                                 module_done(&s->mod);
                                 free(tmp);
-                                free(s);
+                                delete s;
                                 return ret;
                         }
                         filter_list_str = NULL;
@@ -163,7 +167,7 @@ void capture_filter_destroy(struct capture_filter *state)
 
         module_done(&s->mod);
 
-        free(state);
+        delete s;
 }
 
 static struct response *process_message(struct capture_filter *s, struct msg_universal *msg)
@@ -218,6 +222,23 @@ struct video_frame *capture_filter(struct capture_filter *state, struct video_fr
                 free_message(msg, r);
         }
 
+        if (simple_linked_list_size(s->filters) == 0) {
+                return frame;
+        }
+
+        if (frame->fragment) {
+                // tile dimensions of a fragment describe the whole frame, not the data
+                shared_ptr<video_frame> merged = s->fragments.add(frame);
+                VIDEO_FRAME_DISPOSE(frame);
+                if (!merged) {
+                        return NULL;
+                }
+                LOG_ONCE(LOG_LEVEL_WARNING, to_fourcc('C', 'F', 'F', 'R'), "[capture filter] Capture "
+                                "delivers frames in stripes, merging them for capture filters (no stripe-level latency).\n");
+                s->merged = move(merged);
+                frame = s->merged.get();
+        }
+
         for(void *it = simple_linked_list_it_init(s->filters);
                         it != NULL;
            ) {
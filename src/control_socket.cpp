@@ -57,6 +57,7 @@
 #include "module.h"
 #include "rtp/net_udp.h" // socket_error
 #include "tv.h"
+#include "utils/metrics.h"
 #include "utils/net.h"
 #include "utils/thread.h"
 
@@ -359,6 +360,14 @@ static int process_msg(struct control_state *s, fd_t client_fd, char *message, s
                 return ret;
         } else if (strcasecmp(message, "noop") == 0) {
                 return ret;
+        } else if (strcasecmp(message, "metrics") == 0 || strcasecmp(message, "metrics binary") == 0) {
+                string payload = strcasecmp(message, "metrics") == 0 ? metrics_format_prometheus() : metrics_format_binary();
+                // response text carries the payload length, the payload follows
+                send_response(client_fd, new_response(RESPONSE_OK, to_string(payload.size()).c_str()));
+                if (write_all(client_fd, payload.data(), payload.size()) != (ssize_t) payload.size()) {
+                        socket_error("Unable to write metrics");
+                }
+                return ret;
         } else if (prefix_matches(message, "stats ") || prefix_matches(message, "event ")) {
                 if (is_internal_port(client_fd)) {
                         struct client *cur = clients;
@@ -993,7 +1002,8 @@ static void print_control_help() {
                         "\tmute\n"
                                 "\t\tthe three items above apply to receiver\n"
                         "\tpostprocess <new_postprocess>|flush\n"
-                        "\tdump-tree\n");
+                        "\tdump-tree\n"
+                        "\tmetrics [binary]\n");
         printf("\nOther commands can be issued directly to individual "
                         "modules (see \"dump-tree\"), eg.:\n"
                         "\tcapture.filter mirror\n"
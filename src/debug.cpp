@@ -48,18 +48,26 @@
 #include "config_unix.h"
 #include "config_win32.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "compat/platform_time.h"
 #include "debug.h"
 #include "host.h"
 #include "utils/color_out.h"
+#include "utils/metrics.h"
 #include "utils/sv_parse_num.hpp"
 #include "utils/misc.h" // ug_strerror
+#include "utils/thread.h"
 
 using std::string;
 using std::unordered_map;
@@ -89,6 +97,680 @@ static void _dprintf(const char *format, ...)
 #endif                          /* WIN32 */
 }
 
+/**
+ * @name Asynchronous logging backend
+ *
+ * Every thread that logs gets its own single-producer single-consumer byte
+ * ring. log_msg() does not format anything - it parses the format string,
+ * copies the arguments (strings by value) into a record and pushes it to the
+ * ring. The logging thread merges the rings in the order given by a global
+ * sequence number, formats the records and prints them.
+ *
+ * Format strings are referenced by pointer so log_async_stop() must be called
+ * before unloading modules (done by common_cleanup()).
+ * @{
+ */
+namespace {
+enum log_arg_type : uint8_t {
+        LOG_ARG_INT,
+        LOG_ARG_UINT,
+        LOG_ARG_DOUBLE,
+        LOG_ARG_PTR,
+        LOG_ARG_STR, ///< followed by uint16_t length and the characters (no NUL)
+};
+
+struct log_record {
+        uint32_t len;           ///< whole record length including this header
+        int32_t level;          ///< -1 if the text is already styled
+        uint64_t seq;
+        uint64_t time_ms;
+        const char *format;     ///< nullptr if the payload is formatted text
+        bool raw;
+};
+
+constexpr size_t LOG_MAX_RECORD = 4096;
+constexpr auto LOG_ASYNC_IDLE_WAIT = std::chrono::milliseconds(100);
+constexpr time_ns_t LOG_DROP_REPORT_INTERVAL = 5 * NS_IN_SEC;
+
+class log_ring {
+public:
+        explicit log_ring(size_t size) : data(size) {}
+
+        bool push(const char *rec, size_t len) {
+                size_t head = m_head.load(std::memory_order_relaxed);
+                size_t tail = m_tail.load(std::memory_order_acquire);
+                if (data.size() - (head - tail) < len) {
+                        return false;
+                }
+                copy_in(head, rec, len);
+                m_head.store(head + len, std::memory_order_release);
+                return true;
+        }
+        /// copies header of the oldest record to hdr, returns false if empty
+        bool peek(log_record *hdr) const {
+                size_t tail = m_tail.load(std::memory_order_relaxed);
+                if (m_head.load(std::memory_order_acquire) == tail) {
+                        return false;
+                }
+                copy_out(tail, reinterpret_cast<char *>(hdr), sizeof *hdr);
+                return true;
+        }
+        void pop(char *out, size_t len) {
+                size_t tail = m_tail.load(std::memory_order_relaxed);
+                copy_out(tail, out, len);
+                m_tail.store(tail + len, std::memory_order_release);
+        }
+        bool empty() const {
+                return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_relaxed);
+        }
+
+        std::atomic<bool> orphaned{false}; ///< owning thread has exited
+
+private:
+        void copy_in(size_t pos, const char *src, size_t len) {
+                size_t off = pos % data.size();
+                size_t first = std::min(len, data.size() - off);
+                memcpy(data.data() + off, src, first);
+                memcpy(data.data(), src + first, len - first);
+        }
+        void copy_out(size_t pos, char *dst, size_t len) const {
+                size_t off = pos % data.size();
+                size_t first = std::min(len, data.size() - off);
+                memcpy(dst, data.data() + off, first);
+                memcpy(dst + first, data.data(), len - first);
+        }
+
+        std::vector<char> data;
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+struct log_async_state {
+        size_t ring_size = 0;
+        std::mutex lock; ///< protects rings and should_exit
+        std::condition_variable cv;
+        std::vector<std::shared_ptr<log_ring>> rings;
+        std::thread thread;
+        bool should_exit = false;
+        std::atomic<bool> sleeping{false};
+        std::atomic<uint64_t> seq{0};
+};
+log_async_state log_async;
+std::atomic<bool> log_async_running{false};
+
+struct log_thread_ring {
+        std::shared_ptr<log_ring> ring;
+        ~log_thread_ring() {
+                if (ring) {
+                        ring->orphaned.store(true, std::memory_order_release);
+                }
+        }
+};
+thread_local log_thread_ring log_tl_ring;
+
+struct log_drop_counters {
+        std::atomic<uint64_t> ring_full{0};
+        std::atomic<uint64_t> rate_limited{0};
+        std::atomic<time_ns_t> last_report{0};
+        struct metric *metric = metric_register("log_dropped_total",
+                        "Log messages dropped (ring full or rate limited)", METRIC_COUNTER);
+};
+log_drop_counters log_drops;
+
+/// per call-site token counters, call sites (format pointers) hashing to the
+/// same slot share the limit
+struct log_rate_slot {
+        std::atomic<int64_t> second{0};
+        std::atomic<int> count{0};
+};
+std::array<log_rate_slot, 256> log_rate_slots;
+int log_rate_limit; ///< messages per second per call site, 0 - unlimited
+
+enum log_len_mod { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_BIG_L };
+
+struct log_fmt_spec {
+        const char *len_begin;  ///< start of the length modifier
+        const char *end;        ///< one past the conversion specifier
+        int stars;              ///< number of '*' (width/precision) arguments
+        bool prec_star;
+        int prec;               ///< -1 if not given
+        log_len_mod len;
+        char conv;
+};
+
+/**
+ * Parses conversion specification, p points just after '%'.
+ * @retval false if the specification is not supported by the backend
+ */
+bool log_parse_spec(const char *p, log_fmt_spec *spec)
+{
+        *spec = { nullptr, nullptr, 0, false, -1, LEN_NONE, '\0' };
+        const char *q = p;
+        while (isdigit(*q)) {
+                q++;
+        }
+        if (*q == '$') { // positional arguments
+                return false;
+        }
+        while (*p != '\0' && strchr("-+ #0'", *p) != nullptr) {
+                p++;
+        }
+        if (*p == '*') {
+                spec->stars++;
+                p++;
+        } else {
+                while (isdigit(*p)) {
+                        p++;
+                }
+        }
+        if (*p == '.') {
+                p++;
+                if (*p == '*') {
+                        spec->stars++;
+                        spec->prec_star = true;
+                        p++;
+                } else {
+                        spec->prec = 0;
+                        while (isdigit(*p)) {
+                                spec->prec = spec->prec * 10 + (*p++ - '0');
+                        }
+                }
+        }
+        spec->len_begin = p;
+        switch (*p) {
+        case 'h':
+                spec->len = *++p == 'h' ? (p++, LEN_HH) : LEN_H;
+                break;
+        case 'l':
+                spec->len = *++p == 'l' ? (p++, LEN_LL) : LEN_L;
+                break;
+        case 'q': spec->len = LEN_LL; p++; break;
+        case 'j': spec->len = LEN_J; p++; break;
+        case 'z': spec->len = LEN_Z; p++; break;
+        case 't': spec->len = LEN_T; p++; break;
+        case 'L': spec->len = LEN_BIG_L; p++; break;
+        default: break;
+        }
+        spec->conv = *p;
+        if (*p == '\0' || strchr("diouxXcfFeEgGaAsp%", *p) == nullptr) {
+                return false;
+        }
+        spec->end = p + 1;
+        return true;
+}
+
+/**
+ * Copies arguments of format to out.
+ * @retval false if the format is not supported or the arguments do not fit
+ */
+bool log_capture_args(const char *format, va_list ap, char *out, size_t size, size_t *len)
+{
+        size_t pos = 0;
+        auto put = [&](log_arg_type type, const void *val, size_t n) {
+                if (pos + 1 + n > size) {
+                        return false;
+                }
+                out[pos++] = type;
+                memcpy(out + pos, val, n);
+                pos += n;
+                return true;
+        };
+
+        for (const char *p = strchr(format, '%'); p != nullptr; p = strchr(p, '%')) {
+                log_fmt_spec spec;
+                if (!log_parse_spec(p + 1, &spec)) {
+                        return false;
+                }
+                p = spec.end;
+                int prec = spec.prec;
+                for (int i = 0; i < spec.stars; ++i) {
+                        int64_t val = va_arg(ap, int);
+                        if (spec.prec_star && i == spec.stars - 1) {
+                                prec = val < 0 ? -1 : val;
+                        }
+                        if (!put(LOG_ARG_INT, &val, sizeof val)) {
+                                return false;
+                        }
+                }
+                bool ret = true;
+                switch (spec.conv) {
+                case '%':
+                        break;
+                case 'd':
+                case 'i': {
+                        int64_t val = 0;
+                        switch (spec.len) {
+                        case LEN_HH: val = (signed char) va_arg(ap, int); break;
+                        case LEN_H: val = (short) va_arg(ap, int); break;
+                        case LEN_L: val = va_arg(ap, long); break;
+                        case LEN_LL: val = va_arg(ap, long long); break;
+                        case LEN_J: val = va_arg(ap, intmax_t); break;
+                        case LEN_Z: val = va_arg(ap, ssize_t); break;
+                        case LEN_T: val = va_arg(ap, ptrdiff_t); break;
+                        case LEN_BIG_L: return false;
+                        default: val = va_arg(ap, int); break;
+                        }
+                        ret = put(LOG_ARG_INT, &val, sizeof val);
+                        break;
+                }
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X': {
+                        uint64_t val = 0;
+                        switch (spec.len) {
+                        case LEN_HH: val = (unsigned char) va_arg(ap, unsigned); break;
+                        case LEN_H: val = (unsigned short) va_arg(ap, unsigned); break;
+                        case LEN_L: val = va_arg(ap, unsigned long); break;
+                        case LEN_LL: val = va_arg(ap, unsigned long long); break;
+                        case LEN_J: val = va_arg(ap, uintmax_t); break;
+                        case LEN_Z: val = va_arg(ap, size_t); break;
+                        case LEN_T: val = va_arg(ap, ptrdiff_t); break;
+                        case LEN_BIG_L: return false;
+                        default: val = va_arg(ap, unsigned); break;
+                        }
+                        ret = put(LOG_ARG_UINT, &val, sizeof val);
+                        break;
+                }
+                case 'c': {
+                        if (spec.len != LEN_NONE) {
+                                return false;
+                        }
+                        int64_t val = va_arg(ap, int);
+                        ret = put(LOG_ARG_INT, &val, sizeof val);
+                        break;
+                }
+                case 'p': {
+                        void *val = va_arg(ap, void *);
+                        ret = put(LOG_ARG_PTR, &val, sizeof val);
+                        break;
+                }
+                case 's': {
+                        if (spec.len != LEN_NONE) {
+                                return false;
+                        }
+                        const char *str = va_arg(ap, const char *);
+                        if (str == nullptr) {
+                                str = "(null)";
+                        }
+                        size_t n = prec >= 0 ? strnlen(str, prec) : strlen(str);
+                        if (n > UINT16_MAX || pos + 1 + sizeof(uint16_t) + n > size) {
+                                return false;
+                        }
+                        uint16_t n16 = n;
+                        put(LOG_ARG_STR, &n16, sizeof n16);
+                        memcpy(out + pos, str, n);
+                        pos += n;
+                        break;
+                }
+                default: { // floating point
+                        if (spec.len == LEN_BIG_L) {
+                                return false;
+                        }
+                        double val = va_arg(ap, double);
+                        ret = put(LOG_ARG_DOUBLE, &val, sizeof val);
+                        break;
+                }
+                }
+                if (!ret) {
+                        return false;
+                }
+        }
+        *len = pos;
+        return true;
+}
+
+template<typename T>
+void log_append_conv(std::string &out, const char *fmt, int stars, const int *star, T val)
+{
+        auto do_print = [&](char *buf, size_t size) {
+                switch (stars) {
+                case 0: return snprintf(buf, size, fmt, val);
+                case 1: return snprintf(buf, size, fmt, star[0], val);
+                default: return snprintf(buf, size, fmt, star[0], star[1], val);
+                }
+        };
+        char buf[128];
+        int n = do_print(buf, sizeof buf);
+        if (n < 0) {
+                return;
+        }
+        if ((size_t) n < sizeof buf) {
+                out.append(buf, n);
+                return;
+        }
+        size_t old_len = out.length();
+        out.resize(old_len + n + 1);
+        do_print(&out[old_len], n + 1);
+        out.resize(old_len + n);
+}
+
+/// formats captured arguments according to format (runs in the logging thread)
+void log_render(const char *format, const char *args, std::string &out)
+{
+        static std::string str;
+        size_t pos = 0;
+        const char *p = format;
+        while (const char *pct = strchr(p, '%')) {
+                out.append(p, pct - p);
+                log_fmt_spec spec;
+                log_parse_spec(pct + 1, &spec); // already validated by log_capture_args()
+                p = spec.end;
+                if (spec.conv == '%') {
+                        out += '%';
+                        continue;
+                }
+                int star[2] = {};
+                for (int i = 0; i < spec.stars; ++i) {
+                        int64_t val = 0;
+                        memcpy(&val, args + pos + 1, sizeof val);
+                        pos += 1 + sizeof val;
+                        star[i] = val;
+                }
+                // rebuild the specification with the length modifier matching the stored value
+                char fmt[32];
+                size_t n = std::min<size_t>(spec.len_begin - pct, sizeof fmt - 4);
+                memcpy(fmt, pct, n);
+                auto type = static_cast<log_arg_type>(args[pos++]);
+                if ((type == LOG_ARG_INT || type == LOG_ARG_UINT) && spec.conv != 'c') {
+                        fmt[n++] = 'l';
+                        fmt[n++] = 'l';
+                }
+                fmt[n++] = spec.conv;
+                fmt[n] = '\0';
+                switch (type) {
+                case LOG_ARG_INT: {
+                        int64_t val = 0;
+                        memcpy(&val, args + pos, sizeof val);
+                        pos += sizeof val;
+                        if (spec.conv == 'c') {
+                                log_append_conv(out, fmt, spec.stars, star, (int) val);
+                        } else if (spec.len == LEN_HH) { // printf converts the value to the type of the length modifier
+                                log_append_conv(out, fmt, spec.stars, star, (long long) (signed char) val);
+                        } else if (spec.len == LEN_H) {
+                                log_append_conv(out, fmt, spec.stars, star, (long long) (short) val);
+                        } else {
+                                log_append_conv(out, fmt, spec.stars, star, (long long) val);
+                        }
+                        break;
+                }
+                case LOG_ARG_UINT: {
+                        uint64_t val = 0;
+                        memcpy(&val, args + pos, sizeof val);
+                        pos += sizeof val;
+                        if (spec.len == LEN_HH) {
+                                val = (unsigned char) val;
+                        } else if (spec.len == LEN_H) {
+                                val = (unsigned short) val;
+                        }
+                        log_append_conv(out, fmt, spec.stars, star, (unsigned long long) val);
+                        break;
+                }
+                case LOG_ARG_DOUBLE: {
+                        double val = 0;
+                        memcpy(&val, args + pos, sizeof val);
+                        pos += sizeof val;
+                        log_append_conv(out, fmt, spec.stars, star, val);
+                        break;
+                }
+                case LOG_ARG_PTR: {
+                        void *val = nullptr;
+                        memcpy(&val, args + pos, sizeof val);
+                        pos += sizeof val;
+                        log_append_conv(out, fmt, spec.stars, star, val);
+                        break;
+                }
+                case LOG_ARG_STR: {
+                        uint16_t len = 0;
+                        memcpy(&len, args + pos, sizeof len);
+                        pos += sizeof len;
+                        str.assign(args + pos, len);
+                        pos += len;
+                        log_append_conv(out, fmt, spec.stars, star, str.c_str());
+                        break;
+                }
+                }
+        }
+        out.append(p);
+}
+
+void log_async_print(const char *rec, std::string &out)
+{
+        log_record hdr;
+        memcpy(&hdr, rec, sizeof hdr);
+        const char *payload = rec + sizeof hdr;
+
+        out.clear();
+        if (hdr.level >= 0) {
+                out += get_log_output().get_level_style(hdr.level);
+        }
+        if (hdr.format != nullptr) {
+                log_render(hdr.format, payload, out);
+        } else {
+                out.append(payload, hdr.len - sizeof hdr);
+        }
+        if (hdr.level >= 0 && get_log_output().is_interactive()) {
+                out += TERM_RESET;
+        }
+        if (hdr.raw) {
+                get_log_output().print_raw(out);
+        } else {
+                get_log_output().print(out, hdr.time_ms);
+        }
+}
+
+void log_count_drop(std::atomic<uint64_t> &counter)
+{
+        counter.fetch_add(1, std::memory_order_relaxed);
+        metric_add(log_drops.metric, 1);
+}
+
+/// prints number of dropped messages at most once per LOG_DROP_REPORT_INTERVAL
+void log_report_dropped(bool force)
+{
+        if (log_drops.ring_full.load(std::memory_order_relaxed) == 0
+                        && log_drops.rate_limited.load(std::memory_order_relaxed) == 0) {
+                return;
+        }
+        time_ns_t now = get_time_in_ns();
+        time_ns_t last = log_drops.last_report.load(std::memory_order_relaxed);
+        if (!force && now - last < LOG_DROP_REPORT_INTERVAL) {
+                return;
+        }
+        if (!log_drops.last_report.compare_exchange_strong(last, now)) {
+                return; // other thread is reporting
+        }
+        uint64_t full = log_drops.ring_full.exchange(0);
+        uint64_t limited = log_drops.rate_limited.exchange(0);
+        char buf[256];
+        snprintf(buf, sizeof buf, "%s[logger] Dropped %" PRIu64 " log messages (ring full), %" PRIu64
+                        " suppressed by rate limit%s\n",
+                        get_log_output().get_level_style(LOG_LEVEL_WARNING).c_str(), full, limited,
+                        get_log_output().is_interactive() ? TERM_RESET : "");
+        std::string msg = buf;
+        get_log_output().print(msg);
+}
+
+bool log_rate_limited(const char *format)
+{
+        if (log_rate_limit == 0) {
+                return false;
+        }
+        auto &slot = log_rate_slots[(reinterpret_cast<uintptr_t>(format) * UINT64_C(0x9E3779B97F4A7C15)) >> 56];
+        int64_t now = get_time_in_ns() / NS_IN_SEC;
+        int64_t second = slot.second.load(std::memory_order_relaxed);
+        if (second != now && slot.second.compare_exchange_strong(second, now, std::memory_order_relaxed)) {
+                slot.count.store(0, std::memory_order_relaxed);
+        }
+        if (slot.count.fetch_add(1, std::memory_order_relaxed) < log_rate_limit) {
+                return false;
+        }
+        log_count_drop(log_drops.rate_limited);
+        return true;
+}
+
+log_ring *log_get_thread_ring()
+{
+        if (!log_tl_ring.ring) {
+                auto ring = std::make_shared<log_ring>(log_async.ring_size);
+                std::lock_guard<std::mutex> lk(log_async.lock);
+                log_async.rings.push_back(ring);
+                log_tl_ring.ring = std::move(ring);
+        }
+        return log_tl_ring.ring.get();
+}
+
+/// @param rec record with payload, header is filled here
+void log_async_push(char *rec, size_t len, int level, const char *format, bool raw)
+{
+        log_record hdr{};
+        hdr.len = len;
+        hdr.level = level;
+        hdr.seq = log_async.seq.fetch_add(1, std::memory_order_relaxed);
+        hdr.time_ms = time_since_epoch_in_ms();
+        hdr.format = format;
+        hdr.raw = raw;
+        memcpy(rec, &hdr, sizeof hdr);
+        if (!log_get_thread_ring()->push(rec, len)) {
+                log_count_drop(log_drops.ring_full);
+                return;
+        }
+        if (log_async.sleeping.load(std::memory_order_relaxed) && log_async.sleeping.exchange(false)) {
+                std::lock_guard<std::mutex> lk(log_async.lock);
+                log_async.cv.notify_one();
+        }
+}
+
+thread_local std::array<char, LOG_MAX_RECORD> log_scratch;
+
+/// @retval false if the message cannot be handled asynchronously and needs to be printed directly
+bool log_async_push_fmt(int level, const char *format, va_list ap)
+{
+        size_t len = 0;
+        va_list aq;
+        va_copy(aq, ap);
+        bool captured = log_capture_args(format, aq, log_scratch.data() + sizeof(log_record),
+                        log_scratch.size() - sizeof(log_record), &len);
+        va_end(aq);
+        if (captured) {
+                log_async_push(log_scratch.data(), sizeof(log_record) + len, level, format, false);
+                return true;
+        }
+        // unsupported conversion - format here but still output from the logging thread
+        int ret = vsnprintf(log_scratch.data() + sizeof(log_record), log_scratch.size() - sizeof(log_record), format, ap);
+        if (ret < 0 || (size_t) ret >= log_scratch.size() - sizeof(log_record)) {
+                return false;
+        }
+        log_async_push(log_scratch.data(), sizeof(log_record) + ret, level, nullptr, false);
+        return true;
+}
+
+void log_async_thread()
+{
+        set_thread_name("logger");
+        std::vector<std::shared_ptr<log_ring>> rings;
+        std::vector<char> rec(LOG_MAX_RECORD);
+        std::string out;
+        bool exiting = false;
+        while (!exiting) {
+                {
+                        std::lock_guard<std::mutex> lk(log_async.lock);
+                        exiting = log_async.should_exit;
+                        auto &all = log_async.rings;
+                        all.erase(std::remove_if(all.begin(), all.end(), [](auto &r) {
+                                                return r->orphaned.load(std::memory_order_acquire) && r->empty(); }),
+                                        all.end());
+                        rings = all;
+                }
+                bool processed = false;
+                while (true) { // merge rings by sequence number
+                        log_ring *next = nullptr;
+                        log_record hdr;
+                        log_record next_hdr{};
+                        for (auto &r : rings) {
+                                if (r->peek(&hdr) && (next == nullptr || hdr.seq < next_hdr.seq)) {
+                                        next = r.get();
+                                        next_hdr = hdr;
+                                }
+                        }
+                        if (next == nullptr) {
+                                break;
+                        }
+                        if (rec.size() < next_hdr.len) {
+                                rec.resize(next_hdr.len);
+                        }
+                        next->pop(rec.data(), next_hdr.len);
+                        log_async_print(rec.data(), out);
+                        processed = true;
+                }
+                log_report_dropped(false);
+                if (!processed && !exiting) {
+                        std::unique_lock<std::mutex> lk(log_async.lock);
+                        log_async.sleeping.store(true);
+                        if (!log_async.should_exit) {
+                                log_async.cv.wait_for(lk, LOG_ASYNC_IDLE_WAIT);
+                        }
+                        log_async.sleeping.store(false);
+                }
+        }
+        log_report_dropped(true);
+}
+} // end anonymous namespace
+
+bool log_async_start(size_t ring_size)
+{
+        if (log_async_running) {
+                return true;
+        }
+        if (ring_size < 2 * LOG_MAX_RECORD) {
+                log_msg(LOG_LEVEL_ERROR, "[logger] Ring size must be at least %zu B!\n", 2 * LOG_MAX_RECORD);
+                return false;
+        }
+        log_async.ring_size = ring_size;
+        log_async.should_exit = false;
+        log_async.thread = std::thread(log_async_thread);
+        log_async_running = true;
+        static bool atexit_registered = false;
+        if (!atexit_registered) {
+                atexit(log_async_stop);
+                atexit_registered = true;
+        }
+        return true;
+}
+
+/// flushes pending messages and stops the logging thread, further messages are printed synchronously
+void log_async_stop()
+{
+        if (!log_async_running.exchange(false)) {
+                return;
+        }
+        {
+                std::lock_guard<std::mutex> lk(log_async.lock);
+                log_async.should_exit = true;
+                log_async.cv.notify_one();
+        }
+        log_async.thread.join();
+}
+
+bool log_async_push_text(const std::string &msg, bool raw)
+{
+        if (!log_async_running.load(std::memory_order_relaxed)) {
+                return false;
+        }
+        if (msg.length() > log_scratch.size() - sizeof(log_record)) {
+                return false;
+        }
+        memcpy(log_scratch.data() + sizeof(log_record), msg.data(), msg.length());
+        log_async_push(log_scratch.data(), sizeof(log_record) + msg.length(), -1, nullptr, raw);
+        return true;
+}
+
+void log_set_rate_limit(int msgs_per_sec)
+{
+        log_rate_limit = std::max(msgs_per_sec, 0);
+}
+/** @} */
+
 void log_msg(int level, const char *format, ...)
 {
         va_list ap;
@@ -96,6 +778,17 @@ void log_msg(int level, const char *format, ...)
         if (log_level < level) {
                 return;
         }
+        if (log_rate_limited(format)) {
+                return;
+        }
+        if (log_async_running.load(std::memory_order_relaxed)) {
+                va_start(ap, format);
+                bool queued = log_async_push_fmt(level, format, ap);
+                va_end(ap);
+                if (queued) {
+                        return;
+                }
+        }
 
         // get number of required bytes
         va_start(ap, format);
@@ -119,6 +812,7 @@ void log_msg(int level, const char *format, ...)
         if(get_log_output().is_interactive())
                 buf.append(TERM_RESET);
         buf.submit();
+        log_report_dropped(false);
 }
 
 void log_msg_once(int level, uint32_t id, const char *msg) {
@@ -121,6 +121,21 @@ bool parse_log_cfg(const char *conf_str,
 #include "compat/platform_time.h"
 #include "utils/color_out.h"
 
+/**
+ * @name Asynchronous logging backend
+ * When started (--param log-async), log_msg() captures the format pointer
+ * together with its arguments into a per-thread lock-free ring and a
+ * background thread does the formatting and the output.
+ * @{
+ */
+bool log_async_start(size_t ring_size);
+void log_async_stop(void);
+/// queues already formatted message, returns false if backend is not running
+bool log_async_push_text(const std::string &msg, bool raw);
+/// limits log_msg() output per call site (format string), 0 - unlimited
+void log_set_rate_limit(int msgs_per_sec);
+/** @} */
+
 class Log_output{
         class Buffer{
         public:
@@ -159,6 +174,10 @@ public:
         const std::string& get_level_style(int lvl);
         bool is_interactive() const { return interactive; }
 
+        /// prints the message, time_ms is the time the message was issued (0 - now)
+        void print(std::string &msg, uint64_t time_ms = 0);
+        void print_raw(std::string &msg);
+
         Log_output(const Log_output&) = delete;
         Log_output(Log_output&&) = delete;
 
@@ -217,6 +236,13 @@ inline const std::string& Log_output::get_level_style(int lvl){
 }
 
 inline void Log_output::submit(){
+        if (log_async_push_text(buffer, false)) {
+                return;
+        }
+        print(buffer);
+}
+
+inline void Log_output::print(std::string &msg, uint64_t time_ms){
         static constexpr int ts_bufsize = 32; //log10(2^64) is 19.3, so should be enough
         char ts_str[ts_bufsize];
         ts_str[0] = '\0';
@@ -224,7 +250,9 @@ inline void Log_output::submit(){
         if (show_timestamps == LOG_TIMESTAMP_ENABLED
                 || (show_timestamps == LOG_TIMESTAMP_AUTO && log_level >= LOG_LEVEL_VERBOSE))
         {
-                auto time_ms = time_since_epoch_in_ms();
+                if (time_ms == 0) {
+                        time_ms = time_since_epoch_in_ms();
+                }
                 snprintf(ts_str, ts_bufsize - 1, "[%.3f] ", time_ms / 1000.0);
                 ts_str[ts_bufsize - 1] = '\0';
         }
@@ -232,7 +260,7 @@ inline void Log_output::submit(){
         const char *start_newline = "";
         std::lock_guard<std::mutex> lock(mut);
         if (skip_repeated && interactive) {
-                if (buffer == last_msg) {
+                if (msg == last_msg) {
                         last_msg_repeats++;
                         printf("    Last message repeated %d times\r", last_msg_repeats);
                         fflush(stdout);
@@ -245,17 +273,24 @@ inline void Log_output::submit(){
                 last_msg_repeats = 0;
         }
 
-        printf("%s%s%s", start_newline, ts_str, buffer.c_str());
+        printf("%s%s%s", start_newline, ts_str, msg.c_str());
 
-        std::swap(last_msg, buffer);
+        std::swap(last_msg, msg);
 }
 
 inline void Log_output::submit_raw(){
+        if (log_async_push_text(buffer, true)) {
+                return;
+        }
+        print_raw(buffer);
+}
+
+inline void Log_output::print_raw(std::string &msg){
         std::lock_guard<std::mutex> lock(mut);
         if(last_msg_repeats > 0)
                 fputc('\n', stdout);
-        fputs(buffer.c_str(), stdout);
-        std::swap(last_msg, buffer);
+        fputs(msg.c_str(), stdout);
+        std::swap(last_msg, msg);
         last_msg_repeats = 0;
 }
 
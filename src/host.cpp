@@ -60,6 +60,7 @@
 #include "module.h"
 #include "rang.hpp"
 #include "utils/color_out.h" // unit_evaluate
+#include "utils/macros.h"
 #include "utils/misc.h" // unit_evaluate
 #include "video_capture.h"
 #include "video_compress.h"
@@ -132,6 +133,7 @@ static bool validate_param(const char *param);
 
 void common_cleanup(struct init_data *init)
 {
+        log_async_stop(); // messages reference format strings of the modules
         if (init) {
 #if defined BUILD_LIBRARIES
                 for (auto a : init->opened_libs) {
@@ -150,6 +152,17 @@ void common_cleanup(struct init_data *init)
 #endif
 }
 
+#define DEFAULT_LOG_RING_KIB 64
+ADD_TO_PARAM("log-async",
+         "* log-async[=<KiB>]\n"
+         "  Format and print log messages in a separate thread, <KiB> is the per-thread\n"
+         "  queue size (default " TOSTRING(DEFAULT_LOG_RING_KIB) "), messages not fitting are dropped\n");
+ADD_TO_PARAM("log-rate-limit",
+         "* log-rate-limit=<n>\n"
+         "  Print at most <n> messages per second from one call site\n");
+ADD_TO_PARAM("load-all-modules",
+         "* load-all-modules\n"
+         "  Open all modules on startup instead of on demand according to the module manifest\n");
 ADD_TO_PARAM("stdout-buf",
          "* stdout-buf={no|line|full}\n"
          "  Buffering for stdout\n");
@@ -346,6 +359,16 @@ static bool parse_opts_set_logging(int argc, char *argv[])
         log_level = logging_lvl;
         get_log_output().set_skip_repeats(logger_skip_repeats);
         get_log_output().set_timestamp_mode(logger_show_timestamps);
+
+        if (const char *val = get_commandline_param("log-rate-limit")) {
+                log_set_rate_limit(atoi(val));
+        }
+        if (const char *val = get_commandline_param("log-async")) {
+                size_t ring_kib = strlen(val) > 0 ? atoi(val) : DEFAULT_LOG_RING_KIB;
+                if (!log_async_start(ring_kib * 1024)) {
+                        return false;
+                }
+        }
         return true;
 }
 
@@ -415,7 +438,11 @@ struct init_data *common_preinit(int argc, char *argv[])
 
         init = new init_data{};
         if (strstr(argv[0], "run_tests") == nullptr) {
-                open_all("ultragrid_*.so", init->opened_libs); // load modules
+                if (get_commandline_param("load-all-modules") != nullptr) {
+                        open_all("ultragrid_*.so", init->opened_libs); // load modules
+                } else {
+                        open_all_lazy("ultragrid_*.so", init->opened_libs);
+                }
         }
 
 #ifdef __linux__
@@ -682,9 +709,11 @@ void register_param(const char *param, const char *doc)
                 if (params[i].param == NULL) {
                         params[i].param = param;
                         params[i].doc = doc;
+                        register_module_param(param);
                         return;
                 }
                 if (strcmp(params[i].param, param) == 0) {
+                        register_module_param(param);
                         if (strcmp(params[i].doc, doc) != 0) {
                                 log_msg(LOG_LEVEL_WARNING, "Param \"%s\" as it is already registered but with different documentation.\n", param);
                         }
@@ -737,7 +766,8 @@ bool parse_params(const char *optarg, bool preinit)
                         val_cstr = delim + 1;
                         *delim = '\0';
                 }
-                if (!validate_param(key_cstr)) {
+                if (!validate_param(key_cstr) && (preinit || !load_module_for_param(key_cstr)
+                                        || !validate_param(key_cstr))) {
                         if (preinit) {
                                 continue;
                         }
@@ -752,6 +782,7 @@ bool parse_params(const char *optarg, bool preinit)
 
 void print_param_doc()
 {
+        load_all_modules();
         for (unsigned int i = 0; i < sizeof params / sizeof params[0]; ++i) {
                 if (params[i].doc != NULL) {
                         puts(params[i].doc);
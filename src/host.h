@@ -113,6 +113,8 @@ extern int glfw_init_count;
 // getting/setting you can use get_av_delay()/set_av_delay(). All is in milliseconds.
 extern volatile int audio_offset;
 extern volatile int video_offset;
+
+extern uint32_t RTT; ///< RTT to the receiver in microseconds computed from RTCP RR (rtp_callback.c), 0 if unknown
 int get_audio_delay(void);
 void set_audio_delay(int val);
 
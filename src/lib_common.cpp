@@ -45,10 +45,16 @@
 #include <dlfcn.h>
 #include <glob.h>
 #include <libgen.h>
+#include <sys/stat.h>
 #endif
 
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
 
 #include "debug.h"
 #include "host.h"
@@ -171,11 +177,42 @@ static int running_from_path(char * uv_argv[]) {
 }
 #endif
 
-void open_all(const char *pattern, list<void *> &libs) {
 #ifdef BUILD_LIBRARIES
-        char path[512];
-        glob_t glob_buf;
+#define MODULE_MANIFEST_MAGIC "UltraGrid module manifest 1"
 
+struct manifest_module {
+        enum library_class cls;
+        int abi_version;
+        string name;
+        string file;
+};
+
+/**
+ * State of the module loader. Modules listed in the manifest are opened
+ * only when requested (see open_all_lazy()).
+ */
+struct module_loader {
+        recursive_mutex lock;
+        string dir;                             ///< module directory
+        list<void *> *libs = nullptr;           ///< opened handles (owned by caller of open_all*())
+        map<string, bool> files;                ///< module file basename -> already opened
+        vector<manifest_module> modules;
+        map<string, string> params;             ///< param -> module file basename
+        const char *recording_file = nullptr;   ///< file being opened while generating the manifest
+        bool loading_all = false;
+};
+
+static module_loader &get_loader() {
+        /* register_library() may be called before global static members are
+         * initialized, see get_libmap() */
+        static module_loader loader;
+        return loader;
+}
+
+/// @returns glob pattern of modules in module directory
+static string get_module_glob(const char *pattern)
+{
+        char path[512];
         /* binary not from $PATH */
         if (!running_from_path(uv_argv)) {
                 char *tmp = strdup(uv_argv[0]);
@@ -185,19 +222,163 @@ void open_all(const char *pattern, list<void *> &libs) {
         } else {
                 snprintf(path, sizeof(path), LIB_DIR "/ultragrid/%s", pattern);
         }
+        return path;
+}
+
+static void *open_module_file(const char *path)
+{
+        void *handle = dlopen(path, RTLD_NOW|RTLD_GLOBAL);
+        if (!handle) {
+                char *error = dlerror();
+                verbose_msg("Library %s opening warning: %s \n", path,
+                                error);
+                char *tmp = strdup(path);
+                char *filename = basename(tmp);
+                if (filename && error) {
+                        lib_errors[filename] = error;
+                }
+                free(tmp);
+        }
+        return handle;
+}
+
+static string get_manifest_path(const string &dir)
+{
+        string cache_dir;
+        if (const char *xdg_cache = getenv("XDG_CACHE_HOME"); xdg_cache != nullptr && strlen(xdg_cache) > 0) {
+                cache_dir = xdg_cache;
+        } else if (const char *home = getenv("HOME")) {
+                cache_dir = string(home) + "/.cache";
+        } else {
+                return {};
+        }
+        char name[64];
+        snprintf(name, sizeof name, "/ultragrid/module_manifest-%016zx", hash<string>{}(dir));
+        return cache_dir + name;
+}
+
+/// @returns "<mtime> <size>" identifying version of the file
+static string get_file_stamp(const char *path)
+{
+        struct stat st{};
+        if (stat(path, &st) != 0) {
+                return "0 0";
+        }
+        return to_string(static_cast<long long>(st.st_mtime)) + " " + to_string(static_cast<long long>(st.st_size));
+}
+
+/**
+ * Reads the manifest and checks that it describes current binary and
+ * module files. Header lines are compared with expected_header, the rest are
+ * "module <class> <abi> <file> <name>" and "param <file> <name>" records.
+ */
+static bool read_manifest(const string &path, const string &expected_header, module_loader &loader)
+{
+        ifstream in(path);
+        if (!in) {
+                return false;
+        }
+        string header;
+        string line;
+        while (getline(in, line) && line != "end") {
+                header += line + "\n";
+        }
+        if (header != expected_header) {
+                verbose_msg("Module manifest %s is outdated\n", path.c_str());
+                return false;
+        }
+        while (getline(in, line)) {
+                istringstream iss(line);
+                string type;
+                iss >> type;
+                if (type == "module") {
+                        int cls = 0;
+                        manifest_module mod{};
+                        iss >> cls >> mod.abi_version >> mod.file >> mod.name;
+                        mod.cls = static_cast<enum library_class>(cls);
+                        loader.modules.push_back(mod);
+                } else if (type == "param") {
+                        string file;
+                        string param;
+                        iss >> file >> param;
+                        loader.params[param] = file;
+                }
+                if (!iss) {
+                        log_msg(LOG_LEVEL_WARNING, "Malformed module manifest %s line: %s\n", path.c_str(), line.c_str());
+                        loader.modules.clear();
+                        loader.params.clear();
+                        return false;
+                }
+        }
+        return true;
+}
 
-        glob(path, 0, NULL, &glob_buf);
+static void write_manifest(const string &path, const string &header, const module_loader &loader)
+{
+        string dir = path.substr(0, path.find_last_of('/'));
+        mkdir(dir.substr(0, dir.find_last_of('/')).c_str(), 0755);
+        mkdir(dir.c_str(), 0755);
+        string tmp_path = path + "." + to_string(getpid());
+        {
+                ofstream out(tmp_path);
+                out << header << "end\n";
+                for (auto const &mod : loader.modules) {
+                        out << "module " << mod.cls << " " << mod.abi_version << " " << mod.file << " " << mod.name << "\n";
+                }
+                for (auto const &param : loader.params) {
+                        out << "param " << param.second << " " << param.first << "\n";
+                }
+                if (!out) {
+                        verbose_msg("Cannot write module manifest %s\n", tmp_path.c_str());
+                        unlink(tmp_path.c_str());
+                        return;
+                }
+        }
+        if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+                unlink(tmp_path.c_str());
+        }
+}
+
+/**
+ * Opens a module file found by open_all_lazy(), lock must be held.
+ * If the module cannot be opened, it may depend on symbols from another
+ * module so all remaining modules are opened and opening is retried.
+ */
+static void lazy_open_file(module_loader &loader, const string &file)
+{
+        auto it = loader.files.find(file);
+        if (it == loader.files.end() || it->second) {
+                return;
+        }
+        it->second = true;
+        string path = loader.dir + "/" + file;
+        void *handle = open_module_file(path.c_str());
+        if (!handle && !loader.loading_all) {
+                verbose_msg("Opening all modules to satisfy dependencies of %s\n", file.c_str());
+                load_all_modules();
+                lib_errors.erase(file);
+                handle = open_module_file(path.c_str());
+        }
+        if (handle) {
+                loader.libs->push_back(handle);
+        }
+}
+#endif
+
+void open_all(const char *pattern, list<void *> &libs) {
+#ifdef BUILD_LIBRARIES
+        glob_t glob_buf;
+        auto &loader = get_loader();
+
+        glob(get_module_glob(pattern).c_str(), 0, NULL, &glob_buf);
 
         for(unsigned int i = 0; i < glob_buf.gl_pathc; ++i) {
-                void *handle = dlopen(glob_buf.gl_pathv[i], RTLD_NOW|RTLD_GLOBAL);
+                string filename = basename(glob_buf.gl_pathv[i]);
+                loader.files[filename] = true;
+                loader.recording_file = filename.c_str();
+                void *handle = open_module_file(glob_buf.gl_pathv[i]);
+                loader.recording_file = nullptr;
                 if (!handle) {
-                        char *error = dlerror();
-                        verbose_msg("Library %s opening warning: %s \n", glob_buf.gl_pathv[i],
-                                        error);
-                        char *filename = basename(glob_buf.gl_pathv[i]);
-                        if (filename && error) {
-                                lib_errors.emplace(filename, error);
-                        }
                         continue;
                 }
                 libs.push_back(handle);
@@ -210,6 +391,110 @@ void open_all(const char *pattern, list<void *> &libs) {
 #endif
 }
 
+/**
+ * Like open_all() but uses a cached manifest (mapping of module name, class
+ * and ABI version to file) to defer opening of the modules until they are
+ * requested by load_library() or enumerated. If the manifest is missing or
+ * stale (binary or any module file changed), all modules are opened and the
+ * manifest is regenerated.
+ *
+ * Handles of the modules opened later are appended to libs, so it must
+ * outlive the loading of modules.
+ */
+void open_all_lazy(const char *pattern, list<void *> &libs) {
+#ifdef BUILD_LIBRARIES
+        auto &loader = get_loader();
+        lock_guard<recursive_mutex> lk(loader.lock);
+        string module_glob = get_module_glob(pattern);
+        loader.dir = module_glob.substr(0, module_glob.find_last_of('/'));
+        if (char *real_dir = realpath(loader.dir.c_str(), nullptr)) {
+                loader.dir = real_dir;
+                free(real_dir);
+                module_glob = loader.dir + "/" + pattern;
+        }
+        loader.libs = &libs;
+
+        glob_t glob_buf;
+        glob(module_glob.c_str(), 0, NULL, &glob_buf);
+        string header = MODULE_MANIFEST_MAGIC "\n";
+        header += "dir " + loader.dir + "\n";
+        header += "exe " + get_file_stamp("/proc/self/exe") + "\n";
+        for (unsigned int i = 0; i < glob_buf.gl_pathc; ++i) {
+                header += string("file ") + basename(glob_buf.gl_pathv[i]) + " " + get_file_stamp(glob_buf.gl_pathv[i]) + "\n";
+        }
+        globfree(&glob_buf);
+
+        string manifest_path = get_manifest_path(loader.dir);
+        if (!manifest_path.empty() && read_manifest(manifest_path, header, loader)) {
+                istringstream iss(header);
+                string line;
+                while (getline(iss, line)) {
+                        if (line.compare(0, 5, "file ") == 0) {
+                                loader.files[line.substr(5, line.find(' ', 5) - 5)] = false;
+                        }
+                }
+                verbose_msg("Using module manifest %s, modules will be loaded on demand\n", manifest_path.c_str());
+                return;
+        }
+
+        open_all(pattern, libs);
+        if (!manifest_path.empty()) {
+                write_manifest(manifest_path, header, loader);
+        }
+#else
+        UNUSED(libs);
+        UNUSED(pattern);
+#endif
+}
+
+/// opens all modules deferred by open_all_lazy()
+void load_all_modules() {
+#ifdef BUILD_LIBRARIES
+        auto &loader = get_loader();
+        lock_guard<recursive_mutex> lk(loader.lock);
+        if (loader.loading_all) {
+                return;
+        }
+        loader.loading_all = true;
+        for (auto &file : loader.files) {
+                lazy_open_file(loader, file.first);
+        }
+        loader.loading_all = false;
+#endif
+}
+
+/**
+ * Opens module that registers param (if known from the manifest).
+ * @retval true if a module was opened
+ */
+bool load_module_for_param(const char *param) {
+#ifdef BUILD_LIBRARIES
+        auto &loader = get_loader();
+        lock_guard<recursive_mutex> lk(loader.lock);
+        auto it = loader.params.find(param);
+        if (it == loader.params.end() || loader.files[it->second]) {
+                return false;
+        }
+        lazy_open_file(loader, it->second);
+        return true;
+#else
+        UNUSED(param);
+        return false;
+#endif
+}
+
+/// records param registered by a module while generating the manifest
+void register_module_param(const char *param) {
+#ifdef BUILD_LIBRARIES
+        auto &loader = get_loader();
+        if (loader.recording_file != nullptr) {
+                loader.params[param] = loader.recording_file;
+        }
+#else
+        UNUSED(param);
+#endif
+}
+
 struct lib_info {
         const void *data;
         int abi_version;
@@ -252,10 +537,56 @@ void register_library(const char *name, const void *data, enum library_class cls
                 LOG(LOG_LEVEL_ERROR) << "Module \"" << name << "\" (class " << cls << ") multiple initialization!\n";
         }
         map[name] = {data, abi_version, static_cast<bool>(hidden)};
+#ifdef BUILD_LIBRARIES
+        auto &loader = get_loader();
+        if (loader.recording_file != nullptr) {
+                loader.modules.push_back({cls, abi_version, name, loader.recording_file});
+        }
+#endif
+}
+
+static string get_module_filename(const char *name, enum library_class cls)
+{
+        string filename = "ultragrid_";
+        if (strlen(library_class_info.at(cls).file_prefix) > 0) {
+                filename += library_class_info.at(cls).file_prefix;
+                filename += "_";
+        }
+        return filename + name + ".so";
+}
+
+#ifdef BUILD_LIBRARIES
+/**
+ * Opens deferred module files providing module name of class cls (all modules
+ * of the class if name is NULL), lock must be held.
+ */
+static void lazy_load(enum library_class cls, const char *name)
+{
+        auto &loader = get_loader();
+        if (loader.libs == nullptr) {
+                return;
+        }
+        bool found = false;
+        for (size_t i = 0; i < loader.modules.size(); ++i) { // lazy_open_file() may append to modules
+                const auto mod = loader.modules[i];
+                if (mod.cls == cls && (name == nullptr || strcasecmp(mod.name.c_str(), name) == 0)) {
+                        lazy_open_file(loader, mod.file);
+                        found = true;
+                }
+        }
+        // the module might have failed to open when the manifest was generated
+        if (!found && name != nullptr && library_class_info.find(cls) != library_class_info.end()) {
+                lazy_open_file(loader, get_module_filename(name, cls));
+        }
 }
+#endif
 
 const void *load_library(const char *name, enum library_class cls, int abi_version)
 {
+#ifdef BUILD_LIBRARIES
+        lock_guard<recursive_mutex> lk(get_loader().lock);
+        lazy_load(cls, name);
+#endif
         auto it_cls = get_libmap().find(cls);
         if (it_cls != get_libmap().end()) {
                 auto it_module = it_cls->second.find(name);
@@ -273,14 +604,7 @@ const void *load_library(const char *name, enum library_class cls, int abi_versi
         // Library was not found or was not loaded due to unsatisfied
         // dependencies. If the latter one, display reason why dlopen() failed.
         if (library_class_info.find(cls) != library_class_info.end()) {
-                string filename = "ultragrid_";
-                if (strlen(library_class_info.at(cls).file_prefix) > 0) {
-                        filename += library_class_info.at(cls).file_prefix;
-                        filename += "_";
-                }
-
-                filename += name + string(".so");
-
+                string filename = get_module_filename(name, cls);
                 if (lib_errors.find(filename) != lib_errors.end()) {
                         LOG(LOG_LEVEL_WARNING) << filename << ": " << lib_errors.find(filename)->second << "\n";
                 }
@@ -306,6 +630,8 @@ void list_modules(enum library_class cls, int abi_version, bool full) {
 bool list_all_modules() {
         bool ret = true;
 
+        load_all_modules();
+
         auto& libraries = get_libmap();
         for (auto cls_it = library_class_info.begin(); cls_it != library_class_info.end();
                         ++cls_it) {
@@ -334,6 +660,10 @@ bool list_all_modules() {
 map<string, const void *> get_libraries_for_class(enum library_class cls, int abi_version, bool include_hidden)
 {
         map<string, const void *> ret;
+#ifdef BUILD_LIBRARIES
+        lock_guard<recursive_mutex> lk(get_loader().lock);
+        lazy_load(cls, nullptr);
+#endif
         auto& libraries = get_libmap();
         auto it = libraries.find(cls);
         if (it != libraries.end()) {
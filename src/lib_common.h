@@ -68,6 +68,10 @@
 #ifdef __cplusplus
 #include <list>
 void open_all(const char *pattern, std::list<void *> &libs);
+void open_all_lazy(const char *pattern, std::list<void *> &libs);
+void load_all_modules();
+bool load_module_for_param(const char *param);
+void register_module_param(const char *param);
 #endif
 
 #ifdef __cplusplus
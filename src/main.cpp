@@ -63,8 +63,11 @@
 #endif // HAVE_CONFIG_H
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
 #ifndef _WIN32
 #include <execinfo.h>
 #endif // defined WIN32
@@ -93,12 +96,14 @@
 #include "tv.h"
 #include "ug_runtime_error.hpp"
 #include "utils/color_out.h"
+#include "utils/metrics.h"
 #include "utils/misc.h"
 #include "utils/nat.h"
 #include "utils/net.h"
 #include "utils/thread.h"
 #include "utils/wait_obj.h"
 #include "utils/udp_holepunch.h"
+#include "utils/video_frame_pool.h"
 #include "video.h"
 #include "video_capture.h"
 #include "video_display.h"
@@ -441,6 +446,182 @@ static void print_fps(steady_clock::time_point *t0, int *frames, const string &n
         }
 }
 
+#define CAPTURE_POOL_DEPTH_PARAM "capture-pool-depth"
+ADD_TO_PARAM(CAPTURE_POOL_DEPTH_PARAM, "* " CAPTURE_POOL_DEPTH_PARAM "=<n>\n"
+                "  Decouple capture from compression - grabbed frames are copied to a pool of <n> frames\n"
+                "  and passed to compression from a separate thread (default 0 - capture waits for compression)\n");
+
+/**
+ * Pipelined capture - the capture thread copies grabbed frames to pooled
+ * buffers (or passes the frame as is if the grabber provides a dispose
+ * callback) and pushes them to a queue that is fed to compression by
+ * another thread. If all pool frames are in use (queued, being compressed
+ * or sent), the newly captured frame is dropped instead of blocking the grab.
+ * Fragmented frames (stripes) are dropped as a whole - the decision is made
+ * on the first fragment and the rest of the frame follows it.
+ */
+class capture_pipeline {
+public:
+        capture_pipeline(struct state_uv *uv, int depth) : m_uv(uv), m_depth(depth), m_pool(make_shared<pool>()) {
+                m_queue_len_metric = metric_register("capture_queue_len", "Captured frames waiting for compression", METRIC_GAUGE);
+                m_dropped_metric = metric_register("capture_dropped_total", "Captured frames dropped by the capture pipeline", METRIC_COUNTER);
+                m_compress_thread = thread(&capture_pipeline::compress_loop, this);
+        }
+        ~capture_pipeline() {
+                {
+                        lock_guard<mutex> lk(m_lock);
+                        m_finished = true;
+                }
+                m_cv.notify_one();
+                m_compress_thread.join();
+        }
+        void push(struct video_frame *tx_frame);
+
+private:
+        struct pool {
+                video_frame_pool frames;
+                atomic<int> in_use{0};
+        };
+        struct stats {
+                steady_clock::time_point last_report = steady_clock::now();
+                unsigned long long captured = 0;
+                unsigned long long dropped_pool = 0; ///< no free pool frame
+                unsigned long long dropped_queue = 0; ///< compression queue full (grabber-owned frames)
+                unsigned long long compressed = 0;
+                size_t max_queue_len = 0;
+        };
+
+        shared_ptr<video_frame> get_pool_copy(struct video_frame *tx_frame, bool force);
+        void compress_loop();
+        void report_stats();
+
+        struct state_uv *m_uv;
+        const int m_depth;
+        shared_ptr<pool> m_pool;
+        struct video_desc m_pool_desc{};
+        size_t m_pool_data_len = 0;
+
+        mutex m_lock;
+        condition_variable m_cv;
+        deque<shared_ptr<video_frame>> m_queue;
+        bool m_finished = false;
+        struct stats m_stats;
+        int m_dropped_fragment_id = -1; ///< frame_fragment_id of a frame being dropped
+        int m_passed_fragment_id = -1; ///< frame_fragment_id of a frame being passed to compression
+        struct metric *m_queue_len_metric;
+        struct metric *m_dropped_metric;
+        thread m_compress_thread;
+};
+
+shared_ptr<video_frame> capture_pipeline::get_pool_copy(struct video_frame *tx_frame, bool force)
+{
+        if (m_pool->in_use >= m_depth && !force) {
+                return {};
+        }
+        struct video_desc desc = video_desc_from_frame(tx_frame);
+        size_t data_len = 0;
+        for (unsigned i = 0; i < tx_frame->tile_count; ++i) {
+                data_len = max<size_t>(data_len, tx_frame->tiles[i].data_len);
+        }
+        if (!video_desc_eq(desc, m_pool_desc) || data_len > m_pool_data_len) {
+                // compressed frames vary in size so keep some headroom
+                m_pool_data_len = is_codec_opaque(desc.color_spec) ? data_len * 3 / 2 : data_len;
+                m_pool->frames.reconfigure(desc, m_pool_data_len);
+                m_pool_desc = desc;
+        }
+
+        shared_ptr<video_frame> pooled = m_pool->frames.get_frame();
+        for (unsigned i = 0; i < tx_frame->tile_count; ++i) {
+                memcpy(pooled->tiles[i].data, tx_frame->tiles[i].data, tx_frame->tiles[i].data_len);
+                pooled->tiles[i].data_len = tx_frame->tiles[i].data_len;
+                pooled->tiles[i].offset = tx_frame->tiles[i].offset;
+        }
+        vf_copy_metadata(pooled.get(), tx_frame);
+        pooled->fragment = tx_frame->fragment;
+        pooled->last_fragment = tx_frame->last_fragment;
+        pooled->frame_fragment_id = tx_frame->frame_fragment_id;
+
+        m_pool->in_use += 1;
+        struct video_frame *ret = pooled.get();
+        // the pool is shared with the deleter since the frame may outlive the pipeline
+        return shared_ptr<video_frame>(ret, [pool = m_pool, pooled](struct video_frame *) mutable {
+                pooled.reset();
+                pool->in_use -= 1;
+        });
+}
+
+void capture_pipeline::push(struct video_frame *tx_frame)
+{
+        const int fragment_id = tx_frame->fragment ? (int) tx_frame->frame_fragment_id : -1;
+        const bool dropping = fragment_id != -1 && fragment_id == m_dropped_fragment_id;
+        // other fragments of an already accepted frame bypass the limits (bounded by fragment count)
+        const bool passing = fragment_id != -1 && fragment_id == m_passed_fragment_id;
+        shared_ptr<video_frame> frame;
+        if (tx_frame->callbacks.dispose) {
+                frame = shared_ptr<video_frame>(tx_frame, tx_frame->callbacks.dispose);
+        } else if (!dropping) {
+                frame = get_pool_copy(tx_frame, passing);
+        }
+
+        unique_lock<mutex> lk(m_lock);
+        m_stats.captured += 1;
+        if (dropping) {
+                return;
+        }
+        if (!frame) {
+                m_stats.dropped_pool += 1;
+                m_dropped_fragment_id = fragment_id;
+                metric_add(m_dropped_metric, 1);
+                return;
+        }
+        if (m_queue.size() >= (size_t) m_depth && !passing) {
+                m_stats.dropped_queue += 1;
+                m_dropped_fragment_id = fragment_id;
+                metric_add(m_dropped_metric, 1);
+                return;
+        }
+        m_passed_fragment_id = fragment_id;
+        m_queue.push_back(move(frame));
+        metric_set(m_queue_len_metric, m_queue.size());
+        m_stats.max_queue_len = max(m_stats.max_queue_len, m_queue.size());
+        lk.unlock();
+        m_cv.notify_one();
+}
+
+void capture_pipeline::report_stats()
+{
+        auto now = steady_clock::now();
+        if (duration_cast<seconds>(now - m_stats.last_report).count() < 5) {
+                return;
+        }
+        LOG(LOG_LEVEL_VERBOSE) << MOD_NAME "Capture pipeline: captured " << m_stats.captured << ", compressed " << m_stats.compressed
+                << ", dropped " << m_stats.dropped_pool << " (pool exhausted) + " << m_stats.dropped_queue << " (queue full)"
+                << ", queue " << m_queue.size() << " (max " << m_stats.max_queue_len << "), pool frames in use " << m_pool->in_use << "\n";
+        m_stats = {};
+        m_stats.last_report = now;
+}
+
+void capture_pipeline::compress_loop()
+{
+        set_thread_name("capture_compress");
+        while (true) {
+                unique_lock<mutex> lk(m_lock);
+                m_cv.wait(lk, [this] { return m_finished || !m_queue.empty(); });
+                if (m_finished) {
+                        m_queue.clear();
+                        return;
+                }
+                shared_ptr<video_frame> frame = move(m_queue.front());
+                m_queue.pop_front();
+                metric_set(m_queue_len_metric, m_queue.size());
+                m_stats.compressed += 1;
+                report_stats();
+                lk.unlock();
+
+                m_uv->state_video_rxtx->send(move(frame));
+        }
+}
+
 /**
  * This function captures video and possibly compresses it.
  * It then delegates sending to another thread.
@@ -457,6 +638,10 @@ static void *capture_thread(void *arg)
         steady_clock::time_point t0 = steady_clock::now();
         int frames = 0;
         bool should_print_fps = vidcap_generic_fps(uv->capture_device);
+        unique_ptr<capture_pipeline> pipeline;
+        if (const char *depth = get_commandline_param(CAPTURE_POOL_DEPTH_PARAM); depth != nullptr && atoi(depth) > 0) {
+                pipeline = make_unique<capture_pipeline>(uv, atoi(depth));
+        }
 
         while (!should_exit) {
                 /* Capture and transmit video... */
@@ -472,6 +657,10 @@ static void *capture_thread(void *arg)
                         if (should_print_fps) {
                                 print_fps(&t0, &frames, uv->capture_device_name);
                         }
+                        if (pipeline) {
+                                pipeline->push(tx_frame);
+                                continue;
+                        }
                         //tx_frame = vf_get_copy(tx_frame);
                         bool wait_for_cur_uncompressed_frame;
                         shared_ptr<video_frame> frame;
@@ -499,6 +688,7 @@ static void *capture_thread(void *arg)
                 }
         }
 
+        pipeline = nullptr; // before wait_obj_done() - stops feeding the compression
         wait_obj_done(wait_obj);
 
         return NULL;
@@ -54,8 +54,10 @@
 #include "compat/vsnprintf.h"
 #include "net_udp.h"
 #include "rtp.h"
+#include "rtp/net_xdp.h"
 #include "utils/misc.h"
 #include "utils/net.h"
+#include "utils/sv_parse_num.hpp"
 #include "utils/thread.h"
 
 #ifdef NEED_ADDRINFO_H
@@ -64,11 +66,13 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <utility> // std::swap
 
 using std::array;
@@ -77,6 +81,7 @@ using std::max;
 using std::mutex;
 using std::queue;
 using std::string;
+using std::string_view;
 using std::swap;
 using std::to_string;
 using std::unique_lock;
@@ -175,6 +180,10 @@ struct socket_udp_local {
 
         bool should_exit;
         fd_t should_exit_fd[2];
+
+#ifdef HAVE_AF_XDP
+        struct xdp_sock *xdp; ///< AF_XDP backend, NULL if not used
+#endif
 };
 
 /*
@@ -787,6 +796,67 @@ static bool set_sock_opts_and_bind(fd_t fd, bool ipv6, uint16_t rx_port, int ttl
 ADD_TO_PARAM("udp-queue-len",
                 "* udp-queue-len=<l>\n"
                 "  Use different queue size than default DEFAULT_MAX_UDP_READER_QUEUE_LEN\n");
+#ifdef HAVE_AF_XDP
+ADD_TO_PARAM("udp-xdp",
+                "* udp-xdp=<iface>[:<queue>]\n"
+                "  Use AF_XDP socket on given interface (and RX queue, default 0) for RTP data (IPv4 only).\n"
+                "  Regular UDP socket is used if AF_XDP cannot be initialized.\n");
+
+/// @returns false if sa is neither IPv4 nor IPv4-mapped IPv6 address
+static bool get_sockaddr_in(const struct sockaddr_storage *sa, struct sockaddr_in *sin)
+{
+        if (sa->ss_family == AF_INET) {
+                memcpy(sin, sa, sizeof *sin);
+                return true;
+        }
+        const auto *sin6 = (const struct sockaddr_in6 *) sa;
+        if (sa->ss_family != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+                return false;
+        }
+        *sin = {};
+        sin->sin_family = AF_INET;
+        sin->sin_port = sin6->sin6_port;
+        memcpy(&sin->sin_addr, &sin6->sin6_addr.s6_addr[12], sizeof sin->sin_addr);
+        return true;
+}
+
+/**
+ * Tries to use AF_XDP for the socket. Only the first multithreaded (RTP
+ * data) socket is eligible, the other ones (RTCP, other media) use regular
+ * UDP sockets.
+ */
+static void udp_init_xdp(socket_udp *s)
+{
+        static std::atomic<bool> xdp_used{false};
+        if (xdp_used.exchange(true)) {
+                return;
+        }
+        string iface = get_commandline_param("udp-xdp");
+        int queue = 0;
+        if (iface.find(':') != string::npos) {
+                if (!parse_num(string_view(iface).substr(iface.find(':') + 1), queue) || queue < 0) {
+                        LOG(LOG_LEVEL_ERROR) << MOD_NAME << "Wrong udp-xdp queue: " << iface.substr(iface.find(':') + 1)
+                                << ", using regular UDP socket.\n";
+                        return;
+                }
+                iface = iface.substr(0, iface.find(':'));
+        }
+        struct sockaddr_storage local{};
+        socklen_t len = sizeof local;
+        if (getsockname(s->local->rx_fd, (struct sockaddr *) &local, &len) != 0) {
+                socket_error("getsockname");
+                return;
+        }
+        uint16_t port = ntohs(local.ss_family == AF_INET ? ((struct sockaddr_in *) &local)->sin_port :
+                        ((struct sockaddr_in6 *) &local)->sin6_port);
+        struct sockaddr_in dst;
+        bool dst_ipv4 = get_sockaddr_in(&s->sock, &dst); // otherwise only receiving through XDP
+        s->local->xdp = xdp_sock_init(iface.c_str(), queue, port, dst_ipv4 ? &dst : nullptr);
+        if (s->local->xdp == nullptr) {
+                LOG(LOG_LEVEL_WARNING) << MOD_NAME << "Falling back to regular UDP socket.\n";
+        }
+}
+#endif // defined HAVE_AF_XDP
 #ifdef WIN32
 ADD_TO_PARAM("udp-disable-multi-socket",
                 "* udp-disable-multi-socket\n"
@@ -911,6 +981,11 @@ socket_udp *udp_init_if(const char *addr, const char *iface, uint16_t rx_port,
         }
 
         s->local->multithreaded = multithreaded;
+#ifdef HAVE_AF_XDP
+        if (multithreaded && get_commandline_param("udp-xdp") != nullptr) { // XDP RX is polled by udp_reader
+                udp_init_xdp(s);
+        }
+#endif
         if (multithreaded) {
                 if (!get_commandline_param("udp-queue-len")) {
                         s->local->max_packets = DEFAULT_MAX_UDP_READER_QUEUE_LEN;
@@ -946,6 +1021,12 @@ bool udp_is_blackhole(socket_udp *s) {
 void udp_set_receiver(socket_udp *s, struct sockaddr *sa, socklen_t len) {
         memcpy(&s->sock, sa, len);
         s->sock_len = len;
+#ifdef HAVE_AF_XDP
+        struct sockaddr_in sin;
+        if (s->local->xdp != nullptr && !s->local_is_slave) {
+                xdp_sock_set_dst(s->local->xdp, get_sockaddr_in(&s->sock, &sin) ? &sin : nullptr);
+        }
+#endif
 }
 
 socket_udp *udp_init_with_local(struct socket_udp_local *l, struct sockaddr *sa, socklen_t len)
@@ -1023,6 +1104,9 @@ void udp_exit(socket_udp * s)
                         }
                         platform_pipe_close(s->local->should_exit_fd[1]);
                 }
+#ifdef HAVE_AF_XDP
+                xdp_sock_done(s->local->xdp);
+#endif
                 CLOSESOCKET(s->local->rx_fd);
                 if (s->local->tx_fd != s->local->rx_fd) {
                         CLOSESOCKET(s->local->tx_fd);
@@ -1051,6 +1135,15 @@ int udp_send(socket_udp * s, char *buffer, int buflen)
         assert(buffer != NULL);
         assert(buflen > 0);
 
+#ifdef HAVE_AF_XDP
+        if (s->local->xdp != nullptr && !s->local_is_slave) {
+                struct iovec vec = { buffer, (size_t) buflen };
+                int ret = xdp_sock_sendv(s->local->xdp, &vec, 1);
+                if (ret >= 0 || (errno != EMSGSIZE && errno != ENOTCONN)) {
+                        return ret;
+                }
+        }
+#endif
         return sendto(s->local->tx_fd, buffer, buflen, 0, (struct sockaddr *)&s->sock,
                       s->sock_len);
 }
@@ -1090,6 +1183,15 @@ int udp_sendv(socket_udp * s, struct iovec *vector, int count, void *d)
 
         assert(s != NULL);
 
+#ifdef HAVE_AF_XDP
+        if (s->local->xdp != nullptr && !s->local_is_slave) {
+                int ret = xdp_sock_sendv(s->local->xdp, vector, count);
+                if (ret >= 0 || (errno != EMSGSIZE && errno != ENOTCONN)) { // otherwise use the socket
+                        free(d);
+                        return ret;
+                }
+        }
+#endif
         msg.msg_name = (void *) & s->sock;
         msg.msg_namelen = s->sock_len;
         msg.msg_iov = vector;
@@ -1105,6 +1207,54 @@ int udp_sendv(socket_udp * s, struct iovec *vector, int count, void *d)
 }
 #endif // WIN32
 
+/**
+ * Passes a packet received by udp_reader() to the queue.
+ * @returns false if the reader should exit (packet is freed)
+ */
+static bool udp_reader_enqueue(socket_udp *s, uint8_t *packet, int size, struct sockaddr *src_addr, socklen_t addrlen)
+{
+        unique_lock<mutex> lk(s->local->lock);
+        s->local->reader_cv.wait(lk, [s]{return s->local->packets.size() < s->local->max_packets || s->local->should_exit;});
+        if (s->local->should_exit) {
+                free(packet);
+                return false;
+        }
+
+        s->local->packets.emplace(packet, size, src_addr, addrlen);
+
+        lk.unlock();
+        s->local->boss_cv.notify_one();
+        return true;
+}
+
+#ifdef HAVE_AF_XDP
+/// @returns false if the reader should exit
+static bool udp_reader_xdp_packet(void *arg, const uint8_t *data, int len, const struct sockaddr_in *src)
+{
+        socket_udp *s = (socket_udp *) arg;
+        if (len > RTP_MAX_PACKET_LEN - RTP_PACKET_HEADER_SIZE) {
+                return true;
+        }
+        // same layout as packets received by udp_reader()
+        uint8_t *packet = (uint8_t *) malloc(RTP_MAX_PACKET_LEN + sizeof(struct sockaddr_storage));
+        memcpy(packet + RTP_PACKET_HEADER_SIZE, data, len);
+        auto src_addr = (struct sockaddr *)(void *)(packet + RTP_MAX_PACKET_LEN);
+        socklen_t addrlen = sizeof(struct sockaddr_in);
+        if (s->local->mode == IPv6) { // IPv4-mapped
+                struct sockaddr_in6 sin6{};
+                sin6.sin6_family = AF_INET6;
+                sin6.sin6_port = src->sin_port;
+                sin6.sin6_addr.s6_addr[10] = sin6.sin6_addr.s6_addr[11] = 0xff;
+                memcpy(&sin6.sin6_addr.s6_addr[12], &src->sin_addr, sizeof src->sin_addr);
+                memcpy(src_addr, &sin6, sizeof sin6);
+                addrlen = sizeof sin6;
+        } else {
+                memcpy(src_addr, src, sizeof *src);
+        }
+        return udp_reader_enqueue(s, packet, len, src_addr, addrlen);
+}
+#endif // defined HAVE_AF_XDP
+
 /**
  * When receiving data in separate thread, this function fetches data
  * from socket and puts it in queue.
@@ -1120,6 +1270,12 @@ static void *udp_reader(void *arg)
                 FD_SET(s->local->rx_fd, &fds);
                 FD_SET(s->local->should_exit_fd[0], &fds);
                 int nfds = max(s->local->rx_fd, s->local->should_exit_fd[0]) + 1;
+#ifdef HAVE_AF_XDP
+                if (s->local->xdp != nullptr) {
+                        FD_SET(xdp_sock_fd(s->local->xdp), &fds);
+                        nfds = max(nfds, xdp_sock_fd(s->local->xdp) + 1);
+                }
+#endif
 
                 int rc = select(nfds, &fds, NULL, NULL, NULL);
                 if (rc <= 0) {
@@ -1129,6 +1285,15 @@ static void *udp_reader(void *arg)
                 if (FD_ISSET(s->local->should_exit_fd[0], &fds)) {
                         break;
                 }
+#ifdef HAVE_AF_XDP
+                if (s->local->xdp != nullptr && FD_ISSET(xdp_sock_fd(s->local->xdp), &fds)
+                                && xdp_sock_recv(s->local->xdp, udp_reader_xdp_packet, s) < 0) {
+                        break;
+                }
+                if (!FD_ISSET(s->local->rx_fd, &fds)) {
+                        continue;
+                }
+#endif
                 uint8_t *packet = (uint8_t *) malloc(RTP_MAX_PACKET_LEN + sizeof(struct sockaddr_storage));
                 uint8_t *buffer = ((uint8_t *) packet) + RTP_PACKET_HEADER_SIZE;
                 auto src_addr = (struct sockaddr *)(void *)(packet + RTP_MAX_PACKET_LEN);
@@ -1147,17 +1312,9 @@ static void *udp_reader(void *arg)
                         continue;
                 }
 
-                unique_lock<mutex> lk(s->local->lock);
-                s->local->reader_cv.wait(lk, [s]{return s->local->packets.size() < s->local->max_packets || s->local->should_exit;});
-                if (s->local->should_exit) {
-                        free(packet);
+                if (!udp_reader_enqueue(s, packet, size, src_addr, addrlen)) {
                         break;
                 }
-
-                s->local->packets.emplace(packet, size, src_addr, addrlen);
-
-                lk.unlock();
-                s->local->boss_cv.notify_one();
         }
 
         platform_pipe_close(s->local->should_exit_fd[0]);
@@ -1542,6 +1699,11 @@ void udp_async_start(socket_udp *s, int nr_packets)
         s->overlapping_active = true;
 #else
         UNUSED(nr_packets);
+#ifdef HAVE_AF_XDP
+        if (s->local->xdp != nullptr) { // notify kernel once per batch of packets
+                xdp_sock_set_batch(s->local->xdp, true);
+        }
+#endif
         UNUSED(s);
 #endif
 }
@@ -1569,6 +1731,12 @@ void udp_async_wait(socket_udp *s)
         }
         s->overlapping_active = false;
 #else
+#ifdef HAVE_AF_XDP
+        if (s->local->xdp != nullptr) {
+                xdp_sock_flush(s->local->xdp);
+                xdp_sock_set_batch(s->local->xdp, false);
+        }
+#endif
         UNUSED(s);
 #endif
 }
@@ -0,0 +1,671 @@
+/**
+ * @file   rtp/net_xdp.cpp
+ *
+ * AF_XDP backend of the UDP socket, see net_xdp.h.
+ *
+ * Half of the UMEM frames is given to the kernel through the fill ring for
+ * reception, the other half is used for transmission (free frames are kept
+ * in a stack and returned from the completion ring). The XDP program is
+ * generated at runtime (to avoid dependency on libbpf/libxdp) and redirects
+ * unfragmented IPv4 UDP datagrams destined to our port to the XSK map,
+ * everything else is passed to the kernel stack, so that RTCP and other
+ * traffic works as usual.
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#ifdef HAVE_AF_XDP
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#include <mutex>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <net/route.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "debug.h"
+#include "rtp/net_xdp.h"
+#include "utils/misc.h"
+
+#define MOD_NAME "[AF_XDP] "
+
+#define XDP_FRAME_SIZE 4096
+#define XDP_RX_FRAMES 2048 ///< also size of fill and RX rings
+#define XDP_TX_FRAMES 2048 ///< also size of TX and completion rings
+#define XDP_TX_BATCH 32    ///< max packets queued in batch mode before kernel is notified
+#define XDP_NEIGH_TIMEOUT_MS 1000
+
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+struct __attribute__((packed)) xdp_pkt_hdr {
+        uint8_t eth_dst[ETH_ALEN];
+        uint8_t eth_src[ETH_ALEN];
+        uint16_t eth_type;
+        uint8_t ip_ver_ihl;
+        uint8_t ip_tos;
+        uint16_t ip_len;
+        uint16_t ip_id;
+        uint16_t ip_frag;
+        uint8_t ip_ttl;
+        uint8_t ip_proto;
+        uint16_t ip_csum;
+        uint32_t ip_src;
+        uint32_t ip_dst;
+        uint16_t udp_sport;
+        uint16_t udp_dport;
+        uint16_t udp_len;
+        uint16_t udp_csum;
+};
+static_assert(sizeof(struct xdp_pkt_hdr) == 42, "Ethernet + IPv4 + UDP header size mismatch");
+
+struct xdp_ring {
+        uint32_t *producer;
+        uint32_t *consumer;
+        uint32_t *flags;
+        void *ring;
+        uint32_t size; ///< power of 2
+        void *map;
+        size_t map_len;
+};
+
+struct xdp_sock {
+        char iface[IFNAMSIZ];
+        uint16_t src_port;
+        int fd = -1;
+        int map_fd = -1;
+        int prog_fd = -1;
+        int link_fd = -1;
+
+        char *umem = nullptr;
+        size_t umem_len = 0;
+        struct xdp_ring fill{}, comp{}, rx{}, tx{};
+        bool need_wakeup = false;
+
+        mutex tx_lock;
+        uint64_t tx_free[XDP_TX_FRAMES]; ///< UMEM addresses of frames available for TX
+        int tx_free_count = 0;
+        bool can_send = false;
+        struct xdp_pkt_hdr hdr_template{};
+        uint16_t ip_id = 0;
+        bool batch = false;
+        int tx_pending = 0; ///< packets not yet notified to kernel
+};
+
+static int sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr)
+{
+        return syscall(__NR_bpf, cmd, attr, sizeof *attr);
+}
+
+static bool xdp_ring_map(int fd, struct xdp_ring *r, const struct xdp_ring_offset *off, uint32_t size,
+                size_t desc_size, off_t pgoff)
+{
+        r->map_len = off->desc + size * desc_size;
+        r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+        if (r->map == MAP_FAILED) {
+                r->map = nullptr;
+                return false;
+        }
+        r->producer = (uint32_t *) ((char *) r->map + off->producer);
+        r->consumer = (uint32_t *) ((char *) r->map + off->consumer);
+        r->flags = (uint32_t *) ((char *) r->map + off->flags);
+        r->ring = (char *) r->map + off->desc;
+        r->size = size;
+        return true;
+}
+
+static void xdp_ring_unmap(struct xdp_ring *r)
+{
+        if (r->map != nullptr) {
+                munmap(r->map, r->map_len);
+        }
+}
+
+/**
+ * Generates and loads the XDP program redirecting IPv4 UDP datagrams for
+ * port to the XSK bound to the RX queue the packet arrived on.
+ */
+static int xdp_load_prog(int map_fd, uint16_t port)
+{
+        vector<struct bpf_insn> p;
+        vector<size_t> to_pass; // jumps to be patched to the XDP_PASS branch
+        auto emit = [&](uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+                struct bpf_insn i{};
+                i.code = code;
+                i.dst_reg = dst;
+                i.src_reg = src;
+                i.off = off;
+                i.imm = imm;
+                p.push_back(i);
+        };
+        auto jne_pass = [&](uint8_t reg, int32_t imm) {
+                to_pass.push_back(p.size());
+                emit(BPF_JMP | BPF_JNE | BPF_K, reg, 0, 0, imm);
+        };
+
+        emit(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+        emit(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0);
+        emit(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0);
+        emit(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+        emit(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, sizeof(struct xdp_pkt_hdr));
+        to_pass.push_back(p.size());
+        emit(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0); // packet too short
+        emit(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, offsetof(struct xdp_pkt_hdr, eth_type), 0);
+        jne_pass(BPF_REG_5, htons(ETHERTYPE_IP));
+        emit(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, offsetof(struct xdp_pkt_hdr, ip_ver_ihl), 0);
+        jne_pass(BPF_REG_5, 0x45); // IPv4 without options
+        emit(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, offsetof(struct xdp_pkt_hdr, ip_frag), 0);
+        emit(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, htons(0x3fff)); // MF flag and fragment offset
+        jne_pass(BPF_REG_5, 0);
+        emit(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, offsetof(struct xdp_pkt_hdr, ip_proto), 0);
+        jne_pass(BPF_REG_5, IPPROTO_UDP);
+        emit(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, offsetof(struct xdp_pkt_hdr, udp_dport), 0);
+        jne_pass(BPF_REG_5, htons(port));
+        // return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+        emit(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0);
+        emit(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+        emit(0, 0, 0, 0, 0); // second half of the 64-bit immediate load
+        emit(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+        emit(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+        emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+        size_t pass = p.size();
+        emit(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS);
+        emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+        for (size_t i : to_pass) {
+                p[i].off = pass - i - 1;
+        }
+
+        union bpf_attr attr{};
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uintptr_t) p.data();
+        attr.insn_cnt = p.size();
+        attr.license = (uintptr_t) "Dual BSD/GPL";
+        int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+        if (fd < 0) {
+                int err = errno;
+                if (log_level >= LOG_LEVEL_VERBOSE) { // reload to obtain the verifier log
+                        char log[16384] = "";
+                        attr.log_buf = (uintptr_t) log;
+                        attr.log_size = sizeof log;
+                        attr.log_level = 1;
+                        sys_bpf(BPF_PROG_LOAD, &attr);
+                        log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "Verifier log:\n%s\n", log);
+                }
+                errno = err;
+        }
+        return fd;
+}
+
+static bool xdp_get_iface_addr(const char *iface, uint8_t *mac, uint32_t *ip)
+{
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+                return false;
+        }
+        struct ifreq ifr{};
+        snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "%s", iface);
+        bool ret = ioctl(fd, SIOCGIFHWADDR, &ifr) == 0;
+        if (ret) {
+                memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+                ifr.ifr_addr.sa_family = AF_INET;
+                ret = ioctl(fd, SIOCGIFADDR, &ifr) == 0;
+        }
+        if (ret) {
+                *ip = ((struct sockaddr_in *) &ifr.ifr_addr)->sin_addr.s_addr;
+        }
+        close(fd);
+        return ret;
+}
+
+/// @returns gateway for dst from the routing table or dst itself if on-link
+static uint32_t xdp_get_next_hop(const char *iface, uint32_t dst)
+{
+        FILE *f = fopen("/proc/net/route", "r");
+        if (f == nullptr) {
+                return dst;
+        }
+        uint32_t next_hop = dst;
+        uint32_t best_mask = 0;
+        bool found = false;
+        char line[256];
+        while (fgets(line, sizeof line, f) != nullptr) {
+                char name[IFNAMSIZ + 1];
+                unsigned int route_dst, gw, flags, mask;
+                // Iface Destination Gateway Flags RefCnt Use Metric Mask ... (addresses as raw hex u32)
+                if (sscanf(line, "%16s %x %x %x %*d %*d %*d %x", name, &route_dst, &gw, &flags, &mask) != 5
+                                || strcmp(name, iface) != 0 || (flags & RTF_UP) == 0 || (dst & mask) != route_dst) {
+                        continue;
+                }
+                if (!found || ntohl(mask) > ntohl(best_mask)) {
+                        found = true;
+                        best_mask = mask;
+                        next_hop = (flags & RTF_GATEWAY) != 0 ? gw : dst;
+                }
+        }
+        fclose(f);
+        return next_hop;
+}
+
+static bool xdp_lookup_neigh(const char *iface, uint32_t ip, uint8_t *mac)
+{
+        FILE *f = fopen("/proc/net/arp", "r");
+        if (f == nullptr) {
+                return false;
+        }
+        bool ret = false;
+        char line[256];
+        while (!ret && fgets(line, sizeof line, f) != nullptr) {
+                char addr[INET_ADDRSTRLEN + 1], name[IFNAMSIZ + 1];
+                unsigned int flags, m[ETH_ALEN];
+                struct in_addr in;
+                // IP address HW type Flags HW address Mask Device
+                if (sscanf(line, "%16s %*x %x %x:%x:%x:%x:%x:%x %*s %16s", addr, &flags,
+                                        &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], name) != 9
+                                || inet_pton(AF_INET, addr, &in) != 1 || in.s_addr != ip
+                                || strcmp(name, iface) != 0 || (flags & ATF_COM) == 0) {
+                        continue;
+                }
+                for (int i = 0; i < ETH_ALEN; ++i) {
+                        mac[i] = m[i];
+                }
+                ret = true;
+        }
+        fclose(f);
+        return ret;
+}
+
+/**
+ * Obtains destination MAC address - computed for multicast, otherwise looked
+ * up in the neighbor table. If missing, a datagram to the discard port is sent
+ * to let the kernel resolve the address.
+ */
+static bool xdp_resolve_dst_mac(const char *iface, uint32_t dst, uint8_t *mac)
+{
+        if (IN_MULTICAST(ntohl(dst))) {
+                uint32_t group = ntohl(dst);
+                const uint8_t mcast_mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, (uint8_t) (group >> 16 & 0x7f),
+                        (uint8_t) (group >> 8), (uint8_t) group };
+                memcpy(mac, mcast_mac, ETH_ALEN);
+                return true;
+        }
+        uint32_t next_hop = xdp_get_next_hop(iface, dst);
+        if (xdp_lookup_neigh(iface, next_hop, mac)) {
+                return true;
+        }
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd >= 0) {
+                struct sockaddr_in sin{};
+                sin.sin_family = AF_INET;
+                sin.sin_addr.s_addr = dst;
+                sin.sin_port = htons(9); // discard
+                sendto(fd, "", 0, 0, (struct sockaddr *) &sin, sizeof sin);
+                close(fd);
+        }
+        for (int i = 0; i < XDP_NEIGH_TIMEOUT_MS / 10; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                if (xdp_lookup_neigh(iface, next_hop, mac)) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+static uint16_t ip_checksum(const struct xdp_pkt_hdr *h)
+{
+        const uint8_t *ip = (const uint8_t *) &h->ip_ver_ihl;
+        uint32_t sum = 0;
+        for (int i = 0; i < 20; i += 2) {
+                sum += ip[i] << 8 | ip[i + 1];
+        }
+        while (sum >> 16) {
+                sum = (sum & 0xffff) + (sum >> 16);
+        }
+        return htons(~sum);
+}
+
+bool xdp_sock_set_dst(struct xdp_sock *x, const struct sockaddr_in *dst)
+{
+        lock_guard<mutex> lk(x->tx_lock);
+        x->can_send = false;
+        if (dst == nullptr || dst->sin_addr.s_addr == INADDR_ANY || (ntohl(dst->sin_addr.s_addr) >> 24) == IN_LOOPBACKNET) {
+                return false;
+        }
+        struct xdp_pkt_hdr *h = &x->hdr_template;
+        uint32_t src_ip = 0;
+        if (!xdp_get_iface_addr(x->iface, h->eth_src, &src_ip)) {
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "Cannot get address of %s: %s\n", x->iface, ug_strerror(errno));
+                return false;
+        }
+        if (!xdp_resolve_dst_mac(x->iface, dst->sin_addr.s_addr, h->eth_dst)) {
+                char addr[INET_ADDRSTRLEN] = "";
+                inet_ntop(AF_INET, &dst->sin_addr, addr, sizeof addr);
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "Cannot resolve MAC address of %s on %s.\n", addr, x->iface);
+                return false;
+        }
+        h->eth_type = htons(ETHERTYPE_IP);
+        h->ip_ver_ihl = 0x45;
+        h->ip_frag = htons(0x4000); // DF
+        h->ip_ttl = IN_MULTICAST(ntohl(dst->sin_addr.s_addr)) ? 1 : 64;
+        h->ip_proto = IPPROTO_UDP;
+        h->ip_src = src_ip;
+        h->ip_dst = dst->sin_addr.s_addr;
+        h->udp_sport = htons(x->src_port);
+        h->udp_dport = dst->sin_port;
+        h->udp_csum = 0; // optional for IPv4
+        x->can_send = true;
+        return true;
+}
+
+struct xdp_sock *xdp_sock_init(const char *iface, int queue, uint16_t src_port, const struct sockaddr_in *dst)
+{
+        unsigned int ifindex = if_nametoindex(iface);
+        if (ifindex == 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unknown interface %s!\n", iface);
+                return nullptr;
+        }
+
+        auto *x = new xdp_sock();
+        snprintf(x->iface, sizeof x->iface, "%s", iface);
+        x->src_port = src_port;
+        struct xdp_umem_reg mr{};
+        struct xdp_mmap_offsets off{};
+        socklen_t optlen = sizeof off;
+        int ring_size[] = { XDP_RX_FRAMES, XDP_TX_FRAMES, XDP_RX_FRAMES, XDP_TX_FRAMES };
+        const int ring_opt[] = { XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING };
+        const uint16_t bind_flags[] = { XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY, XDP_USE_NEED_WAKEUP | XDP_COPY, XDP_COPY };
+        struct sockaddr_xdp sxdp{};
+        union bpf_attr attr{};
+        uint32_t key = queue;
+
+        if ((x->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot create socket: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        x->umem_len = (size_t) (XDP_RX_FRAMES + XDP_TX_FRAMES) * XDP_FRAME_SIZE;
+        x->umem = (char *) mmap(NULL, x->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (x->umem == MAP_FAILED) {
+                x->umem = nullptr;
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot allocate UMEM: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        mr.addr = (uintptr_t) x->umem;
+        mr.len = x->umem_len;
+        mr.chunk_size = XDP_FRAME_SIZE;
+        if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof mr) != 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot register UMEM: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        for (unsigned i = 0; i < sizeof ring_opt / sizeof ring_opt[0]; ++i) {
+                if (setsockopt(x->fd, SOL_XDP, ring_opt[i], &ring_size[i], sizeof ring_size[i]) != 0) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot set ring size: %s\n", ug_strerror(errno));
+                        goto error;
+                }
+        }
+        if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0 ||
+                        !xdp_ring_map(x->fd, &x->fill, &off.fr, XDP_RX_FRAMES, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+                        !xdp_ring_map(x->fd, &x->comp, &off.cr, XDP_TX_FRAMES, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+                        !xdp_ring_map(x->fd, &x->rx, &off.rx, XDP_RX_FRAMES, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+                        !xdp_ring_map(x->fd, &x->tx, &off.tx, XDP_TX_FRAMES, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING)) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot map rings: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        for (int i = 0; i < XDP_RX_FRAMES; ++i) {
+                ((uint64_t *) x->fill.ring)[i] = (uint64_t) i * XDP_FRAME_SIZE;
+        }
+        __atomic_store_n(x->fill.producer, XDP_RX_FRAMES, __ATOMIC_RELEASE);
+        for (int i = 0; i < XDP_TX_FRAMES; ++i) {
+                x->tx_free[x->tx_free_count++] = (uint64_t) (XDP_RX_FRAMES + i) * XDP_FRAME_SIZE;
+        }
+
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = ifindex;
+        sxdp.sxdp_queue_id = queue;
+        for (uint16_t flags : bind_flags) {
+                sxdp.sxdp_flags = flags;
+                if (bind(x->fd, (struct sockaddr *) &sxdp, sizeof sxdp) == 0) {
+                        break;
+                }
+                sxdp.sxdp_flags = 0;
+        }
+        if (sxdp.sxdp_flags == 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot bind to %s queue %d: %s\n", iface, queue, ug_strerror(errno));
+                goto error;
+        }
+        x->need_wakeup = (sxdp.sxdp_flags & XDP_USE_NEED_WAKEUP) != 0;
+
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(int);
+        attr.max_entries = queue + 1;
+        if ((x->map_fd = sys_bpf(BPF_MAP_CREATE, &attr)) < 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot create XSK map: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        attr = {};
+        attr.map_fd = x->map_fd;
+        attr.key = (uintptr_t) &key;
+        attr.value = (uintptr_t) &x->fd;
+        attr.flags = BPF_ANY;
+        if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot insert socket to XSK map: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        if ((x->prog_fd = xdp_load_prog(x->map_fd, src_port)) < 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot load XDP program: %s\n", ug_strerror(errno));
+                goto error;
+        }
+        attr = {};
+        attr.link_create.prog_fd = x->prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        if ((x->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot attach XDP program to %s: %s\n", iface, ug_strerror(errno));
+                goto error;
+        }
+
+        log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Using %s queue %d, port %d (%s mode).\n", iface, queue, src_port,
+                        (sxdp.sxdp_flags & XDP_ZEROCOPY) != 0 ? "zero-copy" : "copy");
+        if (!xdp_sock_set_dst(x, dst)) {
+                log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Sending through regular socket.\n");
+        }
+        return x;
+error:
+        if (errno == EPERM) {
+                log_msg(LOG_LEVEL_INFO, MOD_NAME "AF_XDP requires CAP_NET_RAW and CAP_BPF (or CAP_SYS_ADMIN).\n");
+        }
+        xdp_sock_done(x);
+        return nullptr;
+}
+
+void xdp_sock_done(struct xdp_sock *x)
+{
+        if (x == nullptr) {
+                return;
+        }
+        for (int fd : { x->link_fd, x->prog_fd, x->map_fd }) { // closing the link detaches the program
+                if (fd >= 0) {
+                        close(fd);
+                }
+        }
+        xdp_ring_unmap(&x->fill);
+        xdp_ring_unmap(&x->comp);
+        xdp_ring_unmap(&x->rx);
+        xdp_ring_unmap(&x->tx);
+        if (x->fd >= 0) {
+                close(x->fd);
+        }
+        if (x->umem != nullptr) {
+                munmap(x->umem, x->umem_len);
+        }
+        delete x;
+}
+
+int xdp_sock_fd(struct xdp_sock *x)
+{
+        return x->fd;
+}
+
+int xdp_sock_recv(struct xdp_sock *x, xdp_recv_callback_t cb, void *udata)
+{
+        uint32_t prod = __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE);
+        uint32_t cons = *x->rx.consumer;
+        uint32_t fill_prod = *x->fill.producer;
+        auto *descs = (struct xdp_desc *) x->rx.ring;
+        auto *fill = (uint64_t *) x->fill.ring;
+        int count = prod - cons;
+        bool stop = false;
+
+        for ( ; cons != prod && !stop; ++cons) {
+                struct xdp_desc *d = &descs[cons & (x->rx.size - 1)];
+                const uint8_t *frame = (uint8_t *) x->umem + d->addr;
+                const auto *h = (const struct xdp_pkt_hdr *) frame;
+                int payload_len = d->len >= sizeof *h ? ntohs(h->udp_len) - 8 : -1;
+                if (payload_len >= 0 && payload_len <= (int) (d->len - sizeof *h)) { // validated by XDP prog except lengths
+                        struct sockaddr_in src{};
+                        src.sin_family = AF_INET;
+                        src.sin_addr.s_addr = h->ip_src;
+                        src.sin_port = h->udp_sport;
+                        stop = !cb(udata, frame + sizeof *h, payload_len, &src);
+                }
+                fill[fill_prod++ & (x->fill.size - 1)] = d->addr & ~((uint64_t) XDP_FRAME_SIZE - 1);
+        }
+        __atomic_store_n(x->rx.consumer, cons, __ATOMIC_RELEASE);
+        __atomic_store_n(x->fill.producer, fill_prod, __ATOMIC_RELEASE);
+        if (count > 0 && x->need_wakeup && (__atomic_load_n(x->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) != 0) {
+                recvfrom(x->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+        return stop ? -1 : count;
+}
+
+static void xdp_tx_kick(struct xdp_sock *x)
+{
+        x->tx_pending = 0;
+        if (x->need_wakeup && (__atomic_load_n(x->tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) == 0) {
+                return;
+        }
+        if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN && errno != EBUSY
+                        && errno != ENOBUFS && errno != ENETDOWN) {
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "sendto: %s\n", ug_strerror(errno));
+        }
+}
+
+static void xdp_tx_reclaim(struct xdp_sock *x)
+{
+        uint32_t prod = __atomic_load_n(x->comp.producer, __ATOMIC_ACQUIRE);
+        uint32_t cons = *x->comp.consumer;
+        for ( ; cons != prod; ++cons) {
+                x->tx_free[x->tx_free_count++] = ((uint64_t *) x->comp.ring)[cons & (x->comp.size - 1)];
+        }
+        __atomic_store_n(x->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+int xdp_sock_sendv(struct xdp_sock *x, const struct iovec *vec, int count)
+{
+        size_t len = 0;
+        for (int i = 0; i < count; ++i) {
+                len += vec[i].iov_len;
+        }
+        if (!x->can_send || len + sizeof(struct xdp_pkt_hdr) > XDP_FRAME_SIZE) {
+                errno = x->can_send ? EMSGSIZE : ENOTCONN;
+                return -1;
+        }
+
+        lock_guard<mutex> lk(x->tx_lock);
+        xdp_tx_reclaim(x);
+        while (x->tx_free_count == 0) { // all frames in flight - let the kernel process them
+                xdp_tx_kick(x);
+                std::this_thread::yield();
+                xdp_tx_reclaim(x);
+        }
+        uint64_t addr = x->tx_free[--x->tx_free_count];
+        uint8_t *frame = (uint8_t *) x->umem + addr;
+        auto *h = (struct xdp_pkt_hdr *) frame;
+        *h = x->hdr_template;
+        h->ip_len = htons(len + sizeof *h - offsetof(struct xdp_pkt_hdr, ip_ver_ihl));
+        h->ip_id = htons(x->ip_id++);
+        h->ip_csum = ip_checksum(h);
+        h->udp_len = htons(len + sizeof *h - offsetof(struct xdp_pkt_hdr, udp_sport));
+        uint8_t *payload = frame + sizeof *h;
+        for (int i = 0; i < count; ++i) {
+                memcpy(payload, vec[i].iov_base, vec[i].iov_len);
+                payload += vec[i].iov_len;
+        }
+
+        uint32_t idx = *x->tx.producer;
+        struct xdp_desc *d = &((struct xdp_desc *) x->tx.ring)[idx & (x->tx.size - 1)];
+        d->addr = addr;
+        d->len = len + sizeof *h;
+        d->options = 0;
+        __atomic_store_n(x->tx.producer, idx + 1, __ATOMIC_RELEASE);
+
+        if (!x->batch || ++x->tx_pending >= XDP_TX_BATCH) {
+                xdp_tx_kick(x);
+        }
+        return len;
+}
+
+void xdp_sock_set_batch(struct xdp_sock *x, bool batch)
+{
+        lock_guard<mutex> lk(x->tx_lock);
+        x->batch = batch;
+}
+
+void xdp_sock_flush(struct xdp_sock *x)
+{
+        lock_guard<mutex> lk(x->tx_lock);
+        if (x->tx_pending > 0) {
+                xdp_tx_kick(x);
+        }
+}
+
+#endif // defined HAVE_AF_XDP
@@ -0,0 +1,92 @@
+/**
+ * @file   rtp/net_xdp.h
+ *
+ * AF_XDP backend of the UDP socket (Linux only). Packets destined to the
+ * bound port are redirected by a small XDP program to an AF_XDP socket
+ * whose rings are polled by the UDP reader thread, outgoing datagrams are
+ * written with prebuilt Ethernet/IPv4/UDP headers directly to the UMEM. Only
+ * IPv4 is supported, any failure during setup makes the caller fall back to
+ * the regular UDP socket.
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RTP_NET_XDP_H_
+#define RTP_NET_XDP_H_
+
+#ifdef HAVE_AF_XDP
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+struct xdp_sock;
+
+/// called for every received datagram, src is the sender address, returns false to stop receiving
+typedef bool (*xdp_recv_callback_t)(void *udata, const uint8_t *data, int len, const struct sockaddr_in *src);
+
+/**
+ * @param iface    interface name
+ * @param queue    NIC RX queue to be bound to
+ * @param src_port local UDP port (both received and used as the source port)
+ * @param dst      peer address, NULL if only receiving
+ * @returns        NULL if AF_XDP cannot be used, error is already printed
+ */
+struct xdp_sock *xdp_sock_init(const char *iface, int queue, uint16_t src_port, const struct sockaddr_in *dst);
+void xdp_sock_done(struct xdp_sock *x);
+/**
+ * Sets the peer. If its MAC address cannot be resolved (or dst is NULL,
+ * INADDR_ANY or loopback), xdp_sock_sendv() fails with ENOTCONN and caller
+ * should use the regular socket.
+ */
+bool xdp_sock_set_dst(struct xdp_sock *x, const struct sockaddr_in *dst);
+/// fd to be waited upon (select/poll) for incoming packets
+int xdp_sock_fd(struct xdp_sock *x);
+/// processes all packets waiting in the RX ring, returns their count or -1 if cb requested stop
+int xdp_sock_recv(struct xdp_sock *x, xdp_recv_callback_t cb, void *udata);
+/**
+ * Sends one datagram, in batch mode the kernel is notified only once per
+ * several packets and by xdp_sock_flush().
+ * @returns bytes sent or -1 (errno set), EMSGSIZE for datagram not fitting to an UMEM frame
+ */
+int xdp_sock_sendv(struct xdp_sock *x, const struct iovec *vec, int count);
+void xdp_sock_set_batch(struct xdp_sock *x, bool batch);
+void xdp_sock_flush(struct xdp_sock *x);
+
+#endif // defined HAVE_AF_XDP
+
+#endif // RTP_NET_XDP_H_
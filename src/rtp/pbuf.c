@@ -66,6 +66,7 @@
 #include "rtp/pbuf.h"
 #include "tv.h"
 #include "utils/color_out.h"
+#include "utils/metrics.h"
 
 #define PBUF_MAGIC	0xcafebabe
 
@@ -80,6 +81,7 @@ struct pbuf_node {
         struct pbuf_node *prv;
         uint32_t rtp_timestamp; /* RTP timestamp for the frame           */
         time_ns_t arrival_time;    /* Arrival time of first packet in frame */
+        time_ns_t last_arrival_time; /* Arrival time of the latest packet    */
         time_ns_t playout_time;    /* Playout time for the frame            */
         time_ns_t deletion_time;   /* Deletion time for the frame            */
         struct coded_data *cdata;       /*                                       */
@@ -105,6 +107,7 @@ struct pbuf {
         uint32_t last_display_ts;
         int longest_gap; // longest loss
         int out_of_order_pkts;
+        struct metric *received_pkts_total, *received_bytes_total, *lost_pkts_total;
         int max_out_of_order_dist;
         int dups; // duplicite packets
 };
@@ -182,6 +185,9 @@ struct pbuf *pbuf_init(volatile int *delay_ms)
                 playout_buf->playout_delay_us = 0.032 * 1000 * 1000;
                 playout_buf->last_report_seq = -1;
                 playout_buf->stats_interval = DEFAULT_STATS_INTERVAL;
+                playout_buf->received_pkts_total = metric_register("rx_packets_total", "Received RTP packets", METRIC_COUNTER);
+                playout_buf->received_bytes_total = metric_register("rx_bytes_total", "Received RTP payload bytes", METRIC_COUNTER);
+                playout_buf->lost_pkts_total = metric_register("rx_packets_lost_total", "Lost RTP packets", METRIC_COUNTER);
         } else {
                 debug_msg("Failed to allocate memory for playout buffer\n");
         }
@@ -232,7 +238,10 @@ void pbuf_destroy(struct pbuf *playout_buf) {
 static void add_coded_unit(struct pbuf_node *node, rtp_packet * pkt)
 {
         assert(node->rtp_timestamp == pkt->ts);
-        assert(node->cdata != NULL);
+        if (node->cdata == NULL) { // already detached by pbuf_decode_detach()
+                free(pkt);
+                return;
+        }
 
         struct coded_data *tmp = (struct coded_data *) malloc(sizeof(struct coded_data));
         if (tmp == NULL) {
@@ -244,6 +253,7 @@ static void add_coded_unit(struct pbuf_node *node, rtp_packet * pkt)
         tmp->seqno = pkt->seq;
         tmp->data = pkt;
         node->mbit |= pkt->m;
+        node->last_arrival_time = get_time_in_ns();
         if((int16_t)(tmp->seqno - node->cdata->seqno) > 0){
                 tmp->prv = NULL;
                 tmp->nxt = node->cdata;
@@ -280,7 +290,7 @@ static struct pbuf_node *create_new_pnode(rtp_packet * pkt, long long playout_de
                 tmp->magic = PBUF_MAGIC;
                 tmp->rtp_timestamp = pkt->ts;
                 tmp->mbit = pkt->m;
-                tmp->playout_time =
+                tmp->playout_time = tmp->last_arrival_time =
                         tmp->arrival_time = get_time_in_ns();
                 tmp->playout_time += playout_delay_us * 1000;
                 tmp->deletion_time = tmp->playout_time + playout_delay_us * 1000;
@@ -352,16 +362,20 @@ static inline void pbuf_process_stats(struct pbuf *playout_buf, rtp_packet * pkt
         uint16_t dist = (uint16_t) (pkt->seq - playout_buf->last_report_seq);
         if (dist >= playout_buf->stats_interval * 2 && dist < 1U<<15U) {
                 uint16_t report_seq_until = (uint16_t) ((pkt->seq / playout_buf->stats_interval * playout_buf->stats_interval) - playout_buf->stats_interval); // sum up only up to current-playout_buf->stats_interval to be able to catch out-of-order packets
+                int expected = 0, received = 0;
                 for (uint16_t i = playout_buf->last_report_seq;
                                 i != report_seq_until; i += NUMBER_WORD_BITS) {
-                        playout_buf->expected_pkts += NUMBER_WORD_BITS;
-                        playout_buf->received_pkts += __builtin_popcountll(playout_buf->packets[i / NUMBER_WORD_BITS]);
+                        expected += NUMBER_WORD_BITS;
+                        received += __builtin_popcountll(playout_buf->packets[i / NUMBER_WORD_BITS]);
                         compute_longest_gap(&playout_buf->longest_gap, playout_buf->packets[i / NUMBER_WORD_BITS]);
                         playout_buf->packets[i / NUMBER_WORD_BITS] = 0;
                 }
 
+                playout_buf->expected_pkts += expected;
+                playout_buf->received_pkts += received;
                 playout_buf->received_pkts_cum += playout_buf->received_pkts;
                 playout_buf->expected_pkts_cum += playout_buf->expected_pkts;
+                metric_add(playout_buf->lost_pkts_total, expected - received);
 
                 playout_buf->last_report_seq = report_seq_until;
         }
@@ -406,6 +420,8 @@ void pbuf_insert(struct pbuf *playout_buf, rtp_packet * pkt)
 
         pbuf_validate(playout_buf);
         pbuf_process_stats(playout_buf, pkt);
+        metric_add(playout_buf->received_pkts_total, 1);
+        metric_add(playout_buf->received_bytes_total, pkt->data_len);
 
         if (playout_buf->frst == NULL && playout_buf->last == NULL) {
                 /* playout buffer is empty - add new frame */
@@ -537,9 +553,9 @@ int pbuf_is_empty(struct pbuf *playout_buf)
                 return FALSE;
 }
 
-int
-pbuf_decode(struct pbuf *playout_buf, time_ns_t curr_time,
-                             decode_frame_t decode_func, void *data)
+static int
+pbuf_decode_frame(struct pbuf *playout_buf, time_ns_t curr_time,
+                             decode_frame_t decode_func, void *data, bool detach)
 {
         /* Find the first complete frame that has reached it's playout */
         /* time, and decode it into the framebuffer. Mark the frame as */
@@ -555,9 +571,13 @@ pbuf_decode(struct pbuf *playout_buf, time_ns_t curr_time,
                    ) {
                         if (frame_complete(curr)) {
                                 struct pbuf_stats stats = { playout_buf->received_pkts_cum,
-                                        playout_buf->expected_pkts_cum };
+                                        playout_buf->expected_pkts_cum, curr->arrival_time,
+                                        curr->last_arrival_time };
                                 int ret = decode_func(curr->cdata, data, &stats);
                                 curr->decoded = 1;
+                                if (detach) {
+                                        curr->cdata = NULL;
+                                }
                                 return ret;
                         } else {
                                 if (curr_time > curr->playout_time + 1 * NS_IN_SEC) {
@@ -573,6 +593,59 @@ pbuf_decode(struct pbuf *playout_buf, time_ns_t curr_time,
         return 0;
 }
 
+/**
+ * Returns the earliest time when pbuf_decode() or pbuf_remove() will have
+ * some work to do (a complete frame reaching its playout time, an incomplete
+ * one timing out or the oldest frame reaching its deletion time). Only an
+ * arrival of a new packet can make the deadline earlier, so the caller can
+ * sleep until this time or until pbuf_insert() is called.
+ *
+ * @retval INT64_MAX if there is no pending work
+ */
+time_ns_t pbuf_next_deadline(struct pbuf *playout_buf)
+{
+        time_ns_t deadline = INT64_MAX;
+        struct pbuf_node *curr = playout_buf->frst;
+        if (curr != NULL && frame_complete(curr)) {
+                deadline = curr->deletion_time + 1;
+        }
+        // deadlines are strict (see pbuf_decode()), thus the +1
+        for ( ; curr != NULL; curr = curr->nxt) {
+                if (curr->decoded) {
+                        continue;
+                }
+                time_ns_t frame_deadline = frame_complete(curr) ? curr->playout_time + 1
+                        : curr->playout_time + 1 * NS_IN_SEC + 1;
+                deadline = MIN(deadline, frame_deadline);
+        }
+        return deadline;
+}
+
+int
+pbuf_decode(struct pbuf *playout_buf, time_ns_t curr_time,
+                             decode_frame_t decode_func, void *data)
+{
+        return pbuf_decode_frame(playout_buf, curr_time, decode_func, data, false);
+}
+
+/**
+ * Same as pbuf_decode() except that the ownership of the frame coded data
+ * passes to decode_func, which must eventually free it with
+ * pbuf_free_coded_data(). This allows the frame to be decoded asynchronously
+ * in another thread while the playout buffer is being further used.
+ */
+int
+pbuf_decode_detach(struct pbuf *playout_buf, time_ns_t curr_time,
+                             decode_frame_t decode_func, void *data)
+{
+        return pbuf_decode_frame(playout_buf, curr_time, decode_func, data, true);
+}
+
+void pbuf_free_coded_data(struct coded_data *cdata)
+{
+        free_cdata(cdata);
+}
+
 void pbuf_set_playout_delay(struct pbuf *playout_buf, double playout_delay)
 {
         playout_buf->playout_delay_us = playout_delay * 1000 * 1000;
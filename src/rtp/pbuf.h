@@ -78,6 +78,8 @@ struct coded_data {
 struct pbuf_stats {
         long long int received_pkts_cum;
         long long int expected_pkts_cum;
+        time_ns_t first_arrival;  ///< arrival time of the first packet of the frame
+        time_ns_t last_arrival;   ///< arrival time of the last packet of the frame
 };
 
 /* The playout buffer */
@@ -93,6 +95,7 @@ struct vcodec_state {
         unsigned int max_frame_size; // maximal frame size
                                      // to be returned to caller by a decoder to allow him adjust buffers accordingly
         unsigned int decoded;
+        void *decode_worker; ///< per-participant decoding thread (video_rxtx/ultragrid_rtp.cpp), may be NULL
 };
 
 struct pbuf_audio_data {
@@ -119,7 +122,11 @@ int 	 	 pbuf_is_empty(struct pbuf *playout_buf);
 int 	 	 pbuf_decode(struct pbuf *playout_buf, time_ns_t curr_time,
                              decode_frame_t decode_func, void *data);
                              //struct video_frame *framebuffer, int i, struct state_decoder *decoder);
+int		 pbuf_decode_detach(struct pbuf *playout_buf, time_ns_t curr_time,
+                             decode_frame_t decode_func, void *data);
+void		 pbuf_free_coded_data(struct coded_data *cdata);
 void		 pbuf_remove(struct pbuf *playout_buf, time_ns_t curr_time);
+time_ns_t	 pbuf_next_deadline(struct pbuf *playout_buf);
 void		 pbuf_set_playout_delay(struct pbuf *playout_buf, double playout_delay);
 
 #ifdef __cplusplus
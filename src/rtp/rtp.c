@@ -2851,12 +2851,16 @@ rtp_send_data_hdr(struct rtp *session,
         /* Allocate memory for the packet... */
         assert(buffer_len < RTP_MAX_PACKET_LEN);
         /* we dont always need 20 (12|16) but this seems to work. LG */
+        /* (more if CSRCs or header extension is present) */
 #ifdef WIN32
-        d = (uint8_t *) malloc(3 * sizeof(WSABUF) + 20 + RTP_PACKET_HEADER_SIZE);
+        d = (uint8_t *) malloc(3 * sizeof(WSABUF) + MAX(20, buffer_len) + RTP_PACKET_HEADER_SIZE);
         send_vector = d;
         buffer = (uint8_t *) d + 3 * sizeof(WSABUF);
 #else
-        d = buffer = (uint8_t *) malloc(20 + RTP_PACKET_HEADER_SIZE);
+        // sendmsg() is synchronous so the header doesn't need to outlive this call
+        uint64_t hdr_buf[(RTP_PACKET_HEADER_SIZE + RTP_MAX_PACKET_LEN) / sizeof(uint64_t) + 1];
+        d = NULL;
+        buffer = (uint8_t *) hdr_buf;
 #endif
         packet = (rtp_packet *)(void *) buffer;
 
@@ -2870,10 +2874,10 @@ rtp_send_data_hdr(struct rtp *session,
         send_vector_len = 1;
 
         /* These are internal pointers into the buffer... */
-#ifdef NDEF
-        packet->csrc = (uint32_t *) (buffer + RTP_PACKET_HEADER_SIZE + vlen);
+        packet->csrc = (uint32_t *)(void *) (buffer + RTP_PACKET_HEADER_SIZE + vlen);
         packet->extn =
             (uint8_t *) (buffer + RTP_PACKET_HEADER_SIZE + vlen + (4 * cc));
+#ifdef NDEF
         packet->data =
             (uint8_t *) (buffer + RTP_PACKET_HEADER_SIZE + vlen + (4 * cc));
         if (extn != NULL) {
@@ -3318,7 +3322,7 @@ static void rtcp_udp_send(struct rtp *session, int len, char *buffer)
 }
 
 static void send_rtcp(struct rtp *session, uint32_t rtp_ts,
-                      rtcp_app_callback appcallback)
+                      rtcp_app_callback appcallback, rtcp_app *extra_app)
 {
         /* Construct and send an RTCP packet. The order in which packets are packed into a */
         /* compound packet is defined by section 6.1 of draft-ietf-avt-rtp-new-03.txt and  */
@@ -3393,6 +3397,13 @@ static void send_rtcp(struct rtp *session, uint32_t rtp_ts,
                         assert(RTP_MAX_PACKET_LEN - (ptr - buffer) >= 0);
                 }
         }
+        if (extra_app && RTP_MAX_PACKET_LEN - (ptr - buffer) >= (extra_app->length + 1) * 4) {
+                lpt = ptr;
+                ptr =
+                    format_rtcp_app(ptr,
+                                    RTP_MAX_PACKET_LEN - (ptr - buffer),
+                                    rtp_my_ssrc(session), extra_app);
+        }
 
         /* And encrypt if desired... */
         if (session->encryption_enabled) {
@@ -3429,6 +3440,21 @@ static void send_rtcp(struct rtp *session, uint32_t rtp_ts,
         check_database(session);
 }
 
+/**
+ * Sends an RTCP compound packet containing the given APP packet immediately,
+ * outside the regular RTCP schedule (eg. congestion control feedback that
+ * needs to be sent more often than the RTCP interval allows).
+ *
+ * @param app APP packet with header in host byte order (as passed to
+ *            rtcp_app_callback), the data are copied as is
+ */
+void rtp_send_app(struct rtp *session, uint32_t rtp_ts, rtcp_app *app)
+{
+        check_database(session);
+        send_rtcp(session, rtp_ts, NULL, app);
+        check_database(session);
+}
+
 /**
  * rtp_send_ctrl:
  * @session: the session pointer (returned by rtp_init())
@@ -3457,7 +3483,7 @@ void rtp_send_ctrl(struct rtp *session, uint32_t rtp_ts,
                     rtcp_interval(session) / (session->csrc_count + 1);
                 time_ns_t new_send_time = session->last_rtcp_send_time + new_interval * NS_IN_SEC;
                 if (curr_time > new_send_time) {
-                        send_rtcp(session, rtp_ts, appcallback);
+                        send_rtcp(session, rtp_ts, appcallback, NULL);
                         session->initial_rtcp = FALSE;
                         session->last_rtcp_send_time = curr_time;
                         session->next_rtcp_send_time = curr_time + (rtcp_interval(session) / (session->csrc_count +
@@ -272,6 +272,7 @@ int 		 rtp_send_data_hdr(struct rtp *session,
 			       char *extn, uint16_t extn_len, uint16_t extn_type);
 void 		 rtp_send_ctrl(struct rtp *session, uint32_t rtp_ts, 
 			       rtcp_app_callback appcallback, time_ns_t curr_time);
+void 		 rtp_send_app(struct rtp *session, uint32_t rtp_ts, rtcp_app *app);
 void 		 rtp_update(struct rtp *session, time_ns_t curr_time);
 
 uint32_t	 rtp_my_ssrc(struct rtp *session);
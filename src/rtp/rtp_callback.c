@@ -60,6 +60,7 @@
 #include "config_win32.h"
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "debug.h"
@@ -198,6 +199,41 @@ process_sdes(struct pdb *participants, uint32_t ssrc, rtcp_sdes_item * d)
         }
 }
 
+#define TFRC_APP_ALL_SSRC 0 ///< APP packet addressed to all participants
+
+/**
+ * Sends congestion control APP packet, data are SSRC of the participant the
+ * packet is addressed to (or TFRC_APP_ALL_SSRC) followed by the value.
+ */
+static void send_app_u32(struct rtp *session, uint32_t rtp_ts, const char *name, uint32_t target_ssrc, uint32_t val)
+{
+        uint32_t buf[5] = { 0 };
+        rtcp_app *app = (rtcp_app *)(void *) buf;
+        app->length = 4;
+        memcpy(app->name, name, 4);
+        uint32_t data[2] = { htonl(target_ssrc), htonl(val) };
+        memcpy((char *) app + offsetof(rtcp_app, data), data, sizeof data);
+        rtp_send_app(session, rtp_ts, app);
+}
+
+/**
+ * Sender announces its RTT (in microseconds) to the receivers, which then start
+ * sending TFRC feedback (see tfrc.c).
+ */
+void rtp_send_tfrc_rtt(struct rtp *session, uint32_t rtp_ts, uint32_t rtt_us)
+{
+        send_app_u32(session, rtp_ts, "RTT_", TFRC_APP_ALL_SSRC, rtt_us);
+}
+
+/**
+ * Receiver reports the allowed sending rate (in bits per second) to the sender
+ * with given SSRC, other senders in the session ignore the report.
+ */
+void rtp_send_tfrc_feedback(struct rtp *session, uint32_t rtp_ts, uint32_t sender_ssrc, double txrate)
+{
+        send_app_u32(session, rtp_ts, "TFRC", sender_ssrc, (uint32_t) MIN(txrate / 1000.0, UINT32_MAX));
+}
+
 void rtp_recv_callback(struct rtp *session, rtp_event * e)
 {
         rtcp_app *pckt_app = (rtcp_app *) e->data;
@@ -232,11 +268,24 @@ void rtp_recv_callback(struct rtp *session, rtp_event * e)
                 break;
         case RX_APP:
                 pckt_app = (rtcp_app *) e->data;
-                if (strncmp(pckt_app->name, "RTT_", 4) == 0) {
-                        assert(pckt_app->length == 3);
-                        assert(pckt_app->subtype == 0);
-//                      tfrc_recv_rtt(state->tfrc_state, get_time_in_ns(), ntohl(*((int *) pckt_app->data)));
+                if (state != NULL && e->ssrc != rtp_my_ssrc(session)
+                                && pckt_app->length == 4 && pckt_app->subtype == 0) {
+                        uint32_t data[2];
+                        memcpy(data, (char *) pckt_app + offsetof(rtcp_app, data), sizeof data);
+                        uint32_t target_ssrc = ntohl(data[0]);
+                        uint32_t val = ntohl(data[1]);
+                        // state belongs to the participant that sent the APP (e->ssrc) so the
+                        // reports of individual receivers are kept apart, packets addressed to
+                        // other participants (multicast, reflector) are ignored
+                        if (target_ssrc == TFRC_APP_ALL_SSRC || target_ssrc == rtp_my_ssrc(session)) {
+                                if (strncmp(pckt_app->name, "RTT_", 4) == 0) {
+                                        tfrc_recv_rtt(state->tfrc_state, get_time_in_ns(), val);
+                                } else if (strncmp(pckt_app->name, "TFRC", 4) == 0) {
+                                        tfrc_recv_feedback(state->tfrc_state, get_time_in_ns(), val * 1000.0);
+                                }
+                        }
                 }
+                free(pckt_app);
                 break;
         case RX_BYE:
                 break;
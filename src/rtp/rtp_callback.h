@@ -48,6 +48,8 @@ extern "C" {
 #endif
 
 void rtp_recv_callback(struct rtp *session, rtp_event *e);
+void rtp_send_tfrc_rtt(struct rtp *session, uint32_t rtp_ts, uint32_t rtt_us);
+void rtp_send_tfrc_feedback(struct rtp *session, uint32_t rtp_ts, uint32_t sender_ssrc, double txrate);
 int handle_with_buffer(struct rtp *session,rtp_event *e);
 int check_for_frame_completion(struct rtp *);
 void process_packet_for_display(char *);
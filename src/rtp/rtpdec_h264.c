@@ -74,9 +74,6 @@ int fill_coded_frame_from_sps(struct video_frame *rx_data, unsigned char *data,
  * eg. frame type - for prepending RTSP/SDP sprop-parameter-sets to I-frame and
  * parsing dimensions from SPS NAL.
  *
- * Should be run in 1st pass - it sets frame_type according to which does the
- * decoder deduce offset in 2nd pass.
- *
  * @retval H.264 or RTP NAL type
  */
 static uint8_t process_nal(uint8_t nal, struct video_frame *frame, uint8_t *data, int data_len) {
@@ -98,28 +95,48 @@ static uint8_t process_nal(uint8_t nal, struct video_frame *frame, uint8_t *data
     return type;
 }
 
-static _Bool decode_nal_unit(struct video_frame *frame, int *total_length, int pass, unsigned char **dst, uint8_t *data, int data_len) {
-    int fu_length = 0;
+/**
+ * Checks (from NAL headers only) if the packet contains IDR or SEI NAL unit,
+ * which makes the frame INTRA (see process_nal()).
+ */
+static _Bool packet_is_intra(const uint8_t *data, int data_len) {
+    if (data_len < 1) {
+        return FALSE;
+    }
+    uint8_t type = NALU_HDR_GET_TYPE(data[0]);
+    if (type == RTP_FU_A) {
+        type = data_len > 2 && (data[1] & 0x80) ? NALU_HDR_GET_TYPE(data[1]) : 0;
+    } else if (type == RTP_STAP_A) {
+        for (int i = 1; i + 2 < data_len; i += 2 + ((data[i] << 8) | data[i + 1])) {
+            uint8_t sub_type = NALU_HDR_GET_TYPE(data[i + 2]);
+            if (sub_type == NAL_IDR || sub_type == NAL_SEI) {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+    return type == NAL_IDR || type == NAL_SEI;
+}
+
+/**
+ * Depacketizes one RTP packet writing the reconstructed Annex B stream to *dst,
+ * which is advanced past the written data.
+ */
+static _Bool decode_nal_unit(struct video_frame *frame, unsigned char **dst, uint8_t *data, int data_len) {
     uint8_t nal = data[0];
-    uint8_t type = pass == 0 ? process_nal(nal, frame, data, data_len) : NALU_HDR_GET_TYPE(nal);
+    uint8_t type = process_nal(nal, frame, data, data_len);
     if (type >= NAL_MIN && type <= NAL_MAX) {
         type = H264_NAL;
     }
 
     switch (type) {
         case H264_NAL:
-            if (pass == 0) {
-                *total_length += sizeof(start_sequence) + data_len;
-            } else {
-                *dst -= data_len + sizeof(start_sequence);
-                memcpy(*dst, start_sequence, sizeof(start_sequence));
-                memcpy(*dst + sizeof(start_sequence), data, data_len);
-            }
+            memcpy(*dst, start_sequence, sizeof(start_sequence));
+            memcpy(*dst + sizeof(start_sequence), data, data_len);
+            *dst += sizeof(start_sequence) + data_len;
             break;
         case RTP_STAP_A:
         {
-            int nal_sizes[100];
-            unsigned nal_count = 0;
             data++;
             data_len--;
 
@@ -133,36 +150,17 @@ static _Bool decode_nal_unit(struct video_frame *frame, int *total_length, int p
 
                 log_msg(LOG_LEVEL_DEBUG2, "STAP-A subpacket NAL type %d (nri: %d)\n", (int) NALU_HDR_GET_TYPE(data[0]), (int) NALU_HDR_GET_NRI(nal));
 
-                if (nal_size <= data_len) {
-                    if (pass == 0) {
-                        *total_length += sizeof(start_sequence) + nal_size;
-                        process_nal(data[0], frame, data, data_len);
-                    } else {
-                        assert(nal_count < sizeof nal_sizes / sizeof nal_sizes[0] - 1);
-                        nal_sizes[nal_count++] = nal_size;
-                    }
-                } else {
+                if (nal_size > data_len) {
                     error_msg("NAL size exceeds length: %u %d\n", nal_size, data_len);
                     return FALSE;
                 }
+                process_nal(data[0], frame, data, nal_size);
+                memcpy(*dst, start_sequence, sizeof(start_sequence));
+                memcpy(*dst + sizeof(start_sequence), data, nal_size);
+                *dst += sizeof(start_sequence) + nal_size;
+
                 data += nal_size;
                 data_len -= nal_size;
-
-                if (data_len < 0) {
-                    error_msg("Consumed more bytes than we got! (%d)\n", data_len);
-                    return FALSE;
-                }
-
-            }
-            if (pass > 0) {
-                for (int i = nal_count - 1; i >= 0; i--) {
-                    int nal_size = nal_sizes[i];
-                    data -= nal_size;
-                    *dst -= nal_size + sizeof(start_sequence);
-                    memcpy(*dst, start_sequence, sizeof(start_sequence));
-                    memcpy(*dst + sizeof(start_sequence), data, nal_size);
-                    data -= 2;
-                }
             }
             break;
         }
@@ -179,7 +177,6 @@ static _Bool decode_nal_unit(struct video_frame *frame, int *total_length, int p
             if (data_len > 1) {
                 uint8_t fu_header = *data;
                 uint8_t start_bit = fu_header >> 7;
-                uint8_t end_bit       = (fu_header & 0x40) >> 6;
                 uint8_t nal_type = NALU_HDR_GET_TYPE(fu_header);
                 uint8_t reconstructed_nal;
 
@@ -193,29 +190,14 @@ static _Bool decode_nal_unit(struct video_frame *frame, int *total_length, int p
                 data++;
                 data_len--;
 
-                if (pass == 0) {
-                    if (end_bit) {
-                        fu_length = data_len;
-                    } else {
-                        fu_length += data_len;
-                    }
-                    if (start_bit) {
-                        *total_length += sizeof(start_sequence) + sizeof(reconstructed_nal) + data_len;
-                        process_nal(reconstructed_nal, frame, data, fu_length);
-                    } else {
-                        *total_length += data_len;
-                    }
-                } else {
-                    if (start_bit) {
-                        *dst -= sizeof(start_sequence) + sizeof(reconstructed_nal) + data_len;
-                        memcpy(*dst, start_sequence, sizeof(start_sequence));
-                        memcpy(*dst + sizeof(start_sequence), &reconstructed_nal, sizeof(reconstructed_nal));
-                        memcpy(*dst + sizeof(start_sequence) + sizeof(reconstructed_nal), data, data_len);
-                    } else {
-                        *dst -= data_len;
-                        memcpy(*dst, data, data_len);
-                    }
+                if (start_bit) {
+                    process_nal(reconstructed_nal, frame, data, data_len);
+                    memcpy(*dst, start_sequence, sizeof(start_sequence));
+                    *dst += sizeof(start_sequence);
+                    *(*dst)++ = reconstructed_nal;
                 }
+                memcpy(*dst, data, data_len);
+                *dst += data_len;
             } else {
                 error_msg("Too short data for FU-A H264 RTP packet\n");
                 return FALSE;
@@ -228,37 +210,255 @@ static _Bool decode_nal_unit(struct video_frame *frame, int *total_length, int p
     return TRUE;
 }
 
+/**
+ * Reconstructs the H.264 Annex B frame from the RTP packets.
+ *
+ * Packets are written in one pass directly to the (preallocated) frame buffer.
+ * Because the coded_data list is sorted from the newest packet, it is first
+ * walked to the oldest one only reading NAL headers to find out if the frame
+ * is INTRA and space for data->offset_len bytes needs to be left at the beginning.
+ */
 int decode_frame_h264(struct coded_data *cdata, void *decode_data) {
-    struct coded_data *orig = cdata;
+    struct decode_data_h264 *data = (struct decode_data_h264 *) decode_data;
+    struct video_frame *frame = data->frame;
+    frame->frame_type = BFRAME;
 
-    int total_length = 0;
+    _Bool intra = FALSE;
+    struct coded_data *oldest = cdata;
+    for ( ; ; oldest = oldest->nxt) {
+        intra = intra || packet_is_intra((uint8_t *) oldest->data->data, oldest->data->data_len);
+        if (oldest->nxt == NULL) {
+            break;
+        }
+    }
 
+    unsigned char *start = (unsigned char *) frame->tiles[0].data;
+    unsigned char *dst = start + (intra ? data->offset_len : 0);
+    for (cdata = oldest; cdata != NULL; cdata = cdata->prv) {
+        rtp_packet *pckt = cdata->data;
+
+        if (!decode_nal_unit(frame, &dst, (uint8_t *) pckt->data, pckt->data_len)) {
+            return FALSE;
+        }
+    }
+    frame->tiles[0].data_len = dst - start;
+
+    return TRUE;
+}
+
+#define H265_NAL_HDR_GET_TYPE(hdr) (((hdr) >> 1) & 0x3FU)
+#define H265_NAL_IRAP_MIN 16
+#define H265_NAL_IRAP_MAX 23
+#define H265_NAL_MAX      40 ///< max (unspecified) NAL unit type that is not RTP specific
+#define H265_AP           48
+#define H265_FU           49
+#define H265_NAL_HDR_LEN   2
+
+static void h265_process_nal(uint8_t type, struct video_frame *frame) {
+    log_msg(LOG_LEVEL_DEBUG2, "HEVC NAL type %d\n", (int) type);
+    if (type >= H265_NAL_IRAP_MIN && type <= H265_NAL_IRAP_MAX) {
+        frame->frame_type = INTRA;
+    } else if (frame->frame_type == BFRAME) {
+        frame->frame_type = OTHER;
+    }
+}
+
+static _Bool h265_packet_is_intra(const uint8_t *data, int data_len) {
+    if (data_len < H265_NAL_HDR_LEN) {
+        return FALSE;
+    }
+    uint8_t type = H265_NAL_HDR_GET_TYPE(data[0]);
+    if (type == H265_FU) {
+        type = data_len > 3 && (data[2] & 0x80) ? data[2] & 0x3F : 0;
+    } else if (type == H265_AP) {
+        for (int i = H265_NAL_HDR_LEN; i + 2 < data_len; i += 2 + ((data[i] << 8) | data[i + 1])) {
+            uint8_t sub_type = H265_NAL_HDR_GET_TYPE(data[i + 2]);
+            if (sub_type >= H265_NAL_IRAP_MIN && sub_type <= H265_NAL_IRAP_MAX) {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+    return type >= H265_NAL_IRAP_MIN && type <= H265_NAL_IRAP_MAX;
+}
+
+/// @copydoc decode_nal_unit
+static _Bool decode_h265_nal_unit(struct video_frame *frame, unsigned char **dst, uint8_t *data, int data_len) {
+    if (data_len < H265_NAL_HDR_LEN + 1) {
+        error_msg("Too short HEVC RTP packet\n");
+        return FALSE;
+    }
+    uint8_t type = H265_NAL_HDR_GET_TYPE(data[0]);
+    if (type <= H265_NAL_MAX) {
+        h265_process_nal(type, frame);
+        memcpy(*dst, start_sequence, sizeof(start_sequence));
+        memcpy(*dst + sizeof(start_sequence), data, data_len);
+        *dst += sizeof(start_sequence) + data_len;
+        return TRUE;
+    }
+    if (type == H265_AP) {
+        data += H265_NAL_HDR_LEN;
+        data_len -= H265_NAL_HDR_LEN;
+        while (data_len > 2) {
+            int nal_size = (data[0] << 8) | data[1];
+            data += 2;
+            data_len -= 2;
+            if (nal_size > data_len || nal_size < H265_NAL_HDR_LEN) {
+                error_msg("NAL size exceeds length: %d %d\n", nal_size, data_len);
+                return FALSE;
+            }
+            h265_process_nal(H265_NAL_HDR_GET_TYPE(data[0]), frame);
+            memcpy(*dst, start_sequence, sizeof(start_sequence));
+            memcpy(*dst + sizeof(start_sequence), data, nal_size);
+            *dst += sizeof(start_sequence) + nal_size;
+            data += nal_size;
+            data_len -= nal_size;
+        }
+        return TRUE;
+    }
+    if (type == H265_FU) {
+        uint8_t fu_header = data[H265_NAL_HDR_LEN];
+        uint8_t nal_type = fu_header & 0x3F;
+        data += H265_NAL_HDR_LEN + 1;
+        data_len -= H265_NAL_HDR_LEN + 1;
+        if (fu_header & 0x80) { // start bit - reconstruct NAL header from payload header
+            h265_process_nal(nal_type, frame);
+            memcpy(*dst, start_sequence, sizeof(start_sequence));
+            *dst += sizeof(start_sequence);
+            *(*dst)++ = (data[-3] & 0x81) | nal_type << 1;
+            *(*dst)++ = data[-2];
+        }
+        memcpy(*dst, data, data_len);
+        *dst += data_len;
+        return TRUE;
+    }
+    error_msg("Unhandled HEVC NAL type %d\n", type);
+    return FALSE;
+}
+
+/**
+ * Reconstructs the HEVC Annex B frame from RTP packets (RFC 7798). Same as
+ * decode_frame_h264() including the data->offset_len space left for INTRA
+ * frames. DONL fields are not supported (sprop-max-don-diff must be 0).
+ */
+int decode_frame_h265(struct coded_data *cdata, void *decode_data) {
     struct decode_data_h264 *data = (struct decode_data_h264 *) decode_data;
     struct video_frame *frame = data->frame;
     frame->frame_type = BFRAME;
 
-    for (int pass = 0; pass < 2; pass++) {
-        unsigned char *dst = NULL;
+    _Bool intra = FALSE;
+    struct coded_data *oldest = cdata;
+    for ( ; ; oldest = oldest->nxt) {
+        intra = intra || h265_packet_is_intra((uint8_t *) oldest->data->data, oldest->data->data_len);
+        if (oldest->nxt == NULL) {
+            break;
+        }
+    }
 
-        if (pass > 0) {
-            cdata = orig;
-            if(frame->frame_type == INTRA){
-                total_length+=data->offset_len;
-            }
-            frame->tiles[0].data_len = total_length;
-            dst = (unsigned char *) frame->tiles[0].data + total_length;
+    unsigned char *start = (unsigned char *) frame->tiles[0].data;
+    unsigned char *dst = start + (intra ? data->offset_len : 0);
+    for (cdata = oldest; cdata != NULL; cdata = cdata->prv) {
+        rtp_packet *pckt = cdata->data;
+
+        if (!decode_h265_nal_unit(frame, &dst, (uint8_t *) pckt->data, pckt->data_len)) {
+            return FALSE;
+        }
+    }
+    frame->tiles[0].data_len = dst - start;
+
+    return TRUE;
+}
+
+#define AV1_AGGR_Z 0x80 ///< first OBU element continues OBU from the previous packet
+#define AV1_AGGR_Y 0x40 ///< last OBU element continues in next packet
+#define AV1_AGGR_W(hdr) (((hdr) >> 4) & 0x3)
+#define AV1_AGGR_N 0x08 ///< first packet of a coded video sequence
+#define AV1_OBU_HAS_EXTENSION 0x4
+#define AV1_OBU_HAS_SIZE 0x2
+#define AV1_OBU_SIZE_LEN 4 ///< obu_size is written padded to fixed length, the size is not known in advance
+
+static _Bool leb128_read(const uint8_t **ptr, const uint8_t *end, uint32_t *val) {
+    *val = 0;
+    for (int i = 0; i < 5 && *ptr < end; ++i) {
+        uint8_t b = *(*ptr)++;
+        *val |= (uint32_t) (b & 0x7F) << (7 * i);
+        if ((b & 0x80) == 0) {
+            return TRUE;
         }
+    }
+    return FALSE;
+}
 
-        while (cdata != NULL) {
-            rtp_packet *pckt = cdata->data;
+static void av1_write_obu_size(unsigned char *dst, uint32_t size) {
+    for (int i = 0; i < AV1_OBU_SIZE_LEN; ++i) {
+        dst[i] = ((size >> (7 * i)) & 0x7F) | (i < AV1_OBU_SIZE_LEN - 1 ? 0x80 : 0);
+    }
+}
 
-            if (!decode_nal_unit(frame, &total_length, pass, &dst, (uint8_t *) pckt->data, pckt->data_len)) {
+/**
+ * Reconstructs the AV1 temporal unit in low overhead bitstream format (OBUs
+ * with obu_size, preceded with a temporal delimiter) from RTP packets (AV1 RTP
+ * payload format v1.0). Frame is marked INTRA if it starts a new coded video
+ * sequence (N bit).
+ */
+int decode_frame_av1(struct coded_data *cdata, void *decode_data) {
+    struct decode_data_h264 *data = (struct decode_data_h264 *) decode_data;
+    struct video_frame *frame = data->frame;
+    frame->frame_type = OTHER;
+
+    struct coded_data *oldest = cdata;
+    while (oldest->nxt != NULL) {
+        oldest = oldest->nxt;
+    }
+
+    unsigned char *start = (unsigned char *) frame->tiles[0].data;
+    unsigned char *dst = start;
+    *dst++ = 0x12; // temporal delimiter OBU
+    *dst++ = 0;
+    unsigned char *obu_size = NULL; // obu_size field of the OBU being reconstructed
+    for (cdata = oldest; cdata != NULL; cdata = cdata->prv) {
+        const uint8_t *ptr = (uint8_t *) cdata->data->data;
+        const uint8_t *end = ptr + cdata->data->data_len;
+        if (ptr == end) {
+            continue;
+        }
+        uint8_t aggr_hdr = *ptr++;
+        if (aggr_hdr & AV1_AGGR_N) {
+            frame->frame_type = INTRA;
+        }
+        if ((aggr_hdr & AV1_AGGR_Z) && obu_size == NULL) {
+            error_msg("AV1 OBU continuation without start!\n");
+            return FALSE;
+        }
+        int w = AV1_AGGR_W(aggr_hdr);
+        for (int i = 0; ptr < end; ++i) {
+            uint32_t elem_len = end - ptr; // last element of W != 0 has no length field
+            if ((w == 0 || i < w - 1) && (!leb128_read(&ptr, end, &elem_len) || elem_len > (uint32_t) (end - ptr))) {
+                error_msg("Malformed AV1 RTP packet!\n");
                 return FALSE;
             }
-
-            cdata = cdata->nxt;
+            if (i == 0 && (aggr_hdr & AV1_AGGR_Z)) { // continuation of the OBU
+                memcpy(dst, ptr, elem_len);
+                dst += elem_len;
+            } else if (elem_len > 0) { // new OBU - insert obu_size after OBU header
+                unsigned hdr_len = ptr[0] & AV1_OBU_HAS_EXTENSION ? 2 : 1;
+                hdr_len = MIN(hdr_len, elem_len);
+                *dst++ = ptr[0] | AV1_OBU_HAS_SIZE;
+                memcpy(dst, ptr + 1, hdr_len - 1);
+                dst += hdr_len - 1;
+                obu_size = dst;
+                dst += AV1_OBU_SIZE_LEN;
+                memcpy(dst, ptr + hdr_len, elem_len - hdr_len);
+                dst += elem_len - hdr_len;
+            }
+            ptr += elem_len;
+            if (obu_size != NULL && (ptr < end || !(aggr_hdr & AV1_AGGR_Y))) { // OBU complete
+                av1_write_obu_size(obu_size, dst - obu_size - AV1_OBU_SIZE_LEN);
+                obu_size = NULL;
+            }
         }
     }
+    frame->tiles[0].data_len = dst - start;
 
     return TRUE;
 }
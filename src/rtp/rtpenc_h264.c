@@ -55,36 +55,79 @@
 
 #include "rtp/rtpenc_h264.h"
 
-static uint32_t get4Bytes(const unsigned char *ptr) {
-        return (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/**
+ * Finds first occurence of 3-byte start code (00 00 01) in [start, stop).
+ */
+static const unsigned char *find_start_code(const unsigned char *start, const unsigned char *stop) {
+        const unsigned char *p = start;
+        // compare 32 (16) positions at once - bytes p[i], p[i+1] with 0 and p[i+2] with 1
+#ifdef __AVX2__
+        const __m256i zero32 = _mm256_setzero_si256();
+        const __m256i one32 = _mm256_set1_epi8(1);
+        for ( ; stop - p >= 32 + 2; p += 32) {
+                __m256i b0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(const void *) p), zero32);
+                __m256i b1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(const void *) (p + 1)), zero32);
+                __m256i b2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(const void *) (p + 2)), one32);
+                unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(b0, b1), b2));
+                if (mask != 0) {
+                        return p + __builtin_ctz(mask);
+                }
+        }
+#endif
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        for ( ; stop - p >= 16 + 2; p += 16) {
+                __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *) p), zero);
+                __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *) (p + 1)), zero);
+                __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *) (p + 2)), one);
+                unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+                if (mask != 0) {
+                        return p + __builtin_ctz(mask);
+                }
+        }
+#endif
+        while (stop - p >= 3) {
+                if (p[2] > 1) { // start code cannot begin at p, p+1 nor p+2
+                        p += 3;
+                } else if (p[2] == 1 && p[1] == 0 && p[0] == 0) {
+                        return p;
+                } else {
+                        p += 1;
+                }
+        }
+        return NULL;
 }
 
 /**
  * Returns pointer to next NAL unit in stream.
  *
+ * Both 3-byte (00 00 01) and 4-byte (00 00 00 01) start codes are recognized,
+ * NAL unit is required to have at least one byte after a 3-byte start code.
+ *
  * @param with_start_code returned pointer will point to start code preceeding NAL unit, otherwise it will point
  *                        to NAL unit beginning (skipping the start code)
  */
 static const unsigned char *get_next_nal(const unsigned char *start, long len, _Bool with_start_code) {
         const unsigned char * const stop = start + len;
-        while (stop - start >= 4) {
-                uint32_t next4Bytes = get4Bytes(start);
-                if (next4Bytes == 0x00000001) {
-                        return start + (with_start_code ? 0 : 4);
-                }
-                if ((next4Bytes & 0xFFFFFF00) == 0x00000100) {
-                        return start + (with_start_code ? 0 : 3);
-                }
-                // We save at least some of "next4Bytes".
-                if ((unsigned) (next4Bytes & 0xFF) > 1) {
-                        // Common case: 0x00000001 or 0x000001 definitely doesn't begin anywhere in "next4Bytes", so we save all of it:
-                        start += 4;
-                } else {
-                        // Save the first byte, and continue testing the rest:
-                        start += 1;
-                }
+        const unsigned char *sc = find_start_code(start, stop);
+        if (sc == NULL) {
+                return NULL;
         }
-        return NULL;
+        if (sc > start && sc[-1] == 0) {
+                return with_start_code ? sc - 1 : sc + 3;
+        }
+        if (stop - sc < 4) {
+                return NULL;
+        }
+        return with_start_code ? sc : sc + 3;
 }
 
 /**
@@ -113,7 +113,11 @@
 #include "rtp/rtp_callback.h"
 #include "rtp/pbuf.h"
 #include "rtp/video_decoders.h"
+#include "utils/latency_trace.h"
 #include "utils/macros.h"
+#include "utils/metrics.h"
+#include "utils/misc.h"
+#include "utils/parallel_conv.h"
 #include "utils/synchronized_queue.h"
 #include "utils/thread.h"
 #include "utils/timed_message.h"
@@ -126,6 +130,7 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #ifdef RECONFIGURE_IN_FUTURE_THREAD
 #include <future>
 #endif
@@ -260,6 +265,16 @@ struct reported_statistics_cumul {
         }
 };
 
+/// receiver part of the latency trace, follows the sender stages (enum frame_trace_stage)
+enum rx_trace_stage {
+        RX_TRACE_RECV_FIRST = TRACE_STAGE_COUNT,
+        RX_TRACE_RECV_LAST,
+        RX_TRACE_DECODE,
+        RX_TRACE_POSTPROCESS,
+        RX_TRACE_DISPLAY,
+        RX_TRACE_STAGE_COUNT
+};
+
 // message definitions
 struct frame_msg {
         inline frame_msg(struct control_state *c, struct reported_statistics_cumul &sr) : control(c), recv_frame(nullptr),
@@ -269,6 +284,11 @@ struct frame_msg {
         {}
         inline ~frame_msg() {
                 if (recv_frame) {
+                        static struct metric *fec_ok = metric_register("video_fec_ok_total", "Video frames received complete (FEC not needed)", METRIC_COUNTER);
+                        static struct metric *fec_corrected = metric_register("video_fec_corrected_total", "Video frames recovered by FEC", METRIC_COUNTER);
+                        static struct metric *fec_nok = metric_register("video_fec_failed_total", "Video frames FEC failed to recover", METRIC_COUNTER);
+                        static struct metric *corrupted = metric_register("video_frames_corrupted_total", "Corrupted received video frames", METRIC_COUNTER);
+                        static struct metric *displayed = metric_register("video_frames_displayed_total", "Displayed video frames", METRIC_COUNTER);
                         int received_bytes = 0;
                         for (unsigned int i = 0; i < recv_frame->tile_count; ++i) {
                                 received_bytes += sum_map(pckt_list[i]);
@@ -277,16 +297,21 @@ struct frame_msg {
                         if (recv_frame->fec_params.type != FEC_NONE) {
                                 if (is_corrupted) {
                                         stats.fec_nok += 1;
+                                        metric_add(fec_nok, 1);
                                 } else {
                                         if (received_bytes == expected_bytes) {
                                                 stats.fec_ok += 1;
+                                                metric_add(fec_ok, 1);
                                         } else {
                                                 stats.fec_corrected += 1;
+                                                metric_add(fec_corrected, 1);
                                         }
                                 }
                         }
                         stats.corrupted += is_corrupted;
                         stats.displayed += is_displayed;
+                        metric_add(corrupted, is_corrupted);
+                        metric_add(displayed, is_displayed);
                 }
                 vf_free(recv_frame);
                 vf_free(nofec_frame);
@@ -300,6 +325,7 @@ struct frame_msg {
         struct reported_statistics_cumul &stats;
         bool is_displayed = false;
         bool is_corrupted = false;
+        time_ns_t trace_ns[RX_TRACE_STAGE_COUNT] = {}; ///< sender stages are on a different time base, see latency_trace_parse_rtp_ext()
 };
 
 struct main_msg_reconfigure {
@@ -331,12 +357,21 @@ struct state_video_decoder
                 mod.new_message = decoder_process_message;
                 module_register(&mod, parent);
                 control = (struct control_state *) get_module(get_root_module(parent), "control");
+                if (latency_trace_enabled()) {
+                        const char *intervals[] = { "filter", "compress_queue", "compress", "send_queue",
+                                "recv", "decode", "postprocess", "display", "total_excl_net" };
+                        latency_trace = latency_trace_init(&mod, "RX", sizeof intervals / sizeof intervals[0], intervals);
+                }
         }
         ~state_video_decoder() {
+                if (latency_trace) {
+                        latency_trace_destroy(latency_trace);
+                }
                 module_done(&mod);
         }
         struct module mod;
         struct control_state *control = {};
+        struct latency_trace *latency_trace = nullptr; ///< NULL if not tracing
 
         thread decompress_thread_id,
                   fec_thread_id;
@@ -344,6 +379,8 @@ struct state_video_decoder
         struct video_desc display_desc = {};      ///< description of the mode that display is currently configured to
 
         struct video_frame *frame = NULL; ///< @todo rewrite this more reasonably
+        deque<struct video_frame *> spare_frames; ///< display frames acquired in advance (decompress thread only)
+        int display_pool_frames = 1; ///< frames that may be held concurrently, see @ref DISPLAY_PROPERTY_BUFFER_POOL
 
         struct display   *display = NULL; ///< assigned display device
         /// @{
@@ -406,6 +443,26 @@ static void wait_for_framebuffer_swap(struct state_video_decoder *decoder) {
 #define NOT_ENCRYPTED_ERR "Receiving unencrypted video data " \
         "while expecting encrypted.\n"
 
+struct line_decoder_stripe_data {
+        const struct line_decoder *line_decoder;
+        unsigned char *dst;
+        int dst_linesize;
+        const unsigned char *src;
+};
+
+/// decodes whole received (FEC-reconstructed) tile with a line decoder, see parallel_conv_run()
+static void decode_lines_stripe(void *arg, int y_start, int y_end) {
+        auto *d = (struct line_decoder_stripe_data *) arg;
+        const struct line_decoder *ld = d->line_decoder;
+        unsigned char *dst = d->dst + (size_t) y_start * d->dst_linesize;
+        const unsigned char *src = d->src + (size_t) y_start * ld->src_linesize;
+        for (int y = y_start; y < y_end; ++y) {
+                ld->decode_line(dst, src, ld->dst_linesize, ld->shifts[0], ld->shifts[1], ld->shifts[2]);
+                src += ld->src_linesize;
+                dst += d->dst_linesize;
+        }
+}
+
 static void *fec_thread(void *args) {
         set_thread_name(__func__);
         struct state_video_decoder *decoder =
@@ -516,18 +573,14 @@ static void *fec_thread(void *args) {
                                         struct line_decoder *line_decoder =
                                                 &decoder->line_decoder[pos];
 
-                                        int data_pos = 0;
-                                        char *src = fec_out_buffer;
-                                        char *dst = tile->data + line_decoder->base_offset;
-                                        while(data_pos < (int) fec_out_len) {
-                                                line_decoder->decode_line((unsigned char*)dst, (unsigned char *) src, line_decoder->dst_linesize,
-                                                                line_decoder->shifts[0],
-                                                                line_decoder->shifts[1],
-                                                                line_decoder->shifts[2]);
-                                                src += line_decoder->src_linesize;
-                                                dst += vc_get_linesize(tile->width ,frame->color_spec);
-                                                data_pos += line_decoder->src_linesize;
-                                        }
+                                        struct line_decoder_stripe_data stripe_data = {
+                                                line_decoder,
+                                                (unsigned char *) tile->data + line_decoder->base_offset,
+                                                vc_get_linesize(tile->width, frame->color_spec),
+                                                (const unsigned char *) fec_out_buffer,
+                                        };
+                                        int lines = (fec_out_len + line_decoder->src_linesize - 1) / line_decoder->src_linesize;
+                                        parallel_conv_run(lines, 1, decode_lines_stripe, &stripe_data, get_cpu_core_count());
                                 }
                         }
                 } else { /* PT_VIDEO */
@@ -573,6 +626,47 @@ static bool blacklist_current_out_codec(struct state_video_decoder *decoder){
         return true;
 }
 
+/**
+ * Acquires display frames in advance up to the display buffer pool size so that
+ * taking next frame after display_put_frame() doesn't need to wait for the display.
+ */
+static void fill_spare_frames(struct state_video_decoder *decoder)
+{
+        if (decoder->frame == nullptr) { // not configured
+                return;
+        }
+        while ((int) decoder->spare_frames.size() + 1 < decoder->display_pool_frames) {
+                struct video_frame *f = display_get_frame(decoder->display);
+                if (f == nullptr) {
+                        break;
+                }
+                decoder->spare_frames.push_back(f);
+        }
+}
+
+static struct video_frame *get_next_frame(struct state_video_decoder *decoder)
+{
+        if (decoder->spare_frames.empty()) {
+                return display_get_frame(decoder->display);
+        }
+        struct video_frame *f = decoder->spare_frames.front();
+        decoder->spare_frames.pop_front();
+        return f;
+}
+
+/// returns all held frames to the display, threads must not be running
+static void discard_display_frames(struct state_video_decoder *decoder)
+{
+        if (decoder->frame) {
+                display_put_frame(decoder->display, decoder->frame, PUTF_DISCARD);
+                decoder->frame = NULL;
+        }
+        for (auto *f : decoder->spare_frames) {
+                display_put_frame(decoder->display, f, PUTF_DISCARD);
+        }
+        decoder->spare_frames.clear();
+}
+
 struct decompress_data {
         struct state_video_decoder *decoder;
         int pos;
@@ -602,6 +696,22 @@ static void *decompress_worker(void *data)
 ADD_TO_PARAM("decoder-drop-policy",
                 "* decoder-drop-policy=blocking|nonblock\n"
                 "  Force specified blocking policy (default nonblock).\n");
+static void record_latency_trace(struct latency_trace *trace, const time_ns_t *stages)
+{
+        if (!trace) {
+                return;
+        }
+        latency_trace_record_stages(trace, 0, stages, TRACE_STAGE_COUNT);
+        latency_trace_record_stages(trace, TRACE_STAGE_COUNT - 1, stages + RX_TRACE_RECV_FIRST,
+                        RX_TRACE_STAGE_COUNT - RX_TRACE_RECV_FIRST);
+        if (stages[TRACE_CAPTURE] != 0 && stages[RX_TRACE_RECV_FIRST] != 0) {
+                // one-way network delay cannot be measured without synchronized clocks
+                latency_trace_record(trace, RX_TRACE_STAGE_COUNT - 2, stages[TRACE_PACKETIZE] - stages[TRACE_CAPTURE]
+                                + stages[RX_TRACE_DISPLAY] - stages[RX_TRACE_RECV_FIRST]);
+        }
+        latency_trace_report(trace);
+}
+
 static void *decompress_thread(void *args) {
         set_thread_name(__func__);
         struct state_video_decoder *decoder =
@@ -695,6 +805,7 @@ static void *decompress_thread(void *args) {
 
                 LOG(LOG_LEVEL_DEBUG) << MOD_NAME << "Decompress duration: " <<
                         duration_cast<nanoseconds>(high_resolution_clock::now() - t0).count() / 1000000.0 << " ms\n";
+                msg->trace_ns[RX_TRACE_DECODE] = get_time_in_ns();
 
                 if(decoder->change_il) {
                         for(unsigned int i = 0; i < decoder->frame->tile_count; ++i) {
@@ -703,6 +814,7 @@ static void *decompress_thread(void *args) {
                                                         decoder->out_codec), tile->height, &decoder->change_il_state[i]);
                         }
                 }
+                msg->trace_ns[RX_TRACE_POSTPROCESS] = get_time_in_ns();
 
                 {
                         int putf_flags = force_putf_flag != -1 ? force_putf_flag : PUTF_NONBLOCK; // originally was BLOCKING when !is_codec_interframe(decoder->received_vid_desc.color_spec)
@@ -712,8 +824,10 @@ static void *decompress_thread(void *args) {
                                         decoder->frame, putf_flags);
                         if (ret == 0) {
                                 msg->is_displayed = true;
+                                msg->trace_ns[RX_TRACE_DISPLAY] = get_time_in_ns();
+                                record_latency_trace(decoder->latency_trace, msg->trace_ns);
                         }
-                        decoder->frame = display_get_frame(decoder->display);
+                        decoder->frame = get_next_frame(decoder);
                 }
 
 skip_frame:
@@ -725,6 +839,8 @@ skip_frame:
                         lk.unlock();
                         decoder->buffer_swapped_cv.notify_one();
                 }
+                // refill while the next frame is being received
+                fill_spare_frames(decoder);
         }
 
         return NULL;
@@ -916,10 +1032,7 @@ void video_decoder_remove_display(struct state_video_decoder *decoder)
 {
         if (decoder->display) {
                 video_decoder_stop_threads(decoder);
-                if (decoder->frame) {
-                        display_put_frame(decoder->display, decoder->frame, PUTF_DISCARD);
-                        decoder->frame = NULL;
-                }
+                discard_display_frames(decoder);
                 decoder->display = NULL;
                 memset(&decoder->display_desc, 0, sizeof(decoder->display_desc));
         }
@@ -1200,9 +1313,7 @@ static bool reconfigure_decoder(struct state_video_decoder *decoder,
 
         // this code forces flushing the pipelined data
         video_decoder_stop_threads(decoder);
-        if (decoder->frame)
-                display_put_frame(decoder->display, decoder->frame, PUTF_DISCARD);
-        decoder->frame = NULL;
+        discard_display_frames(decoder);
         video_decoder_start_threads(decoder);
 
         cleanup(decoder);
@@ -1254,6 +1365,14 @@ static bool reconfigure_decoder(struct state_video_decoder *decoder,
                         << display_desc << "\n";
                 decoder->display_desc = display_desc;
 
+                len = sizeof decoder->display_pool_frames;
+                if (!display_ctl_property(decoder->display, DISPLAY_PROPERTY_BUFFER_POOL,
+                                        &decoder->display_pool_frames, &len) || decoder->display_pool_frames < 1) {
+                        decoder->display_pool_frames = 1;
+                }
+                LOG(LOG_LEVEL_VERBOSE) << MOD_NAME << "Display allows " << decoder->display_pool_frames
+                        << " frame(s) to be held concurrently.\n";
+
                 len = sizeof(display_requested_rgb_shift);
                 ret = display_ctl_property(decoder->display, DISPLAY_PROPERTY_RGB_SHIFT,
                                 &display_requested_rgb_shift, &len);
@@ -1511,6 +1630,8 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
         int buffer_length = 0;
         int pt = 0;
         bool buffer_swapped = false;
+        time_ns_t sender_trace[TRACE_STAGE_COUNT] = {};
+        bool sender_trace_parsed = false;
 
         // We have no framebuffer assigned, exitting
         if(!decoder->display) {
@@ -1566,6 +1687,11 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
                 pckt = cdata->data;
                 enum openssl_mode crypto_mode = MODE_AES128_NONE;
 
+                if (decoder->latency_trace && !sender_trace_parsed && pckt->extn) {
+                        sender_trace_parsed = latency_trace_parse_rtp_ext(pckt->extn_type, pckt->extn_len,
+                                        pckt->extn + 4, sender_trace);
+                }
+
                 pt = pckt->pt;
                 hdr = (uint32_t *)(void *) pckt->data;
                 data_pos = ntohl(hdr[1]);
@@ -1851,6 +1977,9 @@ next_packet:
                 fec_msg->pckt_list = std::move(pckt_list);
                 fec_msg->received_pkts_cum = stats->received_pkts_cum;
                 fec_msg->expected_pkts_cum = stats->expected_pkts_cum;
+                copy(sender_trace, sender_trace + TRACE_STAGE_COUNT, fec_msg->trace_ns);
+                fec_msg->trace_ns[RX_TRACE_RECV_FIRST] = stats->first_arrival;
+                fec_msg->trace_ns[RX_TRACE_RECV_LAST] = stats->last_arrival;
 
                 auto t0 = std::chrono::high_resolution_clock::now();
                 decoder->fec_queue.push(move(fec_msg));
@@ -48,7 +48,7 @@
 
 BasicRTSPOnlyServer *BasicRTSPOnlyServer::srvInstance = NULL;
 
-BasicRTSPOnlyServer::BasicRTSPOnlyServer(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio){
+BasicRTSPOnlyServer::BasicRTSPOnlyServer(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio, const rtsp_video_codec_t *video_codec){
     if(mod == NULL){
         exit(1);
     }
@@ -61,17 +61,18 @@ BasicRTSPOnlyServer::BasicRTSPOnlyServer(int port, struct module *mod, rtps_type
     this->audio_bps = audio_bps;
     this->rtp_port = rtp_port;
     this->rtp_port_audio = rtp_port_audio;
+    this->video_codec = video_codec;
     this->rtspServer = NULL;
     this->env = NULL;
     this->srvInstance = this;
 }
 
 BasicRTSPOnlyServer* 
-BasicRTSPOnlyServer::initInstance(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio){
+BasicRTSPOnlyServer::initInstance(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio, const rtsp_video_codec_t *video_codec){
     if (srvInstance != NULL){
         return srvInstance;
     }
-    return new BasicRTSPOnlyServer(port, mod, avType, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio);
+    return new BasicRTSPOnlyServer(port, mod, avType, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio, video_codec);
 }
 
 BasicRTSPOnlyServer* 
@@ -119,16 +120,16 @@ int BasicRTSPOnlyServer::init_server() {
 
                if(avType == av){
                                   sms->addSubsession(BasicRTSPOnlySubsession
-                                                    ::createNew(*env, True, mod, audio, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio));
+                                                    ::createNew(*env, True, mod, audio, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio, video_codec));
                                   sms->addSubsession(BasicRTSPOnlySubsession
-                                                    ::createNew(*env, True, mod, video, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio));
+                                                    ::createNew(*env, True, mod, video, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio, video_codec));
                }else if(avType == audio){
                    sms->addSubsession(BasicRTSPOnlySubsession
-                                     	 ::createNew(*env, True, mod, audio, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio));
+                                     	 ::createNew(*env, True, mod, audio, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio, video_codec));
 
                }else if(avType == video){
             	   sms->addSubsession(BasicRTSPOnlySubsession
-            			   	   	    	 ::createNew(*env, True, mod, video, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio));
+            			   	   	    	 ::createNew(*env, True, mod, video, audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio, video_codec));
                }else{
             	   *env << "\n[RTSP Server] Error when trying to play stream type: \"" << avType << "\"\n";
             	   exit(1);
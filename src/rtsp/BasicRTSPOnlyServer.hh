@@ -49,16 +49,17 @@
 #include <BasicUsageEnvironment.hh>
 #include "rtsp/rtsp_utils.h"
 #include "audio/types.h"
+#include "types.h"
 #include "module.h"
 
 
 
 class BasicRTSPOnlyServer {
 private:
-    BasicRTSPOnlyServer(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio);
+    BasicRTSPOnlyServer(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio, const rtsp_video_codec_t *video_codec);
 
 public:
-    static BasicRTSPOnlyServer* initInstance(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio);
+    static BasicRTSPOnlyServer* initInstance(int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio, const rtsp_video_codec_t *video_codec);
     static BasicRTSPOnlyServer* getInstance();
 
     int init_server();
@@ -79,6 +80,7 @@ private:
     int audio_bps;
     int rtp_port; //server rtp port
     int rtp_port_audio; //server rtp port
+    const rtsp_video_codec_t *video_codec;
     RTSPServer* rtspServer;
     UsageEnvironment* env;
 };
@@ -48,20 +48,22 @@
 #include <GroupsockHelper.hh>
 
 #include "messaging.h"
+#include "utils/sdp.h"
 
 BasicRTSPOnlySubsession*
 BasicRTSPOnlySubsession::createNew(UsageEnvironment& env,
 		Boolean reuseFirstSource, struct module *mod, rtps_types_t avType,
 		audio_codec_t audio_codec, int audio_sample_rate, int audio_channels,
-		int audio_bps, int rtp_port, int rtp_port_audio) {
+		int audio_bps, int rtp_port, int rtp_port_audio, const rtsp_video_codec_t *video_codec) {
 	return new BasicRTSPOnlySubsession(env, reuseFirstSource, mod, avType,
-			audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio);
+			audio_codec, audio_sample_rate, audio_channels, audio_bps, rtp_port, rtp_port_audio,
+			video_codec);
 }
 
 BasicRTSPOnlySubsession::BasicRTSPOnlySubsession(UsageEnvironment& env,
 		Boolean reuseFirstSource, struct module *mod, rtps_types_t avType,
 		audio_codec_t audio_codec, int audio_sample_rate, int audio_channels,
-		int audio_bps, int rtp_port, int rtp_port_audio) :
+		int audio_bps, int rtp_port, int rtp_port_audio, const rtsp_video_codec_t *video_codec) :
 		ServerMediaSubsession(env), fSDPLines(NULL), fReuseFirstSource(
 				reuseFirstSource), fLastStreamToken(NULL) {
 	Vdestination = NULL;
@@ -75,6 +77,8 @@ BasicRTSPOnlySubsession::BasicRTSPOnlySubsession(UsageEnvironment& env,
 	this->audio_bps = audio_bps;
 	this->rtp_port = rtp_port;
 	this->rtp_port_audio = rtp_port_audio;
+	this->video_codec = video_codec;
+	this->fSDPVideoCodec = VIDEO_CODEC_NONE;
 	fCNAME[sizeof fCNAME - 1] = '\0';
 }
 
@@ -85,6 +89,11 @@ BasicRTSPOnlySubsession::~BasicRTSPOnlySubsession() {
 }
 
 char const* BasicRTSPOnlySubsession::sdpLines() {
+	if (fSDPLines != NULL && (avType == video || avType == av)
+			&& fSDPVideoCodec != *video_codec) { // codec changed
+		delete[] fSDPLines;
+		fSDPLines = NULL;
+	}
 	if (fSDPLines == NULL) {
 		setSDPLines();
 	}
@@ -101,7 +110,11 @@ void BasicRTSPOnlySubsession::setSDPLines() {
 		char const* mediaType = "video";
 		uint8_t rtpPayloadType = 96;
 		AddressString ipAddressStr(fServerAddressForSDP);
-		char* rtpmapLine = strdup("a=rtpmap:96 H264/90000\n");
+		const char *encoding_name = sdp_get_video_encoding_name(*video_codec);
+		char rtpmapLine[64];
+		snprintf(rtpmapLine, sizeof rtpmapLine, "a=rtpmap:%u %s/90000\n",
+				rtpPayloadType, encoding_name ? encoding_name : "H264");
+		fSDPVideoCodec = *video_codec;
 		//char const* auxSDPLine = "";
 
 		char const* const sdpFmt = "m=%s %u RTP/AVP %u\r\n"
@@ -126,7 +139,6 @@ void BasicRTSPOnlySubsession::setSDPLines() {
 				trackId()); // a=control:<track-id>
 
 		fSDPLines = sdpLines;
-		free(rtpmapLine);
 	}
 	//AStream
 	if (avType == audio || avType == av) {
@@ -50,6 +50,7 @@
 
 #include "rtsp/rtsp_utils.h"
 #include "audio/types.h"
+#include "types.h"
 #include "module.h"
 #include "control_socket.h"
 
@@ -93,12 +94,14 @@ public:
     createNew(UsageEnvironment& env,
         Boolean reuseFirstSource,
         struct module *mod,
-        rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio);
+        rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio,
+        const rtsp_video_codec_t *video_codec);
 
 protected:
 
     BasicRTSPOnlySubsession(UsageEnvironment& env, Boolean reuseFirstSource,
-        struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio);
+        struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio,
+        const rtsp_video_codec_t *video_codec);
 
     virtual ~BasicRTSPOnlySubsession();
 
@@ -148,6 +151,8 @@ private:
     int audio_bps;
     int rtp_port; //server rtp port
     int rtp_port_audio; //server rtp port
+    const rtsp_video_codec_t *video_codec; ///< current video codec (set by the sender)
+    codec_t fSDPVideoCodec;     ///< video codec fSDPLines were generated for
 };
 
 
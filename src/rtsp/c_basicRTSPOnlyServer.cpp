@@ -46,7 +46,7 @@
 
 int c_start_server(rtsp_serv_t* server){
     int ret;
-    BasicRTSPOnlyServer *srv = BasicRTSPOnlyServer::initInstance(server->port, server->mod, server->avType, server->audio_codec, server->audio_sample_rate, server->audio_channels, server->audio_bps, server->rtp_port, server->rtp_port_audio);
+    BasicRTSPOnlyServer *srv = BasicRTSPOnlyServer::initInstance(server->port, server->mod, server->avType, server->audio_codec, server->audio_sample_rate, server->audio_channels, server->audio_bps, server->rtp_port, server->rtp_port_audio, &server->video_codec);
     srv->init_server();
     ret = pthread_create(&server->server_th, NULL, BasicRTSPOnlyServer::start_server, &server->watch);
     if (ret == 0){
@@ -58,7 +58,7 @@ int c_start_server(rtsp_serv_t* server){
 }
 
 rtsp_serv_t *init_rtsp_server(unsigned int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio){
-    rtsp_serv_t *server = (rtsp_serv_t*) malloc(sizeof(rtsp_serv_t));
+    rtsp_serv_t *server = new rtsp_serv_t(); // not malloc - contains std::atomic
     server->port = port;
     server->mod = mod;
     server->watch = 0;
@@ -70,6 +70,7 @@ rtsp_serv_t *init_rtsp_server(unsigned int port, struct module *mod, rtps_types_
     server->audio_bps = audio_bps;
     server->rtp_port = rtp_port;
     server->rtp_port_audio = rtp_port_audio;
+    server->video_codec = H264;
     return server;
 }
 
@@ -80,3 +81,7 @@ void c_stop_server(rtsp_serv_t* server){
     }
 }
 
+void c_destroy_server(rtsp_serv_t* server){
+    delete server;
+}
+
@@ -57,6 +57,7 @@
 #include "debug.h"
 #include "rtsp/rtsp_utils.h"
 #include "audio/types.h"
+#include "types.h"
 
 
 #ifdef __cplusplus
@@ -78,12 +79,15 @@ EXTERNC typedef struct rtsp_serv {
     int audio_bps;
     int rtp_port;  //server rtp port
     int rtp_port_audio;
+    rtsp_video_codec_t video_codec; ///< codec announced in SDP, updated by the sender thread, read by the live555 thread
 } rtsp_serv_t;
 
 EXTERNC int c_start_server(rtsp_serv_t* server);
 
 EXTERNC void c_stop_server(rtsp_serv_t* server);
 
+EXTERNC void c_destroy_server(rtsp_serv_t* server);
+
 EXTERNC rtsp_serv_t* init_rtsp_server(unsigned int port, struct module *mod, rtps_types_t avType, audio_codec_t audio_codec, int audio_sample_rate, int audio_channels, int audio_bps, int rtp_port, int rtp_port_audio);
 
 #undef EXTERNC
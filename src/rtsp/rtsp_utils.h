@@ -1,6 +1,14 @@
 #ifndef _RTSP_TYPES_HH
 #define _RTSP_TYPES_HH
 
+#ifdef __cplusplus
+#include <atomic>
+#else
+#include <stdatomic.h>
+#endif
+
+#include "types.h"
+
 typedef enum {
     none,
     av,
@@ -9,6 +17,13 @@ typedef enum {
     NUM_RTSP_FORMATS
 }rtps_types_t;
 
+/// video codec shared between the sender (writer) and the RTSP server thread (reader)
+#ifdef __cplusplus
+typedef std::atomic<codec_t> rtsp_video_codec_t;
+#else
+typedef _Atomic(codec_t) rtsp_video_codec_t;
+#endif
+
 #ifdef __cplusplus
 #define EXTERNC extern "C"
 #else
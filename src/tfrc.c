@@ -44,6 +44,17 @@
  *
  */
 
+/*
+ * Receiver side of TCP-friendly rate control (loosely following RFC 5348).
+ * The receiver computes the loss event rate and the receive rate and derives
+ * the allowed sending rate from the TCP throughput equation. The rate is then
+ * reported back to the sender (see rtp_send_tfrc_feedback()) that keeps the
+ * most recent report (tfrc_recv_feedback(), tfrc_get_txrate()).
+ *
+ * Feedback is sent only after the sender announces its RTT (RTCP APP "RTT_"),
+ * which also signalizes that the sender performs the congestion control.
+ */
+
 #include "config.h"
 #include "config_unix.h"
 #include "config_win32.h"
@@ -54,307 +65,95 @@
 
 #define TFRC_MAGIC	0xbaef03b7      /* For debugging */
 
-#define MAX_HISTORY		1000
-#define N			8       /* number of intervals */
-#define MAX_DROPOUT		100
-#define RTP_SEQ_MOD        	0x10000
-#define MAX_MISORDER   		100
+#define N			8       /* number of loss intervals */
+#define RTP_SEQ_MOD		0x10000
+#define MAX_DROPOUT		3000    /* larger gaps in sequence numbers are considered as a restart */
+#define DEFAULT_RTT_US		100000  /* used until the sender tells us the RTT */
+#define MIN_FEEDBACK_INTERVAL	(100 * 1000 * 1000LL) /* [ns] do not send feedback more often */
+#define NOFEEDBACK_TIMEOUT	(2 * NS_IN_SEC) /* sender halves the rate if no feedback arrives */
+#define FEEDBACK_EXPIRY		(3 * NOFEEDBACK_TIMEOUT) /* receiver no longer reporting is not rate limiting */
+#define MIN_RATE		1000000.0 /* [bps] */
 
 /*
- * The state of this TFRC connection, stored in a struct that is passed to 
- * all TFRC routines so we can have multiple connections active at once. 
+ * The state of this TFRC connection, stored in a struct that is passed to
+ * all TFRC routines so we can have multiple connections active at once.
  * See tfrc_init() for initialisation.
- *
  */
 struct tfrc {
+        uint32_t magic;         /* For debugging */
+
+        /* receiver side */
+        uint32_t RTT;           /* [us] received from sender in app packet */
+        int seq_init;
+        uint16_t last_seq;      /* highest sequence number seen so far */
+        int cur_interval;       /* packets since the start of the last loss event */
+        int intervals[N];       /* closed loss intervals, the most recent first */
+        int interval_count;
+        time_ns_t loss_event_time; /* start of the last loss event, 0 if none yet */
+        double s;               /* average packet size */
+        long long bytes_recv;   /* since the last feedback */
+        time_ns_t last_feedback;
+        time_ns_t feedback_timer; /* indicates points in time when feedback should be sent */
+
+        /* sender side */
+        double txrate;          /* [bps] last reported rate, 0 if none */
+        time_ns_t txrate_time;  /* last report or no-feedback rate decrease */
+        time_ns_t last_report;
+
+        /* statistics */
         int total_pckts;
+        int lost_pckts;
         int ooo;
-        int cycles;             /* number of times seq number cycles 65535 */
-        uint32_t RTT;           /* received from sender in app packet */
-        time_ns_t feedback_timer;  /* indicates points in time when p should be computed */
-        double p, p_prev;
-        int s;
-        time_ns_t start_time;
-        int loss_count;
-        int interval_count;
-        int gap[20];
-        int jj;                 /* index for arrival -1<=i<=MAX_HISTORY */
-        int ii;                 /* index for loss    -1<=ii<=10 */
-        double W_tot;
-        double weight[N + 5];   /* Weights for loss event calculation. In the RFC, the numbering is the other way around */
-        uint32_t magic;         /* For debugging */
 };
 
+static const double weight[N] = { 1.0, 1.0, 1.0, 1.0, 0.8, 0.6, 0.4, 0.2 };
+
 static void validate_tfrc_state(struct tfrc *state)
 {
         /* Debugging routine. Called each time we enter TFRC code, */
         /* to ensure that the state information we've been given   */
         /* is valid.                                               */
         assert(state->magic == TFRC_MAGIC);
-#ifdef DEBUG
-        /* ...do some fancy debugging... */
-#endif
-}
-
-static struct {
-        uint32_t seq;
-        uint32_t ts;
-} arrival[MAX_HISTORY];
-
-static struct {
-        uint32_t seq;
-        uint32_t ts;
-} loss[MAX_HISTORY];
-
-#ifdef NDEF
-static double transfer_rate(double p)
-{
-        double t, t1, t2, t3, t4, rtt, tRTO;
-        if (p == 0) {
-                return 0;
-        }
-
-        /* convert RTT from usec to sec */
-        rtt = ((double)RTT) / 1000000.0;
-        tRTO = 4 * rtt;
-
-        t1 = rtt * sqrt(2 * p / 3);
-        t2 = (1 + 32 * p * p);
-        t3 = 3 * sqrt(3 * p / 8);
-        t4 = t1 + tRTO * t3 * p * t2;
-        t = ((double)s) / t4;
-
-        return (t);
-}
-
-static void compute_transfer_rate(void)
-{
-        double t1;
-        time_ns_t now;
-
-        t1 = transfer_rate(p);
-        now = get_time_in_ns()
-}
-#endif
-
-static int set_zero(int first, int last, uint16_t u)
-{
-        int i, count = 0;;
-
-        assert((first >= 0) && (first < MAX_HISTORY));
-        assert((last >= 0) && (last < MAX_HISTORY));
-
-        if (first == last)
-                return (0);
-        if ((first + 1) % MAX_HISTORY == last)
-                return (1);
-
-        if (first < last) {
-                for (i = first + 1; i < last; i++) {
-                        arrival[i].seq = 0;
-                        arrival[i].ts = 0;
-                        count++;
-                }
-        } else {
-                for (i = first + 1; i < MAX_HISTORY; i++) {
-                        arrival[i].seq = 0;
-                        arrival[i].ts = 0;
-                        count++;
-                }
-                for (i = 0; i < last; i++) {
-                        arrival[i].seq = 0;
-                        arrival[i].ts = 0;
-                        count++;
-                }
-        }
-        assert(count == (u - 1));
-        return (count);
-}
-
-static int arrived(int first, int last)
-{
-        int i, count = 0;
-
-        assert((first >= 0) && (first < MAX_HISTORY));
-        assert((last >= 0) && (last < MAX_HISTORY));
-
-        if (first == last)
-                return (0);
-        if ((first + 1) % MAX_HISTORY == last)
-                return (0);
-
-        if (first < last) {
-                for (i = first; i <= last; i++) {
-                        if (arrival[i].seq != 0)
-                                count++;
-                }
-        } else {
-                for (i = first; i < MAX_HISTORY; i++) {
-                        if (arrival[i].seq != 0)
-                                count++;
-                }
-                for (i = 0; i <= last; i++) {
-                        if (arrival[i].seq != 0)
-                                count++;
-                }
-        }
-        return (count);
 }
 
-static void
-record_loss(struct tfrc *state, uint32_t s1, uint32_t s2, uint32_t ts1,
-            uint32_t ts2)
+static void record_loss(struct tfrc *state, time_ns_t curr_time)
 {
-        /* Mark all packets between s1 (which arrived at time ts1) and */
-        /* s2 (which arrived at time ts2) as lost.                     */
-        int i;
-        uint32_t est;
-        uint32_t seq = s1 + 1;
-
-        est = ts1 + (ts2 - ts1) * ((seq - s1) / (s2 - seq));
-
-        state->loss_count++;
-        if (state->ii <= -1) {
-                /* first loss! */
-                state->ii++;
-                loss[state->ii].seq = seq;
-                loss[state->ii].ts = est;
+        /* Losses within one RTT from the start of a loss event belong to */
+        /* that event, otherwise a new loss interval begins.              */
+        long long rtt_ns = (state->RTT > 0 ? state->RTT : DEFAULT_RTT_US) * 1000LL;
+        if (state->loss_event_time != 0 && curr_time - state->loss_event_time <= rtt_ns) {
                 return;
         }
-
-        if (est - loss[state->ii].ts <= state->RTT) {   /* not a new event */
-                return;
-        }
-
-        state->interval_count++;
-        if (state->ii > (N + 1)) {
-                printf("how did this happen?\n");
-        }
-
-        if (state->ii >= (N + 1)) {     /* shift */
-                for (i = 0; i < (N + 1); i++) {
-                        loss[i].seq = loss[i + 1].seq;
-                        loss[i].ts = loss[i + 1].ts;
-                }
-                state->ii = N;
-        }
-
-        state->ii++;
-        loss[state->ii].seq = seq;
-        loss[state->ii].ts = est;
+        memmove(state->intervals + 1, state->intervals, (N - 1) * sizeof state->intervals[0]);
+        state->intervals[0] = state->cur_interval;
+        state->interval_count = MIN(state->interval_count + 1, N);
+        state->cur_interval = 0;
+        state->loss_event_time = curr_time;
 }
 
-static void
-save_arrival(struct tfrc *state, time_ns_t curr_time, uint16_t seq)
+/* Loss event rate - inverse of the weighted average of loss intervals. */
+static double compute_loss_event_rate(struct tfrc *state)
 {
-        int kk, inc, last_jj;
-        uint16_t udelta;
-        uint32_t now;
-        uint32_t ext_seq;
-        static uint16_t last_seq;
-        static uint32_t ext_last_ack;
-        static int last_ack_jj = 0;
-
-        curr_time = get_time_in_ns();
-        now = (curr_time - state->start_time) / 1000;
-
-        if (state->jj == -1) {
-                /* first packet arrival */
-                state->jj = 0;
-                last_seq = seq;
-                ext_last_ack = seq;
-                last_ack_jj = 0;
-                arrival[state->jj].seq = seq;
-                arrival[state->jj].ts = now;
-                return;
+        if (state->interval_count == 0) {
+                return 0.0;
         }
-
-        udelta = seq - last_seq;
-
-        state->total_pckts++;
-        if (udelta < MAX_DROPOUT) {
-                /* in order, with permissible gap */
-                if (seq < last_seq) {
-                        state->cycles++;
-                }
-                /* record arrival */
-                last_jj = state->jj;
-                state->jj = (state->jj + udelta) % MAX_HISTORY;
-                set_zero(last_jj, state->jj, udelta);
-                ext_seq = seq + state->cycles * RTP_SEQ_MOD;
-                last_seq = seq;
-                arrival[state->jj].seq = ext_seq;
-                arrival[state->jj].ts = now;
-                if (udelta < 10)
-                        state->gap[udelta - 1]++;
-
-                if ((ext_seq - ext_last_ack) == 1) {
-                        /* We got two consecutive packets, no loss */
-                        ext_last_ack = ext_seq;
-                        last_ack_jj = state->jj;
-                } else {
-                        /* Sequence number jumped, we've missed a packet for some reason */
-                        if (arrived(last_ack_jj, state->jj) >= 4) {
-                                record_loss(state, ext_last_ack, ext_seq,
-                                            arrival[last_ack_jj].ts, now);
-                                ext_last_ack = ext_seq;
-                                last_ack_jj = state->jj;
-                        }
-                }
-        } else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
-                printf(" -- seq:%u last seq:%u  ", seq, arrival[state->jj].seq);
-                abort();        /* FIXME */
-        } else {
-                /* duplicate or reordered packet */
-                ext_seq = seq + state->cycles * RTP_SEQ_MOD;
-                state->ooo++;
-                if (ext_seq > ext_last_ack) {
-                        inc = ext_seq - arrival[state->jj].seq;
-
-                        kk = (state->jj + inc) % MAX_HISTORY;
-                        if (arrival[kk].seq == 0) {
-                                arrival[kk].seq = ext_seq;
-                                arrival[kk].ts = (arrival[last_ack_jj].ts + now) / 2;   /* NOT the best interpolation */
-                        }
-                        while (arrival[last_ack_jj + 1].seq != 0
-                               && last_ack_jj < state->jj) {
-                                last_ack_jj = (last_ack_jj + 1) % MAX_HISTORY;
-                        }
-                        ext_last_ack = arrival[last_ack_jj].seq;
+        double I_tot0 = 0.0, I_tot1 = state->cur_interval * weight[0], W_tot = 0.0;
+        for (int i = 0; i < state->interval_count; i++) {
+                I_tot0 += state->intervals[i] * weight[i];
+                if (i + 1 < state->interval_count) {
+                        I_tot1 += state->intervals[i] * weight[i + 1];
                 }
+                W_tot += weight[i];
         }
+        double I_mean = MAX(I_tot0, I_tot1) / W_tot;
+        return I_mean > 0.0 ? 1.0 / I_mean : 1.0;
 }
 
-static double compute_loss_event(struct tfrc *state)
+/* TCP throughput equation (RFC 5348, section 3.1), returns bytes/s */
+static double transfer_rate(double s, double R, double p)
 {
-        int i;
-        uint32_t t __attribute__((unused));
-        uint32_t temp, I_tot0 = 0, I_tot1 = 0, I_tot = 0;
-        double I_mean, p;
-
-        if (state->ii < N) {
-                return 0;
-        }
-
-        for (i = state->ii - N; i < state->ii; i++) {
-                temp = loss[i + 1].seq - loss[i].seq;
-                I_tot0 = I_tot0 + temp * state->weight[i];
-                if (i >= (state->ii - N + 1)) {
-                        I_tot1 = I_tot1 + temp * state->weight[i - 1];
-                }
-        }
-        I_tot1 =
-            I_tot1 + (arrival[state->jj].seq -
-                      loss[state->ii].seq) * state->weight[N - 1];
-
-        I_tot = (I_tot1 > I_tot0) ? I_tot1 : I_tot0;
-        I_mean = I_tot / state->W_tot;
-        p = 1 / I_mean;
-
-        t = (get_time_in_ns() - state->start_time) / 1000;
-
-        return p;
-
+        double t_RTO = 4 * R;
+        return s / (R * sqrt(2 * p / 3) + t_RTO * (3 * sqrt(3 * p / 8) * p * (1 + 32 * p * p)));
 }
 
 /*
@@ -364,70 +163,25 @@ static double compute_loss_event(struct tfrc *state)
 
 struct tfrc *tfrc_init(time_ns_t curr_time)
 {
-        struct tfrc *state;
-        int i;
-
-        state = (struct tfrc *)malloc(sizeof(struct tfrc));
+        struct tfrc *state = (struct tfrc *) calloc(1, sizeof(struct tfrc));
         if (state != NULL) {
                 state->magic = TFRC_MAGIC;
-                state->total_pckts = 0;
-                state->ooo = 0;
-                state->cycles = 0;
-                state->RTT = 0;
+                state->last_feedback = curr_time;
                 state->feedback_timer = curr_time;
-                state->p = 0.0;
-                state->p_prev = 0.0;
-                state->s = 0;
-                state->start_time = curr_time;
-                state->loss_count = 0;
-                state->interval_count = 0;
-                state->jj = -1;
-                state->ii = -1;
-                state->W_tot = 0;
-                state->weight[0] = 0.2;
-                state->weight[1] = 0.4;
-                state->weight[2] = 0.6;
-                state->weight[3] = 0.8;
-                state->weight[4] = 1.0;
-                state->weight[5] = 1.0;
-                state->weight[6] = 1.0;
-                state->weight[7] = 1.0;
-                state->weight[8] = 1.0;
-
-                for (i = 0; i < 20; i++) {
-                        state->gap[i] = 0;
-                }
-
-                for (i = 0; i < N; i++) {
-                        state->W_tot = state->W_tot + state->weight[i];
-                }
-        }
-
-        for (i = 0; i < MAX_HISTORY; i++) {
-                arrival[i].seq = 0;
-                arrival[i].ts = 0;
-                loss[i].seq = 0;
-                loss[i].ts = 0;
         }
         return state;
 }
 
 void tfrc_done(struct tfrc *state)
 {
-        int i;
-
+        if (state == NULL) {
+                return;
+        }
         validate_tfrc_state(state);
 
-        if (log_level >= LOG_LEVEL_DEBUG) {
-                for (i = 0; i < 10; i++) {
-                        printf("\n%2d %8d", i, state->gap[i]);
-                }
-                printf("\n");
-                printf("\nLost:       %8d", state->loss_count);
-                printf("\nIntervals:  %8d", state->interval_count);
-                printf("\nTotal:      %8d", state->total_pckts);
-                printf("\nooo:        %8d -- %7.5f\n\n", state->ooo,
-                                (state->ooo * 100) / (double)state->total_pckts);
+        if (state->total_pckts > 0) {
+                debug_msg("TFRC: total %d packets, lost %d, out-of-order %d, loss intervals %d\n",
+                                state->total_pckts, state->lost_pckts, state->ooo, state->interval_count);
         }
         free(state);
 }
@@ -441,20 +195,34 @@ tfrc_recv_data(struct tfrc *state, time_ns_t curr_time, uint16_t seqnum,
 
         validate_tfrc_state(state);
 
-        if (state->RTT > 0) {
-                save_arrival(state, curr_time, seqnum);
-                state->p_prev = state->p;
-#ifdef NDEF
-                state->p = compute_loss_event(state);
-                if (state->p - state->p_prev > 0.00000000001) {
-                        gettimeofday(&(state->feedback_timer), NULL);
-                        tv_add(&(state->feedback_timer),
-                               (unsigned int)state->RTT);
-                        compute_transfer_rate();
-                }
-#endif
+        state->total_pckts++;
+        state->bytes_recv += length;
+        state->s = state->s == 0.0 ? length : 0.9 * state->s + 0.1 * length;
+
+        if (!state->seq_init) {
+                state->seq_init = TRUE;
+                state->last_seq = seqnum;
+                state->cur_interval = 1;
+                return;
         }
-        state->s = length;      /* packet size is needed transfer_rate */
+
+        uint16_t udelta = seqnum - state->last_seq;
+        if (udelta == 0 || udelta >= RTP_SEQ_MOD / 2) {
+                /* duplicate or reordered packet (already accounted as lost) */
+                state->ooo++;
+                return;
+        }
+        if (udelta > MAX_DROPOUT) {
+                /* sender probably restarted */
+                state->last_seq = seqnum;
+                return;
+        }
+        if (udelta > 1) {
+                state->lost_pckts += udelta - 1;
+                record_loss(state, curr_time);
+        }
+        state->cur_interval += udelta;
+        state->last_seq = seqnum;
 }
 
 void tfrc_recv_rtt(struct tfrc *state, time_ns_t curr_time, uint32_t rtt)
@@ -466,9 +234,11 @@ void tfrc_recv_rtt(struct tfrc *state, time_ns_t curr_time, uint32_t rtt)
         validate_tfrc_state(state);
 
         if (state->RTT == 0) {
-                state->feedback_timer = curr_time + rtt * NS_IN_SEC;
+                state->last_feedback = curr_time;
+                state->bytes_recv = 0;
+                state->feedback_timer = curr_time + MAX(rtt * 1000LL, MIN_FEEDBACK_INTERVAL);
         }
-        state->RTT = rtt;
+        state->RTT = MAX(rtt, 1);
 }
 
 int tfrc_feedback_is_due(struct tfrc *state, time_ns_t curr_time)
@@ -476,7 +246,7 @@ int tfrc_feedback_is_due(struct tfrc *state, time_ns_t curr_time)
         /* Determine if it is time to send feedback to the sender */
         validate_tfrc_state(state);
 
-        if ((state->RTT == 0) || state->feedback_timer > curr_time) {
+        if (state->RTT == 0 || state->bytes_recv == 0 || state->feedback_timer > curr_time) {
                 /* Not yet time to send feedback to the sender... */
                 return FALSE;
         }
@@ -492,11 +262,45 @@ double tfrc_feedback_txrate(struct tfrc *state, time_ns_t curr_time)
 
         assert(tfrc_feedback_is_due(state, curr_time));
 
-        state->feedback_timer = curr_time + state->RTT * NS_IN_SEC;
-        state->p = compute_loss_event(state);
-        //compute_transfer_rate ();
-        if (state->ii >= N) {
-                abort();        /* FIXME */
+        double R = state->RTT / (double) US_IN_SEC;
+        double X_recv = state->bytes_recv / ((curr_time - state->last_feedback) / NS_IN_SEC_DBL);
+        double p = compute_loss_event_rate(state);
+        double X = 2 * X_recv;
+        if (p > 0.0) {
+                X = MIN(X, transfer_rate(state->s, R, p));
+        }
+        debug_msg("TFRC: p=%f X_recv=%f bps X=%f bps\n", p, X_recv * 8, X * 8);
+
+        state->bytes_recv = 0;
+        state->last_feedback = curr_time;
+        state->feedback_timer = curr_time + MAX(state->RTT * 1000LL, MIN_FEEDBACK_INTERVAL);
+        return MAX(X * 8, MIN_RATE);
+}
+
+void tfrc_recv_feedback(struct tfrc *state, time_ns_t curr_time, double txrate)
+{
+        validate_tfrc_state(state);
+
+        state->txrate = MAX(txrate, MIN_RATE);
+        state->txrate_time = state->last_report = curr_time;
+}
+
+double tfrc_get_txrate(struct tfrc *state, time_ns_t curr_time)
+{
+        validate_tfrc_state(state);
+
+        if (state->txrate == 0.0) {
+                return 0.0;
+        }
+        if (curr_time - state->last_report > FEEDBACK_EXPIRY) {
+                /* the receiver is gone or does not perform congestion control anymore */
+                state->txrate = 0.0;
+                return 0.0;
+        }
+        if (curr_time - state->txrate_time > NOFEEDBACK_TIMEOUT) {
+                /* no feedback - the path may be congested */
+                state->txrate = MAX(state->txrate / 2, MIN_RATE);
+                state->txrate_time = curr_time;
         }
-        return 0.0;             /* FIXME */
+        return state->txrate;
 }
@@ -54,11 +54,16 @@ struct tfrc;
 struct tfrc *tfrc_init(time_ns_t curr_time);
 void         tfrc_done(struct tfrc *state);
 
+/* receiver */
 void         tfrc_recv_data      (struct tfrc *state, time_ns_t curr_time, uint16_t seqnum, unsigned length);
 void         tfrc_recv_rtt       (struct tfrc *state, time_ns_t curr_time, uint32_t rtt);
 double       tfrc_feedback_txrate(struct tfrc *state, time_ns_t curr_time);
 int          tfrc_feedback_is_due(struct tfrc *state, time_ns_t curr_time);
 
+/* sender */
+void         tfrc_recv_feedback  (struct tfrc *state, time_ns_t curr_time, double txrate);
+double       tfrc_get_txrate     (struct tfrc *state, time_ns_t curr_time);
+
 #ifdef __cplusplus
 }
 #endif
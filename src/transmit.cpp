@@ -79,14 +79,16 @@
 #include "tv.h"
 #include "transmit.h"
 #include "utils/jpeg_reader.h"
+#include "utils/latency_trace.h"
+#include "utils/metrics.h"
 #include "utils/misc.h" // unit_evaluate
 #include "video.h"
 #include "video_codec.h"
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <iostream>
-#include <vector>
 
 #define TRANSMIT_MAGIC	0xe80ab15f
 
@@ -109,7 +111,6 @@
 #define DEFAULT_CIPHER_MODE MODE_AES128_CFB
 
 using std::array;
-using std::vector;
 
 static void tx_update(struct tx *tx, struct video_frame *frame, int substream);
 static void tx_done(struct module *tx);
@@ -131,6 +132,24 @@ struct rate_limit_dyn {
         static constexpr int EXCESS_GAP = 4; ///< minimal gap between excessive frames
 };
 
+/// descriptor of one video packet, the payload is referenced directly in the tile
+struct tx_packet {
+        char *data;
+        int data_len;
+};
+
+/**
+ * Packet descriptors and payload headers of the currently sent tile. Reused
+ * among frames and only grows, so that there is no allocation per frame.
+ */
+struct tx_packet_arena {
+        struct tx_packet *packets;
+        int count;
+        int packets_max;
+        uint32_t *hdrs; ///< payload headers, one per packet
+        int hdr_words_max;
+};
+
 struct tx {
         struct module mod;
 
@@ -156,6 +175,14 @@ struct tx {
         struct openssl_encrypt *encryption;
         long long int bitrate;
         struct rate_limit_dyn dyn_rate_limit_state;
+        std::atomic<long long> cc_rate; ///< rate allowed by congestion control, 0 if none
+
+        struct latency_trace *latency_trace; ///< NULL if not tracing
+        struct metric *sent_packets;
+        struct metric *sent_bytes;
+
+        struct tx_packet_arena arena;
+        char *encrypted_data; ///< payload of one encrypted packet, NULL if encryption not used
 		
         char tmp_packet[RTP_MAX_MTU];
 };
@@ -227,6 +254,17 @@ struct tx *tx_init(struct module *parent, unsigned mtu, enum tx_media_type media
         tx->avg_len = tx->avg_len_last = tx->sent_frames = 0u;
         tx->fec_scheme = FEC_NONE;
         tx->last_frame_fragment_id = -1;
+        if (media_type == TX_MEDIA_VIDEO) {
+                tx->sent_packets = metric_register("tx_video_packets_total", "Sent video RTP packets", METRIC_COUNTER);
+                tx->sent_bytes = metric_register("tx_video_bytes_total", "Sent video payload bytes", METRIC_COUNTER);
+        } else {
+                tx->sent_packets = metric_register("tx_audio_packets_total", "Sent audio RTP packets", METRIC_COUNTER);
+                tx->sent_bytes = metric_register("tx_audio_bytes_total", "Sent audio payload bytes", METRIC_COUNTER);
+        }
+        if (media_type == TX_MEDIA_VIDEO && latency_trace_enabled()) {
+                const char *intervals[] = { "filter", "compress_queue", "compress", "send_queue", "send" };
+                tx->latency_trace = latency_trace_init(&tx->mod, "TX", sizeof intervals / sizeof intervals[0], intervals);
+        }
         if (fec) {
                 if(!set_fec(tx, fec)) {
                         module_done(&tx->mod);
@@ -247,6 +285,7 @@ struct tx *tx_init(struct module *parent, unsigned mtu, enum tx_media_type media
                         module_done(&tx->mod);
                         return NULL;
                 }
+                tx->encrypted_data = (char *) malloc(RTP_MAX_MTU + MAX_CRYPTO_EXCEED);
         }
 
         tx->bitrate = bitrate;
@@ -363,9 +402,36 @@ static void tx_done(struct module *mod)
 {
         struct tx *tx = (struct tx *) mod->priv_data;
         assert(tx->magic == TRANSMIT_MAGIC);
+        if (tx->latency_trace) {
+                latency_trace_destroy(tx->latency_trace);
+        }
+        free(tx->arena.packets);
+        free(tx->arena.hdrs);
+        free(tx->encrypted_data);
         free(tx);
 }
 
+static void tx_trace_start(struct tx *tx, struct video_frame *frame)
+{
+        if (tx->latency_trace) {
+                frame->trace_ns[TRACE_PACKETIZE] = get_time_in_ns();
+        }
+}
+
+static void tx_trace_done(struct tx *tx, struct video_frame *frame)
+{
+        if (!tx->latency_trace) {
+                return;
+        }
+        time_ns_t stages[TRACE_STAGE_COUNT];
+        for (int i = 0; i < TRACE_STAGE_COUNT; ++i) {
+                stages[i] = frame->trace_ns[i];
+        }
+        latency_trace_record_stages(tx->latency_trace, 0, stages, TRACE_STAGE_COUNT);
+        latency_trace_record(tx->latency_trace, TRACE_STAGE_COUNT - 1, get_time_in_ns() - frame->trace_ns[TRACE_PACKETIZE]);
+        latency_trace_report(tx->latency_trace);
+}
+
 /*
  * sends one or more frames (tiles) with same TS in one RTP stream. Only one m-bit is set.
  */
@@ -388,6 +454,7 @@ tx_send(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session)
                 tx->last_ts = ts;
         }
 
+        tx_trace_start(tx, frame);
         for(i = 0; i < frame->tile_count; ++i)
         {
                 int last = FALSE;
@@ -403,7 +470,10 @@ tx_send(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session)
                 tx_send_base(tx, frame, rtp_session, ts, last,
                                 i, fragment_offset);
         }
-        tx->buffer++;
+        tx_trace_done(tx, frame);
+        if (!frame->fragment || frame->last_fragment) { // fragments of a frame share the buffer ID
+                tx->buffer++;
+        }
 }
 
 void format_video_header(struct video_frame *frame, int tile_idx, int buffer_idx, uint32_t *video_hdr)
@@ -462,9 +532,13 @@ tx_send_tile(struct tx *tx, struct video_frame *frame, int pos, struct rtp *rtp_
                 last = TRUE;
         if(frame->fragment)
                 fragment_offset = vf_get_tile(frame, pos)->offset;
+        tx_trace_start(tx, frame);
         tx_send_base(tx, frame, rtp_session, ts, last, pos,
                         fragment_offset);
-        tx->buffer ++;
+        tx_trace_done(tx, frame);
+        if (!frame->fragment || frame->last_fragment) {
+                tx->buffer++;
+        }
 }
 
 static uint32_t format_interl_fps_hdr_row(enum interlacing_t interlacing, double input_fps)
@@ -535,10 +609,28 @@ static inline void check_symbol_size(int fec_symbol_size, int payload_len)
         status_printed = true;
 }
 
-/// @param mtu is tx->mtu - hdrs_len
-static vector<int> get_packet_sizes(struct video_frame *frame, int substream, int mtu) {
+static void tx_packet_arena_push(struct tx_packet_arena *a, char *data, int data_len)
+{
+        if (a->count == a->packets_max) {
+                a->packets_max = std::max(2 * a->packets_max, 64);
+                a->packets = (struct tx_packet *) realloc(a->packets, a->packets_max * sizeof a->packets[0]);
+        }
+        a->packets[a->count].data = data;
+        a->packets[a->count].data_len = data_len;
+        a->count += 1;
+}
+
+/**
+ * Splits the tile to packets and fills their payload headers from the template.
+ *
+ * @param mtu is tx->mtu - hdrs_len
+ * @param hdr payload header template, offset (word 1) is filled per packet
+ */
+static void tx_packets_prepare(struct tx_packet_arena *a, struct video_frame *frame, int substream, int mtu,
+                int fragment_offset, const uint32_t *hdr, int hdr_len)
+{
         unsigned int fec_symbol_size = frame->fec_params.symbol_size;
-        vector<int> ret;
+        struct tile *tile = &frame->tiles[substream];
 
         if (frame->fec_params.type != FEC_NONE) {
                 check_symbol_size(fec_symbol_size, mtu);
@@ -547,25 +639,52 @@ static vector<int> get_packet_sizes(struct video_frame *frame, int substream, in
         int fec_symbol_offset = 0;
         int pf_block_size = is_codec_opaque(frame->color_spec) ? 1 : PIX_BLOCK_LCM / get_pf_block_pixels(frame->color_spec) * get_pf_block_bytes(frame->color_spec);
         unsigned pos = 0;
-        do {
+        a->count = 0;
+        while (pos < tile->data_len) {
                 int len = get_video_pkt_len(frame->fec_params.type != FEC_NONE, mtu,
                                         fec_symbol_size, &fec_symbol_offset, pf_block_size);
+                len = std::min<unsigned>(len, tile->data_len - pos);
+                tx_packet_arena_push(a, tile->data + pos, len);
                 pos += len;
-                ret.push_back(len);
-        } while (pos < frame->tiles[substream].data_len);
-        return ret;
+        }
+
+        int hdr_words = hdr_len / sizeof(uint32_t);
+        if (a->count * hdr_words > a->hdr_words_max) {
+                a->hdr_words_max = a->packets_max * hdr_words;
+                a->hdrs = (uint32_t *) realloc(a->hdrs, a->hdr_words_max * sizeof(uint32_t));
+        }
+        for (int i = 0; i < a->count; ++i) {
+                uint32_t *pkt_hdr = a->hdrs + i * hdr_words;
+                memcpy(pkt_hdr, hdr, hdr_len);
+                pkt_hdr[1] = htonl(a->packets[i].data - tile->data + fragment_offset);
+        }
 }
 
 /**
- * Returns inter-packet interval in nanoseconds.
+ * Returns length of the whole tile. For fragmented uncompressed frames, the
+ * fragment (tile::data_len) is only a part of it.
+ */
+static unsigned int get_tile_len(struct video_frame *frame, int substream)
+{
+        struct tile *tile = &frame->tiles[substream];
+        if (!frame->fragment || is_codec_opaque(frame->color_spec)) {
+                return tile->data_len;
+        }
+        return vc_get_datalen(tile->width, tile->height, frame->color_spec);
+}
+
+/**
+ * Returns inter-packet interval in nanoseconds according to the requested bitrate.
  */
 static long
-get_packet_rate(struct tx *tx, struct video_frame *frame, int substream, long packet_count)
+get_requested_packet_rate(struct tx *tx, struct video_frame *frame, int substream, long packet_count)
 {
         if (tx->bitrate == RATE_UNLIMITED) {
                 return 0;
         }
         double time_for_frame = 1.0 / frame->fps / frame->tile_count;
+        // fragment (stripe) should be sent within its share of the frame time
+        time_for_frame = time_for_frame * frame->tiles[substream].data_len / get_tile_len(frame, substream);
         double interval_between_pkts = time_for_frame / tx->mult_count / packet_count;
         // use only 75% of the time - we less likely overshot the frame time and
         // can minimize risk of swapping packets between 2 frames (out-of-order ones)
@@ -597,6 +716,27 @@ get_packet_rate(struct tx *tx, struct video_frame *frame, int substream, long pa
         return packet_rate;
 }
 
+/**
+ * Returns inter-packet interval in nanoseconds, the requested rate is further
+ * capped by the congestion control (if active).
+ */
+static long
+get_packet_rate(struct tx *tx, struct video_frame *frame, int substream, long packet_count)
+{
+        long packet_rate = get_requested_packet_rate(tx, frame, substream, packet_count);
+        long long cc_rate = tx->cc_rate;
+        if (cc_rate > 0) {
+                int avg_packet_size = frame->tiles[substream].data_len / packet_count;
+                packet_rate = std::max<long>(packet_rate, 1000'000'000LL * avg_packet_size * 8 / cc_rate);
+        }
+        return packet_rate;
+}
+
+void tx_set_congestion_rate(struct tx *tx, long long bitrate)
+{
+        tx->cc_rate = bitrate;
+}
+
 static void
 tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                 uint32_t ts, int send_m,
@@ -623,8 +763,6 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
 	LARGE_INTEGER start, stop, freq;
 #endif
         long delta, overslept = 0;
-        array <int, FEC_MAX_MULT> mult_pos{};
-        int mult_index = 0;
 
         int hdrs_len = (rtp_is_ipv6(rtp_session) ? 40 : 20) + 8 + 12; // IP hdr size + UDP hdr size + RTP hdr size
 
@@ -636,6 +774,7 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                 hdrs_len += (sizeof(video_payload_hdr_t));
                 rtp_hdr_len = sizeof(video_payload_hdr_t);
                 format_video_header(frame, substream, tx->buffer, rtp_hdr);
+                rtp_hdr[2] = htonl(get_tile_len(frame, substream)); // whole tile length if fragmented
         } else {
                 hdrs_len += (sizeof(fec_payload_hdr_t));
                 rtp_hdr_len = sizeof(fec_payload_hdr_t);
@@ -657,91 +796,66 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                 rtp_hdr_len += sizeof(crypto_payload_hdr_t);
         }
 
-        vector<int> packet_sizes = get_packet_sizes(frame, substream, tx->mtu - hdrs_len);
-        long packet_count = packet_sizes.size() * (tx->fec_scheme == FEC_MULT ? tx->mult_count : 1);
+        // sender part of the latency trace is passed in every packet - any of them may be lost
+        uint32_t trace_ext[LATENCY_TRACE_RTP_EXT_WORDS];
+        char *extn = nullptr;
+        if (tx->latency_trace) {
+                latency_trace_format_rtp_ext(frame, trace_ext);
+                extn = (char *) trace_ext;
+                hdrs_len += sizeof trace_ext + 4;
+        }
 
-        long packet_rate = get_packet_rate(tx, frame, substream, packet_count);
+        struct tx_packet_arena *arena = &tx->arena;
+        tx_packets_prepare(arena, frame, substream, tx->mtu - hdrs_len, fragment_offset, rtp_hdr, rtp_hdr_len);
+        int mult_count = tx->fec_scheme == FEC_MULT ? tx->mult_count : 1;
+        long packet_count = (long) arena->count * mult_count;
 
-        // initialize header array with values (except offset which is different among
-        // different packts)
-        void *rtp_headers = malloc(packet_count * rtp_hdr_len);
-        uint32_t *rtp_hdr_packet = (uint32_t *) rtp_headers;
-        for (int i = 0; i < packet_count; ++i) {
-                memcpy(rtp_hdr_packet, rtp_hdr, rtp_hdr_len);
-                rtp_hdr_packet += rtp_hdr_len / sizeof(uint32_t);
-        }
-        rtp_hdr_packet = (uint32_t *) rtp_headers;
+        long packet_rate = get_packet_rate(tx, frame, substream, packet_count);
 
         if (!tx->encryption) {
                 rtp_async_start(rtp_session, packet_count);
         }
 
-        int packet_idx = 0;
-        unsigned pos = 0;
-        do {
-                GET_STARTTIME;
-                int m = 0;
-                if(tx->fec_scheme == FEC_MULT) {
-                        pos = mult_pos[mult_index];
-                }
-
-                int offset = pos + fragment_offset;
-
-                rtp_hdr_packet[1] = htonl(offset);
-
-                char *data = tile->data + pos;
-                data_len = packet_sizes.at(packet_idx);
-                if (pos + data_len >= (unsigned int) tile->data_len) {
-                        if (send_m) {
-                                m = 1;
-                        }
-                        data_len = tile->data_len - pos;
-                }
-                pos += data_len;
-                if(data_len) { /* check needed for FEC_MULT */
-                        char encrypted_data[data_len + MAX_CRYPTO_EXCEED];
-
-                        if (tx->encryption) {
+        // the payload goes to the socket directly from the tile, only encrypted one is copied
+        long sent = 0;
+        for (int i = 0; i < arena->count; ++i) {
+                uint32_t *rtp_hdr_packet = arena->hdrs + i * (rtp_hdr_len / sizeof(uint32_t));
+                char *data = arena->packets[i].data;
+                data_len = arena->packets[i].data_len;
+                int m = send_m && i == arena->count - 1;
+                for (int mult_index = 0; mult_index < mult_count; ++mult_index) { // FEC_MULT sends copies in a row
+                        GET_STARTTIME;
+                        if (tx->encryption && mult_index == 0) {
                                 data_len = tx->enc_funcs->encrypt(tx->encryption,
                                                 data, data_len,
                                                 (char *) rtp_hdr_packet,
                                                 frame->fec_params.type != FEC_NONE ? sizeof(fec_payload_hdr_t) :
                                                 sizeof(video_payload_hdr_t),
-                                                encrypted_data);
-                                data = encrypted_data;
+                                                tx->encrypted_data);
+                                data = tx->encrypted_data;
                         }
 
                         rtp_send_data_hdr(rtp_session, ts, pt, m, 0, 0,
                                   (char *) rtp_hdr_packet, rtp_hdr_len,
-                                  data, data_len, 0, 0, 0);
-                }
-
-                if (mult_index + 1 == tx->mult_count) {
-                        ++packet_idx;
-                }
-
-                if(tx->fec_scheme == FEC_MULT) {
-                        mult_pos[mult_index] = pos;
-                        mult_index = (mult_index + 1) % tx->mult_count;
-                }
-
-                rtp_hdr_packet += rtp_hdr_len / sizeof(uint32_t);
+                                  data, data_len, extn, extn ? LATENCY_TRACE_RTP_EXT_WORDS : 0,
+                                  LATENCY_TRACE_RTP_EXT_TYPE);
+                        metric_add(tx->sent_packets, 1);
+                        metric_add(tx->sent_bytes, data_len);
 
-                // TRAFFIC SHAPER
-                if (pos < (unsigned int) tile->data_len) { // wait for all but last packet
-                        do {
-                                GET_STOPTIME;
-                                GET_DELTA;
-                        } while (packet_rate - delta - overslept > 0);
-                        overslept = -(packet_rate - delta - overslept);
-                        //fprintf(stdout, "%ld ", overslept);
+                        // TRAFFIC SHAPER
+                        if (++sent < packet_count) { // wait for all but last packet
+                                do {
+                                        GET_STOPTIME;
+                                        GET_DELTA;
+                                } while (packet_rate - delta - overslept > 0);
+                                overslept = -(packet_rate - delta - overslept);
+                        }
                 }
-        } while (pos < tile->data_len || mult_index != 0); // when multiplying, we need all streams go to the end
+        }
 
         if (!tx->encryption) {
                 rtp_async_wait(rtp_session);
         }
-        free(rtp_headers);
 }
 
 /* 
@@ -877,6 +991,8 @@ void audio_tx_send(struct tx* tx, struct rtp *rtp_session, const audio_frame2 *
                                       (char *) rtp_hdr, rtp_hdr_len,
                                       const_cast<char *>(data), data_len,
                                       0, 0, 0);
+                                metric_add(tx->sent_packets, 1);
+                                metric_add(tx->sent_bytes, data_len);
                         }
 
                         if(tx->fec_scheme == FEC_MULT) {
@@ -987,119 +1103,252 @@ void audio_tx_send_standard(struct tx* tx, struct rtp *rtp_session,
 }
 
 /**
- *  H.264 standard transmission
+ * Returns RTP timestamp for the frame - fragments of one frame share the
+ * timestamp of the first one.
  */
-void tx_send_h264(struct tx *tx, struct video_frame *frame,
-		struct rtp *rtp_session) {
+static uint32_t get_std_fragment_ts(struct tx *tx, struct video_frame *frame)
+{
+        uint32_t ts = get_std_video_local_mediatime();
+        if (frame->fragment &&
+                        tx->last_frame_fragment_id == frame->frame_fragment_id) {
+                ts = tx->last_ts;
+        } else {
+                tx->last_frame_fragment_id = frame->frame_fragment_id;
+                tx->last_ts = ts;
+        }
+        return ts;
+}
+
+#define H265_NAL_HDR_LEN 2
+#define H265_FU 49
+
+/**
+ * Sends Annex B stream of H.264 (RFC 6184) or HEVC (RFC 7798) NAL units.
+ * NAL units not fitting into the packet are sent as FU-A (H.264) or FU (HEVC)
+ * fragmentation units.
+ *
+ * Fragments of a frame (that must consist of complete NAL units) are sent with
+ * the same RTP timestamp and only the last one sets the marker bit.
+ */
+static void tx_send_nal_units(struct tx *tx, struct video_frame *frame,
+                struct rtp *rtp_session, bool hevc)
+{
         assert(frame->tile_count == 1); // std transmit doesn't handle more than one tile
         assert(!frame->fragment || tx->fec_scheme == FEC_NONE); // currently no support for FEC with fragments
         assert(!frame->fragment || frame->tile_count); // multiple tiles are not currently supported for fragmented send
-        uint32_t ts = get_std_video_local_mediatime();
+        uint32_t ts = get_std_fragment_ts(tx, frame);
+        bool last_fragment = !frame->fragment || frame->last_fragment;
         struct tile *tile = &frame->tiles[0];
 
-	char pt =  PT_DynRTP_Type96;
-	unsigned char hdr[2];
-	int cc = 0;
-	uint32_t csrc = 0;
-	int m = 0;
-	char *extn = 0;
-	uint16_t extn_len = 0;
-	uint16_t extn_type = 0;
-	const uint8_t *start = (uint8_t *) tile->data;
-	int data_len = tile->data_len;
-	unsigned maxPacketSize = tx->mtu - 40;
+        char pt = PT_DynRTP_Type96;
+        const unsigned nal_hdr_len = hevc ? H265_NAL_HDR_LEN : 1;
+        const unsigned fu_hdr_len = nal_hdr_len + 1; // payload header + FU header
+        unsigned char hdr[3];
+        int cc = 0;
+        uint32_t csrc = 0;
+        int m = 0;
+        char *extn = 0;
+        uint16_t extn_len = 0;
+        uint16_t extn_type = 0;
+        const uint8_t *start = (uint8_t *) tile->data;
+        int data_len = tile->data_len;
+        unsigned maxPacketSize = tx->mtu - 40;
 
         const unsigned char *endptr = 0;
         const unsigned char *nal = start;
 
         while ((nal = rtpenc_h264_get_next_nal(nal, data_len - (nal - start), &endptr))) {
                 unsigned int nalsize = endptr - nal;
-                bool eof = endptr == start + data_len;
-                bool lastNALUnitFragment = false; // by default
-                unsigned curNALOffset = 0;
+                bool eof = endptr == start + data_len && last_fragment;
                 char *nalc = const_cast<char *>(reinterpret_cast<const char *>(nal));
 
-		while(!lastNALUnitFragment){
-			// We have NAL unit data in the buffer.  There are three cases to consider:
-			// 1. There is a new NAL unit in the buffer, and it's small enough to deliver
-			//    to the RTP sink (as is).
-			// 2. There is a new NAL unit in the buffer, but it's too large to deliver to
-			//    the RTP sink in its entirety.  Deliver the first fragment of this data,
-			//    as a FU packet, with one extra preceding header byte (for the "FU header").
-			// 3. There is a NAL unit in the buffer, and we've already delivered some
-			//    fragment(s) of this.  Deliver the next fragment of this data,
-			//    as a FU packet, with two (H.264) extra preceding header bytes
-			//    (for the "NAL header" and the "FU header").
-			if (curNALOffset == 0) { // case 1 or 2
-				if (nalsize	<= maxPacketSize) { // case 1
-
-					if (eof) m = 1;
-					if (rtp_send_data(rtp_session, ts, pt, m, cc, &csrc,
-							nalc, nalsize,
-							extn, extn_len, extn_type) < 0) {
-						error_msg("There was a problem sending the RTP packet\n");
-					}
-					lastNALUnitFragment = true;
-				} else { // case 2
-					// We need to send the NAL unit data as FU packets.  Deliver the first
-					// packet now.  Note that we add "NAL header" and "FU header" bytes to the front
-					// of the packet (overwriting the existing "NAL header").
-					hdr[0] = (nal[0] & 0xE0) | 28; //FU indicator
-					hdr[1] = 0x80 | (nal[0] & 0x1F); // FU header (with S bit)
-
-					if (rtp_send_data_hdr(rtp_session, ts, pt, m, cc, &csrc,
-									(char *) hdr, 2,
-									nalc + 1, maxPacketSize - 2,
-									extn, extn_len, extn_type) < 0) {
-										error_msg("There was a problem sending the RTP packet\n");
-					}
-					curNALOffset += maxPacketSize - 1;
-					lastNALUnitFragment = false;
-					nalsize -= maxPacketSize - 1;
-				}
-			} else { // case 3
-				// We are sending this NAL unit data as FU packets.  We've already sent the
-				// first packet (fragment).  Now, send the next fragment.  Note that we add
-				// "NAL header" and "FU header" bytes to the front.  (We reuse these bytes that
-				// we already sent for the first fragment, but clear the S bit, and add the E
-				// bit if this is the last fragment.)
-				hdr[1] = hdr[1] & ~0x80;// FU header (no S bit)
-
-				if (nalsize + 1 > maxPacketSize) {
-					// We can't send all of the remaining data this time:
-					if (rtp_send_data_hdr(rtp_session, ts, pt, m, cc, &csrc,
-							(char *) hdr, 2,
-							nalc + curNALOffset,
-							maxPacketSize - 2, extn, extn_len,
-							extn_type) < 0) {
-								error_msg("There was a problem sending the RTP packet\n");
-					}
-					curNALOffset += maxPacketSize - 2;
-					lastNALUnitFragment = false;
-					nalsize -= maxPacketSize - 2;
-
-				} else {
-					// This is the last fragment:
-					if (eof) m = 1;
-
-					hdr[1] |= 0x40;// set the E bit in the FU header
-
-					if (rtp_send_data_hdr(rtp_session, ts, pt, m, cc, &csrc,
-									(char *) hdr, 2,
-									nalc + curNALOffset,
-									nalsize, extn, extn_len, extn_type) < 0) {
-										error_msg("There was a problem sending the RTP packet\n");
-					}
-					lastNALUnitFragment = true;
-				}
-			}
-		}
-	}
-        if (endptr != start + data_len) {
+                if (nalsize <= maxPacketSize) { // NAL unit fits in the packet - send as is
+                        if (eof) m = 1;
+                        if (rtp_send_data(rtp_session, ts, pt, m, cc, &csrc,
+                                                nalc, nalsize,
+                                                extn, extn_len, extn_type) < 0) {
+                                error_msg("There was a problem sending the RTP packet\n");
+                        }
+                        nal = endptr; // continue from the next start code, do not scan the sent NAL again
+                        continue;
+                }
+
+                // send the NAL unit as fragmentation units - the original NAL header is
+                // replaced by the payload header + FU header (carrying the NAL type)
+                if (hevc) {
+                        hdr[0] = (nal[0] & 0x81) | H265_FU << 1; // keep F and LayerId MSB
+                        hdr[1] = nal[1];                          // LayerId, TID
+                        hdr[2] = 0x80 | ((nal[0] >> 1) & 0x3F);   // FU header (with S bit)
+                } else {
+                        hdr[0] = (nal[0] & 0xE0) | 28;            // FU indicator
+                        hdr[1] = 0x80 | (nal[0] & 0x1F);          // FU header (with S bit)
+                }
+                unsigned char &fu_header = hdr[nal_hdr_len];
+                unsigned offset = nal_hdr_len;
+                nalsize -= nal_hdr_len;
+                while (nalsize > 0) {
+                        unsigned len = maxPacketSize - fu_hdr_len;
+                        if (nalsize <= len) { // last fragment
+                                len = nalsize;
+                                fu_header |= 0x40; // set the E bit in the FU header
+                                if (eof) m = 1;
+                        }
+                        if (rtp_send_data_hdr(rtp_session, ts, pt, m, cc, &csrc,
+                                                (char *) hdr, fu_hdr_len,
+                                                nalc + offset, len,
+                                                extn, extn_len, extn_type) < 0) {
+                                error_msg("There was a problem sending the RTP packet\n");
+                        }
+                        fu_header &= ~0x80; // clear S bit for the following fragments
+                        offset += len;
+                        nalsize -= len;
+                }
+                nal = endptr; // continue from the next start code, do not scan the sent NAL again
+        }
+        if (data_len > 0 && endptr != start + data_len) {
                 error_msg("No NAL found!\n");
         }
 }
 
+/**
+ *  H.264 standard transmission
+ */
+void tx_send_h264(struct tx *tx, struct video_frame *frame,
+		struct rtp *rtp_session) {
+        tx_send_nal_units(tx, frame, rtp_session, false);
+}
+
+/**
+ *  HEVC standard transmission (RFC 7798)
+ *
+ *  @note
+ *  Aggregation packets are not used and DONL is not sent (sprop-max-don-diff=0).
+ */
+void tx_send_h265(struct tx *tx, struct video_frame *frame,
+		struct rtp *rtp_session) {
+        tx_send_nal_units(tx, frame, rtp_session, true);
+}
+
+#define AV1_OBU_TEMPORAL_DELIMITER 2
+#define AV1_OBU_SEQUENCE_HEADER 1
+#define AV1_OBU_TILE_LIST 8
+#define AV1_OBU_PADDING 15
+#define AV1_OBU_GET_TYPE(hdr) (((hdr) >> 3) & 0xF)
+#define AV1_OBU_HAS_EXTENSION 0x4
+#define AV1_OBU_HAS_SIZE 0x2
+#define AV1_AGGR_Z 0x80 ///< first OBU element continues OBU from the previous packet
+#define AV1_AGGR_Y 0x40 ///< last OBU element continues in next packet
+#define AV1_AGGR_N 0x08 ///< first packet of a coded video sequence
+
+static unsigned leb128_write(unsigned char *dst, uint32_t val)
+{
+        unsigned len = 0;
+        do {
+                dst[len] = val & 0x7F;
+                val >>= 7;
+                if (val != 0) {
+                        dst[len] |= 0x80;
+                }
+                len++;
+        } while (val != 0);
+        return len;
+}
+
+static bool leb128_read(const unsigned char **ptr, const unsigned char *end, uint64_t *val)
+{
+        *val = 0;
+        for (int i = 0; i < 8 && *ptr < end; ++i) {
+                unsigned char b = *(*ptr)++;
+                *val |= (uint64_t) (b & 0x7F) << (7 * i);
+                if ((b & 0x80) == 0) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/**
+ * AV1 standard transmission (AV1 RTP payload format v1.0)
+ *
+ * The frame is expected to be in low overhead bitstream format (Section 5 of
+ * the AV1 specification, OBUs with obu_size) as produced by the encoders.
+ * OBU elements are sent without obu_size field, each prefixed by its LEB128
+ * length (W=0), OBUs not fitting the packet continue in the next one (Y/Z
+ * bits). Temporal delimiters, tile lists and padding are dropped.
+ */
+void tx_send_av1(struct tx *tx, struct video_frame *frame,
+		struct rtp *rtp_session) {
+        assert(frame->tile_count == 1); // std transmit doesn't handle more than one tile
+        assert(!frame->fragment || tx->fec_scheme == FEC_NONE); // currently no support for FEC with fragments
+        uint32_t ts = get_std_video_local_mediatime();
+
+        const unsigned char *ptr = (unsigned char *) frame->tiles[0].data;
+        const unsigned char *const end = ptr + frame->tiles[0].data_len;
+        const unsigned max_len = tx->mtu - 40;
+        unsigned char *pkt = (unsigned char *) tx->tmp_packet;
+        unsigned pkt_len = 1; // aggregation header
+        pkt[0] = 0;
+
+        auto flush = [&](bool m) {
+                if (rtp_send_data(rtp_session, ts, PT_DynRTP_Type96, m, 0, 0,
+                                        (char *) pkt, pkt_len, 0, 0, 0) < 0) {
+                        error_msg("There was a problem sending the RTP packet\n");
+                }
+                pkt[0] = 0;
+                pkt_len = 1;
+        };
+
+        while (ptr < end) {
+                unsigned char obu_hdr = ptr[0];
+                unsigned hdr_len = obu_hdr & AV1_OBU_HAS_EXTENSION ? 2 : 1;
+                const unsigned char *payload = ptr + hdr_len;
+                uint64_t payload_len = end - payload;
+                if (payload > end || ((obu_hdr & AV1_OBU_HAS_SIZE) && (!leb128_read(&payload, end, &payload_len)
+                                                || payload_len > (uint64_t) (end - payload)))) {
+                        error_msg("Malformed AV1 OBU!\n");
+                        break;
+                }
+                const unsigned char *obu_end = payload + payload_len;
+                int type = AV1_OBU_GET_TYPE(obu_hdr);
+                if (type == AV1_OBU_TEMPORAL_DELIMITER || type == AV1_OBU_TILE_LIST || type == AV1_OBU_PADDING) {
+                        ptr = obu_end;
+                        continue;
+                }
+                if (type == AV1_OBU_SEQUENCE_HEADER) { // packet starts a new coded video sequence
+                        pkt[0] |= AV1_AGGR_N;
+                }
+
+                // OBU element - header without obu_size followed by payload
+                unsigned char elem_hdr[2] = { (unsigned char) (obu_hdr & ~AV1_OBU_HAS_SIZE), hdr_len == 2 ? ptr[1] : (unsigned char) 0 };
+                unsigned elem_hdr_left = hdr_len;
+                const unsigned char *data = payload;
+                while (elem_hdr_left > 0 || data < obu_end) {
+                        unsigned char len_buf[5];
+                        // OBU header must not be split, besides it at least one byte of the payload should fit
+                        unsigned min_elem_len = elem_hdr_left + std::min<unsigned>(obu_end - data, 1);
+                        if (pkt_len + min_elem_len + sizeof len_buf > max_len) {
+                                flush(false);
+                        }
+                        unsigned room = max_len - pkt_len - sizeof len_buf;
+                        unsigned elem_len = std::min<unsigned>(room, elem_hdr_left + (obu_end - data));
+                        pkt_len += leb128_write(pkt + pkt_len, elem_len);
+                        unsigned hdr_part = std::min(elem_len, elem_hdr_left);
+                        memcpy(pkt + pkt_len, elem_hdr + hdr_len - elem_hdr_left, hdr_part);
+                        memcpy(pkt + pkt_len + hdr_part, data, elem_len - hdr_part);
+                        pkt_len += elem_len;
+                        elem_hdr_left -= hdr_part;
+                        data += elem_len - hdr_part;
+                        if (elem_hdr_left > 0 || data < obu_end) { // OBU continues in next packet
+                                pkt[0] |= AV1_AGGR_Y;
+                                flush(false);
+                                pkt[0] |= AV1_AGGR_Z;
+                        }
+                }
+                ptr = obu_end;
+        }
+        flush(true); // last packet of the frame (possibly without any OBU element) carries the marker
+}
+
 void tx_send_jpeg(struct tx *tx, struct video_frame *frame,
                struct rtp *rtp_session) {
         uint32_t ts = 0;
@@ -1178,3 +1427,8 @@ int tx_get_buffer_id(struct tx *tx)
 
 }
 
+bool tx_supports_fragments(struct tx *tx)
+{
+        return tx->fec_scheme == FEC_NONE;
+}
+
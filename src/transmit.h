@@ -78,6 +78,8 @@ void             format_video_header(struct video_frame *frame, int tile_idx, in
                 uint32_t *hdr);
 
 void tx_send_h264(struct tx *tx_session, struct video_frame *frame, struct rtp *rtp_session);
+void tx_send_h265(struct tx *tx_session, struct video_frame *frame, struct rtp *rtp_session);
+void tx_send_av1(struct tx *tx_session, struct video_frame *frame, struct rtp *rtp_session);
 void tx_send_jpeg(struct tx *tx_session, struct video_frame *frame, struct rtp *rtp_session);
 
 /**
@@ -85,6 +87,19 @@ void tx_send_jpeg(struct tx *tx_session, struct video_frame *frame, struct rtp *
  */
 int tx_get_buffer_id(struct tx *tx_session);
 
+/**
+ * Returns true if fragments of a frame (video_frame::fragment) can be passed
+ * to tx_send() (currently FEC is not supported with fragments).
+ */
+bool tx_supports_fragments(struct tx *tx_session);
+
+/**
+ * Sets the sending rate allowed by congestion control (in bits per second),
+ * the rate further caps the bitrate requested by user. 0 disables the limit.
+ * May be called from a thread other than the sending one.
+ */
+void tx_set_congestion_rate(struct tx *tx_session, long long bitrate);
+
 #ifdef __cplusplus
 }
 #endif
@@ -253,6 +253,16 @@ enum mem_location_t {
         CUDA_MEM
 };
 
+/// sender-side stages of the per-frame latency trace, see utils/latency_trace.h
+enum frame_trace_stage {
+        TRACE_CAPTURE,        ///< frame grabbed
+        TRACE_FILTER,         ///< capture filters applied
+        TRACE_COMPRESS_START,
+        TRACE_COMPRESS_END,
+        TRACE_PACKETIZE,      ///< transmission of the frame started
+        TRACE_STAGE_COUNT
+};
+
 /**
  * @brief Struct video_frame represents a video frame and contains video description.
  */
@@ -286,6 +296,7 @@ struct video_frame {
         uint32_t timecode; ///< BCD timecode (hours, minutes, seconds, frame number)
         uint64_t compress_start; ///< in ms from epoch
         uint64_t compress_end; ///< in ms from epoch
+        uint64_t trace_ns[TRACE_STAGE_COUNT]; ///< get_time_in_ns() of the passed stages, 0 if not recorded
         unsigned int paused_play:1;
 #define VF_METADATA_END tile_count
 
@@ -0,0 +1,267 @@
+/**
+ * @file   utils/latency_trace.cpp
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // defined HAVE_CONFIG_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "control_socket.h"
+#include "debug.h"
+#include "host.h"
+#include "module.h"
+#include "utils/latency_trace.h"
+#include "utils/metrics.h"
+
+#define MOD_NAME "[latency] "
+#define REPORT_INTERVAL_S 5
+
+using namespace std;
+
+ADD_TO_PARAM(LATENCY_TRACE_PARAM, "* " LATENCY_TRACE_PARAM "\n"
+                "  Trace per-frame latency of the pipeline stages and report p50/p99/max (in us) periodically (set on both sender and receiver)\n");
+
+namespace {
+/**
+ * Log-linear histogram (16 sub-buckets per power of 2, so the error is
+ * within ~6 %) that can be updated concurrently without locking.
+ */
+class latency_histogram {
+public:
+        void record(time_ns_t val) {
+                uint64_t v = val < 0 ? 0 : val;
+                m_buckets[bucket_idx(v)].fetch_add(1, memory_order_relaxed);
+                m_count.fetch_add(1, memory_order_relaxed);
+                uint64_t max = m_max.load(memory_order_relaxed);
+                while (v > max && !m_max.compare_exchange_weak(max, v, memory_order_relaxed)) {
+                }
+        }
+        uint64_t count() const {
+                return m_count.load(memory_order_relaxed);
+        }
+        uint64_t max() const {
+                return m_max.load(memory_order_relaxed);
+        }
+        /// @returns lower bound of the bucket containing the percentile
+        uint64_t percentile(double p) const {
+                uint64_t target = count() * p;
+                uint64_t sum = 0;
+                for (size_t i = 0; i < m_buckets.size(); ++i) {
+                        sum += m_buckets[i].load(memory_order_relaxed);
+                        if (sum > target) {
+                                return bucket_value(i);
+                        }
+                }
+                return max();
+        }
+        void reset() {
+                for (auto &b : m_buckets) {
+                        b.store(0, memory_order_relaxed);
+                }
+                m_count.store(0, memory_order_relaxed);
+                m_max.store(0, memory_order_relaxed);
+        }
+
+private:
+        static constexpr int SUB_BITS = 4;
+        static constexpr int SUB_COUNT = 1 << SUB_BITS;
+
+        static size_t bucket_idx(uint64_t v) {
+                if (v < SUB_COUNT) {
+                        return v;
+                }
+                int exp = 63 - __builtin_clzll(v);
+                return (exp - SUB_BITS + 1) * SUB_COUNT + ((v >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+        }
+        static uint64_t bucket_value(size_t idx) {
+                if (idx < SUB_COUNT) {
+                        return idx;
+                }
+                int exp = idx / SUB_COUNT + SUB_BITS - 1;
+                return (uint64_t) (SUB_COUNT | (idx % SUB_COUNT)) << (exp - SUB_BITS);
+        }
+
+        array<atomic<uint64_t>, (64 - SUB_BITS + 1) * SUB_COUNT> m_buckets{};
+        atomic<uint64_t> m_count{0};
+        atomic<uint64_t> m_max{0};
+};
+} // end of anonymous namespace
+
+struct latency_trace {
+        latency_trace(struct module *parent, const char *name, int interval_count, const char *const *interval_names) :
+                name(name),
+                intervals(interval_count),
+                names(interval_names, interval_names + interval_count)
+        {
+                control = (struct control_state *) get_module(get_root_module(parent), "control");
+                string prefix = "latency_" + this->name + "_";
+                transform(prefix.begin(), prefix.end(), prefix.begin(), [](unsigned char c) { return tolower(c); });
+                for (auto const &n : names) {
+                        metrics.push_back(metric_register((prefix + n + "_ns").c_str(),
+                                                ("Latency of the " + n + " stage in ns").c_str(), METRIC_HISTOGRAM));
+                }
+        }
+        string name;
+        struct control_state *control;
+        vector<latency_histogram> intervals; ///< reset after every report
+        vector<string> names;
+        vector<struct metric *> metrics; ///< cumulative counterparts of intervals
+        atomic<time_ns_t> last_report{get_time_in_ns()};
+};
+
+bool latency_trace_enabled(void)
+{
+        return get_commandline_param(LATENCY_TRACE_PARAM) != nullptr;
+}
+
+/**
+ * @param name           name used in the report, eg. "TX"
+ * @param interval_names names of the measured intervals
+ */
+struct latency_trace *latency_trace_init(struct module *parent, const char *name,
+                int interval_count, const char *const *interval_names)
+{
+        return new latency_trace(parent, name, interval_count, interval_names);
+}
+
+void latency_trace_record(struct latency_trace *s, int interval, time_ns_t duration)
+{
+        assert(interval >= 0 && interval < (int) s->intervals.size());
+        s->intervals[interval].record(duration);
+        metric_observe(s->metrics[interval], duration);
+}
+
+/**
+ * Records durations between consecutive stages to intervals starting with
+ * first_interval. Intervals with any of the stages not recorded (0) are skipped.
+ */
+void latency_trace_record_stages(struct latency_trace *s, int first_interval,
+                const time_ns_t *stages, int stage_count)
+{
+        for (int i = 1; i < stage_count; ++i) {
+                if (stages[i - 1] == 0 || stages[i] == 0) {
+                        continue;
+                }
+                latency_trace_record(s, first_interval + i - 1, stages[i] - stages[i - 1]);
+        }
+}
+
+/**
+ * Reports the histograms and resets them if the report interval has elapsed.
+ */
+void latency_trace_report(struct latency_trace *s)
+{
+        time_ns_t now = get_time_in_ns();
+        time_ns_t last = s->last_report.load(memory_order_relaxed);
+        if (now - last < REPORT_INTERVAL_S * NS_IN_SEC
+                        || !s->last_report.compare_exchange_strong(last, now)) {
+                return;
+        }
+
+        ostringstream oss;
+        oss << "LATENCY " << s->name;
+        for (size_t i = 0; i < s->intervals.size(); ++i) {
+                auto &h = s->intervals[i];
+                if (h.count() == 0) {
+                        continue;
+                }
+                oss << " " << s->names[i] << " " << h.percentile(0.5) / 1000 << "/"
+                        << h.percentile(0.99) / 1000 << "/" << h.max() / 1000;
+                h.reset();
+        }
+        LOG(LOG_LEVEL_INFO) << MOD_NAME << oss.str() << " (p50/p99/max in us)\n";
+        if (s->control != nullptr) {
+                control_report_stats(s->control, oss.str());
+        }
+}
+
+void latency_trace_destroy(struct latency_trace *s)
+{
+        delete s;
+}
+
+/**
+ * Writes LATENCY_TRACE_RTP_EXT_WORDS words (network order) - for each sender
+ * stage its age in microseconds at TRACE_PACKETIZE, UINT32_MAX if unknown.
+ */
+void latency_trace_format_rtp_ext(const struct video_frame *f, uint32_t *ext)
+{
+        uint64_t packetize = f->trace_ns[TRACE_PACKETIZE];
+        for (int i = 0; i < LATENCY_TRACE_RTP_EXT_WORDS; ++i) {
+                uint32_t val = UINT32_MAX;
+                if (f->trace_ns[i] != 0 && packetize >= f->trace_ns[i]) {
+                        val = min<uint64_t>((packetize - f->trace_ns[i]) / 1000, UINT32_MAX - 1);
+                }
+                ext[i] = htonl(val);
+        }
+}
+
+/**
+ * Converts the received extension to the sender stage timestamps. The time
+ * base is synthetic so only differences between the stages are meaningful,
+ * stages unknown to the sender are 0.
+ *
+ * @param extn RTP extension data (after the type/length header)
+ * @retval false extension is not a latency trace
+ */
+bool latency_trace_parse_rtp_ext(uint16_t extn_type, uint16_t extn_len,
+                const unsigned char *extn, time_ns_t *sender_stages_ns)
+{
+        if (extn_type != LATENCY_TRACE_RTP_EXT_TYPE || extn_len != LATENCY_TRACE_RTP_EXT_WORDS) {
+                return false;
+        }
+        const time_ns_t packetize = (time_ns_t) UINT32_MAX * 1000 + 1000;
+        for (int i = 0; i < LATENCY_TRACE_RTP_EXT_WORDS; ++i) {
+                uint32_t val = 0;
+                memcpy(&val, extn + i * sizeof val, sizeof val);
+                val = ntohl(val);
+                sender_stages_ns[i] = val == UINT32_MAX ? 0 : packetize - val * 1000LL;
+        }
+        sender_stages_ns[TRACE_PACKETIZE] = packetize;
+        return true;
+}
+
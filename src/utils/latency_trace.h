@@ -0,0 +1,87 @@
+/**
+ * @file   utils/latency_trace.h
+ *
+ * Per-frame latency tracing. Sender stamps the stages listed in enum
+ * frame_trace_stage to the video frame and passes the sender part to the
+ * receiver in an RTP header extension. Both sides keep histograms of the
+ * stage durations and periodically report p50/p99/max over the control
+ * socket (in microseconds). Enabled with "--param latency-trace" (needed on
+ * both sides).
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UTILS_LATENCY_TRACE_H_
+#define UTILS_LATENCY_TRACE_H_
+
+#ifndef __cplusplus
+#include <stdbool.h>
+#include <stdint.h>
+#else
+#include <cstdint>
+#endif
+
+#include "tv.h"
+#include "types.h"
+
+#define LATENCY_TRACE_PARAM "latency-trace"
+#define LATENCY_TRACE_RTP_EXT_TYPE 0x5554 ///< "UT"
+/// RTP extension length in 32-bit words - age of every sender stage at TRACE_PACKETIZE in us
+#define LATENCY_TRACE_RTP_EXT_WORDS TRACE_PACKETIZE
+
+struct latency_trace;
+struct module;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool latency_trace_enabled(void);
+struct latency_trace *latency_trace_init(struct module *parent, const char *name,
+                int interval_count, const char *const *interval_names);
+void latency_trace_record(struct latency_trace *s, int interval, time_ns_t duration);
+void latency_trace_record_stages(struct latency_trace *s, int first_interval,
+                const time_ns_t *stages, int stage_count);
+void latency_trace_report(struct latency_trace *s);
+void latency_trace_destroy(struct latency_trace *s);
+
+void latency_trace_format_rtp_ext(const struct video_frame *f, uint32_t *ext);
+bool latency_trace_parse_rtp_ext(uint16_t extn_type, uint16_t extn_len,
+                const unsigned char *extn, time_ns_t *sender_stages_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // defined UTILS_LATENCY_TRACE_H_
+
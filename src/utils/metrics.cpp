@@ -0,0 +1,245 @@
+/**
+ * @file   utils/metrics.cpp
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // defined HAVE_CONFIG_H
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "utils/metrics.h"
+
+#define METRICS_SHARDS 16
+#define CACHE_LINE_SIZE 64
+
+using namespace std;
+
+namespace {
+struct alignas(CACHE_LINE_SIZE) metric_slot {
+        atomic<int64_t> val{0};
+};
+
+/// per-thread part of a histogram, count is the sum of the buckets
+struct alignas(CACHE_LINE_SIZE) histogram_slot {
+        array<atomic<uint64_t>, METRICS_HISTOGRAM_BUCKETS> buckets{};
+        atomic<int64_t> sum{0};
+};
+
+/// histogram merged from all shards
+struct histogram_snapshot {
+        array<uint64_t, METRICS_HISTOGRAM_BUCKETS> buckets{};
+        uint64_t count = 0;
+        int64_t sum = 0;
+};
+
+/// @returns index of the slot used by the calling thread
+int get_shard() {
+        static atomic<int> next_shard{0};
+        thread_local int shard = next_shard++ % METRICS_SHARDS;
+        return shard;
+}
+
+struct metrics_registry {
+        mutex lock; ///< guards the list only, not the values
+        vector<unique_ptr<struct metric>> metrics;
+};
+
+metrics_registry &get_registry() {
+        static auto *registry = new metrics_registry(); // never freed - metrics may be updated during exit
+        return *registry;
+}
+} // end of anonymous namespace
+
+struct metric {
+        metric(const char *n, const char *h, enum metric_type t) : name(n), help(h), type(t) {
+                if (t == METRIC_HISTOGRAM) {
+                        hist = make_unique<array<histogram_slot, METRICS_SHARDS>>();
+                }
+        }
+        string name;
+        string help;
+        enum metric_type type;
+        array<metric_slot, METRICS_SHARDS> shards; ///< counter values, gauge uses the first only
+        /// histogram shards (bucket i counts values < 2^i), NULL for other types
+        unique_ptr<array<histogram_slot, METRICS_SHARDS>> hist;
+
+        int64_t value() const {
+                if (type == METRIC_GAUGE) {
+                        return shards[0].val.load(memory_order_relaxed);
+                }
+                int64_t ret = 0;
+                for (auto const &s : shards) {
+                        ret += s.val.load(memory_order_relaxed);
+                }
+                return ret;
+        }
+
+        histogram_snapshot histogram() const {
+                histogram_snapshot ret;
+                for (auto const &s : *hist) {
+                        for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+                                uint64_t n = s.buckets[i].load(memory_order_relaxed);
+                                ret.buckets[i] += n;
+                                ret.count += n;
+                        }
+                        ret.sum += s.sum.load(memory_order_relaxed);
+                }
+                return ret;
+        }
+};
+
+/**
+ * Registers a new metric or returns already registered one with the same
+ * name (metrics from several instances of a module are summed up). The
+ * returned metric is valid until the program exits.
+ */
+struct metric *metric_register(const char *name, const char *help, enum metric_type type)
+{
+        auto &reg = get_registry();
+        lock_guard<mutex> lk(reg.lock);
+        for (auto &m : reg.metrics) {
+                if (m->name == name) {
+                        assert(m->type == type);
+                        return m.get();
+                }
+        }
+        reg.metrics.emplace_back(make_unique<metric>(name, help, type));
+        return reg.metrics.back().get();
+}
+
+void metric_add(struct metric *m, int64_t val)
+{
+        m->shards[get_shard()].val.fetch_add(val, memory_order_relaxed);
+}
+
+void metric_set(struct metric *m, int64_t val)
+{
+        m->shards[0].val.store(val, memory_order_relaxed);
+}
+
+void metric_observe(struct metric *m, int64_t val)
+{
+        uint64_t v = val < 0 ? 0 : val;
+        int bucket = v == 0 ? 0 : 64 - __builtin_clzll(v);
+        assert(m->hist);
+        histogram_slot &slot = (*m->hist)[get_shard()];
+        slot.buckets[min(bucket, METRICS_HISTOGRAM_BUCKETS - 1)].fetch_add(1, memory_order_relaxed);
+        slot.sum.fetch_add(val, memory_order_relaxed);
+}
+
+static const char *prometheus_type(enum metric_type type)
+{
+        switch (type) {
+        case METRIC_COUNTER: return "counter";
+        case METRIC_GAUGE: return "gauge";
+        case METRIC_HISTOGRAM: return "histogram";
+        }
+        abort();
+}
+
+string metrics_format_prometheus()
+{
+        auto &reg = get_registry();
+        lock_guard<mutex> lk(reg.lock);
+        ostringstream oss;
+        for (auto &m : reg.metrics) {
+                oss << "# HELP ultragrid_" << m->name << " " << m->help << "\n";
+                oss << "# TYPE ultragrid_" << m->name << " " << prometheus_type(m->type) << "\n";
+                if (m->type != METRIC_HISTOGRAM) {
+                        oss << "ultragrid_" << m->name << " " << m->value() << "\n";
+                        continue;
+                }
+                histogram_snapshot h = m->histogram();
+                uint64_t cumulative = 0;
+                int last_nonempty = 0;
+                for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+                        if (h.buckets[i] != 0) {
+                                last_nonempty = i;
+                        }
+                }
+                for (int i = 0; i <= last_nonempty && i < METRICS_HISTOGRAM_BUCKETS - 1; ++i) {
+                        cumulative += h.buckets[i];
+                        // bucket i holds values < 2^i, ie. <= 2^i - 1
+                        oss << "ultragrid_" << m->name << "_bucket{le=\"" << (1ULL << i) - 1 << "\"} " << cumulative << "\n";
+                }
+                oss << "ultragrid_" << m->name << "_bucket{le=\"+Inf\"} " << h.count << "\n";
+                oss << "ultragrid_" << m->name << "_sum " << h.sum << "\n";
+                oss << "ultragrid_" << m->name << "_count " << h.count << "\n";
+        }
+        return oss.str();
+}
+
+template<typename T>
+static void append(string &out, T val)
+{
+        out.append((const char *) &val, sizeof val);
+}
+
+string metrics_format_binary()
+{
+        auto &reg = get_registry();
+        lock_guard<mutex> lk(reg.lock);
+        string out = "UGMT";
+        append<uint32_t>(out, METRICS_BINARY_VERSION);
+        append<uint32_t>(out, reg.metrics.size());
+        for (auto &m : reg.metrics) {
+                append<uint8_t>(out, m->type);
+                size_t name_len = min<size_t>(m->name.size(), UINT8_MAX);
+                append<uint8_t>(out, name_len);
+                out.append(m->name, 0, name_len);
+                if (m->type != METRIC_HISTOGRAM) {
+                        append<int64_t>(out, m->value());
+                        continue;
+                }
+                histogram_snapshot h = m->histogram();
+                append<uint64_t>(out, h.count);
+                append<int64_t>(out, h.sum);
+                for (auto b : h.buckets) {
+                        append<uint64_t>(out, b);
+                }
+        }
+        return out;
+}
+
@@ -0,0 +1,88 @@
+/**
+ * @file   utils/metrics.h
+ *
+ * Process-wide registry of numeric metrics (counters, gauges, histograms).
+ * Updates are lock-free - counters are sharded to cache-line padded
+ * per-thread slots, so hot paths only do a relaxed atomic add. Snapshots
+ * are formatted on demand when requested over the control socket
+ * ("metrics" for Prometheus text format, "metrics binary").
+ *
+ * Binary snapshot (host byte order):
+ * - "UGMT", uint32_t version (1), uint32_t metric count
+ * - for every metric: uint8_t type, uint8_t name length, name (not
+ *   NUL-terminated) and then int64_t value for counters and gauges or
+ *   uint64_t count, int64_t sum and METRICS_HISTOGRAM_BUCKETS uint64_t bucket
+ *   counts for histograms (bucket i counts values less than 2^i)
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UTILS_METRICS_H_
+#define UTILS_METRICS_H_
+
+#ifndef __cplusplus
+#include <stdint.h>
+#else
+#include <cstdint>
+#include <string>
+#endif
+
+#define METRICS_BINARY_VERSION 1
+#define METRICS_HISTOGRAM_BUCKETS 64
+
+enum metric_type {
+        METRIC_COUNTER = 0,
+        METRIC_GAUGE = 1,
+        METRIC_HISTOGRAM = 2,
+};
+
+struct metric;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct metric *metric_register(const char *name, const char *help, enum metric_type type);
+void metric_add(struct metric *m, int64_t val);
+void metric_set(struct metric *m, int64_t val);
+void metric_observe(struct metric *m, int64_t val);
+
+#ifdef __cplusplus
+}
+
+std::string metrics_format_prometheus();
+std::string metrics_format_binary();
+#endif
+
+#endif // defined UTILS_METRICS_H_
+
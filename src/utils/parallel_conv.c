@@ -41,44 +41,119 @@
 #include "config_win32.h"
 #endif
 
+#include <assert.h>
+#include <stdatomic.h>
+
 #include "utils/parallel_conv.h"
 #include "utils/worker.h"
 
+#define MIN_STRIPE_LINES 16
+/// a picture is split into (at least) this number of stripes per worker so
+/// that a worker that is preempted or falls behind leaves its remaining
+/// stripes to the others instead of stalling the whole frame
+#define STRIPES_PER_THREAD 4
+
+struct parallel_conv_state {
+        parallel_conv_stripe_t convert;
+        void *udata;
+        int height;
+        int stripe_lines;
+        int stripe_count;
+        atomic_int next_stripe;
+};
+
+static void *parallel_conv_task(void *arg) {
+        struct parallel_conv_state *s = *(struct parallel_conv_state **) arg;
+        int stripe = 0;
+        // completion is synchronized by task_run_parallel() so relaxed is enough
+        while ((stripe = atomic_fetch_add_explicit(&s->next_stripe, 1, memory_order_relaxed)) < s->stripe_count) {
+                int y_start = stripe * s->stripe_lines;
+                s->convert(s->udata, y_start, MIN(y_start + s->stripe_lines, s->height));
+        }
+        return NULL;
+}
+
+/**
+ * Runs a conversion of a picture with given height in parallel.
+ *
+ * The picture is split to stripes of (a multiple of) align lines, which are
+ * claimed by the workers dynamically from a shared counter.
+ *
+ * @param align   stripe alignment in lines, eg. 2 for 4:2:0 subsampled
+ *                planar formats so that a chroma line is not shared by
+ *                2 stripes, see parallel_conv_get_align()
+ * @param threads maximal number of workers to be used
+ */
+void parallel_conv_run(int height, int align, parallel_conv_stripe_t convert, void *udata, int threads)
+{
+        assert(align > 0);
+        if (height <= 0) {
+                return;
+        }
+        threads = MAX(threads, 1);
+        int stripe_lines = MAX(height / (threads * STRIPES_PER_THREAD), MIN_STRIPE_LINES);
+        stripe_lines = (stripe_lines + align - 1) / align * align;
+        int stripe_count = (height + stripe_lines - 1) / stripe_lines;
+        threads = MIN(threads, stripe_count);
+        if (threads == 1) {
+                convert(udata, 0, height);
+                return;
+        }
+
+        struct parallel_conv_state s = { .convert = convert, .udata = udata, .height = height,
+                .stripe_lines = stripe_lines, .stripe_count = stripe_count };
+        atomic_init(&s.next_stripe, 0);
+        struct parallel_conv_state *data[threads];
+        for (int i = 0; i < threads; ++i) {
+                data[i] = &s;
+        }
+
+        task_run_parallel(parallel_conv_task, threads, data, sizeof data[0], NULL);
+}
+
+/**
+ * @returns stripe alignment for parallel_conv_run() for pictures of given codec,
+ *          ie. the maximal vertical subsampling of a planar codec, 1 otherwise
+ */
+int parallel_conv_get_align(codec_t codec)
+{
+        if (!codec_is_planar(codec)) {
+                return 1;
+        }
+        int sub[8];
+        codec_get_planes_subsampling(codec, sub);
+        int align = 1;
+        for (int i = 0; i < 4; ++i) {
+                if (sub[2 * i] == 0) {
+                        break;
+                }
+                align = MAX(align, sub[2 * i + 1]);
+        }
+        return align;
+}
+
 struct parallel_pix_conv_data {
         decoder_t decode;
-        int height;
         unsigned char *out_data;
         int out_linesize;
         const unsigned char *in_data;
         int in_linesize;
 };
 
-static void *parallel_pix_conv_task(void *arg) {
+static void parallel_pix_conv_stripe(void *arg, int y_start, int y_end) {
         struct parallel_pix_conv_data *data = arg;
-        for (int y = 0; y < data->height; ++y) {
-                data->decode(data->out_data, data->in_data, data->out_linesize, DEFAULT_R_SHIFT, DEFAULT_G_SHIFT, DEFAULT_B_SHIFT);
-                data->out_data += data->out_linesize;
-                data->in_data += data->in_linesize;
+        unsigned char *out = data->out_data + (size_t) y_start * data->out_linesize;
+        const unsigned char *in = data->in_data + (size_t) y_start * data->in_linesize;
+        for (int y = y_start; y < y_end; ++y) {
+                data->decode(out, in, data->out_linesize, DEFAULT_R_SHIFT, DEFAULT_G_SHIFT, DEFAULT_B_SHIFT);
+                out += data->out_linesize;
+                in += data->in_linesize;
         }
-        return NULL;
 }
 
 void parallel_pix_conv(int height, char *out, int out_linesize, const char *in, int in_linesize, decoder_t decode, int threads)
 {
-        struct parallel_pix_conv_data data[threads];
-
-        for (int i = 0; i < threads; ++i) {
-                data[i].decode = decode;
-                data[i].height = height / threads;
-                data[i].out_data = (unsigned char *) out + i * data[i].height * out_linesize;
-                data[i].out_linesize = out_linesize;
-                data[i].in_data = (const unsigned char *) in + i * data[i].height * in_linesize;
-                data[i].in_linesize = in_linesize;
-                if (i == threads - 1) {
-                        data[i].height = height - (threads - 1) * (height / threads);
-                }
-        }
-
-        task_run_parallel(parallel_pix_conv_task, threads, data, sizeof data[0], NULL);
+        struct parallel_pix_conv_data data = { decode, (unsigned char *) out, out_linesize, (const unsigned char *) in, in_linesize };
+        parallel_conv_run(height, 1, parallel_pix_conv_stripe, &data, threads);
 }
 
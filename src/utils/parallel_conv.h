@@ -44,6 +44,15 @@
 extern "C" {
 #endif
 
+/**
+ * Converts lines [y_start, y_end) of a picture. Both bounds are multiples
+ * of the alignment passed to parallel_conv_run() except for y_end of the
+ * last stripe, which is the picture height.
+ */
+typedef void (*parallel_conv_stripe_t)(void *udata, int y_start, int y_end);
+
+void parallel_conv_run(int height, int align, parallel_conv_stripe_t convert, void *udata, int threads);
+int parallel_conv_get_align(codec_t codec);
 void parallel_pix_conv(int height, char *out, int out_linesize, const char *in, int in_linesize, decoder_t decode, int threads);
 
 #ifdef __cplusplus
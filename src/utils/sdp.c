@@ -202,9 +202,28 @@ int sdp_add_audio(struct sdp *sdp, int port, int sample_rate, int channels, audi
  * @retval -1 too much streams
  * @retval -2 unsupported codec
  */
+/**
+ * Returns RTP encoding name (as used in rtpmap) of codecs sent with a dynamic
+ * payload type, NULL for other codecs.
+ */
+const char *sdp_get_video_encoding_name(codec_t codec)
+{
+    switch (codec) {
+    case H264:
+        return "H264";
+    case H265:
+        return "H265";
+    case AV1:
+        return "AV1";
+    default:
+        return NULL;
+    }
+}
+
 int sdp_add_video(struct sdp *sdp, int port, codec_t codec)
 {
-    if (codec != H264 && codec != JPEG && codec != MJPG) {
+    const char *encoding_name = sdp_get_video_encoding_name(codec);
+    if (encoding_name == NULL && codec != JPEG && codec != MJPG) {
         return -2;
     }
 
@@ -212,9 +231,9 @@ int sdp_add_video(struct sdp *sdp, int port, codec_t codec)
     if (index < 0) {
         return -1;
     }
-    snprintf(sdp->stream[index].media_info, STR_LENGTH, "m=video %d RTP/AVP %d\n", port, codec == H264 ? PT_DynRTP_Type96 : PT_JPEG);
-    if (codec == H264) {
-        snprintf(sdp->stream[index].rtpmap, STR_LENGTH, "a=rtpmap:%d H264/90000\n", PT_DynRTP_Type96);
+    snprintf(sdp->stream[index].media_info, STR_LENGTH, "m=video %d RTP/AVP %d\n", port, encoding_name ? PT_DynRTP_Type96 : PT_JPEG);
+    if (encoding_name) {
+        snprintf(sdp->stream[index].rtpmap, STR_LENGTH, "a=rtpmap:%d %s/90000\n", PT_DynRTP_Type96, encoding_name);
     }
     return 0;
 }
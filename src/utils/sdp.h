@@ -59,6 +59,7 @@ typedef void (*address_callback_t)(void *udata, const char *address);
 struct sdp *new_sdp(int ip_version, const char *receiver);
 int sdp_add_audio(struct sdp *sdp, int port, int sample_rate, int channels, audio_codec_t codec);
 int sdp_add_video(struct sdp *sdp, int port, codec_t codec);
+const char *sdp_get_video_encoding_name(codec_t codec);
 /**
  * @param sdp           SDP struct to be generated file to
  * @param sdp_file_name name of the created file, may be empty in which case
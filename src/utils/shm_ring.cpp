@@ -0,0 +1,621 @@
+/**
+ * @file   utils/shm_ring.cpp
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#ifdef HAVE_SHM_TRANSPORT
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#include "debug.h"
+#include "utils/shm_ring.h"
+#include "video_codec.h"
+#include "video_frame.h"
+
+#define MOD_NAME "[shm] "
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+namespace {
+
+constexpr uint32_t SHM_RING_MAGIC = 0x4d534755; // "UGSM"
+constexpr uint32_t SHM_RING_VERSION = 1;
+constexpr unsigned MAX_TILES = 16;
+constexpr size_t TILE_ALIGN = 64;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "atomic<uint32_t> must be usable as a futex word");
+
+enum slot_state : uint32_t {
+        SLOT_FREE = 0,  ///< owned by the writer
+        SLOT_READY = 1, ///< written, waiting for the reader
+        SLOT_TAKEN = 2, ///< passed by the reader to its pipeline, freed on dispose
+};
+
+struct shm_ring_slot {
+        std::atomic<uint32_t> state;
+        uint32_t width;
+        uint32_t height;
+        uint32_t color_spec;
+        uint32_t interlacing;
+        uint32_t tile_count;
+        uint32_t frame_type;
+        uint32_t timecode;
+        double fps;
+        uint32_t data_len[MAX_TILES];
+};
+
+/// shared header, followed by slot_count shm_ring_slot structs, data start at data_offset
+struct shm_ring_hdr {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t reserved;
+        uint64_t slot_size;   ///< tile data capacity of a slot
+        uint64_t data_offset; ///< offset of the data of the first slot
+        std::atomic<uint32_t> write_seq; ///< count of written frames, the reader waits on it (futex)
+        std::atomic<uint32_t> reader_waiting;
+        std::atomic<uint32_t> closed;    ///< ring was abandoned by the writer
+        uint32_t reserved2;
+
+        shm_ring_slot *slots() {
+                return reinterpret_cast<shm_ring_slot *>(this + 1);
+        }
+};
+
+/// local mapping of the ring, slot geometry is copied (and validated) from the header
+struct shm_ring_map {
+        shm_ring_hdr *hdr;
+        size_t len;
+        char *data;
+        size_t slot_size;
+        unsigned slot_count;
+        std::atomic<int> refs;
+};
+
+size_t align_up(size_t val, size_t alignment) {
+        return (val + alignment - 1) / alignment * alignment;
+}
+
+void futex_wait(std::atomic<uint32_t> *addr, uint32_t val, long timeout_ms) {
+        struct timespec ts = { timeout_ms / 1000, timeout_ms % 1000 * 1000000L };
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, val, &ts, nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t> *addr) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+shm_ring_map *map_ring(int fd, size_t len) {
+        void *addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "mmap: %s\n", strerror(errno));
+                return nullptr;
+        }
+        auto *m = new shm_ring_map();
+        m->hdr = static_cast<shm_ring_hdr *>(addr);
+        m->len = len;
+        m->refs = 1;
+        return m;
+}
+
+void map_set_geometry(shm_ring_map *m) {
+        m->data = reinterpret_cast<char *>(m->hdr) + m->hdr->data_offset;
+        m->slot_size = m->hdr->slot_size;
+        m->slot_count = m->hdr->slot_count;
+}
+
+void map_unref(shm_ring_map *m) {
+        if (--m->refs == 0) {
+                munmap(m->hdr, m->len);
+                delete m;
+        }
+}
+
+void unix_sock_addr(const char *path, struct sockaddr_un *addr) {
+        memset(addr, 0, sizeof *addr);
+        addr->sun_family = AF_UNIX;
+        strncpy(addr->sun_path, path, sizeof addr->sun_path - 1);
+}
+
+bool send_fd(int sock, int fd) {
+        uint32_t magic = SHM_RING_MAGIC;
+        struct iovec iov = { &magic, sizeof magic };
+        union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+        } control{};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof magic;
+}
+
+/// @returns received fd, -1 if peer disconnected or sent garbage
+int recv_fd(int sock) {
+        uint32_t magic = 0;
+        struct iovec iov = { &magic, sizeof magic };
+        union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+        } control{};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+        if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof magic) {
+                return -1;
+        }
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+                        || cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+                return -1;
+        }
+        int fd = -1;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+        if (magic != SHM_RING_MAGIC) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/// peer closed the connection (neither side sends anything else than the ring fds)
+bool peer_closed(int sock) {
+        char c = 0;
+        ssize_t ret = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return ret == 0 || (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+void frame_dispose(struct video_frame *f) {
+        auto *m = static_cast<shm_ring_map *>(f->callbacks.dispose_udata);
+        size_t idx = (f->tiles[0].data - m->data) / m->slot_size;
+        m->hdr->slots()[idx].state.store(SLOT_FREE, std::memory_order_release);
+        map_unref(m);
+        vf_free(f);
+}
+
+} // end of anonymous namespace
+
+struct shm_ring_writer {
+        std::string path;
+        int slots;
+        int listen_fd = -1;
+        int client_fd = -1;
+        int memfd = -1;
+        shm_ring_map *ring = nullptr;
+        bool tile_count_reported = false;
+};
+
+struct shm_ring_writer *shm_ring_writer_create(const char *path, int slots)
+{
+        if (slots < 1 || slots > SHM_RING_MAX_SLOTS) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Slot count must be between 1 and %d!\n", SHM_RING_MAX_SLOTS);
+                return nullptr;
+        }
+        auto *w = new shm_ring_writer();
+        w->path = path;
+        w->slots = slots;
+
+        struct sockaddr_un addr;
+        unix_sock_addr(path, &addr);
+        w->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(path);
+        if (w->listen_fd == -1 || bind(w->listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof addr) == -1
+                        || listen(w->listen_fd, 1) == -1) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unable to listen on %s: %s\n", path, strerror(errno));
+                if (w->listen_fd != -1) {
+                        close(w->listen_fd);
+                }
+                delete w;
+                return nullptr;
+        }
+        log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Waiting for a reader on %s.\n", path);
+        return w;
+}
+
+/// marks the current ring abandoned (reader switches to the next one or reconnects)
+static void writer_drop_ring(struct shm_ring_writer *w)
+{
+        if (w->ring == nullptr) {
+                return;
+        }
+        shm_ring_hdr *hdr = w->ring->hdr;
+        hdr->closed.store(1);
+        hdr->write_seq.fetch_add(1);
+        futex_wake(&hdr->write_seq);
+        map_unref(w->ring);
+        close(w->memfd);
+        w->ring = nullptr;
+        w->memfd = -1;
+}
+
+static void writer_disconnect(struct shm_ring_writer *w)
+{
+        writer_drop_ring(w);
+        close(w->client_fd);
+        w->client_fd = -1;
+}
+
+/**
+ * Creates a new ring big enough for the frame and passes it to the reader.
+ * Uncompressed frames are expected to keep their size, compressed get some
+ * headroom so that the ring needn't be replaced for every bigger frame.
+ */
+static bool writer_new_ring(struct shm_ring_writer *w, const struct video_frame *f, size_t needed)
+{
+        writer_drop_ring(w);
+
+        size_t slot_size = 0;
+        for (unsigned i = 0; i < f->tile_count; ++i) {
+                size_t tile_size = f->tiles[i].data_len;
+                if (is_codec_opaque(f->color_spec)) {
+                        tile_size = std::max(2 * tile_size, vc_get_datalen(f->tiles[i].width, f->tiles[i].height, UYVY));
+                }
+                slot_size += align_up(tile_size, TILE_ALIGN);
+        }
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        slot_size = align_up(std::max(slot_size, needed), page_size);
+        const size_t data_offset = align_up(sizeof(shm_ring_hdr) + w->slots * sizeof(shm_ring_slot), page_size);
+        const size_t len = data_offset + w->slots * slot_size;
+
+        int fd = memfd_create("ultragrid-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd == -1 || ftruncate(fd, len) == -1
+                        || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unable to create shared memory of %zu B: %s\n", len, strerror(errno));
+                if (fd != -1) {
+                        close(fd);
+                }
+                return false;
+        }
+        shm_ring_map *m = map_ring(fd, len);
+        if (m == nullptr) {
+                close(fd);
+                return false;
+        }
+        // the memory is zeroed, so are the atomics (all slots free)
+        m->hdr->magic = SHM_RING_MAGIC;
+        m->hdr->version = SHM_RING_VERSION;
+        m->hdr->slot_count = w->slots;
+        m->hdr->slot_size = slot_size;
+        m->hdr->data_offset = data_offset;
+        map_set_geometry(m);
+        w->ring = m;
+        w->memfd = fd;
+
+        log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "New ring with %d slots of %zu B.\n", w->slots, slot_size);
+        return send_fd(w->client_fd, fd);
+}
+
+enum shm_ring_put_result shm_ring_writer_put(struct shm_ring_writer *w, const struct video_frame *f)
+{
+        if (w->client_fd == -1) {
+                w->client_fd = accept4(w->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (w->client_fd == -1) {
+                        return SHM_RING_NO_READER;
+                }
+                log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Reader connected.\n");
+        } else if (peer_closed(w->client_fd)) {
+                log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Reader disconnected.\n");
+                writer_disconnect(w);
+                return SHM_RING_NO_READER;
+        }
+
+        if (f->tile_count > MAX_TILES) {
+                if (!w->tile_count_reported) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "At most %u tiles supported!\n", MAX_TILES);
+                        w->tile_count_reported = true;
+                }
+                return SHM_RING_ERROR;
+        }
+        size_t needed = 0;
+        for (unsigned i = 0; i < f->tile_count; ++i) {
+                needed += align_up(f->tiles[i].data_len, TILE_ALIGN);
+        }
+        if (w->ring == nullptr || needed > w->ring->slot_size) {
+                if (!writer_new_ring(w, f, needed)) {
+                        writer_disconnect(w);
+                        return SHM_RING_ERROR;
+                }
+        }
+
+        shm_ring_hdr *hdr = w->ring->hdr;
+        const uint32_t seq = hdr->write_seq.load(std::memory_order_relaxed);
+        const unsigned idx = seq % w->ring->slot_count;
+        shm_ring_slot *slot = &hdr->slots()[idx];
+        if (slot->state.load(std::memory_order_acquire) != SLOT_FREE) {
+                return SHM_RING_FULL;
+        }
+
+        char *dst = w->ring->data + idx * w->ring->slot_size;
+        for (unsigned i = 0; i < f->tile_count; ++i) {
+                memcpy(dst, f->tiles[i].data, f->tiles[i].data_len);
+                slot->data_len[i] = f->tiles[i].data_len;
+                dst += align_up(f->tiles[i].data_len, TILE_ALIGN);
+        }
+        slot->width = f->tiles[0].width;
+        slot->height = f->tiles[0].height;
+        slot->color_spec = f->color_spec;
+        slot->interlacing = f->interlacing;
+        slot->tile_count = f->tile_count;
+        slot->frame_type = f->frame_type;
+        slot->timecode = f->timecode;
+        slot->fps = f->fps;
+        slot->state.store(SLOT_READY, std::memory_order_release);
+
+        hdr->write_seq.store(seq + 1);
+        if (hdr->reader_waiting.load() != 0) {
+                futex_wake(&hdr->write_seq);
+        }
+        return SHM_RING_OK;
+}
+
+void shm_ring_writer_destroy(struct shm_ring_writer *w)
+{
+        if (w == nullptr) {
+                return;
+        }
+        if (w->client_fd != -1) {
+                writer_disconnect(w);
+        }
+        close(w->listen_fd);
+        unlink(w->path.c_str());
+        delete w;
+}
+
+struct shm_ring_reader {
+        std::string path;
+        int sock = -1;
+        shm_ring_map *ring = nullptr;
+        uint32_t read_seq = 0;
+};
+
+struct shm_ring_reader *shm_ring_reader_create(const char *path)
+{
+        auto *r = new shm_ring_reader();
+        r->path = path;
+        return r;
+}
+
+static void reader_disconnect(struct shm_ring_reader *r)
+{
+        if (r->ring != nullptr) {
+                map_unref(r->ring);
+                r->ring = nullptr;
+        }
+        close(r->sock);
+        r->sock = -1;
+}
+
+static bool reader_connect(struct shm_ring_reader *r)
+{
+        struct sockaddr_un addr;
+        unix_sock_addr(r->path.c_str(), &addr);
+        r->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (r->sock == -1) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "socket: %s\n", strerror(errno));
+                return false;
+        }
+        if (connect(r->sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof addr) == -1) {
+                close(r->sock);
+                r->sock = -1;
+                return false;
+        }
+        log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Connected to %s.\n", r->path.c_str());
+        return true;
+}
+
+/// maps the ring received from the writer, the header is validated against the memfd size
+static bool reader_map_ring(struct shm_ring_reader *r, int fd)
+{
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(shm_ring_hdr)) {
+                return false;
+        }
+        shm_ring_map *m = map_ring(fd, st.st_size);
+        if (m == nullptr) {
+                return false;
+        }
+        const shm_ring_hdr *hdr = m->hdr;
+        if (hdr->magic != SHM_RING_MAGIC || hdr->version != SHM_RING_VERSION
+                        || hdr->slot_count == 0 || hdr->slot_count > SHM_RING_MAX_SLOTS
+                        || hdr->slot_size == 0 || hdr->slot_size % TILE_ALIGN != 0
+                        || hdr->data_offset < sizeof(shm_ring_hdr) + hdr->slot_count * sizeof(shm_ring_slot)
+                        || hdr->data_offset % TILE_ALIGN != 0
+                        || hdr->data_offset > m->len
+                        || (m->len - hdr->data_offset) / hdr->slot_count < hdr->slot_size) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Invalid ring received!\n");
+                map_unref(m);
+                return false;
+        }
+        map_set_geometry(m);
+        r->ring = m;
+        r->read_seq = 0;
+        return true;
+}
+
+/// @returns frame from the slot or nullptr if the slot content is not valid
+static struct video_frame *reader_take_frame(struct shm_ring_reader *r)
+{
+        shm_ring_map *m = r->ring;
+        const unsigned idx = r->read_seq % m->slot_count;
+        shm_ring_slot *slot = &m->hdr->slots()[idx];
+        if (slot->state.load(std::memory_order_acquire) != SLOT_READY || slot->tile_count == 0
+                        || slot->tile_count > MAX_TILES || slot->color_spec >= VIDEO_CODEC_COUNT
+                        || slot->interlacing > INTERLACING_MAX) {
+                return nullptr;
+        }
+        size_t total = 0;
+        for (unsigned i = 0; i < slot->tile_count; ++i) {
+                total += align_up(slot->data_len[i], TILE_ALIGN);
+        }
+        if (total > m->slot_size) {
+                return nullptr;
+        }
+
+        struct video_desc desc{};
+        desc.width = slot->width;
+        desc.height = slot->height;
+        desc.color_spec = static_cast<codec_t>(slot->color_spec);
+        desc.fps = slot->fps;
+        desc.interlacing = static_cast<enum interlacing_t>(slot->interlacing);
+        desc.tile_count = slot->tile_count;
+        struct video_frame *f = vf_alloc_desc(desc);
+        char *data = m->data + idx * m->slot_size;
+        for (unsigned i = 0; i < f->tile_count; ++i) {
+                f->tiles[i].data = data;
+                f->tiles[i].data_len = slot->data_len[i];
+                data += align_up(slot->data_len[i], TILE_ALIGN);
+        }
+        f->frame_type = slot->frame_type <= OTHER ? static_cast<frame_type_t>(slot->frame_type) : OTHER;
+        f->timecode = slot->timecode;
+        slot->state.store(SLOT_TAKEN, std::memory_order_relaxed);
+
+        m->refs++;
+        f->callbacks.dispose = frame_dispose;
+        f->callbacks.dispose_udata = m;
+        r->read_seq += 1;
+        return f;
+}
+
+struct video_frame *shm_ring_reader_get(struct shm_ring_reader *r, int timeout_ms)
+{
+        const auto deadline = steady_clock::now() + milliseconds(timeout_ms);
+        auto remaining_ms = [&deadline]() {
+                return std::chrono::duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+        };
+
+        if (r->sock == -1 && !reader_connect(r)) {
+                std::this_thread::sleep_for(milliseconds(timeout_ms));
+                return nullptr;
+        }
+
+        while (true) {
+                if (r->ring == nullptr) {
+                        struct pollfd pfd = { r->sock, POLLIN, 0 };
+                        if (poll(&pfd, 1, std::max(remaining_ms(), 0L)) <= 0) {
+                                return nullptr;
+                        }
+                        int fd = recv_fd(r->sock);
+                        if (fd == -1) {
+                                log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Writer disconnected.\n");
+                                reader_disconnect(r);
+                                return nullptr;
+                        }
+                        bool mapped = reader_map_ring(r, fd);
+                        close(fd);
+                        if (!mapped) {
+                                reader_disconnect(r);
+                                return nullptr;
+                        }
+                }
+
+                shm_ring_hdr *hdr = r->ring->hdr;
+                const uint32_t write_seq = hdr->write_seq.load();
+                if (hdr->closed.load() != 0) {
+                        // frames written before the ring was dropped are
+                        // skipped, the writer has already moved on
+                        map_unref(r->ring);
+                        r->ring = nullptr;
+                        continue;
+                }
+                if (write_seq != r->read_seq) {
+                        struct video_frame *f = reader_take_frame(r);
+                        if (f == nullptr) {
+                                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Corrupted slot, reconnecting.\n");
+                                reader_disconnect(r);
+                        }
+                        return f;
+                }
+
+                const long remaining = remaining_ms();
+                if (remaining <= 0) {
+                        if (peer_closed(r->sock)) {
+                                log_msg(LOG_LEVEL_NOTICE, MOD_NAME "Writer disconnected.\n");
+                                reader_disconnect(r);
+                        }
+                        return nullptr;
+                }
+                hdr->reader_waiting.store(1);
+                if (hdr->write_seq.load() == write_seq) {
+                        futex_wait(&hdr->write_seq, write_seq, remaining);
+                }
+                hdr->reader_waiting.store(0);
+        }
+}
+
+void shm_ring_reader_destroy(struct shm_ring_reader *r)
+{
+        if (r == nullptr) {
+                return;
+        }
+        if (r->sock != -1) {
+                reader_disconnect(r);
+        }
+        delete r;
+}
+
+#endif // defined HAVE_SHM_TRANSPORT
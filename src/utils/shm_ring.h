@@ -0,0 +1,98 @@
+/**
+ * @file   utils/shm_ring.h
+ *
+ * Ring of video frames in shared memory used to pass frames between
+ * UltraGrid processes on the same host. The writer keeps the ring in a memfd
+ * and hands its descriptor (SCM_RIGHTS) to a single reader connected to
+ * a Unix socket. Every slot holds a frame descriptor and the tile data,
+ * the reader gets frames pointing directly to the mapping, the slot is
+ * returned to the writer when the frame is disposed. Both sides sleep/wake
+ * on a futex in the shared header. Linux only.
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UTILS_SHM_RING_H_
+#define UTILS_SHM_RING_H_
+
+#ifdef HAVE_SHM_TRANSPORT
+
+#define SHM_RING_DEFAULT_PATH "/tmp/ug_shm"
+#define SHM_RING_DEFAULT_SLOTS 4
+#define SHM_RING_MAX_SLOTS 64
+
+struct shm_ring_reader;
+struct shm_ring_writer;
+struct video_frame;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum shm_ring_put_result {
+        SHM_RING_OK = 0,
+        SHM_RING_NO_READER, ///< frame discarded - no reader connected
+        SHM_RING_FULL,      ///< frame discarded - reader doesn't keep up
+        SHM_RING_ERROR,     ///< frame discarded - error, already printed
+};
+
+/**
+ * @param path  path of the Unix socket readers connect to, it is created
+ *              (replacing existing file) and removed in shm_ring_writer_destroy()
+ * @param slots number of frames the ring holds
+ */
+struct shm_ring_writer *shm_ring_writer_create(const char *path, int slots);
+/**
+ * Copies the frame to the ring (once). If the frame doesn't fit to the slot,
+ * the ring is replaced by a bigger one and passed to the reader.
+ */
+enum shm_ring_put_result shm_ring_writer_put(struct shm_ring_writer *w, const struct video_frame *f);
+void shm_ring_writer_destroy(struct shm_ring_writer *w);
+
+struct shm_ring_reader *shm_ring_reader_create(const char *path);
+/**
+ * Waits at most timeout_ms for a frame. Tiles of the returned frame point to
+ * the shared memory, frame must be released with VIDEO_FRAME_DISPOSE() (may
+ * be done from any thread and even after shm_ring_reader_destroy()).
+ * @returns frame or NULL on timeout or when the writer is not (yet) running
+ */
+struct video_frame *shm_ring_reader_get(struct shm_ring_reader *r, int timeout_ms);
+void shm_ring_reader_destroy(struct shm_ring_reader *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // defined HAVE_SHM_TRANSPORT
+
+#endif // UTILS_SHM_RING_H_
@@ -42,8 +42,10 @@
 #include "config_win32.h"
 #endif // HAVE_CONFIG_H
 
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
+#include "debug.h"
 #include "utils/vf_split.h"
 #include "video.h"
 #include "video_codec.h"
@@ -175,7 +177,46 @@ shared_ptr<video_frame> vf_merge_tiles(std::vector<shared_ptr<video_frame>> cons
         vf_copy_metadata(ret.get(), tiles.at(0).get());
         ret->compress_start = t0;
         ret->compress_end = t1;
+        ret->fragment = tiles[0]->fragment;
+        ret->last_fragment = tiles[0]->last_fragment;
+        ret->frame_fragment_id = tiles[0]->frame_fragment_id;
+        for (unsigned int i = 0; i < tiles.size(); ++i) {
+                ret->tiles[i].offset = tiles[i]->tiles[0].offset;
+        }
 
         return ret;
 }
 
+shared_ptr<video_frame> vf_fragment_assembler::add(struct video_frame *fragment)
+{
+        if (m_active && m_id != fragment->frame_fragment_id) {
+                log_msg(LOG_LEVEL_WARNING, "Incomplete fragmented frame dropped!\n");
+                m_active = false;
+        }
+        if (!m_active) {
+                m_active = true;
+                m_id = fragment->frame_fragment_id;
+                m_desc = video_desc_from_frame(fragment);
+                vf_store_metadata(fragment, m_metadata.data());
+                m_data.clear();
+        }
+        const struct tile *tile = &fragment->tiles[0];
+        m_data.resize(max<size_t>(m_data.size(), tile->offset + tile->data_len));
+        memcpy(m_data.data() + tile->offset, tile->data, tile->data_len);
+        if (!fragment->last_fragment) {
+                return {};
+        }
+        m_active = false;
+
+        auto *data = new vector<char>(move(m_data));
+        shared_ptr<video_frame> ret(vf_alloc_desc(m_desc), [data](struct video_frame *frame) {
+                                delete data;
+                                vf_free(frame);
+                        });
+        ret->tiles[0].data = data->data();
+        ret->tiles[0].data_len = data->size();
+        vf_restore_metadata(ret.get(), m_metadata.data());
+        ret->compress_end = fragment->compress_end;
+
+        return ret;
+}
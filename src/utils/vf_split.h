@@ -75,12 +75,31 @@ void vf_split_horizontal(struct video_frame *out, struct video_frame *src,
 #endif
 
 #ifdef __cplusplus
+#include <array>
 #include <memory>
 #include <vector>
 
+#include "types.h"
+
 std::vector<std::shared_ptr<video_frame>> vf_separate_tiles(std::shared_ptr<video_frame> frame);
 std::shared_ptr<video_frame> vf_merge_tiles(std::vector<std::shared_ptr<video_frame>> const & tiles);
 
+/**
+ * Reassembles fragments (video_frame::fragment) of single-tile frames. Data
+ * are copied so that the fragments can be released immediately.
+ */
+class vf_fragment_assembler {
+public:
+        /// @returns complete frame after the last fragment was added, empty pointer otherwise
+        std::shared_ptr<video_frame> add(struct video_frame *fragment);
+private:
+        bool m_active = false;
+        unsigned int m_id = 0;
+        struct video_desc m_desc{};
+        std::array<char, VF_METADATA_SIZE> m_metadata{};
+        std::vector<char> m_data;
+};
+
 #endif // __cplusplus
 
 #endif // VF_SPLIT_H_
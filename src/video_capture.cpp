@@ -61,9 +61,11 @@
 #include "debug.h"
 #include "lib_common.h"
 #include "module.h"
+#include "tv.h"
 #include "utils/config_file.h"
 #include "video_capture.h"
 
+#include <cstring>
 #include <string>
 #include <iomanip>
 
@@ -253,8 +255,15 @@ struct video_frame *vidcap_grab(struct vidcap *state, struct audio_frame **audio
         assert(state->magic == VIDCAP_MAGIC);
         struct video_frame *frame;
         frame = state->funcs->grab(state->state, audio);
-        if (frame != NULL)
+        if (frame != NULL) {
+                time_ns_t captured = get_time_in_ns();
                 frame = capture_filter(state->capture_filter, frame);
+                if (frame != NULL) {
+                        memset(frame->trace_ns, 0, sizeof frame->trace_ns);
+                        frame->trace_ns[TRACE_CAPTURE] = captured;
+                        frame->trace_ns[TRACE_FILTER] = get_time_in_ns();
+                }
+        }
         return frame;
 }
 
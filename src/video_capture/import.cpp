@@ -60,6 +60,7 @@
 
 #include "audio/types.h"
 #include "audio/wav_reader.h"
+#include "control_socket.h"
 #include "keyboard_control.h"
 #include "messaging.h"
 #include "module.h"
@@ -83,7 +84,11 @@
 
 #include <condition_variable>
 #include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #define BUFFER_LEN_MAX 40
 #define MAX_CLIENTS 16
@@ -94,6 +99,8 @@
 
 #define MAX_NUMBER_WORKERS 100
 #define MOD_NAME "[import] "
+#define STATS_INTERVAL_S 5
+#define BUFFER_POOL_MAX_FREE (2 * BUFFER_LEN_MAX)
 
 using std::condition_variable;
 using std::chrono::duration;
@@ -104,6 +111,54 @@ using std::string;
 using std::to_string;
 using std::unique_lock;
 
+#define ALLOC_ALIGN 512
+
+/**
+ * Pool of aligned tile buffers so that the readahead doesn't allocate (and
+ * page-fault) a fresh buffer for every tile. Shared with the frames given
+ * out by grab so it may outlive the capture state.
+ */
+struct buffer_pool {
+        char *get(size_t size) {
+                std::lock_guard<mutex> lk(lock);
+                for (auto it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+                        if (it->second >= size) {
+                                char *ret = it->first;
+                                buffer_sizes[ret] = it->second;
+                                free_buffers.erase(it);
+                                return ret;
+                        }
+                }
+                // satisfies both per-frame files and container O_DIRECT reads
+                char *ret = (char *) aligned_malloc(size, VIDEO_EXPORT_CONTAINER_ALIGN);
+                assert(ret != nullptr);
+                buffer_sizes[ret] = size;
+                return ret;
+        }
+        void put(char *buf) {
+                if (buf == nullptr) {
+                        return;
+                }
+                std::lock_guard<mutex> lk(lock);
+                size_t size = buffer_sizes.at(buf);
+                buffer_sizes.erase(buf);
+                if (free_buffers.size() >= BUFFER_POOL_MAX_FREE) {
+                        aligned_free(free_buffers.front().first);
+                        free_buffers.pop_front();
+                }
+                free_buffers.emplace_back(buf, size);
+        }
+        ~buffer_pool() {
+                for (auto &b : free_buffers) {
+                        aligned_free(b.first);
+                }
+        }
+private:
+        mutex lock;
+        std::deque<std::pair<char *, size_t>> free_buffers;
+        std::map<char *, size_t> buffer_sizes; ///< buffers currently in use
+};
+
 struct processed_entry;
 struct tile_data {
         char *data;
@@ -112,6 +167,7 @@ struct tile_data {
 
 struct processed_entry {
         struct processed_entry *next;
+        std::shared_ptr<buffer_pool> *pool;
         int count;
         struct tile_data tiles[];
 };
@@ -184,6 +240,9 @@ struct vidcap_import_state {
         volatile int queue_len;
 
         pthread_t video_thread_id;
+        int readahead = 0; ///< max reads in flight
+        std::shared_ptr<buffer_pool> pool = std::make_shared<buffer_pool>();
+        struct control_state *control = nullptr;
 
         struct timeval prev_time;
         long video_frame_count = 0L;
@@ -192,9 +251,15 @@ struct vidcap_import_state {
         bool finished;
         bool loop;
         bool o_direct;
-        int video_reading_threads_count;
         bool should_exit_at_end;
         double force_fps;
+
+        /// @name container import (see @ref VIDEO_EXPORT_CONTAINER_INDEX)
+        /// @{
+        int container_fd = -1; ///< -1 if reading a file per frame
+        std::vector<struct video_export_index_entry> container_index;
+        std::vector<long> container_frame_start; ///< first index entry of a frame, -1 if frame missing
+        /// @}
 };
 
 static void * audio_reading_thread(void *args);
@@ -371,6 +436,75 @@ static int get_tile_count(const char *directory, codec_t color_spec, char *tile_
         return tile_count;
 }
 
+/**
+ * Loads index of a container export if present.
+ *
+ * @retval true   container found, s->container_* members are set
+ * @retval false  directory doesn't contain a container, per-frame files are used
+ */
+static bool load_container_index(struct vidcap_import_state *s, long frame_count) {
+        std::string index_filename = std::string(s->directory) + "/" VIDEO_EXPORT_CONTAINER_INDEX;
+        FILE *index = fopen(index_filename.c_str(), "rb");
+        if (index == nullptr) {
+                return false;
+        }
+        char magic[sizeof VIDEO_EXPORT_CONTAINER_MAGIC - 1];
+        if (fread(magic, sizeof magic, 1, index) != 1 || memcmp(magic, VIDEO_EXPORT_CONTAINER_MAGIC, sizeof magic) != 0) {
+                fclose(index);
+                throw ug_runtime_error("Wrong container index file.");
+        }
+        struct video_export_index_entry entry;
+        while (fread(&entry, sizeof entry, 1, index) == 1) {
+                s->container_index.push_back(entry);
+        }
+        fclose(index);
+
+        s->container_frame_start.assign(frame_count, -1);
+        unsigned int tile_count = 1;
+        for (size_t i = 0; i < s->container_index.size(); ++i) {
+                const auto &e = s->container_index[i];
+                if (e.frame < 1 || e.frame > (unsigned long) frame_count) {
+                        continue;
+                }
+                if (e.tile == 0) {
+                        s->container_frame_start[e.frame - 1] = i;
+                }
+                tile_count = max(tile_count, e.tile + 1);
+        }
+        s->video_desc.tile_count = tile_count;
+        // drop frames that were exported only partially (export queue overflow)
+        for (auto &start : s->container_frame_start) {
+                if (start == -1) {
+                        continue;
+                }
+                for (unsigned int t = 0; t < tile_count; ++t) {
+                        if ((size_t) start + t >= s->container_index.size()
+                                        || s->container_index[start + t].frame != s->container_index[start].frame
+                                        || s->container_index[start + t].tile != t) {
+                                start = -1;
+                                break;
+                        }
+                }
+        }
+
+        std::string data_filename = std::string(s->directory) + "/" VIDEO_EXPORT_CONTAINER_DATA;
+        int flags = O_RDONLY;
+#ifdef WIN32
+        flags |= O_BINARY;
+#endif
+#ifdef HAVE_LINUX
+        if (s->o_direct) {
+                flags |= O_DIRECT;
+        }
+#endif
+        s->container_fd = open(data_filename.c_str(), flags);
+        if (s->container_fd == -1) {
+                throw ug_runtime_error("Cannot open container data file.");
+        }
+        log_msg(LOG_LEVEL_INFO, MOD_NAME "Reading container with %zu tiles.\n", s->container_index.size());
+        return true;
+}
+
 static int
 vidcap_import_init(struct vidcap_params *params, void **state)
 {
@@ -385,10 +519,11 @@ try {
 
         if (strlen(tmp) == 0 || strcmp(tmp, "help") == 0) {
                 color_printf("Import usage:\n"
-                                TERM_BOLD TERM_FG_RED "\t<directory>" TERM_FG_RESET "{:loop|:mt_reading=<nr_threads>|:o_direct|:exit_at_end|:fps=<fps>|frames=<n>|:disable_audio}\n" TERM_RESET
+                                TERM_BOLD TERM_FG_RED "\t<directory>" TERM_FG_RESET "{:loop|:readahead=<n>|:o_direct|:exit_at_end|:fps=<fps>|frames=<n>|:disable_audio}\n" TERM_RESET
                                 "where\n"
+                                TERM_BOLD "\t<n>  " TERM_RESET " - number of frames read concurrently ahead of playback (default 4, mt_reading is an alias)\n"
                                 TERM_BOLD "\t<fps>" TERM_RESET " - overrides FPS from sequence metadata\n"
-                                TERM_BOLD "\t<n>  " TERM_RESET " - use only N first frames fron sequence (if less than available frames)\n");
+                                TERM_BOLD "\tframes=<n>" TERM_RESET " - use only N first frames fron sequence (if less than available frames)\n");
                 delete s;
                 free(tmp);
                 return VIDCAP_INIT_NOERR;
@@ -399,13 +534,14 @@ try {
         s->queue_len = 0;
 
         s->parent = vidcap_params_get_parent(params);
+        s->control = (struct control_state *) get_module(get_root_module(s->parent), "control");
         module_init_default(&s->mod);
         s->mod.cls = MODULE_CLASS_DATA;
         s->mod.priv_data = s;
         s->mod.new_message = vidcap_import_new_message;
         module_register(&s->mod, s->parent);
 
-        s->video_reading_threads_count = 1; // default is single threaded
+        s->readahead = 4;
 
         char *save_ptr = NULL;
         char *suffix;
@@ -424,12 +560,11 @@ try {
                         s->directory = tmp;
                 } else if (strcmp(suffix, "loop") == 0) {
                         s->loop = true;
-                } else if (strncmp(suffix, "mt_reading=",
-                                        strlen("mt_reading=")) == 0) {
-                        s->video_reading_threads_count = atoi(suffix +
-                                        strlen("mt_reading="));
-                        assert(s->video_reading_threads_count <=
-                                        MAX_NUMBER_WORKERS);
+                } else if (strstr(suffix, "mt_reading=") == suffix || strstr(suffix, "readahead=") == suffix) {
+                        s->readahead = atoi(strchr(suffix, '=') + 1);
+                        if (s->readahead < 1 || s->readahead > MAX_NUMBER_WORKERS) {
+                                throw ug_runtime_error("Readahead must be in range 1.." + to_string(MAX_NUMBER_WORKERS) + ".");
+                        }
                 } else if (strcmp(suffix, "o_direct") == 0) {
                         s->o_direct = true;
                 } else if (strcmp(suffix, "noaudio") == 0) {
@@ -487,7 +622,9 @@ try {
                 fclose(info);
                 info = NULL;
 
-                s->video_desc.tile_count = get_tile_count(s->directory, s->video_desc.color_spec, &s->tile_delim);
+                if (!load_container_index(s, s->video_frame_count)) {
+                        s->video_desc.tile_count = get_tile_count(s->directory, s->video_desc.color_spec, &s->tile_delim);
+                }
         }
 
         // override metadata fps setting
@@ -567,9 +704,10 @@ static void free_entry(struct processed_entry *entry)
                 return;
         }
         for (int i = 0; i < entry->count; ++i) {
-                aligned_free(entry->tiles[i].data);
+                (*entry->pool)->put(entry->tiles[i].data);
         }
 
+        delete entry->pool;
         free(entry);
 }
 
@@ -599,6 +737,9 @@ static void cleanup_common(struct vidcap_import_state *s) {
         flush_processed(s->head);
 
         free(s->directory);
+        if (s->container_fd != -1) {
+                close(s->container_fd);
+        }
 
         // audio
         if(s->audio_state.has_audio) {
@@ -815,10 +956,11 @@ struct video_reader_data {
         unsigned int tile_count;
         struct processed_entry *entry;
         bool o_direct;
+        int container_fd; ///< -1 if reading a file per frame
+        const struct video_export_index_entry *container_tiles; ///< index entries of the frame tiles
+        std::shared_ptr<buffer_pool> pool;
 };
 
-#define ALLOC_ALIGN 512
-
 static void *video_reader_callback(void *arg)
 {
         struct video_reader_data *data =
@@ -827,8 +969,45 @@ static void *video_reader_callback(void *arg)
         data->entry = (struct processed_entry *) calloc(1, sizeof(struct processed_entry) + data->tile_count * sizeof(struct tile_data));
         assert(data->entry != NULL);
         data->entry->next = NULL;
+        data->entry->pool = new std::shared_ptr<buffer_pool>(data->pool);
         data->entry->count = data->tile_count;
 
+        if (data->container_fd != -1) {
+                if (data->container_tiles == nullptr) { // frame was not exported
+                        free_entry(data->entry);
+                        data->entry = nullptr;
+                        return data;
+                }
+                for (unsigned int i = 0; i < data->tile_count; i++) {
+                        const struct video_export_index_entry *idx = &data->container_tiles[i];
+                        data->entry->tiles[i].data_len = idx->data_len;
+                        // offset is aligned, length is rounded up so the read is usable with O_DIRECT
+                        const size_t aligned_data_len = (idx->data_len + VIDEO_EXPORT_CONTAINER_ALIGN - 1)
+                                / VIDEO_EXPORT_CONTAINER_ALIGN * VIDEO_EXPORT_CONTAINER_ALIGN;
+                        data->entry->tiles[i].data = data->pool->get(aligned_data_len);
+                        size_t bytes = 0;
+                        while (bytes < idx->data_len) {
+#ifdef WIN32
+                                ssize_t res = -1;
+                                if (_lseeki64(data->container_fd, idx->offset + bytes, SEEK_SET) != -1) {
+                                        res = read(data->container_fd, data->entry->tiles[i].data + bytes, aligned_data_len - bytes);
+                                }
+#else
+                                ssize_t res = pread(data->container_fd, data->entry->tiles[i].data + bytes,
+                                                aligned_data_len - bytes, idx->offset + bytes);
+#endif
+                                if (res <= 0) {
+                                        perror("read");
+                                        free_entry(data->entry);
+                                        data->entry = nullptr;
+                                        return data;
+                                }
+                                bytes += res;
+                        }
+                }
+                return data;
+        }
+
         for (unsigned int i = 0; i < data->tile_count; i++) {
                 char name[1048];
                 char tile_idx[3] = "";
@@ -853,22 +1032,23 @@ static void *video_reader_callback(void *arg)
                 int fd = open(name, flags);
                 if(fd == -1) {
                         perror("open");
-                        return NULL;
+                        free_entry(data->entry);
+                        data->entry = nullptr;
+                        return data;
                 }
                 if (fstat(fd, &sb)) {
                         perror("fstat");
                         close(fd);
                         free_entry(data->entry);
-                        return NULL;
+                        data->entry = nullptr;
+                        return data;
                 }
 
                 data->entry->tiles[i].data_len = sb.st_size;
                 const int aligned_data_len = (data->entry->tiles[i].data_len + ALLOC_ALIGN - 1)
                         / ALLOC_ALIGN * ALLOC_ALIGN;
                 // alignment needed when using O_DIRECT flag
-                data->entry->tiles[i].data = (char *)
-                        aligned_malloc(aligned_data_len, ALLOC_ALIGN);
-                assert(data->entry->tiles[i].data != NULL);
+                data->entry->tiles[i].data = data->pool->get(aligned_data_len);
 
                 ssize_t bytes = 0;
                 do {
@@ -877,12 +1057,10 @@ static void *video_reader_callback(void *arg)
                                         / ALLOC_ALIGN * ALLOC_ALIGN);
                         if (res <= 0) {
                                 perror("read");
-                                for (unsigned int i = 0; i < data->tile_count; i++) {
-                                        aligned_free(data->entry->tiles[i].data);
-                                }
-                                free(data->entry);
+                                free_entry(data->entry);
+                                data->entry = nullptr;
                                 close(fd);
-                                return NULL;
+                                return data;
                         }
                         bytes += res;
                 } while (bytes < data->entry->tiles[i].data_len);
@@ -893,18 +1071,78 @@ static void *video_reader_callback(void *arg)
         return data;
 }
 
+/**
+ * Reads of the frames ahead of playback. Up to s->readahead reads are kept
+ * in flight in the worker pool, completed ones are appended to the queue in
+ * the frame order so that a single slow read doesn't stall the whole batch.
+ */
+struct readahead_window {
+        explicit readahead_window(int len) : data(len), handles(len) {}
+        std::vector<struct video_reader_data> data;
+        std::vector<task_result_handle_t> handles;
+        int first = 0;
+        int count = 0;
+
+        struct video_reader_data *complete_oldest() {
+                assert(count > 0);
+                auto *ret = (struct video_reader_data *) wait_task(handles[first]);
+                first = (first + 1) % data.size();
+                count -= 1;
+                return ret;
+        }
+        /// @returns number of discarded frames
+        int drain() {
+                int ret = count;
+                while (count > 0) {
+                        free_entry(complete_oldest()->entry);
+                }
+                return ret;
+        }
+};
+
+struct readahead_stats {
+        time_ns_t last_report = get_time_in_ns();
+        uint64_t bytes = 0;
+        int frames = 0;
+
+        void update(struct vidcap_import_state *s, const struct processed_entry *entry, int queue_len, int in_flight) {
+                for (int i = 0; i < entry->count; ++i) {
+                        bytes += entry->tiles[i].data_len;
+                }
+                frames += 1;
+                time_ns_t now = get_time_in_ns();
+                if (now - last_report < STATS_INTERVAL_S * NS_IN_SEC) {
+                        return;
+                }
+                double seconds = (double) (now - last_report) / NS_IN_SEC;
+                double mbps = bytes / seconds / 1000000.0;
+                log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "Read %d frames in %.2f s (%.2f MB/s), queue %d, in flight %d.\n",
+                                frames, seconds, mbps, queue_len, in_flight);
+                if (s->control != nullptr) {
+                        control_report_stats(s->control, "IMPORT read_MBps " + to_string(mbps) + " queue " + to_string(queue_len)
+                                        + " in_flight " + to_string(in_flight));
+                }
+                last_report = now;
+                bytes = 0;
+                frames = 0;
+        }
+};
+
 static void * video_reading_thread(void *args)
 {
 	struct vidcap_import_state 	*s = (struct vidcap_import_state *) args;
-        long index = 0;
+        long index = 0; ///< next frame to be submitted for reading
+        int queue_len = 0;
 
         bool paused = false;
 
-        ///while(index < s->video_frame_count && !s->finish_threads) {
+        readahead_window window(s->readahead);
+        readahead_stats stats;
+
         while(1) {
                 {
                         unique_lock<mutex> lk(s->lock);
-                        while((s->queue_len >= BUFFER_LEN_MAX - 1 || index >= s->video_frame_count || paused)
+                        while(window.count == 0 && (s->queue_len >= BUFFER_LEN_MAX - 1 || index >= s->video_frame_count || paused)
                                        && s->message_queue.len == 0) {
                                 if (index >= s->video_frame_count) {
                                         s->finished = true;
@@ -916,17 +1154,19 @@ static void * video_reading_thread(void *args)
                                 struct import_message *msg = pop_message(&s->message_queue);
                                 if(msg->type == FINALIZE) {
                                         free(msg);
+                                        window.drain();
                                         return NULL;
                                 } else if(msg->type == PAUSE) {
                                         paused = !paused;
                                         printf("Toggle pause\n");
 
-                                        index -= flush_processed(s->head);
+                                        index -= flush_processed(s->head) + window.drain();
                                         s->queue_len = 0;
                                         s->head = s->tail = NULL;
 
                                         free(msg);
                                 } else if (msg->type == SEEK) {
+                                        window.drain();
                                         flush_processed(s->head);
                                         s->queue_len = 0;
                                         s->head = s->tail = NULL;
@@ -946,56 +1186,58 @@ static void * video_reading_thread(void *args)
                                         abort();
                                 }
                         }
+                        queue_len = s->queue_len;
                 }
 
-                /// @todo are these checks necessary?
-                index = min(max(0L, index), s->video_frame_count - 1);
-
-                struct video_reader_data data_reader[MAX_NUMBER_WORKERS];
-                task_result_handle_t task_handle[MAX_NUMBER_WORKERS];
-
-                int number_workers = s->video_reading_threads_count;
-                if (index + number_workers >= s->video_frame_count) {
-                        number_workers = s->video_frame_count - index;
-                }
-                // run workers
-                for (int i = 0; i < number_workers; ++i) {
-                        struct video_reader_data *data =
-                                &data_reader[i];
+                // fill the window
+                while (!paused && window.count < s->readahead && index < s->video_frame_count
+                                && queue_len + window.count < BUFFER_LEN_MAX - 1) {
+                        int slot = (window.first + window.count) % s->readahead;
+                        struct video_reader_data *data = &window.data[slot];
                         data->o_direct = s->o_direct;
                         data->tile_count = s->video_desc.tile_count;
+                        data->container_fd = s->container_fd;
+                        data->container_tiles = nullptr;
+                        if (s->container_fd != -1 && s->container_frame_start.at(index) != -1) {
+                                data->container_tiles = &s->container_index.at(s->container_frame_start.at(index));
+                        }
                         data->tile_delim = s->tile_delim;
                         snprintf(data->file_name_prefix, sizeof(data->file_name_prefix),
-                                        "%s/%08ld", s->directory, index + i + 1);
+                                        "%s/%08ld", s->directory, index + 1);
                         strncpy(data->file_name_suffix,
                                         get_codec_file_extension(s->video_desc.color_spec),
                                         sizeof(data->file_name_suffix));
                         data->entry = NULL;
-                        task_handle[i] = task_run_async(video_reader_callback, data);
+                        data->pool = s->pool;
+                        window.handles[slot] = task_run_async(video_reader_callback, data);
+                        window.count += 1;
+                        index += 1;
                 }
 
-                // wait for workers to finish
-                for (int i = 0; i < number_workers; ++i) {
-                        struct video_reader_data *data =
-                                (struct video_reader_data *)
-                                wait_task(task_handle[i]);
-                        if (!data || data->entry == NULL)
-                                continue;
-                        {
-                                unique_lock<mutex> lk(s->lock);
-                                if(s->head) {
-                                        s->tail->next = data->entry;
-                                        s->tail = data->entry;
-                                } else {
-                                        s->head = s->tail = data->entry;
-                                }
-                                s->queue_len += 1;
+                if (window.count == 0) {
+                        continue;
+                }
 
-                                lk.unlock();
-                                s->boss_cv.notify_one();
+                struct video_reader_data *data = window.complete_oldest();
+                if (data->entry == NULL) {
+                        continue;
+                }
+                // before queueing - the entry may be consumed right after that
+                stats.update(s, data->entry, queue_len + 1, window.count);
+                {
+                        unique_lock<mutex> lk(s->lock);
+                        if(s->head) {
+                                s->tail->next = data->entry;
+                                s->tail = data->entry;
+                        } else {
+                                s->head = s->tail = data->entry;
                         }
+                        s->queue_len += 1;
+                        queue_len = s->queue_len;
+
+                        lk.unlock();
+                        s->boss_cv.notify_one();
                 }
-                index += number_workers;
         }
 
         return NULL;
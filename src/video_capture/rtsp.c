@@ -143,6 +143,16 @@ get_nals(FILE *sdp_file, char *nals, int *width, int *height);
 
 bool setup_codecs_and_controls_from_sdp(FILE *sdp_file, void *state);
 
+/// supported video RTP encoding names (as in SDP rtpmap)
+static const struct {
+    const char *name;
+    codec_t codec;
+} rtp_video_codecs[] = {
+    { "H264", H264 },
+    { "H265", H265 },
+    { "AV1", AV1 },
+};
+
 static int
 init_rtsp(struct rtsp_state *s);
 
@@ -294,7 +304,14 @@ int decode_frame_by_pt(struct coded_data *cdata, void *decode_data, struct pbuf_
     pckt = cdata->data;
     struct decode_data_h264 *d = (struct decode_data_h264 *) decode_data;
     if (pckt->pt == d->video_pt) {
-        return decode_frame_h264(cdata,decode_data);
+        switch (d->frame->color_spec) {
+        case H265:
+            return decode_frame_h265(cdata, decode_data);
+        case AV1:
+            return decode_frame_av1(cdata, decode_data);
+        default:
+            return decode_frame_h264(cdata, decode_data);
+        }
     } else {
         error_msg("Wrong Payload type: %u\n", pckt->pt);
         return FALSE;
@@ -423,7 +440,7 @@ vidcap_rtsp_grab(void *state, struct audio_frame **audio) {
 
             if (s->vrtsp_state.decompress) {
                 struct video_desc curr_desc = video_desc_from_frame(frame);
-                curr_desc.color_spec = H264;
+                curr_desc.color_spec = s->vrtsp_state.desc.color_spec;
                 if (!video_desc_eq(s->vrtsp_state.decompress_desc, curr_desc)) {
                     decompress_done(s->vrtsp_state.sd);
                     if (init_decompressor(&s->vrtsp_state, curr_desc) == 0) {
@@ -620,7 +637,6 @@ vidcap_rtsp_init(struct vidcap_params *params, void **state) {
 
     if (s->vrtsp_state.decompress) {
         struct video_desc decompress_desc = s->vrtsp_state.desc;
-        decompress_desc.color_spec = H264;
         if (init_decompressor(&s->vrtsp_state, decompress_desc) == 0) {
             vidcap_rtsp_done(s);
             return VIDCAP_INIT_FAIL;
@@ -746,8 +762,7 @@ init_rtsp(struct rtsp_state *s) {
     if (!setup_codecs_and_controls_from_sdp(sdp_file, s)) {
         goto error;
     }
-    if (strcmp(s->vrtsp_state.codec, "H264") == 0){
-        s->vrtsp_state.desc.color_spec = H264;
+    if (strlen(s->vrtsp_state.codec) > 0) {
         char uri[strlen(s->uri) + 1 + strlen(s->vrtsp_state.control) + 1];
         strcpy(uri, s->uri);
         strcat(uri, "/");
@@ -777,7 +792,11 @@ init_rtsp(struct rtsp_state *s) {
     }
 
     /* get start nal size attribute from sdp file */
-    len_nals = get_nals(sdp_file, (char *) s->vrtsp_state.h264_offset_buffer, (int *) &s->vrtsp_state.desc.width, (int *) &s->vrtsp_state.desc.height);
+    if (s->vrtsp_state.desc.color_spec == H264) {
+        len_nals = get_nals(sdp_file, (char *) s->vrtsp_state.h264_offset_buffer, (int *) &s->vrtsp_state.desc.width, (int *) &s->vrtsp_state.desc.height);
+    } else { // HEVC/AV1 parameter sets are expected in-band
+        len_nals = 0;
+    }
 
     verbose_msg("[rtsp] playing video from server (size: WxH = %d x %d)...\n", s->vrtsp_state.desc.width,s->vrtsp_state.desc.height);
 
@@ -840,15 +859,20 @@ bool setup_codecs_and_controls_from_sdp(FILE *sdp_file, void *state) {
             tmpBuff=NULL;
             int pt = 0;
             sscanf(line, " a=rtpmap:%d %*s", &pt);
-            tmpBuff = strstr(line, "H264");
+            const char *video_codec = NULL;
+            for (unsigned i = 0; i < sizeof rtp_video_codecs / sizeof rtp_video_codecs[0]; ++i) {
+                if ((tmpBuff = strstr(line, rtp_video_codecs[i].name)) != NULL) {
+                    video_codec = rtp_video_codecs[i].name;
+                    break;
+                }
+            }
             if(tmpBuff!=NULL){
                 if ((unsigned) countC < sizeof codecs / sizeof codecs[0]) {
                     //debug_msg("codec = %s\n",tmpBuff);
-                    strncpy(codecs[countC],tmpBuff,4);
-                    codecs[countC][4] = '\0';
+                    strncpy(codecs[countC], video_codec, sizeof codecs[countC] - 1);
                     countC++;
                     if (pt == 0) {
-                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Missing video PT for H.264!\n");
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Missing video PT for %s!\n", video_codec);
                         ret = false;
                         break;
                     }
@@ -878,12 +902,15 @@ bool setup_codecs_and_controls_from_sdp(FILE *sdp_file, void *state) {
         verbose_msg(MOD_NAME "TRACK = %s FOR CODEC = %s\n",tracks[1],codecs[1]);
 
         for(int p=0;p<2;p++){
-            if(strncmp(codecs[p],"H264",4)==0){
-                rtspState->vrtsp_state.codec = "H264";
-                free(rtspState->vrtsp_state.control);
-                rtspState->vrtsp_state.control = strdup(tracks[p]);
-
-            }if(strncmp(codecs[p],"PCMU",4)==0){
+            for (unsigned i = 0; i < sizeof rtp_video_codecs / sizeof rtp_video_codecs[0]; ++i) {
+                if (strcmp(codecs[p], rtp_video_codecs[i].name) == 0) {
+                    rtspState->vrtsp_state.codec = rtp_video_codecs[i].name;
+                    rtspState->vrtsp_state.desc.color_spec = rtp_video_codecs[i].codec;
+                    free(rtspState->vrtsp_state.control);
+                    rtspState->vrtsp_state.control = strdup(tracks[p]);
+                }
+            }
+            if(strncmp(codecs[p],"PCMU",4)==0){
                 rtspState->artsp_state.codec = "PCMU";
                 free(rtspState->artsp_state.control);
                 rtspState->artsp_state.control = strdup(tracks[p]);
@@ -921,7 +948,7 @@ void getNewLine(const char* buffer, int* i, char* line){
  */
 static int
 init_decompressor(struct video_rtsp_state *sr, struct video_desc desc) {
-    if (decompress_init_multi(H264, VIDEO_CODEC_NONE, UYVY, &sr->sd, 1)) {
+    if (decompress_init_multi(desc.color_spec, VIDEO_CODEC_NONE, UYVY, &sr->sd, 1)) {
         decompress_reconfigure(sr->sd, desc, 16, 8, 0,
             vc_get_linesize(desc.width, UYVY), UYVY);
     } else
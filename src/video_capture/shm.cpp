@@ -0,0 +1,159 @@
+/**
+ * @file   video_capture/shm.cpp
+ * @brief  Receives frames from a local UltraGrid process sending with
+ *         "--video-protocol shm", see utils/shm_ring.h.
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#ifdef HAVE_SHM_TRANSPORT
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include "debug.h"
+#include "lib_common.h"
+#include "utils/color_out.h"
+#include "utils/misc.h"
+#include "utils/shm_ring.h"
+#include "video.h"
+#include "video_capture.h"
+
+#define MOD_NAME "[shm cap.] "
+
+/// grab() blocks at most this long so that the capture thread can exit
+static constexpr int GRAB_TIMEOUT_MS = 100;
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+struct vidcap_shm_state {
+        struct shm_ring_reader *reader;
+        steady_clock::time_point t0;
+        int frames;
+};
+
+static void show_help() {
+        col() << "Receives video from an UltraGrid process on the same host sending with " << TBOLD("--video-protocol shm") << ".\n";
+        col() << "Usage:\n";
+        col() << TBOLD(TRED("\t-t shm") << "[:path=<path>]") << "\n\n";
+        col() << TBOLD("\tpath=<path>") << "\tpath of the Unix socket of the sender (default \"" SHM_RING_DEFAULT_PATH "\")\n";
+}
+
+static int vidcap_shm_init(struct vidcap_params *params, void **state)
+{
+        if ((vidcap_params_get_flags(params) & VIDCAP_FLAG_AUDIO_ANY) != 0U) {
+                return VIDCAP_INIT_AUDIO_NOT_SUPPOTED;
+        }
+
+        std::string path = SHM_RING_DEFAULT_PATH;
+        std::string_view fmt = vidcap_params_get_fmt(params);
+        while (!fmt.empty()) {
+                auto tok = tokenize(fmt, ':', '"');
+                auto key = tokenize(tok, '=');
+                if (key == "help") {
+                        show_help();
+                        return VIDCAP_INIT_NOERR;
+                }
+                if (key == "path") {
+                        path = tokenize(tok, '=');
+                } else {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unknown option: %s\n", std::string(key).c_str());
+                        return VIDCAP_INIT_FAIL;
+                }
+        }
+
+        auto *s = new vidcap_shm_state();
+        s->reader = shm_ring_reader_create(path.c_str());
+        s->t0 = steady_clock::now();
+        *state = s;
+        return VIDCAP_INIT_OK;
+}
+
+static void vidcap_shm_done(void *state)
+{
+        auto *s = static_cast<vidcap_shm_state *>(state);
+        shm_ring_reader_destroy(s->reader);
+        delete s;
+}
+
+static struct video_frame *vidcap_shm_grab(void *state, struct audio_frame **audio)
+{
+        auto *s = static_cast<vidcap_shm_state *>(state);
+        *audio = nullptr;
+        struct video_frame *f = shm_ring_reader_get(s->reader, GRAB_TIMEOUT_MS);
+        if (f == nullptr) {
+                return nullptr;
+        }
+
+        s->frames++;
+        auto now = steady_clock::now();
+        double seconds = duration<double>(now - s->t0).count();
+        if (seconds >= 5.0) {
+                log_msg(LOG_LEVEL_INFO, MOD_NAME "%d frames in %g seconds = %g FPS\n",
+                                s->frames, seconds, s->frames / seconds);
+                s->t0 = now;
+                s->frames = 0;
+        }
+        return f;
+}
+
+static struct vidcap_type *vidcap_shm_probe(bool /* verbose */, void (**deleter)(void *))
+{
+        *deleter = free;
+        auto *vt = static_cast<struct vidcap_type *>(calloc(1, sizeof(struct vidcap_type)));
+        if (vt != nullptr) {
+                vt->name = "shm";
+                vt->description = "Frames from a local UltraGrid process (shared memory)";
+        }
+        return vt;
+}
+
+static const struct video_capture_info vidcap_shm_info = {
+        vidcap_shm_probe,
+        vidcap_shm_init,
+        vidcap_shm_done,
+        vidcap_shm_grab,
+        false
+};
+
+REGISTER_MODULE(shm, &vidcap_shm_info, LIBRARY_CLASS_VIDEO_CAPTURE, VIDEO_CAPTURE_ABI_VERSION);
+
+#endif // defined HAVE_SHM_TRANSPORT
@@ -105,6 +105,11 @@ struct testcard_state {
         bool grab_audio = false;
         bool still_image = false;
         string pattern{"bars"};
+
+        int stripes = 0; ///< number of fragments every frame is delivered in, 0 - whole frames
+        int stripe_idx = 0;
+        unsigned int frame_id = 0;
+        struct video_frame *stripe{nullptr};
 };
 
 static void configure_fallback_audio(struct testcard_state *s) {
@@ -319,7 +324,7 @@ static int vidcap_testcard_init(struct vidcap_params *params, void **state)
 
         if (vidcap_params_get_fmt(params) == NULL || strcmp(vidcap_params_get_fmt(params), "help") == 0) {
                 printf("testcard options:\n");
-                col() << TBOLD(TRED("\t-t testcard") << "[:size=<width>x<height>][:fps=<fps>][:codec=<codec>]") << "[:filename=<filename>][:p][:s=<X>x<Y>][:i|:sf][:still][:pattern=<pattern>] " << TBOLD("| -t testcard:help\n");
+                col() << TBOLD(TRED("\t-t testcard") << "[:size=<width>x<height>][:fps=<fps>][:codec=<codec>]") << "[:filename=<filename>][:p][:s=<X>x<Y>][:i|:sf][:still][:pattern=<pattern>][:stripes=<n>] " << TBOLD("| -t testcard:help\n");
                 col() << "or\n";
                 col() << TBOLD(TRED("\t-t testcard") << ":<width>:<height>:<fps>:<codec>") << "[:other_opts]\n";
                 col() << "where\n";
@@ -329,6 +334,7 @@ static int vidcap_testcard_init(struct vidcap_params *params, void **state)
                 col() << TBOLD("\ti|sf") << "       - send as interlaced or segmented frame (if none of those is set, progressive is assumed)\n";
                 col() << TBOLD("\tstill") << "      - send still image\n";
                 col() << TBOLD("\tpattern") << "    - pattern to use, use \"" << TBOLD("pattern=help") << "\" for options\n";
+                col() << TBOLD("\tstripes") << "    - deliver every frame in <n> stripes spread over the frame time (emulates low-latency capture, uncompressed transmission)\n";
                 col() << "\n";
                 testcard_show_codec_help("testcard", false);
                 col() << TBOLD("Note:") << " only certain codec and generator combinations produce full-depth samples (not up-sampled 8-bit), use " << TBOLD("pattern=help") << " for details.\n";
@@ -375,6 +381,8 @@ static int vidcap_testcard_init(struct vidcap_params *params, void **state)
                         if (!parse_fps(strchr(tmp, '=') + 1, &desc)) {
                                 goto error;
                         }
+                } else if (strstr(tmp, "stripes=") == tmp) {
+                        s->stripes = atoi(strchr(tmp, '=') + 1);
                 } else {
                         fprintf(stderr, "[testcard] Unknown option: %s\n", tmp);
                         goto error;
@@ -422,6 +430,14 @@ static int vidcap_testcard_init(struct vidcap_params *params, void **state)
                 }
         }
 
+        if (s->stripes > 0) {
+                if (s->tiled || codec_is_planar(desc.color_spec) || is_codec_opaque(desc.color_spec) || s->stripes > (int) desc.height) {
+                        LOG(LOG_LEVEL_ERROR) << MOD_NAME << "Stripes can be used only with non-tiled packed uncompressed formats!\n";
+                        goto error;
+                }
+                s->stripe = vf_alloc_desc(desc);
+        }
+
         if(vidcap_params_get_flags(params) & VIDCAP_FLAG_AUDIO_EMBEDDED) {
                 if (!configure_audio(s)) {
                         LOG(LOG_LEVEL_ERROR) << "Cannot initialize audio!\n";
@@ -437,6 +453,7 @@ static int vidcap_testcard_init(struct vidcap_params *params, void **state)
 error:
         free(fmt);
         vf_free(s->frame);
+        vf_free(s->stripe);
         delete s;
         return ret;
 }
@@ -452,16 +469,51 @@ static void vidcap_testcard_done(void *state)
                 vf_free(s->tiled);
         }
         vf_free(s->frame);
+        vf_free(s->stripe);
         ring_buffer_destroy(s->midi_buf);
         video_pattern_generator_destroy(s->generator);
         delete s;
 }
 
+/**
+ * Returns next stripe of the current frame once its time (share of the frame
+ * time) elapsed.
+ */
+static struct video_frame *testcard_next_stripe(struct testcard_state *s)
+{
+        std::chrono::duration<double> stripe_time(1.0 / s->frame->fps * s->stripe_idx / s->stripes);
+        if (std::chrono::steady_clock::now() - s->last_frame_time < stripe_time) {
+                return NULL;
+        }
+
+        unsigned int height = s->frame->tiles[0].height;
+        unsigned int first_line = height * s->stripe_idx / s->stripes;
+        unsigned int end_line = height * (s->stripe_idx + 1) / s->stripes;
+        struct tile *tile = &s->stripe->tiles[0];
+        tile->offset = first_line * s->frame_linesize;
+        tile->data = s->frame->tiles[0].data + tile->offset;
+        tile->data_len = (end_line - first_line) * s->frame_linesize;
+        s->stripe->fragment = 1;
+        s->stripe->frame_fragment_id = s->frame_id;
+        s->stripe->last_fragment = s->stripe_idx == s->stripes - 1;
+
+        s->stripe_idx = (s->stripe_idx + 1) % s->stripes;
+        if (s->stripe_idx == 0) {
+                s->frame_id = (s->frame_id + 1) % (1U << 14U);
+        }
+        return s->stripe;
+}
+
 static struct video_frame *vidcap_testcard_grab(void *arg, struct audio_frame **audio)
 {
         struct testcard_state *state;
         state = (struct testcard_state *)arg;
 
+        if (state->stripe_idx > 0) { // remaining stripes of the current frame
+                *audio = NULL;
+                return testcard_next_stripe(state);
+        }
+
         std::chrono::steady_clock::time_point curr_time =
                 std::chrono::steady_clock::now();
 
@@ -505,6 +557,9 @@ static struct video_frame *vidcap_testcard_grab(void *arg, struct audio_frame **
 
                 return state->tiled;
         }
+        if (state->stripes > 0) {
+                return testcard_next_stripe(state);
+        }
         return state->frame;
 }
 
@@ -54,6 +54,7 @@
 #include "compat/platform_time.h"
 #include "messaging.h"
 #include "module.h"
+#include "tv.h"
 #include "utils/synchronized_queue.h"
 #include "utils/thread.h"
 #include "utils/vf_split.h"
@@ -354,6 +355,10 @@ void compress_frame(struct compress_state *proxy, shared_ptr<video_frame> frame)
                 proxy->poisoned = true;
         }
 
+        if (frame) {
+                frame->trace_ns[TRACE_COMPRESS_START] = get_time_in_ns();
+        }
+
         if (s->funcs->compress_frame_async_push_func) {
                 assert(s->funcs->compress_frame_async_pop_func);
                 if (frame) {
@@ -404,6 +409,7 @@ void compress_frame(struct compress_state *proxy, shared_ptr<video_frame> frame)
 
                 sync_api_frame->compress_start = t0;
                 sync_api_frame->compress_end = time_since_epoch_in_ms();
+                sync_api_frame->trace_ns[TRACE_COMPRESS_END] = get_time_in_ns();
 
                 proxy->queue.push(sync_api_frame);
         }
@@ -561,6 +567,7 @@ void compress_state_real::async_tile_consumer(struct compress_state *s)
                         }
 
                         ret->compress_end = time_since_epoch_in_ms();
+                        ret->trace_ns[TRACE_COMPRESS_END] = get_time_in_ns();
                         compressed_tiles.resize(state.size(), nullptr);
                         compressed_tiles[i] = std::move(ret);
                 }
@@ -581,6 +588,9 @@ void compress_state_real::async_consumer(struct compress_state *s)
         set_thread_name(__func__);
         while (true) {
                 auto frame = funcs->compress_frame_async_pop_func(state[0]);
+                if (frame) {
+                        frame->trace_ns[TRACE_COMPRESS_END] = get_time_in_ns();
+                }
                 if (!discard_frames) {
                         s->queue.push(frame);
 
@@ -44,10 +44,13 @@
 #endif // HAVE_CONFIG_H
 
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
 #include <list>
 #include <map>
+#include <mutex>
 #include <regex>
 #include <set>
 #include <stdexcept>
@@ -70,7 +73,8 @@
 #include "utils/macros.h"
 #include "utils/misc.h"
 #include "utils/parallel_conv.h"
-#include "utils/worker.h"
+#include "utils/synchronized_queue.h"
+#include "utils/thread.h"
 #include "video.h"
 #include "video_compress.h"
 
@@ -151,6 +155,7 @@ static void print_codec_supp_pix_fmts(const enum AVPixelFormat *first);
 static void usage(void);
 static int parse_fmt(struct state_video_compress_libav *s, char *fmt);
 static void cleanup(struct state_video_compress_libav *s);
+static void encoder_loop(struct state_video_compress_libav *s);
 
 static unordered_map<codec_t, codec_params_t, hash<int>> codec_params = {
         { H264, codec_params_t{
@@ -227,6 +232,21 @@ static unordered_map<codec_t, codec_params_t, hash<int>> codec_params = {
         }},
 };
 
+/// frame converted to encoder pixel format
+struct lavc_conv_buffer {
+        AVFrame            *in_frame = nullptr;
+        unsigned char      *decoded = nullptr; ///< intermediate representation for codecs
+                                               ///< that are not directly supported
+        bool                borrowed = false;  ///< in_frame points to data of the encoded input frame
+};
+
+struct lavc_encode_job {
+        shared_ptr<video_frame> tx; ///< input frame (kept until encoded), empty for poison pill
+        int                 buf_idx = 0;
+        time_ns_t           conv_duration = 0;
+        bool                quit = false;
+};
+
 struct state_video_compress_libav {
         state_video_compress_libav(struct module *parent) {
                 module_init_default(&module_data);
@@ -243,19 +263,19 @@ struct state_video_compress_libav {
 
         struct video_desc   saved_desc{};
 
-        AVFrame            *in_frame = nullptr;
+        /// frame N+1 is converted to one buffer while frame N is being encoded from the other
+        array<lavc_conv_buffer, 2> conv_buf;
+        int                 cur_buf = 0;
+        int64_t             next_pts = 0;
         AVPacket           *pkt = av_packet_alloc();
-        // for every core - parts of the above
-        vector<AVFrame *>   in_frame_part;
         AVCodecContext     *codec_ctx = nullptr;
 
-        unsigned char      *decoded = nullptr; ///< intermediate representation for codecs
-                                     ///< that are not directly supported
         codec_t             decoded_codec = VIDEO_CODEC_NONE;
         decoder_t           decoder = nullptr;
 
         codec_t             requested_codec_id = VIDEO_CODEC_NONE;
         long long int       requested_bitrate = 0;
+        atomic<long long>   pending_bitrate{0}; ///< bitrate to be applied to the running encoder by the encoder thread
         double              requested_bpp = 0;
         double              requested_crf = -1;
         int                 requested_cqp = -1;
@@ -285,6 +305,13 @@ struct state_video_compress_libav {
 #endif
 
         int conv_thread_count = clamp<unsigned int>(thread::hardware_concurrency(), 1, INT_MAX); ///< number of threads used for UG conversions
+
+        thread              encoder_thread;
+        synchronized_queue<lavc_encode_job, 1> encode_queue;
+        synchronized_queue<shared_ptr<video_frame>, 1> out_queue;
+        mutex               in_flight_lock;
+        condition_variable  in_flight_cv;
+        int                 in_flight = 0; ///< jobs passed to encoder_thread and not yet finished
 };
 
 struct codec_encoders_decoders{
@@ -614,10 +641,7 @@ struct module * libavcodec_compress_init(struct module *parent, const char *opts
                 return ret > 0 ? &compress_init_noerr : NULL;
         }
 
-        s->in_frame_part.resize(s->conv_thread_count);
-        for(int i = 0; i < s->conv_thread_count; i++) {
-                s->in_frame_part[i] = av_frame_alloc();
-        }
+        s->encoder_thread = thread(encoder_loop, s);
 
         return &s->module_data;
 }
@@ -1201,9 +1225,41 @@ static bool configure_swscale(struct state_video_compress_libav *s, struct video
 #endif //HAVE_SWSCALE
 }
 
+static bool configure_conv_buffer(struct state_video_compress_libav *s, struct lavc_conv_buffer *b, struct video_desc desc)
+{
+        b->decoded = (unsigned char *) malloc(vc_get_linesize(desc.width, s->decoded_codec) * desc.height);
+
+        b->in_frame = av_frame_alloc();
+        if (!b->in_frame) {
+                log_msg(LOG_LEVEL_ERROR, "Could not allocate video frame\n");
+                return false;
+        }
+
+        AVPixelFormat fmt = (s->hwenc) ? AV_PIX_FMT_NV12 : s->selected_pixfmt;
+#if LIBAVCODEC_VERSION_MAJOR >= 53
+        b->in_frame->format = fmt;
+        b->in_frame->width = s->codec_ctx->width;
+        b->in_frame->height = s->codec_ctx->height;
+#endif
+
+        int ret = av_frame_get_buffer(b->in_frame, 0);
+        if (ret < 0) {
+                log_msg(LOG_LEVEL_ERROR, "Could not allocate raw picture buffer\n");
+                return false;
+        }
+        // no conversion needed
+        if (get_ug_to_av_pixfmt(desc.color_spec) != AV_PIX_FMT_NONE
+                        && get_ug_to_av_pixfmt(desc.color_spec) == s->selected_pixfmt
+                        && same_linesizes(s->decoded_codec, b->in_frame)) {
+                av_freep(b->in_frame->data); // allocated buffers won't be needed and pointers
+                                             // will be filled by input buffers. av_image_alloc()
+                                             // was called to fill linesizes, however.
+        }
+        return true;
+}
+
 static bool configure_with(struct state_video_compress_libav *s, struct video_desc desc)
 {
-        int ret;
         codec_t ug_codec = s->requested_codec_id == VIDEO_CODEC_NONE ? DEFAULT_CODEC : s->requested_codec_id;
         AVPixelFormat pix_fmt;
         const AVCodec *codec = nullptr;
@@ -1283,51 +1339,12 @@ static bool configure_with(struct state_video_compress_libav *s, struct video_de
                 }
         }
 
-        s->decoded = (unsigned char *) malloc(vc_get_linesize(desc.width, s->decoded_codec) * desc.height);
-
-        s->in_frame = av_frame_alloc();
-        if (!s->in_frame) {
-                log_msg(LOG_LEVEL_ERROR, "Could not allocate video frame\n");
-                return false;
-        }
-        s->in_frame->pts = -1;
-
-        AVPixelFormat fmt = (s->hwenc) ? AV_PIX_FMT_NV12 : s->selected_pixfmt;
-#if LIBAVCODEC_VERSION_MAJOR >= 53
-        s->in_frame->format = fmt;
-        s->in_frame->width = s->codec_ctx->width;
-        s->in_frame->height = s->codec_ctx->height;
-#endif
-
-        ret = av_frame_get_buffer(s->in_frame, 0);
-        if (ret < 0) {
-                log_msg(LOG_LEVEL_ERROR, "Could not allocate raw picture buffer\n");
-                return false;
-        }
-        // conversion needed
-        if (get_ug_to_av_pixfmt(desc.color_spec) == AV_PIX_FMT_NONE
-                        || get_ug_to_av_pixfmt(desc.color_spec) != s->selected_pixfmt) {
-                for(int i = 0; i < s->conv_thread_count; ++i) {
-                        int chunk_size = s->codec_ctx->height / s->conv_thread_count & ~1;
-                        s->in_frame_part[i]->data[0] = s->in_frame->data[0] + s->in_frame->linesize[0] * i *
-                                chunk_size;
-
-                        if (av_pix_fmt_desc_get(s->selected_pixfmt)->log2_chroma_h == 1) { // eg. 4:2:0
-                                chunk_size /= 2;
-                        }
-                        s->in_frame_part[i]->data[1] = s->in_frame->data[1] + s->in_frame->linesize[1] * i *
-                                chunk_size;
-                        s->in_frame_part[i]->data[2] = s->in_frame->data[2] + s->in_frame->linesize[2] * i *
-                                chunk_size;
-                        s->in_frame_part[i]->linesize[0] = s->in_frame->linesize[0];
-                        s->in_frame_part[i]->linesize[1] = s->in_frame->linesize[1];
-                        s->in_frame_part[i]->linesize[2] = s->in_frame->linesize[2];
-                }
-        } else if (same_linesizes(s->decoded_codec, s->in_frame)) {
-                av_freep(s->in_frame->data); // allocated buffers won't be needed and pointers
-                                             // will be filled by input buffers. av_image_alloc()
-                                             // was called to fill linesizes, however.
+        for (auto &b : s->conv_buf) {
+                if (!configure_conv_buffer(s, &b, desc)) {
+                        return false;
+                }
         }
+        s->next_pts = 0;
 
         s->saved_desc = desc;
         s->compressed_desc = desc;
@@ -1359,73 +1376,85 @@ static pixfmt_callback_t select_pixfmt_callback(AVPixelFormat fmt, codec_t src)
 struct pixfmt_conv_task_data {
         pixfmt_callback_t callback;
         AVFrame *out_frame;
-        unsigned char *in_data;
+        int log2_chroma_h;
+        const unsigned char *in_data;
+        int in_linesize;
         int width;
-        int height;
 };
 
-static void *pixfmt_conv_task(void *arg) {
-        struct pixfmt_conv_task_data *data = (struct pixfmt_conv_task_data *) arg;
-        data->callback(data->out_frame, data->in_data, data->width, data->height);
-        return NULL;
+/// converts lines [y_start, y_end) to the (planar) AVFrame, see parallel_conv_run()
+static void pixfmt_conv_stripe(void *arg, int y_start, int y_end) {
+        auto *data = (struct pixfmt_conv_task_data *) arg;
+        AVFrame part;
+        memcpy(part.linesize, data->out_frame->linesize, sizeof part.linesize);
+        for (int plane = 0; plane < AV_NUM_DATA_POINTERS; ++plane) {
+                part.data[plane] = data->out_frame->data[plane];
+                if (part.data[plane] == nullptr) {
+                        break;
+                }
+                part.data[plane] += (y_start * part.linesize[plane]) >> (plane == 0 ? 0 : data->log2_chroma_h);
+        }
+        data->callback(&part, data->in_data + (size_t) y_start * data->in_linesize, data->width, y_end - y_start);
+}
+
+/// waits until at most max_jobs jobs are passed to encoder_loop() and not finished
+static void wait_in_flight(struct state_video_compress_libav *s, int max_jobs)
+{
+        unique_lock<mutex> lk(s->in_flight_lock);
+        s->in_flight_cv.wait(lk, [s, max_jobs] { return s->in_flight <= max_jobs; });
+}
+
+static void submit_job(struct state_video_compress_libav *s, lavc_encode_job &&job)
+{
+        if (!job.quit) {
+                unique_lock<mutex> lk(s->in_flight_lock);
+                s->in_flight += 1;
+        }
+        s->encode_queue.push(move(job));
 }
 
-static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shared_ptr<video_frame> tx)
+/**
+ * Converts the frame to the encoder pixel format and passes it to the encoder
+ * thread. Conversion of this frame thus overlaps with the encoding of the
+ * previous one.
+ */
+static void libavcodec_compress_push(struct module *mod, shared_ptr<video_frame> tx)
 {
         struct state_video_compress_libav *s = (struct state_video_compress_libav *) mod->priv_data;
         unsigned char *decoded;
-        shared_ptr<video_frame> out{};
-        list<unique_ptr<state_video_compress_libav, void (*)(void *)>> cleanup_callbacks; // at function exit handlers
 
         libavcodec_check_messages(s);
 
+        if (!tx) { // poison pill
+                submit_job(s, lavc_encode_job{});
+                return;
+        }
+
         if(!video_desc_eq_excl_param(video_desc_from_frame(tx.get()),
                                 s->saved_desc, PARAM_TILE_COUNT)) {
+                wait_in_flight(s, 0);
                 cleanup(s);
                 int ret = configure_with(s, video_desc_from_frame(tx.get()));
                 if(!ret) {
-                        return {};
+                        return;
                 }
         }
 
-        static auto dispose = [](struct video_frame *frame) {
-#if LIBAVCODEC_VERSION_MAJOR >= 54 && LIBAVCODEC_VERSION_INT < AV_VERSION_INT(57, 37, 100)
-                AVPacket *pkt = (AVPacket *) frame->callbacks.dispose_udata;
-                av_packet_unref(pkt);
-                av_packet_free(&pkt);
-#else
-                free(frame->tiles[0].data);
-#endif // LIBAVCODEC_VERSION_MAJOR >= 54
-                vf_free(frame);
-        };
-        out = shared_ptr<video_frame>(vf_alloc_desc(s->compressed_desc), dispose);
-        if (s->compressed_desc.color_spec == PRORES) {
-                assert(s->codec_ctx->codec_tag != 0);
-                out->color_spec = get_codec_from_fcc(s->codec_ctx->codec_tag);
-        }
-        vf_copy_metadata(out.get(), tx.get());
-#if LIBAVCODEC_VERSION_MAJOR >= 54 && LIBAVCODEC_VERSION_INT < AV_VERSION_INT(57, 37, 100)
-        int got_output;
-        AVPacket *pkt = av_packet_alloc();
-        pkt->data = NULL;
-        pkt->size = 0;
-        out->callbacks.dispose_udata = pkt;
-#else
-        out->tiles[0].data = (char *) malloc(s->compressed_desc.width *
-                        s->compressed_desc.height * 4);
-#endif // LIBAVCODEC_VERSION_MAJOR >= 54
+        // jobs are finished in order so the buffer used 2 frames ago is free
+        wait_in_flight(s, (int) s->conv_buf.size() - 1);
+        struct lavc_conv_buffer *b = &s->conv_buf[s->cur_buf];
 
-        if (int ret = av_frame_make_writable(s->in_frame)) {
+        if (int ret = av_frame_make_writable(b->in_frame)) {
                 print_libav_error(LOG_LEVEL_ERROR, MOD_NAME "Cannot make frame writable", ret);
-                return {};
+                return;
         }
-        s->in_frame->pts += 1;
+        b->in_frame->pts = s->next_pts++;
 
         if (s->decoder != vc_memcpy) {
                 int src_linesize = vc_get_linesize(tx->tiles[0].width, tx->color_spec);
                 int dst_linesize = vc_get_linesize(tx->tiles[0].width, s->decoded_codec);
-                parallel_pix_conv(tx->tiles[0].height, reinterpret_cast<char *>(s->decoded), dst_linesize, tx->tiles[0].data, src_linesize, s->decoder, s->conv_thread_count);
-                decoded = s->decoded;
+                parallel_pix_conv(tx->tiles[0].height, reinterpret_cast<char *>(b->decoded), dst_linesize, tx->tiles[0].data, src_linesize, s->decoder, s->conv_thread_count);
+                decoded = b->decoded;
         } else {
                 decoded = (unsigned char *) tx->tiles[0].data;
         }
@@ -1433,25 +1462,13 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
         time_ns_t t0 = get_time_in_ns();
         auto pixfmt_conv_callback = select_pixfmt_callback(s->selected_pixfmt, s->decoded_codec);
         if (pixfmt_conv_callback != nullptr) {
-                vector<struct pixfmt_conv_task_data> data(s->conv_thread_count);
-                for(int i = 0; i < s->conv_thread_count; ++i) {
-                        data[i].callback = pixfmt_conv_callback;
-                        data[i].out_frame = s->in_frame_part[i];
-
-                        size_t height = tx->tiles[0].height / s->conv_thread_count & ~1; // height needs to be even
-                        if (i < s->conv_thread_count - 1) {
-                                data[i].height = height;
-                        } else { // we are last so we need to do the rest
-                                data[i].height = tx->tiles[0].height -
-                                        height * (s->conv_thread_count - 1);
-                        }
-                        data[i].width = tx->tiles[0].width;
-                        data[i].in_data = decoded + i * height *
-                                vc_get_linesize(tx->tiles[0].width, s->decoded_codec);
-                }
-                task_run_parallel(pixfmt_conv_task, s->conv_thread_count, data.data(), sizeof data[0], NULL);
+                int log2_chroma_h = av_pix_fmt_desc_get(s->selected_pixfmt)->log2_chroma_h;
+                struct pixfmt_conv_task_data data = { pixfmt_conv_callback, b->in_frame, log2_chroma_h,
+                        decoded, vc_get_linesize(tx->tiles[0].width, s->decoded_codec), (int) tx->tiles[0].width };
+                // height needs to be even (the conversions process line pairs) regardless of the subsampling
+                parallel_conv_run(tx->tiles[0].height, max(2, 1 << log2_chroma_h), pixfmt_conv_stripe, &data, s->conv_thread_count);
         } else { // no pixel format conversion needed
-                if (codec_is_planar(s->decoded_codec) && !same_linesizes(s->decoded_codec, s->in_frame)) {
+                if (codec_is_planar(s->decoded_codec) && !same_linesizes(s->decoded_codec, b->in_frame)) {
                         assert(get_bits_per_component(s->decoded_codec) == 8);
                         int sub[8];
                         codec_get_planes_subsampling(s->decoded_codec, sub);
@@ -1460,38 +1477,71 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
                                 if (sub[2 * i] == 0) {
                                         break;
                                 }
-                                int linesize = (s->in_frame->width + sub[2 * i] - 1) / sub[2 * i];
-                                int lines = (s->in_frame->height + sub[2 * i + 1] - 1) / sub[2 * i + 1];
+                                int linesize = (b->in_frame->width + sub[2 * i] - 1) / sub[2 * i];
+                                int lines = (b->in_frame->height + sub[2 * i + 1] - 1) / sub[2 * i + 1];
                                 for (int y = 0; y < lines; ++y) {
-                                        memcpy(s->in_frame->data[i] + y * s->in_frame->linesize[i], in, linesize);
+                                        memcpy(b->in_frame->data[i] + y * b->in_frame->linesize[i], in, linesize);
                                         in += linesize;
                                 }
                         }
                 } else {
                         if (codec_is_planar(s->decoded_codec)) {
-                                buf_get_planes(tx->tiles[0].width, tx->tiles[0].height, s->decoded_codec, (char *) decoded, (char **) s->in_frame->data);
+                                buf_get_planes(tx->tiles[0].width, tx->tiles[0].height, s->decoded_codec, (char *) decoded, (char **) b->in_frame->data);
                         } else {
-                                s->in_frame->data[0] = (uint8_t *) decoded;
+                                b->in_frame->data[0] = (uint8_t *) decoded;
                         }
-                        // prevent leaving dangling pointer to the input buffer that may
+                        // pointers are reset by encoder_loop() after the frame is encoded
+                        // to prevent leaving dangling pointer to the input buffer that may
                         // be freed by cleanup()
-                        static auto deleter = [](void *state) {
-                                auto s = (state_video_compress_libav *) state;
-                                s->in_frame->data[0] = s->in_frame->data[1] = s->in_frame->data[2] = s->in_frame->data[3] = nullptr;
-                        };
-                        std::unique_ptr<state_video_compress_libav, void (*)(void*)> clean_data_ptr{s,
-                                deleter};
-                        cleanup_callbacks.push_back(move(clean_data_ptr));
+                        b->borrowed = true;
                 }
         }
 
         time_ns_t t1 = get_time_in_ns();
 
-        debug_file_dump("lavc-avframe", serialize_video_avframe, s->in_frame);
-        AVFrame *frame = s->in_frame;
+        submit_job(s, lavc_encode_job{move(tx), s->cur_buf, t1 - t0, false});
+        s->cur_buf = (s->cur_buf + 1) % s->conv_buf.size();
+}
+
+static shared_ptr<video_frame> encode_frame(struct state_video_compress_libav *s, lavc_encode_job const &job)
+{
+        struct lavc_conv_buffer *b = &s->conv_buf[job.buf_idx];
+        shared_ptr<video_frame> out{};
+
+        static auto dispose = [](struct video_frame *frame) {
+#if LIBAVCODEC_VERSION_MAJOR >= 54 && LIBAVCODEC_VERSION_INT < AV_VERSION_INT(57, 37, 100)
+                AVPacket *pkt = (AVPacket *) frame->callbacks.dispose_udata;
+                av_packet_unref(pkt);
+                av_packet_free(&pkt);
+#else
+                free(frame->tiles[0].data);
+#endif // LIBAVCODEC_VERSION_MAJOR >= 54
+                vf_free(frame);
+        };
+        out = shared_ptr<video_frame>(vf_alloc_desc(s->compressed_desc), dispose);
+        if (s->compressed_desc.color_spec == PRORES) {
+                assert(s->codec_ctx->codec_tag != 0);
+                out->color_spec = get_codec_from_fcc(s->codec_ctx->codec_tag);
+        }
+        vf_copy_metadata(out.get(), job.tx.get());
+#if LIBAVCODEC_VERSION_MAJOR >= 54 && LIBAVCODEC_VERSION_INT < AV_VERSION_INT(57, 37, 100)
+        int got_output;
+        AVPacket *pkt = av_packet_alloc();
+        pkt->data = NULL;
+        pkt->size = 0;
+        out->callbacks.dispose_udata = pkt;
+#else
+        out->tiles[0].data = (char *) malloc(s->compressed_desc.width *
+                        s->compressed_desc.height * 4);
+#endif // LIBAVCODEC_VERSION_MAJOR >= 54
+
+        time_ns_t t1 = get_time_in_ns();
+
+        debug_file_dump("lavc-avframe", serialize_video_avframe, b->in_frame);
+        AVFrame *frame = b->in_frame;
 #ifdef HWACC_VAAPI
         if(s->hwenc){
-                av_hwframe_transfer_data(s->hwframe, s->in_frame, 0);
+                av_hwframe_transfer_data(s->hwframe, b->in_frame, 0);
                 frame = s->hwframe;
         }
 #endif
@@ -1499,10 +1549,10 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
 #ifdef HAVE_SWSCALE
         if(s->sws_ctx){
                 sws_scale(s->sws_ctx,
-                          s->in_frame->data,
-                          s->in_frame->linesize,
+                          b->in_frame->data,
+                          b->in_frame->linesize,
                           0,
-                          s->in_frame->height,
+                          b->in_frame->height,
                           s->sws_frame->data,
                           s->sws_frame->linesize);
                 frame = s->sws_frame;
@@ -1519,6 +1569,16 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
                 memcpy(out->tiles[0].data + sizeof(uint32_t), s->codec_ctx->extradata, s->codec_ctx->extradata_size);
         }
 
+        if (long long bitrate = s->pending_bitrate.exchange(0); bitrate > 0 && s->codec_ctx->bit_rate > 0) {
+                // rate control parameters are read by the encoders for each frame, keep their ratios
+                double scale = (double) bitrate / s->codec_ctx->bit_rate;
+                s->codec_ctx->bit_rate = bitrate;
+                s->codec_ctx->bit_rate_tolerance = s->codec_ctx->bit_rate_tolerance * scale;
+                s->codec_ctx->rc_max_rate = s->codec_ctx->rc_max_rate * scale;
+                s->codec_ctx->rc_buffer_size = s->codec_ctx->rc_buffer_size * scale;
+                LOG(LOG_LEVEL_VERBOSE) << MOD_NAME "Bitrate changed to " << format_in_si_units(bitrate) << "bps\n";
+        }
+
         if (int ret = avcodec_send_frame(s->codec_ctx, frame)) {
                 print_libav_error(LOG_LEVEL_WARNING, "[lavc] Error encoding frame", ret);
                 return {};
@@ -1567,7 +1627,7 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
         }
 #endif // LIBAVCODEC_VERSION_MAJOR >= 54
         time_ns_t t3 = get_time_in_ns();
-        LOG(LOG_LEVEL_DEBUG2) << MOD_NAME << "duration pixfmt change: " << (t1 - t0) / (double) NS_IN_SEC <<
+        LOG(LOG_LEVEL_DEBUG2) << MOD_NAME << "duration pixfmt change: " << job.conv_duration / (double) NS_IN_SEC <<
                 " s, dump+swscale " << (t2 - t1) / (double) NS_IN_SEC <<
                 " s, compression " << (t3 - t2) / (double) NS_IN_SEC << " s\n";
 
@@ -1578,6 +1638,41 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
         return out;
 }
 
+static void encoder_loop(struct state_video_compress_libav *s)
+{
+        set_thread_name(__func__);
+        while (true) {
+                lavc_encode_job job = s->encode_queue.pop();
+                if (job.quit) {
+                        return;
+                }
+                if (!job.tx) { // poison pill
+                        s->out_queue.push({});
+                } else {
+                        shared_ptr<video_frame> out = encode_frame(s, job);
+                        struct lavc_conv_buffer *b = &s->conv_buf[job.buf_idx];
+                        if (b->borrowed) {
+                                b->in_frame->data[0] = b->in_frame->data[1] = b->in_frame->data[2] = b->in_frame->data[3] = nullptr;
+                                b->borrowed = false;
+                        }
+                        job.tx = {}; // release input frame before waiting for the consumer
+                        if (out) {
+                                s->out_queue.push(move(out));
+                        }
+                }
+                unique_lock<mutex> lk(s->in_flight_lock);
+                s->in_flight -= 1;
+                lk.unlock();
+                s->in_flight_cv.notify_all();
+        }
+}
+
+static shared_ptr<video_frame> libavcodec_compress_pop(struct module *mod)
+{
+        struct state_video_compress_libav *s = (struct state_video_compress_libav *) mod->priv_data;
+        return s->out_queue.pop();
+}
+
 static void cleanup(struct state_video_compress_libav *s)
 {
         if(s->codec_ctx) {
@@ -1602,11 +1697,12 @@ static void cleanup(struct state_video_compress_libav *s)
 #endif
                 avcodec_free_context(&s->codec_ctx);
         }
-        if(s->in_frame) {
-                av_frame_free(&s->in_frame);
+        for (auto &b : s->conv_buf) {
+                av_frame_free(&b.in_frame);
+                free(b.decoded);
+                b.decoded = NULL;
+                b.borrowed = false;
         }
-        free(s->decoded);
-        s->decoded = NULL;
 
         av_frame_free(&s->hwframe);
 
@@ -1620,11 +1716,12 @@ static void libavcodec_compress_done(struct module *mod)
 {
         struct state_video_compress_libav *s = (struct state_video_compress_libav *) mod->priv_data;
 
+        if (s->encoder_thread.joinable()) {
+                s->encode_queue.push(lavc_encode_job{{}, 0, 0, true});
+                s->encoder_thread.join();
+        }
         cleanup(s);
 
-        for (auto &f : s->in_frame_part) {
-                av_free(f);
-        }
         delete s;
 }
 
@@ -1992,6 +2089,18 @@ static void libavcodec_check_messages(struct state_video_compress_libav *s)
                 struct msg_change_compress_data *data =
                         (struct msg_change_compress_data *) msg;
                 struct response *r;
+                // sole bitrate change (eg. from congestion control) is applied without reinitialization
+                if (s->codec_ctx != nullptr && strncmp(data->config_string, "bitrate=", strlen("bitrate=")) == 0
+                                && strchr(data->config_string, ':') == nullptr) {
+                        s->requested_bitrate = unit_evaluate(data->config_string + strlen("bitrate="));
+                        if (s->requested_bitrate > 0) {
+                                s->pending_bitrate = s->requested_bitrate;
+                                free_message(msg, new_response(RESPONSE_OK, NULL));
+                                continue;
+                        }
+                }
+                // parse_fmt() modifies state used by encode_frame() so the encoder thread must be idle
+                wait_in_flight(s, 0);
                 if (parse_fmt(s, data->config_string) == 0) {
                         log_msg(LOG_LEVEL_NOTICE, "[Libavcodec] Compression successfully changed.\n");
                         r = new_response(RESPONSE_OK, NULL);
@@ -2009,11 +2118,11 @@ const struct video_compress_info libavcodec_info = {
         "libavcodec",
         libavcodec_compress_init,
         NULL,
-        libavcodec_compress_tile,
-        NULL,
         NULL,
         NULL,
         NULL,
+        libavcodec_compress_push,
+        libavcodec_compress_pop,
         get_libavcodec_presets,
         get_libavcodec_module_info,
 };
@@ -0,0 +1,483 @@
+/**
+ * @file   video_compress/x264.cpp
+ * @brief  H.264 compression with libx264 emitting slices as they are encoded
+ *
+ * Unlike libavcodec, which returns a frame from the encoder as a whole, this
+ * module uses the x264 NAL unit callback - every slice is passed to the
+ * transmitter as a frame fragment as soon as its slice thread finishes it.
+ * Packetization and sending thus overlap encoding of the rest of the frame.
+ */
+/* Copyright (c) 2026 CESNET z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <x264.h>
+}
+
+#include "compat/platform_time.h"
+#include "debug.h"
+#include "host.h"
+#include "lib_common.h"
+#include "module.h"
+#include "tv.h"
+#include "utils/misc.h"
+#include "video.h"
+#include "video_codec.h"
+#include "video_compress.h"
+
+#define DEFAULT_CRF 22.0
+#define DEFAULT_GOP 20
+#define DEFAULT_PRESET "ultrafast"
+#define MAX_SLICES 16
+#define MOD_NAME "[x264] "
+
+using std::lock_guard;
+using std::map;
+using std::move;
+using std::mutex;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+struct state_video_compress_x264 {
+        struct module module_data{};
+
+        long long requested_bitrate = 0;
+        double requested_crf = -1.0;
+        int requested_slices = 0; ///< 0 - number of CPU cores (up to MAX_SLICES)
+        int requested_gop = DEFAULT_GOP;
+        string preset = DEFAULT_PRESET;
+
+        struct video_desc saved_desc{};
+        struct video_desc compressed_desc{};
+        decoder_t dec = nullptr; ///< conversion of input other than UYVY/I420 to UYVY
+        vector<unsigned char> uyvy_buf;
+        vector<unsigned char> i420_buf;
+        x264_t *enc = nullptr;
+        int mb_count = 0;
+        int64_t pts = 0;
+
+        /// @name state of the currently encoded frame, accessed from x264 slice threads
+        /// @{
+        mutex lock;
+        shared_ptr<video_frame> cur_tx;
+        map<int, pair<int, vector<uint8_t>>> pending_slices; ///< first MB -> (last MB, NAL unit) of slices finished out of order
+        int next_mb = 0;                                      ///< first MB of the slice to be passed next
+        unsigned int offset = 0;                              ///< offset of the next fragment in the frame
+        unsigned int fragment_id = 0;
+        bool frame_done = false;
+        /// @}
+
+        std::queue<shared_ptr<video_frame>> out_queue; ///< protected by lock, empty pointer is poison pill
+        std::condition_variable out_cv;
+};
+
+static void x264_compress_done(struct module *mod)
+{
+        auto *s = (struct state_video_compress_x264 *) mod->priv_data;
+        if (s->enc != nullptr) {
+                x264_encoder_close(s->enc);
+        }
+        delete s;
+}
+
+static void usage()
+{
+        printf("x264 encoder usage:\n");
+        printf("\t-c x264[:bitrate=<bits_per_sec>|:crf=<crf>][:slices=<n>][:gop=<gop>][:preset=<preset>]\n");
+        printf("\t\t<bits_per_sec> requested bitrate (CBR with one-frame VBV buffer), default is CRF " TOSTRING(DEFAULT_CRF) "\n");
+        printf("\t\t<crf> constant rate factor\n");
+        printf("\t\t<n> number of slices encoded in parallel, each passed to the transmitter once encoded (default: number of CPU cores, max. " TOSTRING(MAX_SLICES) ")\n");
+        printf("\t\t<gop> GOP size (default: " TOSTRING(DEFAULT_GOP) ")\n");
+        printf("\t\t<preset> x264 preset (default: " DEFAULT_PRESET ")\n");
+}
+
+static int parse_fmt(struct state_video_compress_x264 *s, char *fmt)
+{
+        char *item, *save_ptr = NULL;
+        while ((item = strtok_r(fmt, ":", &save_ptr)) != NULL) {
+                fmt = NULL;
+                if (strcasecmp("help", item) == 0) {
+                        usage();
+                        return 1;
+                } else if (strncasecmp("bitrate=", item, strlen("bitrate=")) == 0) {
+                        s->requested_bitrate = unit_evaluate(item + strlen("bitrate="));
+                        if (s->requested_bitrate <= 0) {
+                                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Wrong bitrate: %s\n", item + strlen("bitrate="));
+                                return -1;
+                        }
+                } else if (strncasecmp("crf=", item, strlen("crf=")) == 0) {
+                        s->requested_crf = atof(item + strlen("crf="));
+                } else if (strncasecmp("slices=", item, strlen("slices=")) == 0) {
+                        s->requested_slices = atoi(item + strlen("slices="));
+                        if (s->requested_slices < 1 || s->requested_slices > MAX_SLICES) {
+                                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Slice count must be in range 1-%d.\n", MAX_SLICES);
+                                return -1;
+                        }
+                } else if (strncasecmp("gop=", item, strlen("gop=")) == 0) {
+                        s->requested_gop = atoi(item + strlen("gop="));
+                } else if (strncasecmp("preset=", item, strlen("preset=")) == 0) {
+                        s->preset = item + strlen("preset=");
+                } else {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unknown option: %s\n", item);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+static struct module *x264_compress_init(struct module *parent, const char *opts)
+{
+        auto *s = new state_video_compress_x264();
+
+        char *fmt = strdup(opts);
+        int ret = parse_fmt(s, fmt);
+        free(fmt);
+        if (ret != 0) {
+                delete s;
+                return ret > 0 ? &compress_init_noerr : nullptr;
+        }
+        if (s->requested_slices == 0) {
+                s->requested_slices = std::clamp(get_cpu_core_count(), 1, MAX_SLICES);
+        }
+
+        module_init_default(&s->module_data);
+        s->module_data.cls = MODULE_CLASS_DATA;
+        s->module_data.priv_data = s;
+        s->module_data.deleter = x264_compress_done;
+        module_register(&s->module_data, parent);
+
+        return &s->module_data;
+}
+
+/// @note s->lock must be held
+static void emit_fragment(struct state_video_compress_x264 *s, vector<uint8_t> &&nal, bool last)
+{
+        auto *data = new vector<uint8_t>(move(nal));
+        shared_ptr<video_frame> out(vf_alloc_desc(s->compressed_desc), [data](struct video_frame *frame) {
+                        delete data;
+                        vf_free(frame);
+                });
+        vf_copy_metadata(out.get(), s->cur_tx.get());
+        out->tiles[0].data = (char *) data->data();
+        out->tiles[0].data_len = data->size();
+        out->tiles[0].offset = s->offset;
+        out->fragment = 1;
+        out->last_fragment = last;
+        out->frame_fragment_id = s->fragment_id;
+        s->offset += data->size();
+        if (last) {
+                out->compress_end = time_since_epoch_in_ms();
+                s->frame_done = true;
+        }
+        s->out_queue.push(move(out));
+        s->out_cv.notify_one();
+}
+
+/**
+ * Called by x264 for every finished NAL unit. With sliced threads, slices are
+ * finished concurrently and possibly out of order - a slice is passed on only
+ * after all preceding ones so that the fragments form a valid access unit.
+ */
+static void nalu_process(x264_t *h, x264_nal_t *nal, void *opaque)
+{
+        auto *s = static_cast<struct state_video_compress_x264 *>(opaque);
+        vector<uint8_t> buf(nal->i_payload * 3 / 2 + 5 + 64); // size required by x264_nal_encode()
+        x264_nal_encode(h, buf.data(), nal);
+        buf.resize(nal->i_payload);
+
+        lock_guard<mutex> lk(s->lock);
+        if (nal->i_type != NAL_SLICE && nal->i_type != NAL_SLICE_IDR) { // parameter sets and SEI precede slices
+                emit_fragment(s, move(buf), false);
+                return;
+        }
+        s->pending_slices.emplace(nal->i_first_mb, make_pair(nal->i_last_mb, move(buf)));
+        for (auto it = s->pending_slices.begin(); it != s->pending_slices.end() && it->first == s->next_mb;
+                        it = s->pending_slices.erase(it)) {
+                s->next_mb = it->second.first + 1;
+                emit_fragment(s, move(it->second.second), s->next_mb >= s->mb_count);
+        }
+}
+
+static bool configure_with(struct state_video_compress_x264 *s, struct video_desc desc)
+{
+        if (desc.width % 2 != 0 || desc.height % 2 != 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Only even dimensions are supported for 4:2:0, got %ux%u.\n",
+                                desc.width, desc.height);
+                return false;
+        }
+        if (desc.color_spec != I420 && desc.color_spec != UYVY) {
+                codec_t to_convs[] = { UYVY, VIDEO_CODEC_NONE };
+                codec_t out = VIDEO_CODEC_NONE;
+                s->dec = get_best_decoder_from(desc.color_spec, to_convs, &out, true);
+                if (s->dec == nullptr) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unsupported input codec %s.\n", get_codec_name(desc.color_spec));
+                        return false;
+                }
+                s->uyvy_buf.resize(vc_get_datalen(desc.width, desc.height, UYVY));
+        }
+        if (desc.color_spec != I420) {
+                s->i420_buf.resize(desc.width * desc.height * 3 / 2);
+        }
+
+        if (s->enc != nullptr) {
+                x264_encoder_close(s->enc);
+                s->enc = nullptr;
+        }
+
+        x264_param_t param;
+        if (x264_param_default_preset(&param, s->preset.c_str(), "zerolatency") != 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unknown preset %s.\n", s->preset.c_str());
+                return false;
+        }
+        param.i_width = desc.width;
+        param.i_height = desc.height;
+        param.i_csp = X264_CSP_I420;
+        param.i_fps_num = round(desc.fps * 1000);
+        param.i_fps_den = 1000;
+        param.b_vfr_input = 0;
+        param.i_keyint_max = s->requested_gop;
+        param.b_repeat_headers = 1;
+        param.b_annexb = 1;
+        param.i_threads = s->requested_slices;
+        param.b_sliced_threads = 1;
+        param.i_slice_count = s->requested_slices;
+        param.nalu_process = nalu_process;
+        param.i_log_level = log_level >= LOG_LEVEL_DEBUG ? X264_LOG_DEBUG : X264_LOG_WARNING;
+        if (s->requested_bitrate > 0) {
+                param.rc.i_rc_method = X264_RC_ABR;
+                param.rc.i_bitrate = s->requested_bitrate / 1000;
+                param.rc.i_vbv_max_bitrate = param.rc.i_bitrate;
+                param.rc.i_vbv_buffer_size = std::max<int>(param.rc.i_bitrate / desc.fps, 1);
+        } else {
+                param.rc.i_rc_method = X264_RC_CRF;
+                param.rc.f_rf_constant = s->requested_crf >= 0.0 ? s->requested_crf : DEFAULT_CRF;
+        }
+        if (x264_param_apply_profile(&param, "high") != 0) {
+                return false;
+        }
+
+        s->enc = x264_encoder_open(&param);
+        if (s->enc == nullptr) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot open encoder.\n");
+                return false;
+        }
+        s->mb_count = ((desc.width + 15) / 16) * ((desc.height + 15) / 16);
+
+        s->compressed_desc = desc;
+        s->compressed_desc.color_spec = H264;
+        s->compressed_desc.tile_count = 1;
+        s->saved_desc = desc;
+        log_msg(LOG_LEVEL_INFO, MOD_NAME "Encoding %ux%u with %d slices.\n", desc.width, desc.height, s->requested_slices);
+
+        return true;
+}
+
+static void uyvy_to_i420(unsigned char *dst, const unsigned char *src, unsigned width, unsigned height)
+{
+        const size_t src_linesize = vc_get_linesize(width, UYVY);
+        unsigned char *y = dst;
+        unsigned char *u = y + width * height;
+        unsigned char *v = u + width / 2 * height / 2;
+        for (unsigned row = 0; row < height; row += 2) {
+                const unsigned char *in0 = src + row * src_linesize;
+                const unsigned char *in1 = in0 + src_linesize;
+                for (unsigned x = 0; x < width; x += 2) {
+                        y[x] = in0[1];
+                        y[x + 1] = in0[3];
+                        y[width + x] = in1[1];
+                        y[width + x + 1] = in1[3];
+                        *u++ = (in0[0] + in1[0] + 1) / 2;
+                        *v++ = (in0[2] + in1[2] + 1) / 2;
+                        in0 += 4;
+                        in1 += 4;
+                }
+                y += 2 * width;
+        }
+}
+
+static void x264_compress_push(struct module *mod, shared_ptr<video_frame> tx)
+{
+        auto *s = (struct state_video_compress_x264 *) mod->priv_data;
+
+        if (!tx) {
+                lock_guard<mutex> lk(s->lock);
+                s->out_queue.push({});
+                s->out_cv.notify_one();
+                return;
+        }
+
+        assert(tx->tile_count == 1);
+        struct video_desc desc = video_desc_from_frame(tx.get());
+        if (!video_desc_eq(desc, s->saved_desc)) {
+                if (!configure_with(s, desc)) {
+                        return;
+                }
+        }
+
+        unsigned char *i420 = (unsigned char *) tx->tiles[0].data;
+        if (desc.color_spec != I420) {
+                const unsigned char *uyvy = (unsigned char *) tx->tiles[0].data;
+                if (s->dec != nullptr) {
+                        const int src_linesize = vc_get_linesize(desc.width, desc.color_spec);
+                        const int dst_linesize = vc_get_linesize(desc.width, UYVY);
+                        for (unsigned i = 0; i < desc.height; ++i) {
+                                s->dec(s->uyvy_buf.data() + i * dst_linesize,
+                                                (unsigned char *) tx->tiles[0].data + i * src_linesize,
+                                                dst_linesize, DEFAULT_R_SHIFT, DEFAULT_G_SHIFT, DEFAULT_B_SHIFT);
+                        }
+                        uyvy = s->uyvy_buf.data();
+                }
+                uyvy_to_i420(s->i420_buf.data(), uyvy, desc.width, desc.height);
+                i420 = s->i420_buf.data();
+        }
+
+        x264_picture_t pic_in;
+        x264_picture_t pic_out;
+        x264_picture_init(&pic_in);
+        pic_in.img.i_csp = X264_CSP_I420;
+        pic_in.img.i_plane = 3;
+        pic_in.img.i_stride[0] = desc.width;
+        pic_in.img.i_stride[1] = pic_in.img.i_stride[2] = desc.width / 2;
+        pic_in.img.plane[0] = i420;
+        pic_in.img.plane[1] = i420 + desc.width * desc.height;
+        pic_in.img.plane[2] = pic_in.img.plane[1] + desc.width / 2 * desc.height / 2;
+        pic_in.i_pts = s->pts++;
+        pic_in.opaque = s;
+
+        {
+                lock_guard<mutex> lk(s->lock);
+                s->cur_tx = tx;
+                s->pending_slices.clear();
+                s->next_mb = 0;
+                s->offset = 0;
+                s->frame_done = false;
+        }
+
+        x264_nal_t *nals = nullptr;
+        int nal_count = 0;
+        // NAL units are passed through nalu_process() while encoding, returned ones are not valid
+        int ret = x264_encoder_encode(s->enc, &nals, &nal_count, &pic_in, &pic_out);
+        if (ret < 0) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Encoding failed!\n");
+        }
+
+        lock_guard<mutex> lk(s->lock);
+        if (!s->frame_done && s->offset > 0) { // should not happen - flush whatever is left and terminate the frame
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "Frame slices incomplete (%d of %d MBs)!\n", s->next_mb, s->mb_count);
+                if (s->pending_slices.empty()) {
+                        emit_fragment(s, {}, true);
+                }
+                while (!s->pending_slices.empty()) {
+                        auto it = s->pending_slices.begin();
+                        emit_fragment(s, move(it->second.second), s->pending_slices.size() == 1);
+                        s->pending_slices.erase(it);
+                }
+        }
+        if (s->offset > 0) {
+                s->fragment_id = (s->fragment_id + 1) % (1U << 14U);
+        }
+        s->cur_tx = {};
+}
+
+static shared_ptr<video_frame> x264_compress_pop(struct module *mod)
+{
+        auto *s = (struct state_video_compress_x264 *) mod->priv_data;
+
+        unique_lock<mutex> lk(s->lock);
+        s->out_cv.wait(lk, [s] { return !s->out_queue.empty(); });
+        auto frame = s->out_queue.front();
+        if (frame) { // keep the poison pill for eventual subsequent calls
+                s->out_queue.pop();
+        }
+        return frame;
+}
+
+static std::list<compress_preset> get_x264_presets()
+{
+        return {};
+}
+
+static compress_module_info get_x264_module_info()
+{
+        compress_module_info module_info;
+        module_info.name = "x264";
+        module_info.opts.emplace_back(module_option{"Bitrate", "Bitrate", "quality", ":bitrate=", false});
+        module_info.opts.emplace_back(module_option{"Crf", "specifies CRF factor", "crf", ":crf=", false});
+        module_info.opts.emplace_back(module_option{"Slices", "number of slices sent as soon as encoded", "slices", ":slices=", false});
+
+        codec codec_info;
+        codec_info.name = "H.264";
+        codec_info.priority = 110;
+        codec_info.encoders.emplace_back(encoder{"default", ""});
+        module_info.codecs.emplace_back(move(codec_info));
+
+        return module_info;
+}
+
+const struct video_compress_info x264_info = {
+        "x264",
+        x264_compress_init,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        x264_compress_push,
+        x264_compress_pop,
+        get_x264_presets,
+        get_x264_module_info,
+};
+
+REGISTER_MODULE(x264, &x264_info, LIBRARY_CLASS_VIDEO_COMPRESS, VIDEO_COMPRESS_ABI_VERSION);
@@ -51,6 +51,7 @@
 #include "rtp/rtpdec_h264.h"
 #include "rtp/rtpenc_h264.h"
 #include "utils/misc.h" // get_cpu_core_count()
+#include "utils/parallel_conv.h"
 #include "utils/worker.h"
 #include "video.h"
 #include "video_decompress.h"
@@ -70,6 +71,37 @@
 #include "hwaccel_videotoolbox.h"
 
 #define MOD_NAME "[lavd] "
+#define MAX_BANDS 256
+
+struct convert_task_data {
+        av_to_uv_convert_p convert;
+        unsigned char *out_data;
+        AVFrame *in_frame;
+        int width;
+        int height;
+        int pitch;
+        const int *rgb_shift;
+};
+
+/**
+ * Conversion of decoded bands (reported by draw_horiz_band) to the output
+ * buffer running in worker threads while the decoder continues with the
+ * rest of the frame.
+ */
+struct band_convert_state {
+        bool             enabled;
+        pthread_mutex_t  lock;
+        unsigned char   *dst;             ///< NULL if no frame is being decoded
+        const uint8_t   *frame_data;      ///< data[0] of the picture that is being converted
+        enum AVPixelFormat av_fmt;
+        av_to_uv_convert_p convert;       ///< conversion for av_fmt, NULL if not convertible by bands
+        int              next_row;
+        bool             invalid;         ///< bands cannot be used for current frame
+        int              count;
+        AVFrame          parts[MAX_BANDS];
+        struct convert_task_data tasks[MAX_BANDS];
+        task_result_handle_t handles[MAX_BANDS];
+};
 
 struct state_libavcodec_decompress {
         AVCodecContext  *codec_ctx;
@@ -103,9 +135,13 @@ struct state_libavcodec_decompress {
         struct hw_accel_state hwaccel;
 
         _Bool h264_sps_found; ///< to avoid initial error flood, start decoding after SPS was received
+
+        struct band_convert_state band;
 };
 
 static enum AVPixelFormat get_format_callback(struct AVCodecContext *s, const enum AVPixelFormat *fmt);
+static void draw_horiz_band_callback(struct AVCodecContext *ctx, const AVFrame *src,
+                int offset[AV_NUM_DATA_POINTERS], int y, int type, int height);
 
 static void deconfigure(struct state_libavcodec_decompress *s)
 {
@@ -148,6 +184,9 @@ static void deconfigure(struct state_libavcodec_decompress *s)
 #endif // defined HAVE_SWSCALE
 }
 
+ADD_TO_PARAM("lavd-slice-convert", "* lavd-slice-convert\n"
+                "  Convert decoded slices to the output pixel format while the rest of the frame is decoded\n"
+                "  (codecs supporting draw_horiz_band, not with frame threading or HW acceleration).\n");
 ADD_TO_PARAM("lavd-thread-count", "* lavd-thread-count=<thread_count>[F][S][n]\n"
                 "  Use <thread_count> decoding threads (0 is usually auto).\n"
                 "  Flag 'F' enables frame parallelism (disabled by default), 'S' slice based, can be both (default slice), 'n' for none\n");
@@ -197,6 +236,19 @@ static void set_codec_context_params(struct state_libavcodec_decompress *s)
                 }
         }
 
+        s->band.enabled = false;
+        if (get_commandline_param("lavd-slice-convert") != NULL) {
+                if ((s->codec_ctx->codec->capabilities & AV_CODEC_CAP_DRAW_HORIZ_BAND) == 0) {
+                        log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "Codec doesn't support drawing by slices.\n");
+                } else if ((s->codec_ctx->thread_type & FF_THREAD_FRAME) != 0) {
+                        log_msg(LOG_LEVEL_WARNING, MOD_NAME "Slice conversion cannot be used with frame threading.\n");
+                } else {
+                        s->codec_ctx->draw_horiz_band = draw_horiz_band_callback;
+                        s->codec_ctx->slice_flags = 0; // bands in display order only
+                        s->band.enabled = true;
+                }
+        }
+
         s->codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
 
         // set by decoder
@@ -403,6 +455,8 @@ static void * libavcodec_decompress_init(void)
         s->pkt = av_packet_alloc();
         s->pkt->data = NULL;
         s->pkt->size = 0;
+        pthread_mutex_init(&s->band.lock, NULL);
+        s->band.av_fmt = AV_PIX_FMT_NONE; // 0 would be AV_PIX_FMT_YUV420P
 
         hwaccel_state_init(&s->hwaccel);
 
@@ -665,44 +719,146 @@ static bool lavd_sws_convert_to_buffer(struct state_libavcodec_decompress_sws *s
 }
 #endif
 
-struct convert_task_data {
+static void *convert_task(void *arg) {
+        struct convert_task_data *d = arg;
+        d->convert((char *) d->out_data, d->in_frame, d->width, d->height, d->pitch, d->rgb_shift);
+        return NULL;
+}
+
+struct parallel_convert_data {
         av_to_uv_convert_p convert;
-        unsigned char *out_data;
-        AVFrame *in_frame;
+        char *dst;
+        AVFrame *in;
+        int log2_chroma_h;
         int width;
-        int height;
         int pitch;
         const int *rgb_shift;
 };
 
-static void *convert_task(void *arg) {
-        struct convert_task_data *d = arg;
-        d->convert((char *) d->out_data, d->in_frame, d->width, d->height, d->pitch, d->rgb_shift);
-        return NULL;
+static void parallel_convert_stripe(void *arg, int y_start, int y_end) {
+        struct parallel_convert_data *d = arg;
+        AVFrame part;
+        memcpy(part.linesize, d->in->linesize, sizeof d->in->linesize);
+        for (int plane = 0; plane < AV_NUM_DATA_POINTERS; ++plane) {
+                part.data[plane] = d->in->data[plane];
+                if (d->in->data[plane] == NULL) {
+                        break;
+                }
+                part.data[plane] += (y_start * d->in->linesize[plane]) >> (plane == 0 ? 0 : d->log2_chroma_h);
+        }
+        d->convert(d->dst + (size_t) y_start * d->pitch, &part, d->width, y_end - y_start, d->pitch, d->rgb_shift);
 }
 
 static void parallel_convert(av_to_uv_convert_p convert, char *dst, AVFrame *in, int width, int height, int pitch, int rgb_shift[static restrict 3]) {
-        int cpu_count = get_cpu_core_count();
-
-        struct convert_task_data d[cpu_count];
-        AVFrame parts[cpu_count];
-        for (int i = 0; i < cpu_count; ++i) {
-                int row_height = (height / cpu_count) & ~1; // needs to be even
-                unsigned char *part_dst = (unsigned char *) dst + i * row_height * pitch;
-                memcpy(parts[i].linesize, in->linesize, sizeof in->linesize);
-                const AVPixFmtDescriptor *fmt_desc = av_pix_fmt_desc_get(in->format);
-                for (int plane = 0; plane < AV_NUM_DATA_POINTERS; ++plane) {
-                        if (in->data[plane] == NULL) {
-                                break;
-                        }
-                        parts[i].data[plane] = in->data[plane] + ((i * row_height * in->linesize[plane]) >> (plane == 0 ? 0 : fmt_desc->log2_chroma_h));
-                }
-                if (i == cpu_count - 1) {
-                        row_height = height - row_height * (cpu_count - 1);
+        const AVPixFmtDescriptor *fmt_desc = av_pix_fmt_desc_get(in->format);
+        struct parallel_convert_data d = { convert, dst, in, fmt_desc->log2_chroma_h, width, pitch, rgb_shift };
+        // the conversions process 2 lines at once for 4:2:0 so keep the stripes even regardless of the subsampling
+        parallel_conv_run(height, MAX(2, 1 << fmt_desc->log2_chroma_h), parallel_convert_stripe, &d, get_cpu_core_count());
+}
+
+static av_to_uv_convert_p get_band_convert(enum AVPixelFormat av_fmt, codec_t out_codec) {
+        const AVPixFmtDescriptor *fmt_desc = av_pix_fmt_desc_get(av_fmt);
+        if (fmt_desc == NULL || (fmt_desc->flags & AV_PIX_FMT_FLAG_HWACCEL) != 0 || codec_is_const_size(out_codec)) {
+                return NULL;
+        }
+        return get_av_to_uv_conversion(av_fmt, out_codec);
+}
+
+/**
+ * Called by the decoder when rows [y, y + height) of the picture are final.
+ * The rows not yet converted are handed over to a worker thread. If the bands
+ * do not form a single consecutive picture, the whole frame is converted
+ * after decoding as usual.
+ */
+static void draw_horiz_band_callback(struct AVCodecContext *ctx, const AVFrame *src,
+                int offset[AV_NUM_DATA_POINTERS], int y, int type, int height)
+{
+        UNUSED(offset), UNUSED(type);
+        struct state_libavcodec_decompress *s = ctx->opaque;
+        struct band_convert_state *b = &s->band;
+
+        pthread_mutex_lock(&b->lock);
+        if (b->dst == NULL || b->invalid || src == NULL) {
+                goto out;
+        }
+        if (b->frame_data == NULL) {
+                b->frame_data = src->data[0];
+        }
+        if (src->format != b->av_fmt) {
+                b->av_fmt = src->format;
+                b->convert = get_band_convert(src->format, s->out_codec);
+        }
+        if (b->frame_data != src->data[0] || b->convert == NULL || y > b->next_row) {
+                b->invalid = true;
+                goto out;
+        }
+
+        int end = MIN(y + height, (int) s->desc.height);
+        if (end < (int) s->desc.height) {
+                end &= ~1; // chroma rows
+        }
+        int start = b->next_row;
+        if (end <= start) {
+                goto out;
+        }
+        const AVPixFmtDescriptor *fmt_desc = av_pix_fmt_desc_get(src->format);
+        int idx = MIN(b->count, MAX_BANDS - 1);
+        AVFrame *part = &b->parts[idx];
+        memcpy(part->linesize, src->linesize, sizeof src->linesize);
+        for (int plane = 0; plane < AV_NUM_DATA_POINTERS; ++plane) {
+                if (src->data[plane] == NULL) {
+                        break;
                 }
-                d[i] = (struct convert_task_data){convert, part_dst, &parts[i], width, row_height, pitch, rgb_shift};
+                part->data[plane] = src->data[plane] + ((start * src->linesize[plane]) >> (plane == 0 ? 0 : fmt_desc->log2_chroma_h));
+        }
+        b->tasks[idx] = (struct convert_task_data){ b->convert, b->dst + start * s->pitch, part,
+                s->desc.width, end - start, s->pitch, s->rgb_shift };
+        if (b->count < MAX_BANDS - 1) {
+                b->handles[idx] = task_run_async(convert_task, &b->tasks[idx]);
+                b->count += 1;
+        } else { // out of slots, convert synchronously
+                convert_task(&b->tasks[idx]);
         }
-        task_run_parallel(convert_task, cpu_count, d, sizeof d[0], NULL);
+        b->next_row = end;
+out:
+        pthread_mutex_unlock(&b->lock);
+}
+
+static void band_convert_begin(struct state_libavcodec_decompress *s, unsigned char *dst) {
+        if (!s->band.enabled || s->out_codec == VIDEO_CODEC_NONE) {
+                return;
+        }
+        pthread_mutex_lock(&s->band.lock);
+        s->band.dst = dst;
+        s->band.frame_data = NULL;
+        s->band.next_row = 0;
+        s->band.invalid = false;
+        s->band.count = 0;
+        // out_codec may have changed by reconfiguration, look the conversion up again
+        s->band.av_fmt = AV_PIX_FMT_NONE;
+        s->band.convert = NULL;
+        pthread_mutex_unlock(&s->band.lock);
+}
+
+/**
+ * Waits for pending band conversions.
+ * @retval true if out was completely converted by bands
+ */
+static bool band_convert_finish(struct state_libavcodec_decompress *s, const AVFrame *out) {
+        pthread_mutex_lock(&s->band.lock);
+        int count = s->band.count;
+        bool complete = s->band.dst != NULL && !s->band.invalid && out != NULL
+                && s->band.next_row >= (int) s->desc.height && s->band.frame_data == out->data[0];
+        s->band.dst = NULL;
+        s->band.count = 0;
+        pthread_mutex_unlock(&s->band.lock);
+        for (int i = 0; i < count; ++i) {
+                wait_task(s->band.handles[i]);
+        }
+        if (count > 0) {
+                log_msg(LOG_LEVEL_DEBUG, MOD_NAME "Frame %sconverted in %d bands.\n", complete ? "" : "NOT ", count);
+        }
+        return complete;
 }
 
 /**
@@ -828,10 +984,9 @@ static _Bool check_first_h264_sps(struct state_libavcodec_decompress *s, unsigne
         return 0;
 }
 
-static decompress_status libavcodec_decompress(void *state, unsigned char *dst, unsigned char *src,
+static decompress_status libavcodec_decompress_frame(struct state_libavcodec_decompress *s, unsigned char *dst, unsigned char *src,
                 unsigned int src_len, int frame_seq, struct video_frame_callbacks *callbacks, codec_t *internal_codec)
 {
-        struct state_libavcodec_decompress *s = (struct state_libavcodec_decompress *) state;
         int got_frame = 0;
         decompress_status res = DECODER_NO_FRAME;
 
@@ -936,7 +1091,8 @@ static decompress_status libavcodec_decompress(void *state, unsigned char *dst,
 #endif
 
                                 if (s->out_codec != VIDEO_CODEC_NONE) {
-                                        bool ret = change_pixfmt(s->frame, dst, s->frame->format, s->out_codec, s->desc.width,
+                                        bool ret = band_convert_finish(s, s->frame) ||
+                                                change_pixfmt(s->frame, dst, s->frame->format, s->out_codec, s->desc.width,
                                                         s->desc.height, s->pitch, s->rgb_shift, &s->sws);
                                         if(ret == TRUE) {
                                                 s->last_frame_seq_initialized = true;
@@ -994,6 +1150,16 @@ static decompress_status libavcodec_decompress(void *state, unsigned char *dst,
         return res;
 }
 
+static decompress_status libavcodec_decompress(void *state, unsigned char *dst, unsigned char *src,
+                unsigned int src_len, int frame_seq, struct video_frame_callbacks *callbacks, codec_t *internal_codec)
+{
+        struct state_libavcodec_decompress *s = (struct state_libavcodec_decompress *) state;
+        band_convert_begin(s, dst);
+        decompress_status res = libavcodec_decompress_frame(s, dst, src, src_len, frame_seq, callbacks, internal_codec);
+        band_convert_finish(s, NULL);
+        return res;
+}
+
 ADD_TO_PARAM("lavd-accept-corrupted",
                 "* lavd-accept-corrupted[=no]\n"
                 "  Pass corrupted frames to decoder. If decoder isn't error-resilient,\n"
@@ -1035,6 +1201,7 @@ static void libavcodec_decompress_done(void *state)
                 (struct state_libavcodec_decompress *) state;
 
         deconfigure(s);
+        pthread_mutex_destroy(&s->band.lock);
 
         free(s);
 }
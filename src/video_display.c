@@ -328,9 +328,10 @@ static struct response *process_message(struct display *d, struct msg_universal
 /**
  * @brief Returns video framebuffer which will be written to.
  *
- * Currently there is a restriction on number of concurrently acquired frames - only one frame
- * can be hold at the moment. Every obtained frame from this call has to be returned back
- * with display_put_frame()
+ * The frames are owned by the display (they may be eg. mapped device memory), so the
+ * decoder should write the data directly into them. By default, only one frame can be
+ * held at the moment, display may allow more with @ref DISPLAY_PROPERTY_BUFFER_POOL.
+ * Every obtained frame from this call has to be returned back with display_put_frame()
  *
  * @return               video frame
  */
@@ -510,6 +511,10 @@ int display_ctl_property(struct display *d, int property, void *val, size_t *len
                         *(int *) val = PITCH_DEFAULT;
                         *len = sizeof(int);
                         return TRUE;
+                case DISPLAY_PROPERTY_BUFFER_POOL: // postprocessor owns single input frame
+                        *(int *) val = 1;
+                        *len = sizeof(int);
+                        return TRUE;
 		case DISPLAY_PROPERTY_CODECS:
 			{
                                 codec_t display_codecs[VIDEO_CODEC_COUNT];
@@ -131,6 +131,8 @@ enum display_property {
         DISPLAY_PROPERTY_SUPPORTS_MULTI_SOURCES = 5, ///< whether display supports receiving data from - returns (struct multi_sources_supp_info *)
                                                      ///< multiple network sources concurrently
         DISPLAY_PROPERTY_AUDIO_FORMAT = 6, ///< @see audio_display_info::query_format - in/out parameter is struct audio_desc
+        DISPLAY_PROPERTY_BUFFER_POOL = 7, ///< number of frames from the display-owned pool that may be held concurrently - int,
+                                          ///< (obtained by display_get_frame() and not yet put), 1 if not supported
 };
 
 #define PITCH_DEFAULT -1 ///< default pitch, i. e. respective linesize
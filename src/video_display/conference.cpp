@@ -47,8 +47,12 @@
 #include "module.h"
 #include "utils/misc.h"
 #include "utils/sv_parse_num.hpp"
+#include "utils/worker.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <cmath>
 #include <condition_variable>
 #include <chrono>
 #include <cstdint>
@@ -59,17 +63,14 @@
 #include <queue>
 #include <thread>
 #include <string_view>
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wcast-align"
-#pragma GCC diagnostic ignored "-Wcast-qual"
-#include <opencv2/core/mat.hpp>
-#include <opencv2/imgproc.hpp>
-#pragma GCC diagnostic pop
+#include <vector>
 
 #ifdef __SSSE3__
 #include "tmmintrin.h"
 #endif
+#ifdef __AVX2__
+#include "immintrin.h"
+#endif
 
 #include "utils/profile_timer.hpp"
 
@@ -81,31 +82,122 @@ using clock = std::chrono::steady_clock;
 struct frame_deleter{ void operator()(video_frame *f){ vf_free(f); } };
 using unique_frame = std::unique_ptr<video_frame, frame_deleter>;
 
+/*
+ * The mixed picture is kept in a UYVY canvas split into tiles rendered in
+ * parallel. Participants are scaled bilinearly directly from the received
+ * format - each source row segment needed by a tile is unpacked to 8-bit luma
+ * and interleaved chroma, scaled horizontally (Q6) and the two neighbouring
+ * scaled rows are blended vertically (Q15 weight).
+ */
+constexpr unsigned TILE_WIDTH = 512;
+constexpr unsigned TILE_HEIGHT = 64;
+constexpr int H_WEIGHT_ONE = 64;    ///< horizontal weights are Q6 (fit signed byte for maddubs)
+constexpr int V_WEIGHT_ONE = 32768; ///< vertical weights are Q15 (mulhrs)
+constexpr unsigned SCRATCH_PADDING = 64;
+
+struct Tile{
+        unsigned x;
+        unsigned y;
+        unsigned w;
+        unsigned h;
+};
+
+/// per-thread buffers of the tile renderer
+struct Render_scratch{
+        void reserve(unsigned max_src_w);
+        void reset(unsigned begin, unsigned end);
+
+        unsigned seg_begin = 0; ///< first source pixel of the unpacked row segment
+        unsigned seg_end = 0;
+        std::vector<unsigned char> src_luma;   ///< unpacked source row segment
+        std::vector<unsigned char> src_chroma; ///< unpacked source row segment (interleaved U, V)
+        int src_luma_row = -1;
+        int src_chroma_row = -1;
+
+        std::vector<int16_t> luma_rows[2];     ///< horizontally scaled source rows (Q6)
+        std::vector<int16_t> chroma_rows[2];
+        int luma_row_idx[2] = { -1, -1 };
+        int chroma_row_idx[2] = { -1, -1 };
+
+        std::vector<unsigned char> out_luma;
+        std::vector<unsigned char> out_chroma;
+};
+
+void Render_scratch::reserve(unsigned max_src_w){
+        if(src_luma.size() < max_src_w + SCRATCH_PADDING){
+                src_luma.resize(max_src_w + SCRATCH_PADDING);
+                src_chroma.resize(max_src_w + SCRATCH_PADDING);
+        }
+        if(out_luma.empty()){
+                for(int i = 0; i < 2; i++){
+                        luma_rows[i].resize(TILE_WIDTH);
+                        chroma_rows[i].resize(TILE_WIDTH);
+                }
+                out_luma.resize(TILE_WIDTH);
+                out_chroma.resize(TILE_WIDTH);
+        }
+}
+
+void Render_scratch::reset(unsigned begin, unsigned end){
+        seg_begin = begin;
+        seg_end = end;
+        src_luma_row = src_chroma_row = -1;
+        luma_row_idx[0] = luma_row_idx[1] = -1;
+        chroma_row_idx[0] = chroma_row_idx[1] = -1;
+}
+
 struct Participant{
-        void to_cv_frame();
-        void frame_recieved(unique_frame &&f);
+        bool frame_recieved(unique_frame &&f);
         void set_pos_keep_aspect(int x, int y, int w, int h);
+        bool prepare();
+        void render(unsigned char *canvas, size_t linesize, const Tile& t, Render_scratch& s) const;
 
-        unique_frame frame;
+        unique_frame frame; ///< last received frame, kept for re-rendering after layout change
+        bool needs_render = false; ///< frame or position changed since last get_mixed()
         clock::time_point last_time_recieved;
         unsigned src_w = 0;
         unsigned src_h = 0;
+        codec_t src_codec = VIDEO_CODEC_NONE;
 
         unsigned x = 0;
         unsigned y = 0;
         unsigned width = 0;
         unsigned height = 0;
 
-        cv::Mat luma;
-        cv::Mat chroma;
+private:
+        void fetch_luma(Render_scratch& s, int row) const;
+        void fetch_chroma(Render_scratch& s, int row) const;
+        const int16_t *scaled_luma_row(Render_scratch& s, int row, int other_row, unsigned ox, unsigned n) const;
+        const int16_t *scaled_chroma_row(Render_scratch& s, int row, int other_row, unsigned ox, unsigned n) const;
+
+        bool maps_valid = false;
+        std::vector<int> luma_x;          ///< first source sample of each output sample
+        std::vector<int> chroma_x;
+        std::vector<int> luma_y;
+        std::vector<int> chroma_y;
+        std::vector<uint32_t> luma_xw;    ///< Q6 weights of the 2 source samples as bytes (0, 1)
+        std::vector<uint32_t> chroma_xw;  ///< Q6 weights as bytes (0, 1) for U and (2, 3) for V
+        std::vector<int16_t> luma_yw;     ///< Q15 weight of the second source row
+        std::vector<int16_t> chroma_yw;
 };
 
-void Participant::frame_recieved(unique_frame &&f){
+/**
+ * @retval true  source format changed, position needs to be recomputed
+ */
+bool Participant::frame_recieved(unique_frame &&f){
         frame = std::move(f);
         last_time_recieved = clock::now();
 
+        bool changed = src_w != frame->tiles[0].width || src_h != frame->tiles[0].height
+                        || src_codec != frame->color_spec;
+        if(changed){
+                maps_valid = false;
+        }
         src_w = frame->tiles[0].width;
         src_h = frame->tiles[0].height;
+        src_codec = frame->color_spec;
+        needs_render = true;
+        return changed;
 }
 
 void Participant::set_pos_keep_aspect(int x, int y, int w, int h){
@@ -122,49 +214,120 @@ void Participant::set_pos_keep_aspect(int x, int y, int w, int h){
                 y += (h - height) / 2;
         }
 
-        this->x = x;
+        // keep UYVY macropixels whole
+        this->x = x & ~1;
         this->y = y;
+        width &= ~1U;
+        maps_valid = false;
+        needs_render = true;
 }
 
-void Participant::to_cv_frame(){
-        if(!frame)
-                return;
+/**
+ * Computes bilinear sampling positions (pixel centers aligned) of dst_len
+ * samples scaled from src_len samples.
+ *
+ * @param[out] weight  weight of the sample following idx in 1/one units
+ */
+void compute_scale_map(unsigned dst_len, unsigned src_len, int one, std::vector<int>& idx, std::vector<int>& weight){
+        idx.resize(dst_len);
+        weight.resize(dst_len);
+        const double scale = static_cast<double>(src_len) / dst_len;
+        for(unsigned i = 0; i < dst_len; i++){
+                double pos = std::max((i + 0.5) * scale - 0.5, 0.0);
+                int first = static_cast<int>(pos);
+                int w = static_cast<int>(lround((pos - first) * one));
+                if(w == one){
+                        first += 1;
+                        w = 0;
+                }
+                if(first >= static_cast<int>(src_len) - 1){
+                        first = src_len - 1;
+                        w = 0;
+                }
+                idx[i] = first;
+                weight[i] = w;
+        }
+}
 
-        assert(frame->color_spec == UYVY);
+/**
+ * Computes the scaling maps if the source or the position changed.
+ *
+ * @retval false  nothing to render
+ */
+bool Participant::prepare(){
+        if(!frame || width == 0 || height == 0)
+                return false;
         assert(frame->tile_count == 1);
+        if(maps_valid)
+                return true;
+
+        std::vector<int> w;
+        compute_scale_map(width, src_w, H_WEIGHT_ONE, luma_x, w);
+        luma_xw.resize(width);
+        for(unsigned i = 0; i < width; i++){
+                luma_xw[i] = (H_WEIGHT_ONE - w[i]) | w[i] << 8;
+        }
+        compute_scale_map(width / 2, (src_w + 1) / 2, H_WEIGHT_ONE, chroma_x, w);
+        chroma_xw.resize(width / 2);
+        for(unsigned i = 0; i < width / 2; i++){
+                chroma_xw[i] = ((H_WEIGHT_ONE - w[i]) | w[i] << 8) * 0x10001U;
+        }
 
-        PROFILE_FUNC;
-
-        auto& frame_tile = frame->tiles[0];
-        luma.create(cv::Size(frame_tile.width, frame_tile.height), CV_8UC1);
-        chroma.create(cv::Size(frame_tile.width / 2, frame_tile.height), CV_8UC2);
-
-        assert(luma.isContinuous() && chroma.isContinuous());
-        unsigned char *src = reinterpret_cast<unsigned char *>(frame_tile.data);
-        unsigned char *luma_dst = luma.ptr(0);
-        unsigned char *chroma_dst = chroma.ptr(0);
+        compute_scale_map(height, src_h, V_WEIGHT_ONE, luma_y, w);
+        luma_yw.assign(w.begin(), w.end());
+        if(src_codec == I420){
+                compute_scale_map(height, (src_h + 1) / 2, V_WEIGHT_ONE, chroma_y, w);
+                chroma_yw.assign(w.begin(), w.end());
+        } else {
+                chroma_y = luma_y;
+                chroma_yw = luma_yw;
+        }
 
-        unsigned src_len = frame_tile.data_len;
+        maps_valid = true;
+        return true;
+}
 
-#ifdef __SSSE3__
+/**
+ * Splits packed UYVY to a luma and an interleaved chroma plane
+ */
+static void uyvy_to_planes(unsigned char *luma_dst, unsigned char *chroma_dst, const unsigned char *src, size_t src_len){
+#ifdef __AVX2__
+        const __m256i y_shuff = _mm256_set_epi8(14, 12, 10, 8, 6, 4, 2, 0, 15, 13, 11, 9, 7, 5, 3, 1,
+                        14, 12, 10, 8, 6, 4, 2, 0, 15, 13, 11, 9, 7, 5, 3, 1);
+        while(src_len >= 64){
+                // each 128-bit lane -> 8 luma bytes (low qword) and 8 chroma bytes (high qword)
+                __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(const void *) src), y_shuff);
+                __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(const void *) (src + 32)), y_shuff);
+                src += 64;
+                a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(3, 1, 2, 0));
+                b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(3, 1, 2, 0));
+
+                _mm256_storeu_si256((__m256i *)(void *) luma_dst, _mm256_permute2x128_si256(a, b, 0x20));
+                luma_dst += 32;
+                _mm256_storeu_si256((__m256i *)(void *) chroma_dst, _mm256_permute2x128_si256(a, b, 0x31));
+                chroma_dst += 32;
+
+                src_len -= 64;
+        }
+#elif defined __SSSE3__
         __m128i uv_shuff = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 14, 12, 10, 8, 6, 4, 2, 0);
         __m128i y_shuff = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 15, 13, 11, 9, 7, 5, 3, 1);
         while(src_len >= 32){
-                __m128i uyvy = _mm_lddqu_si128((__m128i *)(void *) src);
+                __m128i uyvy = _mm_lddqu_si128((const __m128i *)(const void *) src);
                 src += 16;
 
                 __m128i y_low = _mm_shuffle_epi8(uyvy, y_shuff);
                 __m128i uv_low = _mm_shuffle_epi8(uyvy, uv_shuff);
                 
-                uyvy = _mm_lddqu_si128((__m128i *)(void *) src);
+                uyvy = _mm_lddqu_si128((const __m128i *)(const void *) src);
                 src += 16;
 
                 __m128i y_high = _mm_shuffle_epi8(uyvy, y_shuff);
                 __m128i uv_high = _mm_shuffle_epi8(uyvy, uv_shuff);
 
-                _mm_store_si128((__m128i *)(void *) luma_dst, _mm_or_si128(y_low, _mm_bslli_si128(y_high, 8)));
+                _mm_storeu_si128((__m128i *)(void *) luma_dst, _mm_or_si128(y_low, _mm_bslli_si128(y_high, 8)));
                 luma_dst += 16;
-                _mm_store_si128((__m128i *)(void *) chroma_dst, _mm_or_si128(uv_low, _mm_bslli_si128(uv_high, 8)));
+                _mm_storeu_si128((__m128i *)(void *) chroma_dst, _mm_or_si128(uv_low, _mm_bslli_si128(uv_high, 8)));
                 chroma_dst += 16;
 
                 src_len -= 32;
@@ -181,6 +344,316 @@ void Participant::to_cv_frame(){
         }
 }
 
+/**
+ * Unpacks v210 (6 pixels in 16 B) to 8-bit luma and interleaved chroma plane.
+ * Destination buffers need 2 B of padding.
+ */
+static void v210_to_planes(unsigned char *luma_dst, unsigned char *chroma_dst, const unsigned char *src, size_t groups){
+#ifdef __SSSE3__
+        // 32-bit words hold Cb0 Y0 Cr0 | Y1 Cb2 Y2 | Cr2 Y3 Cb4 | Y4 Cr4 Y5, moved to bytes 0-2 of each word
+        const __m128i y_shuff = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14, 12, 9, 6, 4, 1);
+        const __m128i uv_shuff = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 13, 10, 8, 5, 2, 0);
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        while(groups > 0){
+                __m128i w = _mm_loadu_si128((const __m128i *)(const void *) src);
+                src += 16;
+                __m128i b = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(w, 2), mask),
+                                _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(w, 12), mask), 8),
+                                        _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(w, 22), mask), 16)));
+                _mm_storel_epi64((__m128i *)(void *) luma_dst, _mm_shuffle_epi8(b, y_shuff));
+                _mm_storel_epi64((__m128i *)(void *) chroma_dst, _mm_shuffle_epi8(b, uv_shuff));
+                luma_dst += 6;
+                chroma_dst += 6;
+                groups -= 1;
+        }
+#else
+        while(groups > 0){
+                uint32_t w[4];
+                memcpy(w, src, sizeof w);
+                src += 16;
+                unsigned char f[12];
+                for(int i = 0; i < 4; i++){
+                        f[3 * i] = (w[i] >> 2) & 0xFF;
+                        f[3 * i + 1] = (w[i] >> 12) & 0xFF;
+                        f[3 * i + 2] = (w[i] >> 22) & 0xFF;
+                }
+                const int y_idx[] = { 1, 3, 5, 7, 9, 11 };
+                const int uv_idx[] = { 0, 2, 4, 6, 8, 10 };
+                for(int i = 0; i < 6; i++){
+                        *luma_dst++ = f[y_idx[i]];
+                        *chroma_dst++ = f[uv_idx[i]];
+                }
+                groups -= 1;
+        }
+#endif
+}
+
+/**
+ * Interleaves I420 U and V row to the chroma plane
+ */
+static void uv_interleave(unsigned char *chroma_dst, const unsigned char *u, const unsigned char *v, size_t count){
+#ifdef __SSSE3__
+        while(count >= 16){
+                __m128i uu = _mm_loadu_si128((const __m128i *)(const void *) u);
+                __m128i vv = _mm_loadu_si128((const __m128i *)(const void *) v);
+                _mm_storeu_si128((__m128i *)(void *) chroma_dst, _mm_unpacklo_epi8(uu, vv));
+                _mm_storeu_si128((__m128i *)(void *) (chroma_dst + 16), _mm_unpackhi_epi8(uu, vv));
+                u += 16;
+                v += 16;
+                chroma_dst += 32;
+                count -= 16;
+        }
+#endif
+        while(count-- > 0){
+                *chroma_dst++ = *u++;
+                *chroma_dst++ = *v++;
+        }
+}
+
+/**
+ * Horizontal bilinear pass of 8-bit luma, output in Q6
+ *
+ * @param off  source pixel index of src[0]
+ */
+static void hscale_luma(int16_t *dst, const unsigned char *src, const int *idx, const uint32_t *w, unsigned n, int off){
+        unsigned i = 0;
+#ifdef __AVX2__
+        const __m256i offset = _mm256_set1_epi32(off);
+        for(; i + 16 <= n; i += 16){
+                // 32-bit gather at the first sample - bytes 0 and 1 are the source pair, weights of bytes 2, 3 are 0
+                __m256i a = _mm256_i32gather_epi32((const int *)(const void *) src,
+                                _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(const void *) (idx + i)), offset), 1);
+                __m256i b = _mm256_i32gather_epi32((const int *)(const void *) src,
+                                _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(const void *) (idx + i + 8)), offset), 1);
+                a = _mm256_maddubs_epi16(a, _mm256_loadu_si256((const __m256i *)(const void *) (w + i)));
+                b = _mm256_maddubs_epi16(b, _mm256_loadu_si256((const __m256i *)(const void *) (w + i + 8)));
+                _mm256_storeu_si256((__m256i *)(void *) (dst + i),
+                                _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+#endif
+        for(; i < n; i++){
+                const unsigned char *s = src + idx[i] - off;
+                dst[i] = s[0] * (w[i] & 0xFF) + s[1] * (w[i] >> 8 & 0xFF);
+        }
+}
+
+/**
+ * Horizontal bilinear pass of interleaved 8-bit chroma, output interleaved in Q6
+ *
+ * @param n    number of chroma sample pairs
+ * @param off  source chroma pair index of src[0]
+ */
+static void hscale_chroma(int16_t *dst, const unsigned char *src, const int *idx, const uint32_t *w, unsigned n, int off){
+        unsigned i = 0;
+#ifdef __AVX2__
+        const __m256i offset = _mm256_set1_epi32(off);
+        const __m256i u_v_shuff = _mm256_set_epi8(15, 13, 14, 12, 11, 9, 10, 8, 7, 5, 6, 4, 3, 1, 2, 0,
+                        15, 13, 14, 12, 11, 9, 10, 8, 7, 5, 6, 4, 3, 1, 2, 0);
+        for(; i + 8 <= n; i += 8){
+                // U0 V0 U1 V1 -> U0 U1 V0 V1
+                __m256i vindex = _mm256_slli_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(const void *) (idx + i)), offset), 1);
+                __m256i a = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)(const void *) src, vindex, 1), u_v_shuff);
+                _mm256_storeu_si256((__m256i *)(void *) (dst + 2 * i),
+                                _mm256_maddubs_epi16(a, _mm256_loadu_si256((const __m256i *)(const void *) (w + i))));
+        }
+#endif
+        for(; i < n; i++){
+                const unsigned char *s = src + 2 * (idx[i] - off);
+                const unsigned w0 = w[i] & 0xFF;
+                const unsigned w1 = w[i] >> 8 & 0xFF;
+                dst[2 * i] = s[0] * w0 + s[2] * w1;
+                dst[2 * i + 1] = s[1] * w0 + s[3] * w1;
+        }
+}
+
+/**
+ * Vertical bilinear pass of two horizontally scaled rows (Q6) to 8 bits
+ *
+ * @param w  Q15 weight of row b
+ */
+static void vblend(unsigned char *dst, const int16_t *a, const int16_t *b, int16_t w, unsigned n){
+        unsigned i = 0;
+#ifdef __AVX2__
+        const __m256i weight = _mm256_set1_epi16(w);
+        const __m256i round = _mm256_set1_epi16(H_WEIGHT_ONE / 2);
+        for(; i + 32 <= n; i += 32){
+                __m256i a0 = _mm256_loadu_si256((const __m256i *)(const void *) (a + i));
+                __m256i a1 = _mm256_loadu_si256((const __m256i *)(const void *) (a + i + 16));
+                __m256i b0 = _mm256_loadu_si256((const __m256i *)(const void *) (b + i));
+                __m256i b1 = _mm256_loadu_si256((const __m256i *)(const void *) (b + i + 16));
+                __m256i v0 = _mm256_add_epi16(a0, _mm256_mulhrs_epi16(_mm256_sub_epi16(b0, a0), weight));
+                __m256i v1 = _mm256_add_epi16(a1, _mm256_mulhrs_epi16(_mm256_sub_epi16(b1, a1), weight));
+                v0 = _mm256_srai_epi16(_mm256_add_epi16(v0, round), 6);
+                v1 = _mm256_srai_epi16(_mm256_add_epi16(v1, round), 6);
+                _mm256_storeu_si256((__m256i *)(void *) (dst + i),
+                                _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+#endif
+        for(; i < n; i++){
+                int v = a[i] + (((b[i] - a[i]) * w + (1 << 14)) >> 15);
+                dst[i] = std::clamp((v + H_WEIGHT_ONE / 2) >> 6, 0, 255);
+        }
+}
+
+/**
+ * Merges luma and interleaved chroma plane back to UYVY
+ */
+static void planes_to_uyvy(unsigned char *dst, const unsigned char *luma_src, const unsigned char *chroma_src, size_t dst_len){
+#ifdef __AVX2__
+        while(dst_len >= 64){
+                __m256i luma = _mm256_loadu_si256((const __m256i *)(const void *) luma_src);
+                luma_src += 32;
+                __m256i chroma = _mm256_loadu_si256((const __m256i *)(const void *) chroma_src);
+                chroma_src += 32;
+
+                __m256i lo = _mm256_unpacklo_epi8(chroma, luma);
+                __m256i hi = _mm256_unpackhi_epi8(chroma, luma);
+                _mm256_storeu_si256((__m256i *)(void *) dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+                _mm256_storeu_si256((__m256i *)(void *) (dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+                dst += 64;
+
+                dst_len -= 64;
+        }
+#elif defined __SSSE3__
+        while(dst_len >= 32){
+                __m128i luma = _mm_loadu_si128((const __m128i *)(const void *) luma_src);
+                luma_src += 16;
+                __m128i chroma = _mm_loadu_si128((const __m128i *)(const void *) chroma_src);
+                chroma_src += 16;
+
+                _mm_storeu_si128((__m128i *)(void *) dst, _mm_unpacklo_epi8(chroma, luma));
+                _mm_storeu_si128((__m128i *)(void *) (dst + 16), _mm_unpackhi_epi8(chroma, luma));
+                dst += 32;
+
+                dst_len -= 32;
+        }
+#endif
+
+        while(dst_len >= 4){
+                *dst++ = *chroma_src++;
+                *dst++ = *luma_src++;
+                *dst++ = *chroma_src++;
+                *dst++ = *luma_src++;
+
+                dst_len -= 4;
+        }
+}
+
+/**
+ * Unpacks source row segment [s.seg_begin, s.seg_end) of luma (and chroma
+ * for 4:2:2 formats)
+ */
+void Participant::fetch_luma(Render_scratch& s, int row) const{
+        const unsigned char *src = reinterpret_cast<const unsigned char *>(frame->tiles[0].data);
+        const unsigned end = std::min(s.seg_end, src_w);
+        switch(src_codec){
+        case UYVY:
+                uyvy_to_planes(s.src_luma.data(), s.src_chroma.data(),
+                                src + row * vc_get_linesize(src_w, UYVY) + s.seg_begin * 2,
+                                (end - s.seg_begin) * 2 & ~3U);
+                s.src_chroma_row = row;
+                break;
+        case v210:
+                v210_to_planes(s.src_luma.data(), s.src_chroma.data(),
+                                src + row * vc_get_linesize(src_w, v210) + s.seg_begin / 6 * 16,
+                                (s.seg_end - s.seg_begin) / 6);
+                s.src_chroma_row = row;
+                break;
+        case I420:
+                memcpy(s.src_luma.data(), src + (size_t) row * src_w + s.seg_begin, end - s.seg_begin);
+                break;
+        default:
+                assert("Unsupported codec" && false);
+        }
+        s.src_luma_row = row;
+}
+
+void Participant::fetch_chroma(Render_scratch& s, int row) const{
+        if(src_codec != I420){
+                fetch_luma(s, row);
+                return;
+        }
+        const unsigned char *src = reinterpret_cast<const unsigned char *>(frame->tiles[0].data);
+        const size_t chroma_w = (src_w + 1) / 2;
+        const size_t chroma_h = (src_h + 1) / 2;
+        const unsigned char *u = src + (size_t) src_w * src_h + row * chroma_w + s.seg_begin / 2;
+        const unsigned char *v = u + chroma_w * chroma_h;
+        uv_interleave(s.src_chroma.data(), u, v, std::min<size_t>(s.seg_end / 2, chroma_w) - s.seg_begin / 2);
+        s.src_chroma_row = row;
+}
+
+/**
+ * @returns source row scaled horizontally, the slot holding other_row is kept
+ */
+const int16_t *Participant::scaled_luma_row(Render_scratch& s, int row, int other_row, unsigned ox, unsigned n) const{
+        for(int i = 0; i < 2; i++){
+                if(s.luma_row_idx[i] == row)
+                        return s.luma_rows[i].data();
+        }
+        const int slot = s.luma_row_idx[0] == other_row ? 1 : 0;
+        if(s.src_luma_row != row)
+                fetch_luma(s, row);
+        hscale_luma(s.luma_rows[slot].data(), s.src_luma.data(), luma_x.data() + ox, luma_xw.data() + ox, n, s.seg_begin);
+        s.luma_row_idx[slot] = row;
+        return s.luma_rows[slot].data();
+}
+
+/// @copydoc scaled_luma_row
+const int16_t *Participant::scaled_chroma_row(Render_scratch& s, int row, int other_row, unsigned ox, unsigned n) const{
+        for(int i = 0; i < 2; i++){
+                if(s.chroma_row_idx[i] == row)
+                        return s.chroma_rows[i].data();
+        }
+        const int slot = s.chroma_row_idx[0] == other_row ? 1 : 0;
+        if(s.src_chroma_row != row)
+                fetch_chroma(s, row);
+        hscale_chroma(s.chroma_rows[slot].data(), s.src_chroma.data(), chroma_x.data() + ox / 2, chroma_xw.data() + ox / 2,
+                        n / 2, s.seg_begin / 2);
+        s.chroma_row_idx[slot] = row;
+        return s.chroma_rows[slot].data();
+}
+
+/**
+ * Scales the part of the participant inside the tile to the canvas.
+ * Participants never overlap and tiles are disjoint so this can run
+ * concurrently, prepare() must be called before.
+ */
+void Participant::render(unsigned char *canvas, size_t linesize, const Tile& t, Render_scratch& s) const{
+        const unsigned ix0 = std::max(t.x, x);
+        const unsigned ix1 = std::min(t.x + t.w, x + width) & ~1U;
+        const unsigned iy0 = std::max(t.y, y);
+        const unsigned iy1 = std::min(t.y + t.h, y + height);
+        if(ix0 >= ix1 || iy0 >= iy1)
+                return;
+
+        const unsigned ox = ix0 - x;
+        const unsigned n = ix1 - ix0;
+        // source pixels needed by the luma and chroma samples, aligned to pixel groups
+        const unsigned group = src_codec == v210 ? 6 : 2;
+        const unsigned first = std::min<unsigned>(luma_x[ox], 2 * chroma_x[ox / 2]);
+        const unsigned last = std::max<unsigned>(luma_x[ox + n - 1] + 2, 2 * chroma_x[(ox + n) / 2 - 1] + 4);
+        const unsigned row_end = (src_w + group - 1) / group * group; // do not read past the source line
+        s.reset(first / group * group, std::min((last + group - 1) / group * group, row_end));
+        const int chroma_h = src_codec == I420 ? (src_h + 1) / 2 : src_h;
+
+        for(unsigned iy = iy0; iy < iy1; iy++){
+                const unsigned oy = iy - y;
+                const int l0 = luma_y[oy];
+                const int l1 = std::min<int>(l0 + 1, src_h - 1);
+                const int c0 = chroma_y[oy];
+                const int c1 = std::min(c0 + 1, chroma_h - 1);
+                // luma and chroma of the same row one after another - 4:2:2 sources unpack both at once
+                const int16_t *la = scaled_luma_row(s, l0, l1, ox, n);
+                const int16_t *ca = scaled_chroma_row(s, c0, c1, ox, n);
+                const int16_t *lb = scaled_luma_row(s, l1, l0, ox, n);
+                const int16_t *cb = scaled_chroma_row(s, c1, c0, ox, n);
+                vblend(s.out_luma.data(), la, lb, luma_yw[oy], n);
+                vblend(s.out_chroma.data(), ca, cb, chroma_yw[oy], n);
+
+                planes_to_uyvy(canvas + iy * linesize + ix0 * 2, s.out_luma.data(), s.out_chroma.data(), n * 2);
+        }
+}
+
 class Video_mixer{
 public:
         enum class Layout{ Invalid, Tiled, One_big };
@@ -202,6 +675,8 @@ private:
         void recompute_layout();
         void tiled_layout();
         void one_big_layout();
+        void render_tile(unsigned idx, const std::vector<const Participant *>& render_list,
+                        Render_scratch& scratch, unsigned char *dst);
 
         unsigned width;
         unsigned height;
@@ -209,8 +684,11 @@ private:
 
         uint32_t primary_ssrc = 0;
 
-        cv::Mat mixed_luma;
-        cv::Mat mixed_chroma;
+        size_t linesize;
+        std::vector<unsigned char> canvas; ///< UYVY, participants are re-rendered only when changed
+        std::vector<unsigned char> background_line;
+        bool clear_canvas = true; ///< layout changed, whole canvas needs to be redrawn
+        std::vector<Render_scratch> scratch;
 
         std::map<uint32_t, Participant> participants;
 };
@@ -218,10 +696,15 @@ private:
 Video_mixer::Video_mixer(int width, int height, Layout layout):
         width(width),
         height(height),
-        layout(layout)
+        layout(layout),
+        linesize(vc_get_linesize(width, UYVY))
 {
-        mixed_luma.create(cv::Size(width, height), CV_8UC1);
-        mixed_chroma.create(cv::Size(width / 2, height), CV_8UC2);
+        canvas.resize(linesize * height);
+        background_line.resize(linesize);
+        for(size_t i = 0; i + 4 <= linesize; i += 4){
+                const unsigned char black[] = { 128, 16, 128, 16 };
+                memcpy(&background_line[i], black, sizeof black);
+        }
 }
 
 void Video_mixer::tiled_layout(){
@@ -261,13 +744,15 @@ void Video_mixer::one_big_layout(){
 }
 
 void Video_mixer::recompute_layout(){
-        mixed_luma.setTo(16);
-        mixed_chroma.setTo(128);
+        clear_canvas = true;
 
         if(!primary_ssrc && !participants.empty()){
                 primary_ssrc = participants.begin()->first;
         }
 
+        if(participants.empty())
+                return;
+
         if(participants.size() == 1){
                 participants.begin()->second.set_pos_keep_aspect(0, 0, width, height);
                 return;
@@ -289,13 +774,40 @@ void Video_mixer::recompute_layout(){
 void Video_mixer::process_frame(unique_frame&& f){
         auto iter = participants.find(f->ssrc);
         auto& p = participants[f->ssrc];
-        p.frame_recieved(std::move(f));
+        bool desc_changed = p.frame_recieved(std::move(f));
 
-        if(iter == participants.end()){
+        if(iter == participants.end() || desc_changed){
                 recompute_layout();
         }
 }
 
+/**
+ * Redraws the tile if any of the participants to be rendered intersects it
+ * and copies it to the output frame.
+ */
+void Video_mixer::render_tile(unsigned idx, const std::vector<const Participant *>& render_list,
+                Render_scratch& scratch, unsigned char *dst){
+        const unsigned tiles_x = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+        Tile t;
+        t.x = idx % tiles_x * TILE_WIDTH;
+        t.y = idx / tiles_x * TILE_HEIGHT;
+        t.w = std::min(TILE_WIDTH, width - t.x);
+        t.h = std::min(TILE_HEIGHT, height - t.y);
+
+        if(clear_canvas){
+                for(unsigned y = t.y; y < t.y + t.h; y++){
+                        memcpy(canvas.data() + y * linesize + t.x * 2, background_line.data(), t.w * 2);
+                }
+        }
+        for(const auto *p : render_list){
+                p->render(canvas.data(), linesize, t, scratch);
+        }
+
+        for(unsigned y = t.y; y < t.y + t.h; y++){
+                memcpy(dst + y * linesize + t.x * 2, canvas.data() + y * linesize + t.x * 2, t.w * 2);
+        }
+}
+
 void Video_mixer::get_mixed(video_frame *result){
         PROFILE_FUNC;
 
@@ -317,57 +829,49 @@ void Video_mixer::get_mixed(video_frame *result){
         if(recompute)
                 recompute_layout();
 
+        std::vector<const Participant *> render_list;
+        unsigned max_src_w = 0;
         for(auto&& [ssrc, p] : participants){
                 (void) ssrc;
-                p.to_cv_frame();
-
-                PROFILE_DETAIL("resize participant");
-                cv::Size l_size(p.width, p.height);
-                cv::Size c_size(p.width / 2, p.height);
-                cv::resize(p.luma, mixed_luma(cv::Rect(p.x, p.y, p.width, p.height)), l_size, 0, 0);
-                cv::resize(p.chroma, mixed_chroma(cv::Rect(p.x / 2, p.y, p.width / 2, p.height)), c_size, 0, 0);
-                PROFILE_DETAIL("");
+                if(p.needs_render && p.prepare()){
+                        render_list.push_back(&p);
+                        max_src_w = std::max(max_src_w, p.src_w);
+                }
+                p.needs_render = false;
         }
 
-        unsigned char *dst = reinterpret_cast<unsigned char *>(result->tiles[0].data);
-        unsigned char *chroma_src = mixed_chroma.ptr(0);
-        unsigned char *luma_src = mixed_luma.ptr(0);
-        assert(mixed_luma.isContinuous() && mixed_chroma.isContinuous());
-        PROFILE_DETAIL("Convert to ug frame");
-        unsigned dst_len = result->tiles[0].data_len;
-
-#ifdef __SSSE3__
-        __m128i y_shuff = _mm_set_epi8(7, -1, 6, -1, 5, -1, 4, -1, 3, -1, 2, -1, 1, -1, 0, -1);
-        __m128i uv_shuff = _mm_set_epi8(-1, 7, -1, 6, -1, 5, -1, 4, -1, 3, -1, 2, -1, 1, -1, 0);
-        while(dst_len >= 32){
-               __m128i luma = _mm_load_si128((__m128i const*)(const void *) luma_src); 
-               luma_src += 16;
-               __m128i chroma = _mm_load_si128((__m128i const*)(const void *) chroma_src); 
-               chroma_src += 16;
-
-               __m128i res = _mm_or_si128(_mm_shuffle_epi8(luma, y_shuff), _mm_shuffle_epi8(chroma, uv_shuff));
-               _mm_storeu_si128((__m128i *)(void *) dst, res);
-               dst += 16;
-
-               luma = _mm_bsrli_si128(luma, 8);
-               chroma = _mm_bsrli_si128(chroma, 8);
-
-               res = _mm_or_si128(_mm_shuffle_epi8(luma, y_shuff), _mm_shuffle_epi8(chroma, uv_shuff));
-               _mm_storeu_si128((__m128i *)(void *) dst, res);
-               dst += 16;
-
-               dst_len -= 32;
+        const unsigned tile_count = (width + TILE_WIDTH - 1) / TILE_WIDTH * ((height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+        const unsigned worker_count = std::max(std::min<unsigned>(get_cpu_core_count(), tile_count), 1U);
+        scratch.resize(worker_count);
+        for(auto& s : scratch){
+                s.reserve(max_src_w);
         }
-#endif
 
-        while(dst_len >= 4){
-                *dst++ = *chroma_src++;
-                *dst++ = *luma_src++;
-                *dst++ = *chroma_src++;
-                *dst++ = *luma_src++;
-
-                dst_len -= 4;
+        struct render_task_data{
+                Video_mixer *mixer;
+                const std::vector<const Participant *> *render_list;
+                std::atomic<unsigned> *next_tile;
+                unsigned tile_count;
+                Render_scratch *scratch;
+                unsigned char *dst;
+        };
+        std::atomic<unsigned> next_tile{0};
+        std::vector<render_task_data> tasks(worker_count);
+        for(unsigned i = 0; i < worker_count; i++){
+                tasks[i] = { this, &render_list, &next_tile, tile_count, &scratch[i],
+                        reinterpret_cast<unsigned char *>(result->tiles[0].data) };
         }
+        auto render_task = [](void *arg) -> void * {
+                auto *d = static_cast<render_task_data *>(arg);
+                unsigned idx = 0;
+                while((idx = d->next_tile->fetch_add(1)) < d->tile_count){
+                        d->mixer->render_tile(idx, *d->render_list, *d->scratch, d->dst);
+                }
+                return nullptr;
+        };
+        task_run_parallel(render_task, worker_count, tasks.data(), sizeof tasks[0], nullptr);
+
+        clear_canvas = false;
 }
 
 std::vector<uint32_t> Video_mixer::get_participant_ssrc_list() const{
@@ -650,7 +1154,7 @@ static int display_conference_get_property(void *state, int property, void *val,
                 return TRUE;
 
         } else if(property == DISPLAY_PROPERTY_CODECS) {
-                codec_t codecs[] = {UYVY};
+                codec_t codecs[] = {UYVY, v210, I420};
 
                 memcpy(val, codecs, sizeof(codecs));
 
@@ -63,6 +63,7 @@
 #include <csetjmp>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <string>
@@ -93,6 +94,12 @@
 #define ADAPTIVE_VSYNC -1
 #define SYSTEM_VSYNC 0xFE
 #define SINGLE_BUF 0xFF // use single buffering instead of double
+#define BUFFER_POOL_FRAMES 2 ///< frames the decoder may hold (decoded + prefetched), see DISPLAY_PROPERTY_BUFFER_POOL
+#define PBO_RING_LEN (BUFFER_POOL_FRAMES + 3) ///< persistently mapped PBOs - held by decoder, queued, displayed + 1 in GPU flight
+
+#if defined GL_MAP_PERSISTENT_BIT && defined GL_MAP_COHERENT_BIT
+#define HAVE_GL_BUFFER_STORAGE 1
+#endif
 
 #include "gl_vdpau.hpp"
 
@@ -296,6 +303,18 @@ static constexpr array keybindings{
         pair<int64_t, string_view>{K_CTRL_UP, "make window 10% bigger"}
 };
 
+/**
+ * Frame whose data live in a persistently mapped PBO. The decoder writes
+ * directly to it so that no copy is needed before glTexSubImage2D().
+ */
+struct gl_pbo_frame {
+        GLuint pbo = 0;
+#ifdef HAVE_GL_BUFFER_STORAGE
+        GLsync fence = nullptr; ///< set when returned to the ring, buffer is reused after it is signaled
+#endif
+        bool stale = false; ///< ring was reallocated for a different format, delete when returned
+};
+
 struct state_gl {
         GLuint          PHandle_uyvy = 0;
         GLuint          PHandle_yuva = 0;
@@ -355,6 +374,18 @@ struct state_gl {
         enum modeset_t { MODESET = -2, MODESET_SIZE_ONLY = GLFW_DONT_CARE, NOMODESET = 0 } modeset = NOMODESET; ///< positive vals force framerate
         bool nodecorate = false;
         int use_pbo = -1;
+        bool persistent_pbo = false;
+
+        /// @name persistent PBO ring
+        /// members except upload_pbo and pbo_fenced are protected by lock
+        /// @{
+        map<struct video_frame *, gl_pbo_frame> pbo_frames; ///< all allocated ring frames
+        struct video_desc pbo_desc {};
+        queue<struct video_frame *> pbo_free_frames;  ///< ready to be given by getf
+        vector<struct video_frame *> pbo_returned;    ///< returned to the display, waiting for a fence
+        vector<struct video_frame *> pbo_fenced;      ///< waiting until GPU is done (GL thread only)
+        GLuint upload_pbo = 0;                        ///< PBO backing currently uploaded frame (GL thread only)
+        /// @}
 
 #ifdef HWACC_VDPAU
         struct state_vdpau vdp;
@@ -414,6 +445,10 @@ static void display_gl_set_sync_on_vblank(int value);
 static void screenshot(struct video_frame *frame);
 static void upload_texture(struct state_gl *s, char *data);
 static bool check_rpi_pbo_quirks();
+static void gl_pbo_ring_reconfigure(struct state_gl *s, struct video_desc desc);
+static void gl_pbo_ring_poll(struct state_gl *s);
+static void gl_pbo_ring_destroy(struct state_gl *s);
+static bool gl_return_frame(struct state_gl *s, struct video_frame *frame);
 
 static void gl_print_monitors(bool fullhelp) {
         if (ref_count_init_once<int>()(glfwInit, glfw_init_count).value_or(GLFW_TRUE) == GLFW_FALSE) {
@@ -473,6 +508,7 @@ static void gl_show_help(bool full) {
         col() << TBOLD("\tnodecorate")  << "\tdisable window decorations\n";
         col() << TBOLD("\tnovsync")     << "\t\tdo not turn sync on VBlank\n";
         col() << TBOLD("\t[no]pbo")     << "\t\tWhether or not use PBO (ignore if not sure)\n";
+        col() << TBOLD("\tpersistent")  << "\tdecode directly to a ring of persistently mapped PBOs (needs ARB_buffer_storage)\n";
         col() << TBOLD("\tsingle")      << "\t\tuse single buffer (instead of double-buffering)\n";
         col() << TBOLD("\tsize")        << "\t\tspecifies desired size of window compared "
                 "to native resolution (in percents)\n";
@@ -597,6 +633,8 @@ static void *display_gl_parse_fmt(struct state_gl *s, char *ptr) {
                         s->hide_window = true;
                 } else if (strcasecmp(tok, "pbo") == 0 || strcasecmp(tok, "nopbo") == 0) {
                         s->use_pbo = strcasecmp(tok, "pbo") == 0 ? 1 : 0;
+                } else if (strcasecmp(tok, "persistent") == 0) {
+                        s->persistent_pbo = true;
                 } else if(!strncmp(tok, "size=",
                                         strlen("size="))) {
                         s->window_size_factor =
@@ -935,6 +973,8 @@ static void gl_reconfigure_screen(struct state_gl *s, struct video_desc desc)
 
         s->scratchpad.resize(desc.width * desc.height * 8);
         s->current_display_desc = desc;
+
+        gl_pbo_ring_reconfigure(s, desc);
 }
 
 static void gl_render(struct state_gl *s, char *data)
@@ -1058,12 +1098,14 @@ static void gl_process_frames(struct state_gl *s)
                         return;
                 }
                 if (s->paused) {
-                        vf_recycle(frame);
-                        s->free_frame_queue.push(frame);
+                        if (!gl_return_frame(s, frame)) {
+                                vf_recycle(frame);
+                                s->free_frame_queue.push(frame);
+                        }
                         pop_frame(s, lk);
                         return;
                 }
-                if (s->current_frame) {
+                if (s->current_frame && !gl_return_frame(s, s->current_frame)) {
                         vf_recycle(s->current_frame);
                         s->free_frame_queue.push(s->current_frame);
                 }
@@ -1074,7 +1116,13 @@ static void gl_process_frames(struct state_gl *s)
                 gl_reconfigure_screen(s, video_desc_from_frame(frame));
         }
 
+        {
+                lock_guard<mutex> lk(s->lock);
+                auto it = s->pbo_frames.find(frame);
+                s->upload_pbo = it != s->pbo_frames.end() ? it->second.pbo : 0;
+        }
         gl_render(s, frame->tiles[0].data);
+        s->upload_pbo = 0;
         gl_draw(s->aspect, (s->dxt_height - s->current_display_desc.height) / (float) s->dxt_height * 2, s->vsync != SINGLE_BUF);
 
         // publish to Syphon/Spout
@@ -1446,6 +1494,18 @@ static bool display_gl_init_opengl(struct state_gl *s)
         }
         display_gl_print_depth();
 
+        if (s->persistent_pbo) {
+#ifdef HAVE_GL_BUFFER_STORAGE
+                if (!GLEW_ARB_buffer_storage || !GLEW_ARB_sync) {
+                        log_msg(LOG_LEVEL_WARNING, MOD_NAME "ARB_buffer_storage or ARB_sync not supported, persistent PBOs disabled.\n");
+                        s->persistent_pbo = false;
+                }
+#else
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "Persistent PBOs not supported by this build.\n");
+                s->persistent_pbo = false;
+#endif
+        }
+
         glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
         glEnable( GL_TEXTURE_2D );
 
@@ -1497,6 +1557,7 @@ static void display_gl_cleanup_opengl(struct state_gl *s){
         glDeleteTextures(1, &s->texture_raw);
         glDeleteFramebuffersEXT(1, &s->fbo_id);
         glDeleteBuffersARB(1, &s->pbo_id);
+        gl_pbo_ring_destroy(s);
         glfwDestroyWindow(s->window);
 
         if (s->syphon_spout) {
@@ -1517,6 +1578,7 @@ static void display_gl_run(void *arg)
         while (!glfwWindowShouldClose(s->window)) {
                 glfwPollEvents();
                 gl_process_frames(s);
+                gl_pbo_ring_poll(s);
         }
         glfwMakeContextCurrent(nullptr);
 }
@@ -1581,7 +1643,11 @@ static void upload_texture(struct state_gl *s, char *data)
                 DEBUG_TIMER_STOP(byte_swap_r10k);
         };
         int data_size = vc_get_linesize(s->current_display_desc.width, s->current_display_desc.color_spec) * s->current_display_desc.height;
-        if (s->use_pbo) {
+        if (s->upload_pbo != 0) { // data already reside in a persistently mapped PBO
+                glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, s->upload_pbo);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, s->current_display_desc.height, format, type, nullptr);
+                glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+        } else if (s->use_pbo) {
                 glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, s->pbo_id); // current pbo
                 glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, data_size, 0, GL_STREAM_DRAW_ARB);
                 if (void *ptr = glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB)) {
@@ -1605,6 +1671,163 @@ static void upload_texture(struct state_gl *s, char *data)
         }
 }
 
+/**
+ * (Re)allocates the ring of persistently mapped PBOs for new format. Old
+ * frames currently held by the decoder or queued are deleted when returned.
+ *
+ * Must be called from the GL thread.
+ */
+static void gl_pbo_ring_reconfigure(struct state_gl *s, struct video_desc desc)
+{
+        if (!s->persistent_pbo) {
+                return;
+        }
+#ifdef HAVE_GL_BUFFER_STORAGE
+        lock_guard<mutex> lk(s->lock);
+        for (auto &f : s->pbo_frames) {
+                f.second.stale = true;
+        }
+        while (!s->pbo_free_frames.empty()) {
+                s->pbo_returned.push_back(s->pbo_free_frames.front());
+                s->pbo_free_frames.pop();
+        }
+        s->pbo_desc = desc;
+
+        // R10k needs to be byte-swapped before upload, compressed formats use a different path
+        const codec_t supported[] = { UYVY, v210, Y416, RGB, RGBA };
+        if (find(begin(supported), end(supported), desc.color_spec) == end(supported) || desc.tile_count != 1) {
+                return;
+        }
+
+        const size_t data_len = vc_get_linesize(desc.width, desc.color_spec) * desc.height;
+        // frames are also read by CPU (screenshot, re-rendering of the last frame)
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        for (int i = 0; i < PBO_RING_LEN; ++i) {
+                gl_pbo_frame pbo_frame;
+                glGenBuffersARB(1, &pbo_frame.pbo);
+                glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo_frame.pbo);
+                glBufferStorage(GL_PIXEL_UNPACK_BUFFER_ARB, data_len + MAX_PADDING, nullptr, flags);
+                void *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_ARB, 0, data_len + MAX_PADDING, flags);
+                glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+                if (ptr == nullptr) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Unable to map PBO, using regular frames.\n");
+                        glDeleteBuffersARB(1, &pbo_frame.pbo);
+                        break;
+                }
+                struct video_frame *frame = vf_alloc_desc(desc);
+                frame->tiles[0].data = static_cast<char *>(ptr);
+                frame->tiles[0].data_len = data_len;
+                s->pbo_frames.emplace(frame, pbo_frame);
+                s->pbo_free_frames.push(frame);
+        }
+        gl_check_error();
+        log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "Allocated %zu persistently mapped PBOs.\n", s->pbo_free_frames.size());
+#else
+        UNUSED(desc);
+#endif
+}
+
+/**
+ * If frame belongs to the PBO ring, it is passed back to the GL thread to be
+ * fenced and reused.
+ *
+ * @note
+ * s->lock must be held
+ * @retval true  frame was a ring frame and has been taken over
+ */
+static bool gl_return_frame(struct state_gl *s, struct video_frame *frame)
+{
+        if (s->pbo_frames.find(frame) == s->pbo_frames.end()) {
+                return false;
+        }
+        s->pbo_returned.push_back(frame);
+        return true;
+}
+
+/**
+ * Fences returned ring frames and moves those the GPU is done with to the
+ * free queue. Stale frames are deleted.
+ *
+ * Must be called from the GL thread.
+ */
+static void gl_pbo_ring_poll(struct state_gl *s)
+{
+#ifdef HAVE_GL_BUFFER_STORAGE
+        unique_lock<mutex> lk(s->lock);
+        if (s->pbo_frames.empty()) {
+                return;
+        }
+        for (auto *frame : s->pbo_returned) {
+                auto &pbo_frame = s->pbo_frames.at(frame);
+                if (pbo_frame.stale) {
+                        if (pbo_frame.fence) {
+                                glDeleteSync(pbo_frame.fence);
+                        }
+                        glDeleteBuffersARB(1, &pbo_frame.pbo); // implicitly unmaps
+                        s->pbo_frames.erase(frame);
+                        vf_free(frame);
+                        continue;
+                }
+                pbo_frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                s->pbo_fenced.push_back(frame);
+        }
+        s->pbo_returned.clear();
+
+        for (auto it = s->pbo_fenced.begin(); it != s->pbo_fenced.end(); ) {
+                auto &pbo_frame = s->pbo_frames.at(*it);
+                GLenum ret = glClientWaitSync(pbo_frame.fence, 0, 0);
+                if (ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED) {
+                        glDeleteSync(pbo_frame.fence);
+                        pbo_frame.fence = nullptr;
+                        if (pbo_frame.stale) {
+                                s->pbo_returned.push_back(*it); // deleted next time
+                        } else {
+                                vf_recycle(*it);
+                                s->pbo_free_frames.push(*it);
+                        }
+                        it = s->pbo_fenced.erase(it);
+                } else {
+                        ++it;
+                }
+        }
+#else
+        UNUSED(s);
+#endif
+}
+
+/// Must be called from the GL thread with the GL context current.
+static void gl_pbo_ring_destroy(struct state_gl *s)
+{
+#ifdef HAVE_GL_BUFFER_STORAGE
+        lock_guard<mutex> lk(s->lock);
+        for (auto &f : s->pbo_frames) {
+                if (f.second.fence) {
+                        glDeleteSync(f.second.fence);
+                }
+                glDeleteBuffersARB(1, &f.second.pbo);
+                f.second.pbo = 0;
+                f.first->tiles[0].data = nullptr;
+        }
+        while (!s->pbo_free_frames.empty()) {
+                vf_free(s->pbo_free_frames.front());
+                s->pbo_free_frames.pop();
+        }
+        for (auto *frame : s->pbo_returned) {
+                vf_free(frame);
+        }
+        s->pbo_returned.clear();
+        for (auto *frame : s->pbo_fenced) {
+                vf_free(frame);
+        }
+        s->pbo_fenced.clear();
+        // frames still held by the decoder or queued are no longer ring frames - when
+        // put, they go to free_frame_queue and are freed as regular frames in done
+        s->pbo_frames.clear();
+#else
+        UNUSED(s);
+#endif
+}
+
 static bool check_rpi_pbo_quirks()
 {
 #if ! defined __linux__
@@ -1749,6 +1972,10 @@ static int display_gl_get_property(void *state, int property, void *val, size_t
                         *(int *) val = PITCH_DEFAULT;
                         *len = sizeof(int);
                         break;
+                case DISPLAY_PROPERTY_BUFFER_POOL:
+                        *(int *) val = BUFFER_POOL_FRAMES;
+                        *len = sizeof(int);
+                        break;
                 case DISPLAY_PROPERTY_SUPPORTED_IL_MODES:
                         if(sizeof(supported_il_modes) <= *len) {
                                 memcpy(val, supported_il_modes, sizeof(supported_il_modes));
@@ -1795,6 +2022,15 @@ static struct video_frame * display_gl_getf(void *state)
 
         lock_guard<mutex> lock(s->lock);
 
+        while (!s->pbo_free_frames.empty()) {
+                struct video_frame *buffer = s->pbo_free_frames.front();
+                s->pbo_free_frames.pop();
+                if (video_desc_eq(video_desc_from_frame(buffer), s->current_desc) && !s->pbo_frames.at(buffer).stale) {
+                        return buffer;
+                }
+                s->pbo_returned.push_back(buffer);
+        }
+
         while (s->free_frame_queue.size() > 0) {
                 struct video_frame *buffer = s->free_frame_queue.front();
                 s->free_frame_queue.pop();
@@ -1826,14 +2062,18 @@ static int display_gl_putf(void *state, struct video_frame *frame, int nonblock)
         }
 
         if (nonblock == PUTF_DISCARD) {
-                vf_recycle(frame);
-                s->free_frame_queue.push(frame);
+                if (!gl_return_frame(s, frame)) {
+                        vf_recycle(frame);
+                        s->free_frame_queue.push(frame);
+                }
                 return 0;
         }
         if (s->frame_queue.size() >= MAX_BUFFER_SIZE && nonblock == PUTF_NONBLOCK) {
                 LOG(LOG_LEVEL_INFO) << MOD_NAME << "1 frame(s) dropped!\n";
-                vf_recycle(frame);
-                s->free_frame_queue.push(frame);
+                if (!gl_return_frame(s, frame)) {
+                        vf_recycle(frame);
+                        s->free_frame_queue.push(frame);
+                }
                 return 1;
         }
         s->frame_consumed_cv.wait(lk, [s]{return s->frame_queue.size() < MAX_BUFFER_SIZE;});
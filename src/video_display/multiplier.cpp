@@ -44,6 +44,7 @@
 #include "video.h"
 #include "video_display.h"
 #include "utils/misc.h"
+#include "utils/video_frame_pool.h"
 
 #include <condition_variable>
 #include <vector>
@@ -55,20 +56,36 @@
 using namespace std;
 
 static constexpr unsigned int IN_QUEUE_MAX_BUFFER_LEN = 5;
+static constexpr unsigned int OUT_QUEUE_MAX_BUFFER_LEN = 2;
 static constexpr const char *MOD_NAME = "[multiplier] ";
 static constexpr int SKIP_FIRST_N_FRAMES_IN_STREAM = 5;
 
 namespace{
 struct disp_deleter{ void operator()(display *d){ display_done(d); } };
 using unique_disp = std::unique_ptr<struct display, disp_deleter>;
+using shared_frame = std::shared_ptr<struct video_frame>;
+
+/**
+ * Per-output state - every sub-display is fed by its own worker so that
+ * the copy to the display buffer runs in parallel and a slow display
+ * doesn't delay the others.
+ */
+struct multiplier_output {
+        unique_disp disp;
+        struct video_desc display_desc{};
+
+        queue<shared_frame> frame_queue;
+        mutex lock;
+        condition_variable cv;
+        thread worker_thread;
+        unsigned long long dropped = 0;
+};
 }
 
 struct state_multiplier_common {
-        std::vector<unique_disp> displays;
-
-        struct video_desc display_desc;
+        std::vector<std::unique_ptr<multiplier_output>> outputs;
 
-        queue<struct video_frame *> incoming_queue;
+        queue<shared_frame> incoming_queue;
         condition_variable in_queue_decremented_cv;
 
         mutex lock;
@@ -81,6 +98,8 @@ struct state_multiplier_common {
 struct state_multiplier {
         shared_ptr<struct state_multiplier_common> common;
         struct video_desc desc;
+        size_t data_len;
+        video_frame_pool pool; ///< frames are shared read-only among all outputs
 };
 
 static void show_help(){
@@ -126,64 +145,109 @@ static void *display_multiplier_init(struct module *parent, const char *fmt, uns
                         abort();
                 }
                 unique_disp disp(d_ptr);
-                if (display_needs_mainloop(disp.get()) && !s->common->displays.empty()) {
+                if (display_needs_mainloop(disp.get()) && !s->common->outputs.empty()) {
                         LOG(LOG_LEVEL_ERROR) << "[multiplier] Display " << display << " needs mainloop and should be given first!\n";
                 }
 
-                s->common->displays.push_back(std::move(disp));
+                auto out = std::make_unique<multiplier_output>();
+                out->disp = std::move(disp);
+                s->common->outputs.push_back(std::move(out));
         }
 
         return s.release();
 }
 
-static void check_reconf(struct state_multiplier_common *s, struct video_desc desc)
+static void check_reconf(struct multiplier_output *out, struct video_desc desc)
 {
-        if (!video_desc_eq(desc, s->display_desc)) {
-                s->display_desc = desc;
-                fprintf(stderr, "RECONFIGURED\n");
-                for(auto& disp : s->displays){
-                        display_reconfigure(disp.get(), s->display_desc, VIDEO_NORMAL);
+        if (!video_desc_eq(desc, out->display_desc)) {
+                out->display_desc = desc;
+                LOG(LOG_LEVEL_VERBOSE) << MOD_NAME << "Reconfiguring output to " << desc << "\n";
+                display_reconfigure(out->disp.get(), out->display_desc, VIDEO_NORMAL);
+        }
+}
+
+/**
+ * Copies the shared frame to the respective display. The shared frame is
+ * released as soon as all outputs have copied it.
+ */
+static void display_multiplier_output_worker(struct multiplier_output *out)
+{
+        while (1) {
+                shared_frame frame;
+                {
+                        unique_lock<mutex> lg(out->lock);
+                        out->cv.wait(lg, [out]{return out->frame_queue.size() > 0;});
+                        frame = std::move(out->frame_queue.front());
+                        out->frame_queue.pop();
                 }
+
+                if (!frame) {
+                        display_put_frame(out->disp.get(), NULL, PUTF_BLOCKING);
+                        break;
+                }
+
+                check_reconf(out, video_desc_from_frame(frame.get()));
+
+                struct video_frame *real_display_frame = display_get_frame(out->disp.get());
+                for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                        memcpy(real_display_frame->tiles[i].data, frame->tiles[i].data, frame->tiles[i].data_len);
+                        real_display_frame->tiles[i].data_len = frame->tiles[i].data_len;
+                }
+                frame.reset();
+                display_put_frame(out->disp.get(), real_display_frame, PUTF_BLOCKING);
+        }
+
+        if (out->dropped > 0) {
+                LOG(LOG_LEVEL_INFO) << MOD_NAME << "Dropped " << out->dropped << " frames for a slow output.\n";
         }
 }
 
+/**
+ * Hands the incoming frame (refcounted) over to all outputs. Output
+ * queues are never waited for - if an output is behind, the frame
+ * is dropped for that output only.
+ */
 static void display_multiplier_worker(void *state)
 {
         shared_ptr<struct state_multiplier_common> s = ((struct state_multiplier *)state)->common;
         int skipped = 0;
 
         while (1) {
-                struct video_frame *frame;
+                shared_frame frame;
                 {
                         unique_lock<mutex> lg(s->lock);
                         s->cv.wait(lg, [s]{return s->incoming_queue.size() > 0;});
-                        frame = s->incoming_queue.front();
+                        frame = std::move(s->incoming_queue.front());
                         s->incoming_queue.pop();
                         s->in_queue_decremented_cv.notify_one();
                 }
 
                 if (!frame) {
-                        for (auto& disp : s->displays) {
-                                display_put_frame(disp.get(), NULL, PUTF_BLOCKING);
+                        for (auto& out : s->outputs) {
+                                unique_lock<mutex> lg(out->lock);
+                                out->frame_queue.push(nullptr); // poison pill must not be dropped
+                                lg.unlock();
+                                out->cv.notify_one();
                         }
                         break;
                 }
 
                 if (skipped < SKIP_FIRST_N_FRAMES_IN_STREAM){
                         skipped++;
-                        vf_free(frame);
                         continue;
                 }
 
-                check_reconf(s.get(), video_desc_from_frame(frame));
-
-                for (auto& disp : s->displays) {
-                        struct video_frame *real_display_frame = display_get_frame(disp.get());
-                        memcpy(real_display_frame->tiles[0].data, frame->tiles[0].data, frame->tiles[0].data_len);
-                        display_put_frame(disp.get(), real_display_frame, PUTF_BLOCKING);
+                for (auto& out : s->outputs) {
+                        unique_lock<mutex> lg(out->lock);
+                        if (out->frame_queue.size() >= OUT_QUEUE_MAX_BUFFER_LEN) {
+                                out->dropped += 1;
+                                LOG(LOG_LEVEL_DEBUG) << MOD_NAME << "Output queue full, dropping frame.\n";
+                                continue;
+                        }
+                        out->frame_queue.push(frame);
+                        lg.unlock();
+                        out->cv.notify_one();
                 }
-
-                vf_free(frame);
         }
 }
 
@@ -199,19 +263,25 @@ static void display_multiplier_run(void *state)
 {
         shared_ptr<struct state_multiplier_common> s = ((struct state_multiplier *)state)->common;
 
-        assert(!s->displays.empty());
+        assert(!s->outputs.empty());
 
-        for (size_t i = 1; i < s->displays.size(); i++) {
-                display_run_new_thread(s->displays[i].get());
+        for (size_t i = 1; i < s->outputs.size(); i++) {
+                display_run_new_thread(s->outputs[i]->disp.get());
         }
 
+        for (auto& out : s->outputs) {
+                out->worker_thread = thread(display_multiplier_output_worker, out.get());
+        }
         s->worker_thread = thread(display_multiplier_worker, state);
 
-        display_run_this_thread(s->displays[0].get());
+        display_run_this_thread(s->outputs[0]->disp.get());
 
         s->worker_thread.join();
-        for (size_t i = 1; i < s->displays.size(); i++) {
-                display_join(s->displays[i].get());
+        for (auto& out : s->outputs) {
+                out->worker_thread.join();
+        }
+        for (size_t i = 1; i < s->outputs.size(); i++) {
+                display_join(s->outputs[i]->disp.get());
         }
 }
 
@@ -225,7 +295,11 @@ static struct video_frame *display_multiplier_getf(void *state)
 {
         struct state_multiplier *s = (struct state_multiplier *)state;
 
-        return vf_alloc_desc_data(s->desc);
+        struct video_frame *frame = s->pool.get_disposable_frame();
+        for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                frame->tiles[i].data_len = s->data_len;
+        }
+        return frame;
 }
 
 static int display_multiplier_putf(void *state, struct video_frame *frame, int flags)
@@ -233,18 +307,18 @@ static int display_multiplier_putf(void *state, struct video_frame *frame, int f
         shared_ptr<struct state_multiplier_common> s = ((struct state_multiplier *)state)->common;
 
         if (flags == PUTF_DISCARD) {
-                vf_free(frame);
+                VIDEO_FRAME_DISPOSE(frame);
         } else {
+                shared_frame shared(frame, [](struct video_frame *f) { VIDEO_FRAME_DISPOSE(f); });
                 unique_lock<mutex> lg(s->lock);
                 if (s->incoming_queue.size() >= IN_QUEUE_MAX_BUFFER_LEN) {
                         fprintf(stderr, "Multiplier: queue full!\n");
                 }
                 if (flags == PUTF_NONBLOCK && s->incoming_queue.size() >= IN_QUEUE_MAX_BUFFER_LEN) {
-                        vf_free(frame);
                         return 1;
                 }
                 s->in_queue_decremented_cv.wait(lg, [s]{return s->incoming_queue.size() < IN_QUEUE_MAX_BUFFER_LEN;});
-                s->incoming_queue.push(frame);
+                s->incoming_queue.push(std::move(shared));
                 lg.unlock();
                 s->cv.notify_one();
         }
@@ -268,7 +342,7 @@ static int display_multiplier_get_property(void *state, int property, void *val,
 
         }
         //TODO Find common properties, for now just return properties of the first display
-        return display_ctl_property(s->displays[0].get(), property, val, len);
+        return display_ctl_property(s->outputs[0]->disp.get(), property, val, len);
 }
 
 static int display_multiplier_reconfigure(void *state, struct video_desc desc)
@@ -276,6 +350,9 @@ static int display_multiplier_reconfigure(void *state, struct video_desc desc)
         struct state_multiplier *s = (struct state_multiplier *) state;
 
         s->desc = desc;
+        s->data_len = codec_is_const_size(desc.color_spec) ? get_pf_block_bytes(desc.color_spec)
+                : vc_get_linesize(desc.width, desc.color_spec) * desc.height;
+        s->pool.reconfigure(desc, s->data_len + MAX_PADDING);
 
         return 1;
 }
@@ -284,7 +361,7 @@ static void display_multiplier_put_audio_frame(void *state, const struct audio_f
 {
         auto *s = static_cast<struct state_multiplier *>(state);
 
-        display_put_audio_frame(s->common->displays.at(0).get(), frame);
+        display_put_audio_frame(s->common->outputs.at(0)->disp.get(), frame);
 }
 
 static int display_multiplier_reconfigure_audio(void *state, int quant_samples, int channels,
@@ -292,13 +369,13 @@ static int display_multiplier_reconfigure_audio(void *state, int quant_samples,
 {
         auto *s = static_cast<struct state_multiplier *>(state);
 
-        return display_reconfigure_audio(s->common->displays.at(0).get(), quant_samples, channels, sample_rate);
+        return display_reconfigure_audio(s->common->outputs.at(0)->disp.get(), quant_samples, channels, sample_rate);
 }
 
 static auto display_multiplier_needs_mainloop(void *state)
 {
         auto s = static_cast<struct state_multiplier *>(state)->common;
-        return !s->displays.empty() && display_needs_mainloop(s->displays[0].get());
+        return !s->outputs.empty() && display_needs_mainloop(s->outputs[0]->disp.get());
 }
 
 static void display_multiplier_probe(struct device_info **available_cards, int *count, void (**deleter)(void *)) {
@@ -89,6 +89,7 @@
 
 #define MAGIC_SDL2   0x3cc234a1
 #define MAX_BUFFER_SIZE   1
+#define BUFFER_POOL_FRAMES 2 ///< frames the decoder may hold (decoded + prefetched), see DISPLAY_PROPERTY_BUFFER_POOL
 #define MOD_NAME "[SDL] "
 
 using rang::fg;
@@ -760,6 +761,10 @@ static int display_sdl2_get_property(void *state, int property, void *val, size_
                                 return FALSE;
                         }
                         break;
+                case DISPLAY_PROPERTY_BUFFER_POOL:
+                        *(int *) val = BUFFER_POOL_FRAMES;
+                        *len = sizeof(int);
+                        break;
                 default:
                         return FALSE;
         }
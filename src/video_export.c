@@ -43,16 +43,26 @@
 
 #include <compat/platform_semaphore.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "debug.h"
+#include "tv.h"
+#include "utils/worker.h"
 #include "video.h"
 #include "video_codec.h"
 #include "video_export.h"
 
 #define MAX_QUEUE_SIZE 300
+#define MOD_NAME "[Video export] "
+
+#define CONTAINER_STAGE_MIN_SIZE (32 * 1024 * 1024) ///< size of one of the staging buffers
+#define CONTAINER_PREALLOC_SIZE (1024LL * 1024 * 1024)
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
 
 /*
  * we do not need to have possible stalls, so IO is performend in a separate thread
@@ -67,11 +77,52 @@ struct output_entry {
         char *data;
         int data_len;
 
+        uint32_t frame; ///< used by container export
+        uint32_t tile;
+        uint32_t fourcc;
+        time_ns_t timestamp;
+
         struct output_entry *next;
 };
 
+struct container_write_data {
+        int fd;
+        const char *data;
+        size_t len;
+        uint64_t offset;
+        bool ok;
+};
+
+/**
+ * Container writer - tiles are copied to one of two aligned staging buffers
+ * which is written asynchronously (with O_DIRECT if possible) while the other
+ * is being filled. Index entries of a stage buffer are written only after its
+ * data has been successfully written so that the index never refers to data
+ * missing in the container.
+ */
+struct container_writer {
+        int data_fd;
+        FILE *index;
+
+        char *stage[2];
+        size_t stage_size;
+        size_t stage_len; ///< filled bytes of current stage buffer
+        int cur_stage;
+        struct container_write_data write_data;
+        task_result_handle_t pending_write; ///< write of the other stage buffer, may be NULL
+        struct video_export_index_entry *stage_idx[2]; ///< index entries of tiles in respective stage buffer
+        size_t stage_idx_count[2];
+        size_t stage_idx_alloc[2];
+        bool failed; ///< data or index write failed, nothing more is written
+
+        uint64_t stage_offset;  ///< file offset where current stage buffer belongs
+        uint64_t data_end;      ///< end of the last tile (without padding)
+        uint64_t prealloc_end;
+};
+
 struct video_export {
         char *path;
+        struct container_writer *container; ///< NULL if exporting to separate files
 
         uint32_t total;
 
@@ -84,8 +135,207 @@ struct video_export {
         struct video_desc saved_desc;
 
         pthread_t thread_id;
+        volatile bool failed; ///< write error occured, export stopped
 };
 
+static bool write_all_at(int fd, const char *data, size_t len, uint64_t offset)
+{
+#ifdef WIN32
+        if (_lseeki64(fd, offset, SEEK_SET) == -1) {
+                return false;
+        }
+#endif
+        while (len > 0) {
+#ifdef WIN32
+                ssize_t ret = write(fd, data, len);
+#else
+                ssize_t ret = pwrite(fd, data, len, offset);
+#endif
+                if (ret <= 0) {
+                        if (ret == -1 && errno == EINTR) {
+                                continue;
+                        }
+                        return false;
+                }
+                data += ret;
+                len -= ret;
+                offset += ret;
+        }
+        return true;
+}
+
+static void *container_write_task(void *arg)
+{
+        struct container_write_data *d = arg;
+        d->ok = write_all_at(d->fd, d->data, d->len, d->offset);
+        if (!d->ok) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Container write failed: %s\n", strerror(errno));
+        }
+        return NULL;
+}
+
+/// Waits for the pending data write and, if it succeeded, writes index entries of its tiles.
+static void container_wait_pending(struct container_writer *c)
+{
+        if (!c->pending_write) {
+                return;
+        }
+        wait_task(c->pending_write);
+        c->pending_write = NULL;
+
+        int stage = 1 - c->cur_stage; // buffer of the write that was pending
+        size_t count = c->stage_idx_count[stage];
+        c->stage_idx_count[stage] = 0;
+        if (!c->write_data.ok) {
+                c->failed = true;
+                return;
+        }
+        if (count > 0 && fwrite(c->stage_idx[stage], sizeof c->stage_idx[stage][0], count, c->index) != count) {
+                perror(MOD_NAME "index fwrite");
+                c->failed = true;
+        }
+}
+
+/// Starts asynchronous write of current stage buffer and switches to the other one.
+static void container_flush_stage(struct container_writer *c)
+{
+        container_wait_pending(c);
+        if (c->stage_len == 0 || c->failed) {
+                return;
+        }
+#ifdef HAVE_LINUX
+        if (c->stage_offset + c->stage_len > c->prealloc_end) {
+                // extent preallocation avoids fragmentation and metadata updates on every write
+                if (fallocate(c->data_fd, FALLOC_FL_KEEP_SIZE, c->prealloc_end, CONTAINER_PREALLOC_SIZE) == 0) {
+                        c->prealloc_end += CONTAINER_PREALLOC_SIZE;
+                } else {
+                        c->prealloc_end = UINT64_MAX; // not supported, do not retry
+                }
+        }
+#endif
+        c->write_data = (struct container_write_data) { c->data_fd, c->stage[c->cur_stage], c->stage_len, c->stage_offset, false };
+        c->pending_write = task_run_async(container_write_task, &c->write_data);
+        c->stage_offset += c->stage_len;
+        c->stage_len = 0;
+        c->cur_stage = 1 - c->cur_stage;
+}
+
+static bool container_alloc_stage(struct container_writer *c, size_t size)
+{
+        container_wait_pending(c);
+        for (int i = 0; i < 2; ++i) {
+                aligned_free(c->stage[i]);
+                c->stage[i] = aligned_malloc(size, VIDEO_EXPORT_CONTAINER_ALIGN);
+                if (c->stage[i] == NULL) {
+                        return false;
+                }
+        }
+        c->stage_size = size;
+        return true;
+}
+
+static void container_write_tile(struct container_writer *c, struct output_entry *entry)
+{
+        if (c->failed) {
+                return;
+        }
+        size_t padded_len = ALIGN_UP((size_t) entry->data_len, VIDEO_EXPORT_CONTAINER_ALIGN);
+        if (c->stage_len + padded_len > c->stage_size) {
+                container_flush_stage(c);
+        }
+        if (padded_len > c->stage_size) {
+                if (!container_alloc_stage(c, MAX(padded_len, CONTAINER_STAGE_MIN_SIZE))) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot allocate staging buffers!\n");
+                        c->failed = true;
+                        return;
+                }
+        }
+
+        char *dst = c->stage[c->cur_stage] + c->stage_len;
+        memcpy(dst, entry->data, entry->data_len);
+        memset(dst + entry->data_len, 0, padded_len - entry->data_len);
+
+        struct video_export_index_entry idx = { .offset = c->stage_offset + c->stage_len,
+                .timestamp = entry->timestamp, .data_len = entry->data_len,
+                .frame = entry->frame, .tile = entry->tile, .fourcc = entry->fourcc };
+        int stage = c->cur_stage;
+        if (c->stage_idx_count[stage] == c->stage_idx_alloc[stage]) {
+                size_t new_alloc = MAX(c->stage_idx_alloc[stage] * 2, 64);
+                void *tmp = realloc(c->stage_idx[stage], new_alloc * sizeof idx);
+                if (tmp == NULL) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot allocate index entries!\n");
+                        c->failed = true;
+                        return;
+                }
+                c->stage_idx[stage] = tmp;
+                c->stage_idx_alloc[stage] = new_alloc;
+        }
+        // written to the index file once the stage buffer data is stored
+        c->stage_idx[stage][c->stage_idx_count[stage]++] = idx;
+        c->stage_len += padded_len;
+        c->data_end = idx.offset + entry->data_len;
+}
+
+static struct container_writer *container_init(const char *path)
+{
+        struct container_writer *c = calloc(1, sizeof *c);
+        char name[512];
+
+        snprintf(name, sizeof name, "%s/%s", path, VIDEO_EXPORT_CONTAINER_DATA);
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef WIN32
+        flags |= O_BINARY;
+#endif
+#ifdef HAVE_LINUX
+        c->data_fd = open(name, flags | O_DIRECT, 0666);
+        if (c->data_fd == -1 && errno == EINVAL) { // eg. tmpfs doesn't support O_DIRECT
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "O_DIRECT not supported, using buffered IO.\n");
+                c->data_fd = open(name, flags, 0666);
+        }
+#else
+        c->data_fd = open(name, flags, 0666);
+#endif
+        if (c->data_fd == -1) {
+                perror(MOD_NAME "Cannot open container data file");
+                free(c);
+                return NULL;
+        }
+
+        snprintf(name, sizeof name, "%s/%s", path, VIDEO_EXPORT_CONTAINER_INDEX);
+        c->index = fopen(name, "wb");
+        if (c->index == NULL || fwrite(VIDEO_EXPORT_CONTAINER_MAGIC, strlen(VIDEO_EXPORT_CONTAINER_MAGIC), 1, c->index) != 1) {
+                perror(MOD_NAME "Cannot write container index file");
+                if (c->index) {
+                        fclose(c->index);
+                }
+                close(c->data_fd);
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+static void container_done(struct container_writer *c)
+{
+        if (!c) {
+                return;
+        }
+        container_flush_stage(c);
+        container_wait_pending(c);
+        // remove padding of the last tile and unused preallocated space
+        if (ftruncate(c->data_fd, c->data_end) != 0) {
+                perror(MOD_NAME "ftruncate");
+        }
+        close(c->data_fd);
+        fclose(c->index);
+        aligned_free(c->stage[0]);
+        aligned_free(c->stage[1]);
+        free(c->stage_idx[0]);
+        free(c->stage_idx[1]);
+        free(c);
+}
+
 static void *video_export_thread(void *arg)
 {
         struct video_export *s = (struct video_export *) arg;
@@ -110,14 +360,29 @@ static void *video_export_thread(void *arg)
                         return NULL;
                 }
 
-                FILE *out = fopen(current->filename, "wb");
-                if (out == NULL) {
-                        perror("fopen");
+                bool failed_before = s->failed;
+                if (failed_before) {
+                        // just drain the queue
+                } else if (s->container) {
+                        container_write_tile(s->container, current);
+                        s->failed = s->container->failed;
                 } else {
-                        if (fwrite(current->data, current->data_len, 1, out) != 1) {
-                                perror("fwrite");
+                        FILE *out = fopen(current->filename, "wb");
+                        if (out == NULL) {
+                                perror("fopen");
+                                s->failed = true;
+                        } else {
+                                if (fwrite(current->data, current->data_len, 1, out) != 1) {
+                                        perror("fwrite");
+                                        s->failed = true;
+                                }
+                                if (fclose(out) != 0) {
+                                        s->failed = true;
+                                }
                         }
-                        fclose(out);
+                }
+                if (s->failed && !failed_before) {
+                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Write failed, export stopped.\n");
                 }
                 free(current->data);
                 free(current->filename);
@@ -127,7 +392,7 @@ static void *video_export_thread(void *arg)
         // never get here
 }
 
-struct video_export * video_export_init(const char *path)
+struct video_export * video_export_init(const char *path, bool container)
 {
         struct video_export *s;
 
@@ -143,8 +408,19 @@ struct video_export * video_export_init(const char *path)
 
         memset(&s->saved_desc, 0, sizeof(s->saved_desc));
 
+        if (container) {
+                s->container = container_init(path);
+                if (s->container == NULL) {
+                        free(s->path);
+                        free(s);
+                        return NULL;
+                }
+        }
+
         if(pthread_create(&s->thread_id, NULL, video_export_thread, s) != 0) {
                 fprintf(stderr, "[Video exporter] Failed to create thread.\n");
+                container_done(s->container);
+                free(s->path);
                 free(s);
                 return NULL;
         }
@@ -196,6 +472,7 @@ void video_export_destroy(struct video_export *s)
 
                 pthread_join(s->thread_id, NULL);
                 pthread_mutex_destroy(&s->lock);
+                container_done(s->container);
 
                 // write summary
                 if(s->total > 0) {
@@ -215,6 +492,10 @@ void video_export(struct video_export *s, struct video_frame *frame)
 
         assert(frame != NULL);
 
+        if (s->failed) {
+                return;
+        }
+
         if(s->saved_desc.width == 0) {
                 s->saved_desc = video_desc_from_frame(frame);
         } else {
@@ -231,13 +512,21 @@ void video_export(struct video_export *s, struct video_frame *frame)
 
                 entry->data_len = frame->tiles[i].data_len;
                 entry->data = (char *) malloc(entry->data_len);
-                entry->filename = malloc(512);
+                entry->filename = NULL;
+                entry->frame = s->total + 1;
+                entry->tile = i;
+                entry->fourcc = get_fourcc(frame->color_spec);
+                entry->timestamp = get_time_in_ns();
                 entry->next = NULL;
 
-                if(frame->tile_count == 1) {
+                if (s->container) {
+                        // no file name needed
+                } else if(frame->tile_count == 1) {
+                        entry->filename = malloc(512);
                         snprintf(entry->filename, 512, "%s/%08d.%s", s->path, s->total + 1, get_codec_file_extension(frame->color_spec));
                 } else {
                         // add also tile index
+                        entry->filename = malloc(512);
                         snprintf(entry->filename, 512, "%s/%08d_%d.%s", s->path, s->total + 1, i, get_codec_file_extension(frame->color_spec));
                 }
                 memcpy(entry->data, frame->tiles[i].data, entry->data_len);
@@ -251,6 +540,7 @@ void video_export(struct video_export *s, struct video_frame *frame)
                                                 s->total++); // we increment total size to keep the index
                                 pthread_mutex_unlock(&s->lock);
                                 free(entry->data);
+                                free(entry->filename);
                                 free(entry);
                                 return;
                         }
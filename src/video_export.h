@@ -38,8 +38,38 @@
 #ifndef _VIDEO_EXPORT_H_
 #define _VIDEO_EXPORT_H_
 
+#ifndef __cplusplus
+#include <stdbool.h>
+#include <stdint.h>
+#else
+#include <cstdint>
+#endif // ! defined __cplusplus
+
 #define VIDEO_EXPORT_SUMMARY_VERSION 1
 
+/**
+ * @name Container export
+ * All frames are stored in a single data file, each tile starts at an offset
+ * aligned to VIDEO_EXPORT_CONTAINER_ALIGN. The index file starts with
+ * VIDEO_EXPORT_CONTAINER_MAGIC followed by video_export_index_entry records
+ * (host byte order). Stream parameters are in video.info as usual.
+ * @{
+ */
+#define VIDEO_EXPORT_CONTAINER_DATA "video.data"
+#define VIDEO_EXPORT_CONTAINER_INDEX "video.idx"
+#define VIDEO_EXPORT_CONTAINER_MAGIC "UGVIDX01"
+#define VIDEO_EXPORT_CONTAINER_ALIGN 4096
+
+struct video_export_index_entry {
+        uint64_t offset;    ///< offset of the tile in the data file
+        uint64_t timestamp; ///< export time in ns (monotonic)
+        uint32_t data_len;
+        uint32_t frame;     ///< 1-based frame number (the same as file name in per-frame export)
+        uint32_t tile;
+        uint32_t fourcc;
+};
+/// @}
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -47,7 +77,11 @@ extern "C" {
 struct video_export;
 struct video_frame;
 
-struct video_export * video_export_init(const char *path);
+/**
+ * @param container store frames in a single file with an index instead of
+ *                  writing a file per frame
+ */
+struct video_export * video_export_init(const char *path, bool container);
 void video_export_destroy(struct video_export *state);
 void video_export(struct video_export *state, struct video_frame *frame);
 
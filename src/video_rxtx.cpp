@@ -153,6 +153,13 @@ void video_rxtx::send(shared_ptr<video_frame> frame) {
         if (!frame && m_poisoned) {
                 return;
         }
+        // compressions expect complete frames, fragments are passed through only uncompressed
+        if (frame && frame->fragment && strcmp(get_compress_name(m_compression), "none") != 0) {
+                frame = m_input_fragments.add(frame.get());
+                if (!frame) {
+                        return;
+                }
+        }
         compress_frame(m_compression, frame);
         if (!frame) {
                 m_poisoned = true;
@@ -194,10 +201,30 @@ void *video_rxtx::sender_loop() {
                 if (!tx_frame)
                         goto exit;
 
-                export_video(m_exporter, tx_frame.get());
-
                 tx_frame->paused_play = ret == STREAM_PAUSED_PLAY;
 
+                if (tx_frame->fragment) {
+                        if (supports_fragmented_frames(tx_frame.get())) {
+                                bool last = tx_frame->last_fragment;
+                                send_frame(tx_frame);
+                                if (m_exporter != nullptr) { // exporter needs whole frames, merge a copy after sending
+                                        if (auto whole = m_export_fragments.add(tx_frame.get())) {
+                                                export_video(m_exporter, whole.get());
+                                        }
+                                }
+                                if (last) {
+                                        m_frames_sent += 1;
+                                }
+                                continue;
+                        }
+                        tx_frame = m_output_fragments.add(tx_frame.get());
+                        if (!tx_frame) {
+                                continue;
+                        }
+                }
+
+                export_video(m_exporter, tx_frame.get());
+
                 send_frame(tx_frame);
                 m_frames_sent += 1;
         }
@@ -44,6 +44,7 @@
 #include <string>
 
 #include "module.h"
+#include "utils/vf_split.h"
 
 #define VIDEO_RXTX_ABI_VERSION 2
 
@@ -102,9 +103,17 @@ protected:
         int m_rxtx_mode;
         struct module *m_parent;
         unsigned long long int m_frames_sent;
+        struct compress_state *m_compression;
 private:
         void start();
         virtual void send_frame(std::shared_ptr<video_frame>) = 0;
+        /**
+         * If true, fragments of a frame (video_frame::fragment) are passed to send_frame()
+         * as soon as they are compressed. Otherwise they are merged to a complete frame.
+         */
+        virtual bool supports_fragmented_frames(const struct video_frame *) {
+                return false;
+        }
         virtual void *(*get_receiver_thread())(void *arg) = 0;
         static void *sender_thread(void *args);
         void *sender_loop();
@@ -113,9 +122,11 @@ private:
                 return NULL;
         }
 
-        struct compress_state *m_compression;
         pthread_mutex_t m_lock;
         struct exporter *m_exporter;
+        vf_fragment_assembler m_input_fragments;  ///< fragments passed to send() to be compressed
+        vf_fragment_assembler m_output_fragments; ///< fragments to be merged for send_frame()
+        vf_fragment_assembler m_export_fragments; ///< fragments sent as they are, merged for the exporter
 
         pthread_t m_thread_id;
         bool m_poisoned, m_joined;
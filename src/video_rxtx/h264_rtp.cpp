@@ -81,16 +81,24 @@ h264_rtp_video_rxtx::h264_rtp_video_rxtx(std::map<std::string, param_u> const &p
 
 void h264_rtp_video_rxtx::send_frame(shared_ptr<video_frame> tx_frame)
 {
+        auto tx_send = tx_frame->color_spec == H265 ? tx_send_h265
+                : tx_frame->color_spec == AV1 ? tx_send_av1
+                : tx_send_h264;
+#ifdef HAVE_RTSP_SERVER
+        if (m_rtsp_server->video_codec.load(std::memory_order_relaxed) != tx_frame->color_spec) {
+                m_rtsp_server->video_codec = tx_frame->color_spec; // for SDP, read by the RTSP server thread
+        }
+#endif
         if (m_connections_count == 1) { /* normal/default case - only one connection */
-            tx_send_h264(m_tx, tx_frame.get(), m_network_devices[0]);
+            tx_send(m_tx, tx_frame.get(), m_network_devices[0]);
         } else {
             //TODO to be tested, the idea is to reply per destiny
                 for (int i = 0; i < m_connections_count; ++i) {
-                    tx_send_h264(m_tx, tx_frame.get(),
+                    tx_send(m_tx, tx_frame.get(),
                                         m_network_devices[i]);
                 }
         }
-        if ((m_rxtx_mode & MODE_RECEIVER) == 0) { // send RTCP (receiver thread would otherwise do this
+        if ((m_rxtx_mode & MODE_RECEIVER) == 0 && (!tx_frame->fragment || tx_frame->last_fragment)) { // send RTCP (receiver thread would otherwise do this
                 time_ns_t curr_time = get_time_in_ns();
                 uint32_t ts = (curr_time - m_start_time) / 100'000 * 9; // at 90000 Hz
                 rtp_update(m_network_devices[0], curr_time);
@@ -108,7 +116,7 @@ h264_rtp_video_rxtx::~h264_rtp_video_rxtx()
 {
 #ifdef HAVE_RTSP_SERVER
         c_stop_server(m_rtsp_server);
-        free(m_rtsp_server);
+        c_destroy_server(m_rtsp_server);
 #endif
 }
 
@@ -52,6 +52,9 @@ public:
         virtual ~h264_rtp_video_rxtx();
 private:
         virtual void send_frame(std::shared_ptr<video_frame>);
+        virtual bool supports_fragmented_frames(const struct video_frame *f) {
+                return f->color_spec == H264 || f->color_spec == H265;
+        }
         virtual void *(*get_receiver_thread())(void *arg) {
                 return NULL;
         }
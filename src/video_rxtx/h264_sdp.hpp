@@ -55,6 +55,9 @@ public:
 private:
         static void change_address_callback(void *udata, const char *address);
         virtual void send_frame(std::shared_ptr<video_frame>);
+        virtual bool supports_fragmented_frames(const struct video_frame *f) {
+                return f->color_spec == H264 || f->color_spec == H265;
+        }
         virtual void *(*get_receiver_thread())(void *arg) {
                 return NULL;
         }
@@ -0,0 +1,151 @@
+/**
+ * @file   video_rxtx/shm.cpp
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#ifdef HAVE_SHM_TRANSPORT
+
+#include <string>
+#include <string_view>
+
+#include "debug.h"
+#include "lib_common.h"
+#include "utils/color_out.h"
+#include "utils/misc.h"
+#include "utils/shm_ring.h"
+#include "utils/sv_parse_num.hpp"
+#include "video_frame.h"
+#include "video_rxtx/shm.h"
+
+#define MOD_NAME "[shm] "
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::string;
+
+static void show_help() {
+        col() << "Shared-memory transport to an UltraGrid process on the same host (receiving with " << TBOLD("-t shm") << ").\n";
+        col() << "Usage:\n";
+        col() << TBOLD(TRED("\t--video-protocol shm") << "[:path=<path>][:slots=<n>]") << "\n\n";
+        col() << TBOLD("\tpath=<path>") << "\tpath of the Unix socket the reader connects to (default \"" SHM_RING_DEFAULT_PATH "\")\n";
+        col() << TBOLD("\tslots=<n>") << "\tnumber of frames in the ring (default " << SHM_RING_DEFAULT_SLOTS << ")\n";
+}
+
+shm_video_rxtx::shm_video_rxtx(std::map<std::string, param_u> const &params, struct shm_ring_writer *writer)
+        : video_rxtx(params), m_writer(writer)
+{
+}
+
+shm_video_rxtx::~shm_video_rxtx()
+{
+        join(); // sender thread must not use the writer anymore
+        shm_ring_writer_destroy(m_writer);
+}
+
+void shm_video_rxtx::send_frame(std::shared_ptr<video_frame> f)
+{
+        switch (shm_ring_writer_put(m_writer, f.get())) {
+        case SHM_RING_OK:
+                m_frames_written += 1;
+                break;
+        case SHM_RING_FULL:
+        case SHM_RING_ERROR:
+                m_frames_dropped += 1;
+                break;
+        case SHM_RING_NO_READER:
+                break;
+        }
+
+        auto now = steady_clock::now();
+        double seconds = duration<double>(now - m_t0).count();
+        if (seconds >= 5.0) {
+                if (m_frames_written > 0 || m_frames_dropped > 0) {
+                        log_msg(m_frames_dropped > 0 ? LOG_LEVEL_WARNING : LOG_LEVEL_INFO,
+                                        MOD_NAME "%d frames written, %d dropped in %g seconds.\n",
+                                        m_frames_written, m_frames_dropped, seconds);
+                }
+                m_t0 = now;
+                m_frames_written = m_frames_dropped = 0;
+        }
+}
+
+/// options are processed before the instance exists so that a failure doesn't need to unwind the base class
+static video_rxtx *create_video_rxtx_shm(std::map<std::string, param_u> const &params)
+{
+        string path = SHM_RING_DEFAULT_PATH;
+        int slots = SHM_RING_DEFAULT_SLOTS;
+        std::string_view fmt = params.at("opts").str;
+        while (!fmt.empty()) {
+                auto tok = tokenize(fmt, ':', '"');
+                auto key = tokenize(tok, '=');
+                if (key == "help") {
+                        show_help();
+                        throw 0;
+                }
+                if (key == "path") {
+                        path = tokenize(tok, '=');
+                } else if (key == "slots") {
+                        if (!parse_num(tokenize(tok, '='), slots)) {
+                                throw string(MOD_NAME "Wrong slot count!");
+                        }
+                } else {
+                        throw string(MOD_NAME "Unknown option: ") + string(key);
+                }
+        }
+        struct shm_ring_writer *writer = shm_ring_writer_create(path.c_str(), slots);
+        if (writer == nullptr) {
+                throw string(MOD_NAME "Unable to create the shared-memory writer.");
+        }
+        try {
+                return new shm_video_rxtx(params, writer);
+        } catch (...) {
+                shm_ring_writer_destroy(writer);
+                throw;
+        }
+}
+
+static const struct video_rxtx_info shm_video_rxtx_info = {
+        "shared memory (local)",
+        create_video_rxtx_shm
+};
+
+REGISTER_MODULE(shm, &shm_video_rxtx_info, LIBRARY_CLASS_VIDEO_RXTX, VIDEO_RXTX_ABI_VERSION);
+
+#endif // defined HAVE_SHM_TRANSPORT
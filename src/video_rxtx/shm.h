@@ -0,0 +1,67 @@
+/**
+ * @file   video_rxtx/shm.h
+ *
+ * Sender side of the shared-memory transport to an UltraGrid process running
+ * on the same host (which uses "-t shm"), see utils/shm_ring.h.
+ */
+/*
+ * Copyright (c) 2022 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VIDEO_RXTX_SHM_H_
+#define VIDEO_RXTX_SHM_H_
+
+#include <chrono>
+#include <memory>
+
+#include "video_rxtx.h"
+
+struct shm_ring_writer;
+
+class shm_video_rxtx : public video_rxtx {
+public:
+        shm_video_rxtx(std::map<std::string, param_u> const &, struct shm_ring_writer *writer);
+        virtual ~shm_video_rxtx();
+
+private:
+        virtual void send_frame(std::shared_ptr<video_frame>) override;
+        virtual void *(*get_receiver_thread())(void *arg) override {
+                return nullptr;
+        }
+
+        struct shm_ring_writer *m_writer = nullptr;
+        std::chrono::steady_clock::time_point m_t0 = std::chrono::steady_clock::now();
+        int m_frames_written = 0;
+        int m_frames_dropped = 0;
+};
+
+#endif // VIDEO_RXTX_SHM_H_
@@ -64,6 +64,8 @@
 #include "tfrc.h"
 #include "transmit.h"
 #include "tv.h"
+#include "utils/misc.h"
+#include "utils/synchronized_queue.h"
 #include "utils/thread.h"
 #include "utils/vf_split.h"
 #include "video.h"
@@ -75,12 +77,102 @@
 #include "ug_runtime_error.hpp"
 #include "utils/worker.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <utility>
 
+#define MAX_QUEUED_PARTICIPANT_FRAMES 2
+#define IDLE_TIMEOUT_NS (NS_IN_SEC / 10) ///< max receive wait without any pending pbuf deadline
+#define CC_DEFAULT_RTT_US 100000 ///< announced until RTT is computed from RTCP RR
+#define CC_COMPRESS_MIN_INTERVAL (2 * NS_IN_SEC) ///< minimal interval between compression bitrate changes
+#define CC_COMPRESS_BITRATE_FRAC 0.8 ///< fraction of the allowed rate requested from the encoder
+
 using namespace std;
 
+#define CONGESTION_CONTROL_PARAM "congestion-control"
+ADD_TO_PARAM(CONGESTION_CONTROL_PARAM, "* " CONGESTION_CONTROL_PARAM "\n"
+                "  Adapt sending rate (and libavcodec bitrate) according to TFRC feedback from receivers\n");
+
+/**
+ * Decodes frames of a single participant in a dedicated thread so that a slow
+ * decoder (or display) of one participant doesn't hold up receiving and
+ * decoding of the others. Used with multi-source displays only, otherwise
+ * there is just one active decoder at a time.
+ */
+class participant_decode_worker {
+public:
+        explicit participant_decode_worker(struct vcodec_state *state) : m_state(state) {
+                m_thread = thread(&participant_decode_worker::run, this);
+        }
+        ~participant_decode_worker() {
+                m_queue.push({});
+                m_thread.join();
+        }
+        /// decode_frame_t for pbuf_decode_detach(), takes ownership of cdata
+        static int enqueue(struct coded_data *cdata, void *arg, struct pbuf_stats *stats) {
+                auto *w = static_cast<participant_decode_worker *>(arg);
+                // we are the only producer so the queue cannot grow meanwhile
+                if (w->m_queue.size() >= MAX_QUEUED_PARTICIPANT_FRAMES) {
+                        log_msg(LOG_LEVEL_VERBOSE, "Decoder of participant is busy, dropping frame.\n");
+                        pbuf_free_coded_data(cdata);
+                        return FALSE;
+                }
+                {
+                        lock_guard<mutex> lk(w->m_pending_lock);
+                        w->m_pending += 1;
+                }
+                w->m_queue.push(unique_ptr<job>(new job{cdata, *stats}));
+                return TRUE;
+        }
+        /// waits until all enqueued frames are decoded, the worker stays running
+        void drain() {
+                unique_lock<mutex> lk(m_pending_lock);
+                m_pending_cv.wait(lk, [this] { return m_pending == 0; });
+        }
+        /// vcodec_state counters are updated by the worker so they are
+        /// passed to the receiver thread through these
+        unsigned int decoded() const {
+                return m_decoded;
+        }
+        unsigned int max_frame_size() const {
+                return m_max_frame_size;
+        }
+private:
+        struct job {
+                struct coded_data *cdata;
+                struct pbuf_stats stats;
+        };
+        void run() {
+                set_thread_name("participant_dec");
+                while (unique_ptr<job> j = m_queue.pop()) {
+                        decode_video_frame(j->cdata, m_state, &j->stats);
+                        pbuf_free_coded_data(j->cdata);
+                        m_max_frame_size = m_state->max_frame_size;
+                        m_decoded = m_state->decoded;
+                        lock_guard<mutex> lk(m_pending_lock);
+                        if (--m_pending == 0) {
+                                m_pending_cv.notify_all();
+                        }
+                }
+        }
+
+        struct vcodec_state *m_state;
+        atomic_uint m_decoded{0};
+        atomic_uint m_max_frame_size{0};
+        synchronized_queue<unique_ptr<job>, -1> m_queue;
+        mutex m_pending_lock;
+        condition_variable m_pending_cv;
+        unsigned int m_pending = 0; ///< enqueued but not yet decoded frames
+        thread m_thread;
+};
+
 ultragrid_rtp_video_rxtx::ultragrid_rtp_video_rxtx(const map<string, param_u> &params) :
         rtp_video_rxtx(params), m_send_bytes_total(0)
 {
@@ -95,6 +187,7 @@ ultragrid_rtp_video_rxtx::ultragrid_rtp_video_rxtx(const map<string, param_u> &p
         }
 
         m_control = (struct control_state *) get_module(get_root_module(static_cast<struct module *>(params.at("parent").ptr)), "control");
+        m_congestion_control = get_commandline_param(CONGESTION_CONTROL_PARAM) != nullptr;
 }
 
 ultragrid_rtp_video_rxtx::~ultragrid_rtp_video_rxtx()
@@ -136,6 +229,16 @@ void ultragrid_rtp_video_rxtx::send_frame(shared_ptr<video_frame> tx_frame)
                         (void *) data);
 }
 
+/**
+ * Stripes of uncompressed frames can be sent immediately - the receiver needs
+ * to know the size of the whole frame in advance.
+ */
+bool ultragrid_rtp_video_rxtx::supports_fragmented_frames(const struct video_frame *f)
+{
+        return !is_codec_opaque(f->color_spec) && m_fec_state == nullptr && m_connections_count == 1
+                && tx_supports_fragments(m_tx);
+}
+
 void *ultragrid_rtp_video_rxtx::send_frame_async_callback(void *arg) {
         auto data = (pair<ultragrid_rtp_video_rxtx *, shared_ptr<video_frame>> *) arg;
 
@@ -183,6 +286,10 @@ void ultragrid_rtp_video_rxtx::send_frame_async(shared_ptr<video_frame> tx_frame
                         struct timeval timeout { 0, 0 };
                         rc = rtcp_recv_r(m_network_devices[0], &timeout, ts);
                 } while (!should_exit && rc == TRUE);
+
+                if (m_congestion_control) {
+                        congestion_control(curr_time, ts);
+                }
         }
 
 after_send:
@@ -192,6 +299,50 @@ after_send:
         m_async_sending_cv.notify_all();
 }
 
+/**
+ * Applies rate reported by receivers (the lowest one) to the transmitter and
+ * compression. Receivers that stopped reporting are not taken into account,
+ * the transmitter is not limited if no receiver reports. Must be called from
+ * the thread processing RTCP.
+ */
+void ultragrid_rtp_video_rxtx::congestion_control(time_ns_t curr_time, uint32_t ts)
+{
+        if (curr_time - m_cc_rtt_sent > NS_IN_SEC) { // let the receivers know that we want the feedback
+                rtp_send_tfrc_rtt(m_network_devices[0], ts, RTT > 0 ? RTT : CC_DEFAULT_RTT_US);
+                m_cc_rtt_sent = curr_time;
+        }
+
+        double rate = 0;
+        pdb_iter_t it;
+        struct pdb_e *cp = pdb_iter_init(m_participants, &it);
+        while (cp != NULL) {
+                double participant_rate = tfrc_get_txrate(cp->tfrc_state, curr_time);
+                if (participant_rate > 0 && (rate == 0 || participant_rate < rate)) {
+                        rate = participant_rate;
+                }
+                cp = pdb_iter_next(&it);
+        }
+        pdb_iter_done(&it);
+        tx_set_congestion_rate(m_tx, rate);
+        if (rate == 0) {
+                return;
+        }
+
+        // only libavcodec can change bitrate without reinitialization so do not bother others
+        if (strcmp(get_compress_name(m_compression), "libavcodec") != 0
+                        || curr_time - m_cc_compress_changed < CC_COMPRESS_MIN_INTERVAL
+                        || fabs(rate - m_cc_compress_rate) < m_cc_compress_rate * 0.2) {
+                return;
+        }
+        auto *msg = (struct msg_change_compress_data *) new_message(sizeof(struct msg_change_compress_data));
+        msg->what = CHANGE_PARAMS;
+        snprintf(msg->config_string, sizeof msg->config_string, "bitrate=%lld", (long long) (rate * CC_COMPRESS_BITRATE_FRAC));
+        free_response(send_message(get_root_module(m_parent), "sender.compress", (struct message *) msg));
+        LOG(LOG_LEVEL_VERBOSE) << "[UG RTP] Congestion control: rate " << format_in_si_units(rate) << "bps\n";
+        m_cc_compress_rate = rate;
+        m_cc_compress_changed = curr_time;
+}
+
 void ultragrid_rtp_video_rxtx::receiver_process_messages()
 {
         struct msg_receiver *msg;
@@ -251,9 +402,15 @@ void ultragrid_rtp_video_rxtx::remove_display_from_decoders() {
                 pdb_iter_t it;
                 struct pdb_e *cp = pdb_iter_init(m_participants, &it);
                 while (cp != NULL) {
-                        if(cp->decoder_state)
-                                video_decoder_remove_display(
-                                                ((struct vcodec_state*) cp->decoder_state)->decoder);
+                        if(cp->decoder_state) {
+                                struct vcodec_state *state = (struct vcodec_state*) cp->decoder_state;
+                                // finish pending frames, the decoder must not be used concurrently;
+                                // the worker is kept, it is destroyed together with the decoder
+                                if (state->decode_worker) {
+                                        static_cast<participant_decode_worker *>(state->decode_worker)->drain();
+                                }
+                                video_decoder_remove_display(state->decoder);
+                        }
                         cp = pdb_iter_next(&it);
                 }
                 pdb_iter_done(&it);
@@ -267,6 +424,7 @@ void ultragrid_rtp_video_rxtx::destroy_video_decoder(void *state) {
                 return;
         }
 
+        delete static_cast<participant_decode_worker *>(video_decoder_state->decode_worker);
         video_decoder_destroy(video_decoder_state->decoder);
 
         free(video_decoder_state);
@@ -292,6 +450,33 @@ struct vcodec_state *ultragrid_rtp_video_rxtx::new_video_decoder(struct display
         return state;
 }
 
+/**
+ * @returns the earliest time when some of the participants' playout buffers
+ * needs to be processed
+ */
+time_ns_t ultragrid_rtp_video_rxtx::get_next_pbuf_deadline(time_ns_t curr_time)
+{
+        time_ns_t deadline = INT64_MAX;
+        pdb_iter_t it;
+        struct pdb_e *cp = pdb_iter_init(m_participants, &it);
+        while (cp != NULL) {
+                if (cp->decoder_state == NULL && !pbuf_is_empty(cp->playout_buffer)) {
+                        deadline = curr_time; // create the decoder as soon as the participant sends data
+                } else {
+                        deadline = min(deadline, pbuf_next_deadline(cp->playout_buffer));
+                }
+                cp = pdb_iter_next(&it);
+        }
+        pdb_iter_done(&it);
+        return deadline;
+}
+
+/**
+ * The loop waits for incoming packets or the nearest playout buffer deadline
+ * (see pbuf_next_deadline()) and processes the participants only when any of
+ * the deadlines expires, so that a frame is passed to the decoder as soon as
+ * it is complete and no time is spent by periodic polling.
+ */
 void *ultragrid_rtp_video_rxtx::receiver_loop()
 {
         set_thread_name(__func__);
@@ -313,8 +498,6 @@ void *ultragrid_rtp_video_rxtx::receiver_loop()
 
         fr = 1;
 
-        time_ns_t last_not_timeout = 0;
-
         while (!should_exit) {
                 struct timeval timeout;
                 /* Housekeeping and RTCP... */
@@ -323,32 +506,35 @@ void *ultragrid_rtp_video_rxtx::receiver_loop()
 
                 rtp_update(m_network_devices[0], curr_time);
                 rtp_send_ctrl(m_network_devices[0], ts, 0, curr_time);
+                if (m_congestion_control && (m_rxtx_mode & MODE_SENDER) != 0) {
+                        congestion_control(curr_time, ts);
+                }
 
-                /* Receive packets from the network... The timeout is adjusted */
-                /* to match the video capture rate, so the transmitter works.  */
                 if (fr) {
                         curr_time = get_time_in_ns();
                         receiver_process_messages();
                         fr = 0;
                 }
 
-                timeout.tv_sec = 0;
-                //timeout.tv_usec = 999999 / 59.94;
-                // use longer timeout when we are not receivng any data
-                if ((last_not_timeout - curr_time) > NS_IN_SEC) {
-                        timeout.tv_usec = 100000;
-                } else {
-                        timeout.tv_usec = 1000;
-                }
-                ret = rtp_recv_r(m_network_devices[0], &timeout, ts);
-
-                // timeout
-                if (ret == FALSE) {
-                        // processing is needed here in case we are not receiving any data
-                        receiver_process_messages();
-                        //printf("Failed to receive data\n");
-                } else {
-                        last_not_timeout = curr_time;
+                /* Receive packets from the network until some playout buffer */
+                /* deadline expires (or at least every IDLE_TIMEOUT_NS for     */
+                /* housekeeping and messages).                                 */
+                time_ns_t deadline = get_next_pbuf_deadline(curr_time);
+                if (deadline > curr_time) {
+                        time_ns_t wait_ns = min<time_ns_t>(deadline - curr_time, IDLE_TIMEOUT_NS);
+                        timeout.tv_sec = wait_ns / NS_IN_SEC;
+                        timeout.tv_usec = (wait_ns % NS_IN_SEC + 999) / 1000;
+                        ret = rtp_recv_r(m_network_devices[0], &timeout, ts);
+
+                        // timeout
+                        if (ret == FALSE) {
+                                // processing is needed here in case we are not receiving any data
+                                receiver_process_messages();
+                        }
+                        curr_time = get_time_in_ns();
+                        if (curr_time < deadline) {
+                                continue;
+                        }
                 }
 
                 /* Decode and render for each participant in the conference... */
@@ -356,9 +542,8 @@ void *ultragrid_rtp_video_rxtx::receiver_loop()
                 cp = pdb_iter_init(m_participants, &it);
                 while (cp != NULL) {
                         if (tfrc_feedback_is_due(cp->tfrc_state, curr_time)) {
-                                debug_msg("tfrc rate %f\n",
-                                          tfrc_feedback_txrate(cp->tfrc_state,
-                                                               curr_time));
+                                rtp_send_tfrc_feedback(m_network_devices[0], ts, cp->ssrc,
+                                                tfrc_feedback_txrate(cp->tfrc_state, curr_time));
                         }
 
                         if(cp->decoder_state == NULL &&
@@ -395,14 +580,21 @@ void *ultragrid_rtp_video_rxtx::receiver_loop()
                                         exit_uv(1);
                                         break;
                                 }
+                                if (supp_for_mult_sources.val) {
+                                        struct vcodec_state *state = (struct vcodec_state *) cp->decoder_state;
+                                        state->decode_worker = new participant_decode_worker(state);
+                                }
 #endif // SHARED_DECODER
                         }
 
                         struct vcodec_state *vdecoder_state = (struct vcodec_state *) cp->decoder_state;
 
                         /* Decode and render video... */
-                        if (pbuf_decode
-                            (cp->playout_buffer, curr_time, decode_video_frame, vdecoder_state)) {
+                        int decoded = vdecoder_state && vdecoder_state->decode_worker
+                                ? pbuf_decode_detach(cp->playout_buffer, curr_time,
+                                                participant_decode_worker::enqueue, vdecoder_state->decode_worker)
+                                : pbuf_decode(cp->playout_buffer, curr_time, decode_video_frame, vdecoder_state);
+                        if (decoded) {
                                 tiles_post++;
                                 /* we have data from all connections we need */
                                 if(tiles_post == m_connections_count)
@@ -435,8 +627,18 @@ void *ultragrid_rtp_video_rxtx::receiver_loop()
                                 last_tile_received = curr_time;
                         }
 
-                        if(vdecoder_state && vdecoder_state->decoded % 100 == 99) {
-                                int new_size = vdecoder_state->max_frame_size * 110ull / 100;
+                        unsigned int decoded_count = 0;
+                        unsigned int max_frame_size = 0;
+                        if (vdecoder_state && vdecoder_state->decode_worker) {
+                                auto *w = static_cast<participant_decode_worker *>(vdecoder_state->decode_worker);
+                                decoded_count = w->decoded();
+                                max_frame_size = w->max_frame_size();
+                        } else if (vdecoder_state) {
+                                decoded_count = vdecoder_state->decoded;
+                                max_frame_size = vdecoder_state->max_frame_size;
+                        }
+                        if(vdecoder_state && decoded_count % 100 == 99) {
+                                int new_size = max_frame_size * 110ull / 100;
                                 if(new_size > last_buf_size) {
                                         struct rtp **device = m_network_devices;
                                         while(*device) {
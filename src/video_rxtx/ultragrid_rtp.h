@@ -61,12 +61,15 @@ public:
 private:
         static void *receiver_thread(void *arg);
         virtual void send_frame(std::shared_ptr<video_frame>);
+        virtual bool supports_fragmented_frames(const struct video_frame *);
         void *receiver_loop();
+        time_ns_t get_next_pbuf_deadline(time_ns_t curr_time);
         static void *send_frame_async_callback(void *arg);
         virtual void send_frame_async(std::shared_ptr<video_frame>);
         virtual void *(*get_receiver_thread())(void *arg);
 
         void receiver_process_messages();
+        void congestion_control(time_ns_t curr_time, uint32_t ts);
         void remove_display_from_decoders();
         struct vcodec_state *new_video_decoder(struct display *d);
         static void destroy_video_decoder(void *state);
@@ -93,6 +96,11 @@ private:
         long long int m_nano_per_frame_actual_cumul = 0;
         long long int m_nano_per_frame_expected_cumul = 0;
         long long int m_compress_millis_cumul = 0;
+
+        bool m_congestion_control; ///< adapt to TFRC feedback from receivers
+        time_ns_t m_cc_rtt_sent = 0;
+        double m_cc_compress_rate = 0; ///< rate last passed to compression
+        time_ns_t m_cc_compress_changed = 0;
 };
 
 #endif // VIDEO_RXTX_ULTRAGRID_RTP_H_
@@ -0,0 +1,456 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif
+
+#if defined HAVE_CPPUNIT && defined HAVE_RTSP
+
+#include <cppunit/config/SourcePrefix.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "host.h"
+#include "module.h"
+#include "rtp/net_udp.h"
+#include "rtp/pbuf.h"
+#include "rtp/rtp.h"
+#include "rtp/rtpdec_h264.h"
+#include "rtp/rtpenc_h264.h"
+#include "rtp_payload_test.hpp"
+#include "transmit.h"
+#include "video_frame.h"
+
+using std::pair;
+using std::vector;
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION( rtp_payload_test );
+
+#define MTU 1500
+#define MAX_PAYLOAD_LEN (MTU - 40) ///< same as used by the packetizers in transmit.cpp
+
+#define H264_NAL_SEI 6
+#define H264_NAL_PPS 8
+#define H264_NAL_IDR 5
+#define H264_NAL_SLICE 1
+#define H264_STAP_A 24
+#define H264_FU_A 28
+
+#define AV1_AGGR_Z 0x80
+#define AV1_AGGR_Y 0x40
+#define AV1_AGGR_N 0x08
+#define AV1_OBU_TEMPORAL_DELIMITER 2
+
+namespace {
+
+struct received_packet {
+        bool m;
+        vector<unsigned char> payload;
+};
+
+using obu_list = vector<pair<vector<unsigned char>, vector<unsigned char>>>; ///< OBU elements (header, payload)
+
+void no_rtp_callback(struct rtp *, rtp_event *)
+{
+}
+
+/**
+ * Sends the frame with given packetizer over a loopback RTP session and
+ * returns payloads of the received RTP packets.
+ */
+vector<received_packet> packetize(void (*tx_send)(struct tx *, struct video_frame *, struct rtp *),
+                codec_t codec, const vector<unsigned char> &bitstream)
+{
+        int port = 0;
+        for (int p = 15000; p < 16000; p += 4) {
+                if (udp_port_pair_is_free(4, p) == 0 && udp_port_pair_is_free(4, p + 2) == 0) {
+                        port = p;
+                        break;
+                }
+        }
+        CPPUNIT_ASSERT(port != 0);
+
+        socket_udp *rx = udp_init("127.0.0.1", port, port + 2, 255, 4, false);
+        CPPUNIT_ASSERT(rx != nullptr);
+        udp_set_recv_buf(rx, 8 * 1024 * 1024);
+        struct rtp *session = rtp_init("127.0.0.1", port + 2, port, 255, 64 * 1024 * 1024, 0,
+                        no_rtp_callback, nullptr, 4, false);
+        CPPUNIT_ASSERT(session != nullptr);
+        struct tx *tx = tx_init(nullptr, MTU, TX_MEDIA_VIDEO, nullptr, nullptr, RATE_UNLIMITED);
+        CPPUNIT_ASSERT(tx != nullptr);
+
+        struct video_frame *frame = vf_alloc(1);
+        frame->color_spec = codec;
+        frame->tiles[0].data = (char *) const_cast<unsigned char *>(bitstream.data());
+        frame->tiles[0].data_len = bitstream.size();
+        tx_send(tx, frame, session);
+        frame->tiles[0].data = nullptr;
+        vf_free(frame);
+
+        vector<received_packet> packets;
+        char buf[RTP_MAX_PACKET_LEN];
+        struct timeval timeout = { 0, 200000 };
+        int len = 0;
+        while ((len = udp_recv_timeout(rx, buf, sizeof buf, &timeout)) > 0) {
+                int hdr_len = 12 + 4 * (buf[0] & 0xF);
+                CPPUNIT_ASSERT(len >= hdr_len);
+                packets.push_back({ (buf[1] & 0x80) != 0, vector<unsigned char>(buf + hdr_len, buf + len) });
+                timeout = { 0, 200000 };
+        }
+
+        module_done(CAST_MODULE(tx));
+        rtp_done(session);
+        udp_exit(rx);
+        return packets;
+}
+
+/**
+ * Passes the packets to the depacketizer the same way as pbuf does (list
+ * starting with the newest packet) and returns the reconstructed frame.
+ */
+vector<unsigned char> depacketize(int (*decode)(struct coded_data *, void *),
+                const vector<received_packet> &packets, enum frame_type *type = nullptr)
+{
+        CPPUNIT_ASSERT(!packets.empty());
+        vector<rtp_packet> rtp(packets.size());
+        vector<coded_data> cdata(packets.size());
+        size_t total_len = 0;
+        for (unsigned i = 0; i < packets.size(); ++i) {
+                rtp[i].data = (char *) const_cast<unsigned char *>(packets[i].payload.data());
+                rtp[i].data_len = packets[i].payload.size();
+                cdata[i].data = &rtp[i];
+                cdata[i].nxt = i > 0 ? &cdata[i - 1] : nullptr;
+                cdata[i].prv = i + 1 < packets.size() ? &cdata[i + 1] : nullptr;
+                total_len += packets[i].payload.size();
+        }
+
+        vector<unsigned char> out(2 * total_len + 1024); // space for start codes/obu_size fields
+        struct video_frame *frame = vf_alloc(1);
+        frame->tiles[0].data = (char *) out.data();
+        struct decode_data_h264 decode_data{};
+        decode_data.frame = frame;
+        CPPUNIT_ASSERT(decode(&cdata.back(), &decode_data));
+        CPPUNIT_ASSERT(frame->tiles[0].data_len <= out.size());
+        out.resize(frame->tiles[0].data_len);
+        if (type != nullptr) {
+                *type = frame->frame_type;
+        }
+        frame->tiles[0].data = nullptr;
+        vf_free(frame);
+        return out;
+}
+
+void append_leb128(vector<unsigned char> &v, uint32_t val)
+{
+        do {
+                v.push_back((val & 0x7F) | (val > 0x7F ? 0x80 : 0));
+                val >>= 7;
+        } while (val != 0);
+}
+
+/// appends payload of len bytes with no zero byte (cannot emulate a start code)
+void append_payload(vector<unsigned char> &v, unsigned len, unsigned seed)
+{
+        for (unsigned i = 0; i < len; ++i) {
+                v.push_back((i + seed) % 251 + 1);
+        }
+}
+
+/// appends NAL unit with 4-byte start code, len includes the NAL header
+void append_h264_nal(vector<unsigned char> &v, unsigned type, unsigned len)
+{
+        v.insert(v.end(), { 0, 0, 0, 1, (unsigned char) (3 << 5 | type) });
+        append_payload(v, len - 1, type);
+}
+
+void append_hevc_nal(vector<unsigned char> &v, unsigned type, unsigned len)
+{
+        v.insert(v.end(), { 0, 0, 0, 1, (unsigned char) (type << 1), 1 });
+        append_payload(v, len - 2, type);
+}
+
+/// appends OBU with obu_size (low overhead bitstream format)
+void append_av1_obu(vector<unsigned char> &v, unsigned type, unsigned len, bool extension = false)
+{
+        v.push_back(type << 3 | (extension ? 0x4 : 0) | 0x2);
+        if (extension) {
+                v.push_back(0x28); // temporal_id 1, spatial_id 1
+        }
+        append_leb128(v, len);
+        append_payload(v, len, type);
+}
+
+/// parses low overhead bitstream to OBU elements (OBU header without has_size flag), temporal delimiters skipped
+obu_list parse_av1_obus(const vector<unsigned char> &v)
+{
+        obu_list obus;
+        size_t i = 0;
+        while (i < v.size()) {
+                unsigned hdr_len = v[i] & 0x4 ? 2 : 1;
+                CPPUNIT_ASSERT(v[i] & 0x2);
+                vector<unsigned char> hdr(v.begin() + i, v.begin() + i + hdr_len);
+                hdr[0] &= ~0x2;
+                i += hdr_len;
+                uint32_t len = 0;
+                for (int shift = 0; ; shift += 7) {
+                        CPPUNIT_ASSERT(i < v.size());
+                        len |= (uint32_t) (v[i] & 0x7F) << shift;
+                        if ((v[i++] & 0x80) == 0) {
+                                break;
+                        }
+                }
+                CPPUNIT_ASSERT(i + len <= v.size());
+                if (((hdr[0] >> 3) & 0xF) != AV1_OBU_TEMPORAL_DELIMITER) {
+                        obus.emplace_back(hdr, vector<unsigned char>(v.begin() + i, v.begin() + i + len));
+                }
+                i += len;
+        }
+        return obus;
+}
+
+} // end of anonymous namespace
+
+rtp_payload_test::rtp_payload_test()
+{
+}
+
+rtp_payload_test::~rtp_payload_test()
+{
+}
+
+void
+rtp_payload_test::setUp()
+{
+}
+
+
+void
+rtp_payload_test::tearDown()
+{
+}
+
+/**
+ * The start code scanner compares 16 (SSE2) or 32 (AVX2) positions at once,
+ * so a start code is placed at every offset around the block boundaries, both
+ * 3-byte and 4-byte one (whose leading zero may fall to the previous block).
+ */
+void
+rtp_payload_test::test_h264_start_code_scan()
+{
+        const unsigned len = 100;
+        for (unsigned pos = 1; pos + 4 <= len; ++pos) {
+                for (unsigned sc_len = 3; sc_len <= 4; ++sc_len) {
+                        if (pos + sc_len >= len) {
+                                continue;
+                        }
+                        vector<unsigned char> buf;
+                        append_payload(buf, len, pos);
+                        for (unsigned i = 0; i < sc_len - 1; ++i) {
+                                buf[pos + i] = 0;
+                        }
+                        buf[pos + sc_len - 1] = 1;
+
+                        // single NAL unit after the start code
+                        const unsigned char *end = nullptr;
+                        const unsigned char *nal = rtpenc_h264_get_next_nal(buf.data(), len, &end);
+                        CPPUNIT_ASSERT(nal == buf.data() + pos + sc_len);
+                        CPPUNIT_ASSERT(end == buf.data() + len);
+
+                        // NAL unit at the beginning ends with the start code
+                        buf[0] = 0;
+                        buf[1] = 0;
+                        buf[2] = 1;
+                        if (pos < 4) {
+                                continue; // overlaps the first start code
+                        }
+                        nal = rtpenc_h264_get_next_nal(buf.data(), len, &end);
+                        CPPUNIT_ASSERT(nal == buf.data() + 3);
+                        CPPUNIT_ASSERT(end == buf.data() + pos);
+                }
+        }
+
+        // start code without any following byte is not a NAL unit
+        vector<unsigned char> buf;
+        append_payload(buf, 61, 0);
+        buf.insert(buf.end(), { 0, 0, 1 });
+        CPPUNIT_ASSERT(rtpenc_h264_get_next_nal(buf.data(), buf.size(), nullptr) == nullptr);
+}
+
+/**
+ * NAL units exceeding the MTU are sent as FU-A (S and E bits set on the first
+ * and last fragment), the others as single NAL unit packets. STAP-A, which is
+ * not produced by the packetizer, is built from the parameter sets manually and
+ * must depacketize to the same stream. NAL sizes are chosen so that the start
+ * codes straddle the boundaries of the SIMD blocks of the scanner.
+ */
+void
+rtp_payload_test::test_h264_stap_a_fu_a()
+{
+        vector<unsigned char> h264;
+        append_h264_nal(h264, H264_NAL_SEI, 15);
+        append_h264_nal(h264, H264_NAL_PPS, 31);
+        append_h264_nal(h264, H264_NAL_IDR, 5000); // fragmented
+        append_h264_nal(h264, H264_NAL_SLICE, 63);
+
+        vector<received_packet> packets = packetize(tx_send_h264, H264, h264);
+        CPPUNIT_ASSERT_EQUAL(3 + 4, (int) packets.size()); // 3 single NAL unit packets + 4 FU-As
+        int fu_starts = 0;
+        int fu_ends = 0;
+        for (unsigned i = 0; i < packets.size(); ++i) {
+                const vector<unsigned char> &p = packets[i].payload;
+                CPPUNIT_ASSERT(p.size() <= MAX_PAYLOAD_LEN);
+                CPPUNIT_ASSERT_EQUAL(i == packets.size() - 1, packets[i].m);
+                if ((p[0] & 0x1F) != H264_FU_A) {
+                        continue;
+                }
+                CPPUNIT_ASSERT_EQUAL(3 << 5, p[0] & 0xE0); // NRI of the original NAL unit
+                CPPUNIT_ASSERT_EQUAL(H264_NAL_IDR, p[1] & 0x1F);
+                fu_starts += (p[1] & 0x80) != 0;
+                fu_ends += (p[1] & 0x40) != 0;
+                CPPUNIT_ASSERT((p[1] & 0xC0) != 0xC0);
+        }
+        CPPUNIT_ASSERT_EQUAL(1, fu_starts);
+        CPPUNIT_ASSERT_EQUAL(1, fu_ends);
+        CPPUNIT_ASSERT_EQUAL(15U, (unsigned) packets[0].payload.size());
+        CPPUNIT_ASSERT_EQUAL(31U, (unsigned) packets[1].payload.size());
+
+        enum frame_type type = OTHER;
+        CPPUNIT_ASSERT(depacketize(decode_frame_h264, packets, &type) == h264);
+        CPPUNIT_ASSERT_EQUAL((int) INTRA, (int) type);
+
+        // SEI and PPS aggregated into a single STAP-A
+        received_packet stap{ false, { 3 << 5 | H264_STAP_A } };
+        for (int i = 0; i < 2; ++i) {
+                const vector<unsigned char> &nal = packets[i].payload;
+                stap.payload.push_back(nal.size() >> 8);
+                stap.payload.push_back(nal.size() & 0xFF);
+                stap.payload.insert(stap.payload.end(), nal.begin(), nal.end());
+        }
+        vector<received_packet> aggregated{ stap };
+        aggregated.insert(aggregated.end(), packets.begin() + 2, packets.end());
+        type = OTHER;
+        CPPUNIT_ASSERT(depacketize(decode_frame_h264, aggregated, &type) == h264);
+        CPPUNIT_ASSERT_EQUAL((int) INTRA, (int) type);
+}
+
+/**
+ * NAL units exceeding the MTU are sent as FUs - S bit on the first fragment,
+ * E bit on the last one, reconstructed NAL header must match the original.
+ */
+void
+rtp_payload_test::test_h265_fu()
+{
+        vector<unsigned char> hevc;
+        append_hevc_nal(hevc, 32, 24);   // VPS
+        append_hevc_nal(hevc, 33, 40);   // SPS
+        append_hevc_nal(hevc, 34, 8);    // PPS
+        append_hevc_nal(hevc, 19, 5000); // IDR_W_RADL - fragmented
+        append_hevc_nal(hevc, 19, 700);  // second slice - fits a packet
+
+        vector<received_packet> packets = packetize(tx_send_h265, H265, hevc);
+        CPPUNIT_ASSERT_EQUAL(4 + 4, (int) packets.size()); // 4 single NAL unit packets + 4 FUs
+        int fu_starts = 0;
+        int fu_ends = 0;
+        for (unsigned i = 0; i < packets.size(); ++i) {
+                const vector<unsigned char> &p = packets[i].payload;
+                CPPUNIT_ASSERT(p.size() <= MAX_PAYLOAD_LEN);
+                CPPUNIT_ASSERT_EQUAL(i == packets.size() - 1, packets[i].m);
+                if (((p[0] >> 1) & 0x3F) != 49) {
+                        continue;
+                }
+                CPPUNIT_ASSERT_EQUAL(19, p[2] & 0x3F);
+                fu_starts += (p[2] & 0x80) != 0;
+                fu_ends += (p[2] & 0x40) != 0;
+                CPPUNIT_ASSERT((p[2] & 0xC0) != 0xC0);
+        }
+        CPPUNIT_ASSERT_EQUAL(1, fu_starts);
+        CPPUNIT_ASSERT_EQUAL(1, fu_ends);
+
+        enum frame_type type = OTHER;
+        CPPUNIT_ASSERT(depacketize(decode_frame_h265, packets, &type) == hevc);
+        CPPUNIT_ASSERT_EQUAL((int) INTRA, (int) type);
+}
+
+/**
+ * OBU spanning multiple packets is sent with Y (continues) and Z (continued)
+ * bits, temporal delimiter is dropped and the sequence header sets N.
+ */
+void
+rtp_payload_test::test_av1_obu_continuation()
+{
+        vector<unsigned char> av1;
+        append_av1_obu(av1, AV1_OBU_TEMPORAL_DELIMITER, 0);
+        append_av1_obu(av1, 1, 12);        // sequence header
+        append_av1_obu(av1, 6, 4000);      // frame - spans 3 packets
+        append_av1_obu(av1, 6, 300, true); // frame with extension header
+
+        vector<received_packet> packets = packetize(tx_send_av1, AV1, av1);
+        CPPUNIT_ASSERT_EQUAL(3, (int) packets.size());
+        CPPUNIT_ASSERT_EQUAL(AV1_AGGR_N | AV1_AGGR_Y, packets[0].payload[0] & (AV1_AGGR_Z | AV1_AGGR_Y | AV1_AGGR_N));
+        CPPUNIT_ASSERT_EQUAL(AV1_AGGR_Z | AV1_AGGR_Y, packets[1].payload[0] & (AV1_AGGR_Z | AV1_AGGR_Y | AV1_AGGR_N));
+        CPPUNIT_ASSERT_EQUAL(AV1_AGGR_Z, packets[2].payload[0] & (AV1_AGGR_Z | AV1_AGGR_Y | AV1_AGGR_N));
+        for (unsigned i = 0; i < packets.size(); ++i) {
+                CPPUNIT_ASSERT(packets[i].payload.size() <= MAX_PAYLOAD_LEN);
+                CPPUNIT_ASSERT_EQUAL(0, (packets[i].payload[0] >> 4) & 0x3); // W=0
+                CPPUNIT_ASSERT_EQUAL(i == packets.size() - 1, packets[i].m);
+        }
+
+        enum frame_type type = OTHER;
+        vector<unsigned char> out = depacketize(decode_frame_av1, packets, &type);
+        CPPUNIT_ASSERT(parse_av1_obus(out) == parse_av1_obus(av1));
+        CPPUNIT_ASSERT_EQUAL((int) INTRA, (int) type);
+}
+
+/**
+ * Depacketization of hand-made packets - explicit element count (W != 0,
+ * last element without the length field) must give the same result as W=0.
+ */
+void
+rtp_payload_test::test_av1_w_field()
+{
+        vector<unsigned char> seq_hdr = { 1 << 3 };
+        append_payload(seq_hdr, 5, 0);
+        vector<unsigned char> frame = { 6 << 3 };
+        append_payload(frame, 20, 1);
+        obu_list expected = { { { seq_hdr[0] }, { seq_hdr.begin() + 1, seq_hdr.end() } },
+                { { frame[0] }, { frame.begin() + 1, frame.end() } } };
+
+        received_packet w0{ true, { 0 } };
+        append_leb128(w0.payload, seq_hdr.size());
+        w0.payload.insert(w0.payload.end(), seq_hdr.begin(), seq_hdr.end());
+        append_leb128(w0.payload, frame.size());
+        w0.payload.insert(w0.payload.end(), frame.begin(), frame.end());
+        CPPUNIT_ASSERT(parse_av1_obus(depacketize(decode_frame_av1, { w0 })) == expected);
+
+        received_packet w2{ true, { 2 << 4 } };
+        append_leb128(w2.payload, seq_hdr.size());
+        w2.payload.insert(w2.payload.end(), seq_hdr.begin(), seq_hdr.end());
+        w2.payload.insert(w2.payload.end(), frame.begin(), frame.end());
+        CPPUNIT_ASSERT(parse_av1_obus(depacketize(decode_frame_av1, { w2 })) == expected);
+
+        // OBU split into two packets each with a single element (W=1) - Y and Z set
+        received_packet first{ false, { AV1_AGGR_Y | 1 << 4 } };
+        first.payload.insert(first.payload.end(), frame.begin(), frame.begin() + 8);
+        received_packet second{ true, { AV1_AGGR_Z | 1 << 4 } };
+        second.payload.insert(second.payload.end(), frame.begin() + 8, frame.end());
+        CPPUNIT_ASSERT(parse_av1_obus(depacketize(decode_frame_av1, { first, second })) == obu_list{ expected[1] });
+
+        // continuation without the start must be refused
+        vector<unsigned char> out(1024);
+        struct video_frame *vf = vf_alloc(1);
+        vf->tiles[0].data = (char *) out.data();
+        rtp_packet pckt{};
+        pckt.data = (char *) second.payload.data();
+        pckt.data_len = second.payload.size();
+        coded_data cdata{};
+        cdata.data = &pckt;
+        struct decode_data_h264 decode_data{};
+        decode_data.frame = vf;
+        CPPUNIT_ASSERT(!decode_frame_av1(&cdata, &decode_data));
+        vf->tiles[0].data = nullptr;
+        vf_free(vf);
+}
+
+#endif // defined HAVE_CPPUNIT && defined HAVE_RTSP
@@ -0,0 +1,41 @@
+#ifndef RTP_PAYLOAD_TEST_HPP_3E6B1C2A_7F4D_4B8E_9A51_2D0C8F6E4A17
+#define RTP_PAYLOAD_TEST_HPP_3E6B1C2A_7F4D_4B8E_9A51_2D0C8F6E4A17
+
+#include "config.h"
+
+#ifdef HAVE_RTSP // depacketizers are built with RTSP capture
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Round-trip tests of standard RTP payload formats - frames are packetized by
+ * tx_send_h264()/tx_send_h265()/tx_send_av1() over a loopback RTP session and
+ * the received packets are depacketized by decode_frame_h264()/
+ * decode_frame_h265()/decode_frame_av1().
+ */
+class rtp_payload_test : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( rtp_payload_test );
+  CPPUNIT_TEST( test_h264_start_code_scan );
+  CPPUNIT_TEST( test_h264_stap_a_fu_a );
+  CPPUNIT_TEST( test_h265_fu );
+  CPPUNIT_TEST( test_av1_obu_continuation );
+  CPPUNIT_TEST( test_av1_w_field );
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  rtp_payload_test();
+  ~rtp_payload_test();
+  void setUp();
+  void tearDown();
+
+  void test_h264_start_code_scan();
+  void test_h264_stap_a_fu_a();
+  void test_h265_fu();
+  void test_av1_obu_continuation();
+  void test_av1_w_field();
+};
+
+#endif // defined HAVE_RTSP
+
+#endif // !defined RTP_PAYLOAD_TEST_HPP_3E6B1C2A_7F4D_4B8E_9A51_2D0C8F6E4A17
@@ -0,0 +1,250 @@
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ipc_frame_shm.h"
+
+namespace{
+
+constexpr uint32_t SHM_VERSION = 1;
+constexpr unsigned BUF_COUNT = 3;
+constexpr uint32_t FRESH = 1u << 31; ///< flag in Shm_hdr::latest
+
+struct Shm_hdr{
+        uint32_t magic;
+        uint32_t version;
+        uint64_t buf_size; ///< size of every buffer including Buf_hdr
+        std::atomic<uint32_t> latest; ///< index of the last written buffer
+};
+
+struct Buf_hdr{
+        int32_t width;
+        int32_t height;
+        int32_t data_len;
+        int32_t color_spec;
+        uint64_t timestamp;
+};
+
+constexpr size_t BUF_HDR_LEN = 64;
+static_assert(sizeof(Buf_hdr) <= BUF_HDR_LEN);
+
+size_t page_size(){
+        return sysconf(_SC_PAGESIZE);
+}
+
+size_t align_up(size_t val, size_t alignment){
+        return (val + alignment - 1) / alignment * alignment;
+}
+
+uint64_t now_ns(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} //anon namespace
+
+struct Ipc_frame_shm{
+        int fd = -1; ///< writer only, reader closes it after mapping
+        char *addr = nullptr;
+        size_t len = 0;
+        size_t buf_size = 0;
+        unsigned own = 0; ///< back buffer of writer, front buffer of reader
+        bool has_frame = false;
+
+        Shm_hdr *hdr() const { return reinterpret_cast<Shm_hdr *>(addr); }
+        Buf_hdr *buf(unsigned idx) const {
+                return reinterpret_cast<Buf_hdr *>(addr + page_size() + idx * buf_size);
+        }
+};
+
+Ipc_frame_shm *ipc_frame_shm_create(size_t data_capacity){
+        auto shm = new Ipc_frame_shm();
+        shm->buf_size = align_up(BUF_HDR_LEN + data_capacity, page_size());
+        shm->len = page_size() + BUF_COUNT * shm->buf_size;
+
+        shm->fd = memfd_create("ipc_frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if(shm->fd == -1 || ftruncate(shm->fd, shm->len) == -1
+                        || fcntl(shm->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+        {
+                ipc_frame_shm_free(shm);
+                return nullptr;
+        }
+
+        void *addr = mmap(nullptr, shm->len, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+        if(addr == MAP_FAILED){
+                ipc_frame_shm_free(shm);
+                return nullptr;
+        }
+        shm->addr = static_cast<char *>(addr);
+
+        // memfd is zeroed - reader's front buffer is 2 (see ipc_frame_shm_map())
+        shm->hdr()->magic = IPC_FRAME_SHM_MAGIC;
+        shm->hdr()->version = SHM_VERSION;
+        shm->hdr()->buf_size = shm->buf_size;
+        shm->hdr()->latest.store(1);
+        shm->own = 0;
+
+        return shm;
+}
+
+Ipc_frame_shm *ipc_frame_shm_map(int fd){
+        struct stat st;
+        if(fstat(fd, &st) == -1 || (size_t) st.st_size < page_size())
+                return nullptr;
+
+        auto shm = new Ipc_frame_shm();
+        shm->len = st.st_size;
+        void *addr = mmap(nullptr, shm->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(addr == MAP_FAILED){
+                delete shm;
+                return nullptr;
+        }
+        shm->addr = static_cast<char *>(addr);
+
+        const Shm_hdr *hdr = shm->hdr();
+        if(hdr->magic != IPC_FRAME_SHM_MAGIC || hdr->version != SHM_VERSION
+                        || hdr->buf_size <= BUF_HDR_LEN || hdr->buf_size % page_size() != 0
+                        || (shm->len - page_size()) / BUF_COUNT < hdr->buf_size)
+        {
+                ipc_frame_shm_free(shm);
+                return nullptr;
+        }
+        shm->buf_size = hdr->buf_size;
+        shm->own = 2;
+
+        return shm;
+}
+
+void ipc_frame_shm_free(Ipc_frame_shm *shm){
+        if(!shm)
+                return;
+
+        if(shm->addr)
+                munmap(shm->addr, shm->len);
+        if(shm->fd != -1)
+                close(shm->fd);
+
+        delete shm;
+}
+
+int ipc_frame_shm_fd(const Ipc_frame_shm *shm){
+        return shm->fd;
+}
+
+size_t ipc_frame_shm_capacity(const Ipc_frame_shm *shm){
+        return shm->buf_size - BUF_HDR_LEN;
+}
+
+void ipc_frame_shm_write(Ipc_frame_shm *shm, const Ipc_frame *f){
+        Buf_hdr *buf = shm->buf(shm->own);
+        buf->width = f->header.width;
+        buf->height = f->header.height;
+        buf->data_len = f->header.data_len;
+        buf->color_spec = f->header.color_spec;
+        buf->timestamp = now_ns();
+        memcpy(reinterpret_cast<char *>(buf) + BUF_HDR_LEN, f->data, f->header.data_len);
+
+        uint32_t old = shm->hdr()->latest.exchange(shm->own | FRESH, std::memory_order_acq_rel);
+        shm->own = (old & ~FRESH) % BUF_COUNT;
+}
+
+bool ipc_frame_shm_acquire(Ipc_frame_shm *shm){
+        auto& latest = shm->hdr()->latest;
+        if((latest.load(std::memory_order_relaxed) & FRESH) == 0)
+                return false;
+
+        uint32_t old = latest.exchange(shm->own, std::memory_order_acq_rel);
+        if((old & ~FRESH) >= BUF_COUNT)
+                return false;
+
+        shm->own = old & ~FRESH;
+        shm->has_frame = true;
+        return true;
+}
+
+uint64_t ipc_frame_shm_timestamp(const Ipc_frame_shm *shm){
+        return shm->has_frame ? shm->buf(shm->own)->timestamp : 0;
+}
+
+bool ipc_frame_shm_read(const Ipc_frame_shm *shm, Ipc_frame *dst){
+        if(!shm->has_frame)
+                return false;
+
+        const Buf_hdr *buf = shm->buf(shm->own);
+        int32_t data_len = buf->data_len;
+        if(data_len < 0 || (size_t) data_len > ipc_frame_shm_capacity(shm))
+                return false;
+
+        if(!ipc_frame_reserve(dst, data_len))
+                return false;
+
+        dst->header.width = buf->width;
+        dst->header.height = buf->height;
+        dst->header.data_len = data_len;
+        dst->header.color_spec = static_cast<Ipc_frame_color_spec>(buf->color_spec);
+        memcpy(dst->data, reinterpret_cast<const char *>(buf) + BUF_HDR_LEN, data_len);
+
+        return true;
+}
+
+bool ipc_frame_shm_send_fd(int sock, int fd){
+        uint32_t magic = IPC_FRAME_SHM_MAGIC;
+        struct iovec iov = { &magic, sizeof magic };
+        union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+        } control{};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof magic;
+}
+
+int ipc_frame_shm_recv_fd(int sock){
+        uint32_t magic = 0;
+        struct iovec iov = { &magic, sizeof magic };
+        union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+        } control{};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+        if(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof magic)
+                return -1;
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+                        || cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+        {
+                return -1;
+        }
+
+        int fd = -1;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+        if(magic != IPC_FRAME_SHM_MAGIC){
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+#endif // __linux__
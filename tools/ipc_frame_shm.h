@@ -0,0 +1,48 @@
+#ifndef IPC_FRAME_SHM_7c1e04b2d95a
+#define IPC_FRAME_SHM_7c1e04b2d95a
+
+/*
+ * Shared-memory transport of Ipc_frames (Linux only). Every writer owns
+ * a memfd with a triple buffer and passes it to the reader over the unix
+ * socket used by ipc_frame_unix. Writer never waits - it fills its back
+ * buffer and swaps it with the "latest" one; reader swaps "latest" with its
+ * front buffer only if a fresh frame is there, so frames the reader didn't
+ * manage to display are simply overwritten (latest frame wins).
+ */
+
+#ifdef __linux__
+#define IPC_FRAME_SHM_SUPPORTED 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipc_frame.h"
+
+/// sent by a reader after accept() and with every ring fd (SCM_RIGHTS)
+#define IPC_FRAME_SHM_MAGIC 0x53505547u // "UGPS"
+
+struct Ipc_frame_shm;
+
+struct Ipc_frame_shm *ipc_frame_shm_create(size_t data_capacity);
+struct Ipc_frame_shm *ipc_frame_shm_map(int fd);
+void ipc_frame_shm_free(struct Ipc_frame_shm *shm);
+
+int ipc_frame_shm_fd(const struct Ipc_frame_shm *shm);
+size_t ipc_frame_shm_capacity(const struct Ipc_frame_shm *shm);
+
+/// writer side, f->header.data_len must not exceed capacity
+void ipc_frame_shm_write(struct Ipc_frame_shm *shm, const struct Ipc_frame *f);
+
+/// reader side, takes the latest frame if there is a fresh one
+bool ipc_frame_shm_acquire(struct Ipc_frame_shm *shm);
+/// monotonic time the acquired frame was written, 0 if there is none
+uint64_t ipc_frame_shm_timestamp(const struct Ipc_frame_shm *shm);
+bool ipc_frame_shm_read(const struct Ipc_frame_shm *shm, struct Ipc_frame *dst);
+
+bool ipc_frame_shm_send_fd(int sock, int fd);
+/// @returns received fd or -1 on error/EOF
+int ipc_frame_shm_recv_fd(int sock);
+
+#endif // __linux__
+
+#endif
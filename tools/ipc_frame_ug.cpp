@@ -7,6 +7,12 @@
 
 #include <array>
 #include <cmath>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "ipc_frame_ug.h"
 #include "ipc_frame.h"
@@ -14,7 +20,8 @@
 #include "video_codec.h"
 
 namespace {
-void scale_frame(char *dst, char *src,
+/// picks every f-th pixel block of every f-th line, used for formats that cannot be box-filtered
+void subsample_frame(char *dst, const char *src,
                 int src_w, int src_h,
                 int f, codec_t codec)
 {
@@ -30,6 +37,162 @@ void scale_frame(char *dst, char *src,
         }
 }
 
+/// box filter needs 8-bit components only and sums of f*f components must fit 16 bits
+bool box_filter_supported(codec_t codec, int f){
+        return f >= 2 && f <= 16 && (codec == RGBA || codec == RGB || codec == BGR
+                        || codec == UYVY || codec == YUYV);
+}
+
+/// acc[i] = sum of src[i] in rows lines
+void sum_rows(uint16_t *acc, const unsigned char *src, size_t pitch, int rows, size_t len){
+        size_t i = 0;
+#ifdef __AVX2__
+        for(; i + 32 <= len; i += 32){
+                __m256i lo = _mm256_setzero_si256();
+                __m256i hi = _mm256_setzero_si256();
+                for(int r = 0; r < rows; r++){
+                        const unsigned char *line = src + r * pitch + i;
+                        lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) line)));
+                        hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (line + 16))));
+                }
+                _mm256_storeu_si256((__m256i *) (acc + i), lo);
+                _mm256_storeu_si256((__m256i *) (acc + i + 16), hi);
+        }
+#endif
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for(; i + 16 <= len; i += 16){
+                __m128i lo = zero;
+                __m128i hi = zero;
+                for(int r = 0; r < rows; r++){
+                        __m128i v = _mm_loadu_si128((const __m128i *) (src + r * pitch + i));
+                        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+                        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+                }
+                _mm_storeu_si128((__m128i *) (acc + i), lo);
+                _mm_storeu_si128((__m128i *) (acc + i + 8), hi);
+        }
+#endif
+        for(; i < len; i++){
+                uint16_t sum = 0;
+                for(int r = 0; r < rows; r++)
+                        sum += src[r * pitch + i];
+                acc[i] = sum;
+        }
+}
+
+/**
+ * Averages f x f pixel blocks (per component) of formats with one pixel per
+ * block (RGB, RGBA, BGR), output geometry is the same
+ * as of subsample_frame(). Lines are summed vertically with SIMD, then the
+ * pixel blocks horizontally, division is a fixed-point multiplication.
+ */
+template<int block_size>
+void box_filter_frame(char *dst, const char *src,
+                int src_w, int src_h,
+                int f, codec_t codec)
+{
+        const size_t src_line_len = vc_get_linesize(src_w, codec);
+        const int out_blocks = src_line_len / (f * block_size);
+        const size_t acc_len = out_blocks * f * block_size;
+        const int n = f * f;
+        std::vector<uint16_t> acc(acc_len + 4); // SIMD reads whole 4-lane groups
+#ifdef __SSE2__
+        const __m128i rounding = _mm_set1_epi16(n / 2);
+        const __m128i recip = _mm_set1_epi16((65536 + n - 1) / n);
+#else
+        const uint32_t recip = (65536 + n / 2) / n;
+#endif
+
+        auto *out = reinterpret_cast<unsigned char *>(dst);
+        for(int y = 0; y + f <= src_h; y += f){
+                sum_rows(acc.data(), reinterpret_cast<const unsigned char *>(src) + y * src_line_len,
+                                src_line_len, f, acc_len);
+                const uint16_t *a = acc.data();
+                for(int b = 0; b < out_blocks; b++){
+#ifdef __SSE2__
+                        // one pixel block in lanes 0..block_size-1, the rest is ignored
+                        __m128i sum = _mm_loadl_epi64((const __m128i *) a);
+                        for(int k = 1; k < f; k++)
+                                sum = _mm_add_epi16(sum, _mm_loadl_epi64((const __m128i *) (a + k * block_size)));
+                        sum = _mm_mulhi_epu16(_mm_add_epi16(sum, rounding), recip);
+                        uint32_t px = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+                        memcpy(out, &px, block_size);
+                        out += block_size;
+                        a += f * block_size;
+#else
+                        uint32_t sum[block_size] = {};
+                        for(int k = 0; k < f; k++){
+                                for(int c = 0; c < block_size; c++)
+                                        sum[c] += a[c];
+                                a += block_size;
+                        }
+                        for(int c = 0; c < block_size; c++)
+                                *out++ = (sum[c] * recip + 32768) >> 16;
+#endif
+                }
+        }
+}
+
+/**
+ * Box filter for packed 4:2:2 formats (UYVY, YUYV). Luma samples are 1-pixel
+ * blocks so that each output luma is an average of its own f x f pixels,
+ * chroma samples are 2-pixel blocks averaged over the whole output macropixel.
+ */
+void box_filter_frame_422(char *dst, const char *src,
+                int src_w, int src_h,
+                int f, codec_t codec)
+{
+        const size_t src_line_len = vc_get_linesize(src_w, codec);
+        const int out_blocks = src_line_len / (f * 4);
+        const size_t acc_len = out_blocks * f * 4;
+        const int n = f * f; // both luma and chroma averages are over f*f samples
+        const uint32_t recip = (65536 + n / 2) / n;
+        const int y_off = codec == UYVY ? 1 : 0; // Y0 at y_off, Y1 at y_off + 2, chroma in between
+        std::vector<uint16_t> acc(acc_len);
+
+        auto *out = reinterpret_cast<unsigned char *>(dst);
+        for(int y = 0; y + f <= src_h; y += f){
+                sum_rows(acc.data(), reinterpret_cast<const unsigned char *>(src) + y * src_line_len,
+                                src_line_len, f, acc_len);
+                const uint16_t *a = acc.data();
+                for(int b = 0; b < out_blocks; b++){
+                        uint32_t luma[2] = {};
+                        uint32_t chroma[2] = {};
+                        for(int k = 0; k < f; k++){
+                                // source pixels 2k and 2k+1 of the 2f wide window, first f belong to Y0
+                                luma[2 * k >= f] += a[k * 4 + y_off];
+                                luma[2 * k + 1 >= f] += a[k * 4 + y_off + 2];
+                                chroma[0] += a[k * 4 + 1 - y_off];
+                                chroma[1] += a[k * 4 + 3 - y_off];
+                        }
+                        out[y_off] = (luma[0] * recip + 32768) >> 16;
+                        out[y_off + 2] = (luma[1] * recip + 32768) >> 16;
+                        out[1 - y_off] = (chroma[0] * recip + 32768) >> 16;
+                        out[3 - y_off] = (chroma[1] * recip + 32768) >> 16;
+                        out += 4;
+                        a += f * 4;
+                }
+        }
+}
+
+void scale_frame(char *dst, const char *src,
+                int src_w, int src_h,
+                int f, codec_t codec)
+{
+        if(!box_filter_supported(codec, f)){
+                subsample_frame(dst, src, src_w, src_h, f, codec);
+                return;
+        }
+
+        if(codec == UYVY || codec == YUYV)
+                box_filter_frame_422(dst, src, src_w, src_h, f, codec);
+        else if(get_pf_block_bytes(codec) == 3)
+                box_filter_frame<3>(dst, src, src_w, src_h, f, codec);
+        else
+                box_filter_frame<4>(dst, src, src_w, src_h, f, codec);
+}
+
 }//anon namespace
 
 bool ipc_frame_from_ug_frame(struct Ipc_frame *dst,
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <array>
 #include <string>
+#include <vector>
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -25,21 +26,40 @@ typedef SOCKET fd_t;
 
 #include <cerrno>
 #include "ipc_frame_unix.h"
+#include "ipc_frame_shm.h"
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
 
+#ifdef IPC_FRAME_SHM_SUPPORTED
+#include <poll.h>
+
+/// how long a writer waits for the reader announcing shared memory support
+#define SHM_HELLO_TIMEOUT_MS 500
+#endif
+
+namespace{
+
+struct Reader_conn{
+        fd_t fd;
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        Ipc_frame_shm *shm = nullptr; ///< set once the writer passed its shared memory
+        bool acquired = false;        ///< shm front buffer holds a frame not yet read
+#endif
+};
+
+} //anon namespace
+
 struct Ipc_frame_reader{
         fd_t listen_fd;
-        fd_t data_fd;
+        std::vector<Reader_conn> conns;
         std::string path;
 };
 
 Ipc_frame_reader *ipc_frame_reader_new(const char *path){
         auto reader = new Ipc_frame_reader();
         reader->path = path;
-        reader->data_fd = INVALID_SOCKET;
 
         reader->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
         if(reader->listen_fd == INVALID_SOCKET){
@@ -72,9 +92,16 @@ Ipc_frame_reader *ipc_frame_reader_new(const char *path){
         return reader;
 }
 
+static void close_conn(Reader_conn& conn){
+        CLOSESOCKET(conn.fd);
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        ipc_frame_shm_free(conn.shm);
+#endif
+}
+
 void ipc_frame_reader_free(struct Ipc_frame_reader *reader){
-        if(reader->data_fd != INVALID_SOCKET)
-                CLOSESOCKET(reader->data_fd);
+        for(auto& conn : reader->conns)
+                close_conn(conn);
         if(reader->listen_fd != INVALID_SOCKET)
                 CLOSESOCKET(reader->listen_fd);
 
@@ -114,29 +141,99 @@ static bool socket_read_avail(fd_t fd){
         return ret > 0;
 }
 
+/// accepts all pending writers, shared memory capable ones are told so
 static bool try_accept(struct Ipc_frame_reader *reader){
-        if(!socket_read_avail(reader->listen_fd))
-                return false;
+        bool accepted = false;
+        while(socket_read_avail(reader->listen_fd)){
+                fd_t fd = accept(reader->listen_fd, nullptr, 0);
+                if(fd == INVALID_SOCKET)
+                        break;
+#ifdef IPC_FRAME_SHM_SUPPORTED
+                uint32_t hello = IPC_FRAME_SHM_MAGIC;
+                send(fd, &hello, sizeof hello, MSG_NOSIGNAL);
+#endif
+                reader->conns.push_back(Reader_conn{fd});
+                accepted = true;
+        }
+
+        return accepted;
+}
+
+#ifdef IPC_FRAME_SHM_SUPPORTED
+/**
+ * Handles messages of shared memory writers (new buffers, disconnect) and
+ * acquires their fresh frames.
+ * @retval false connection was closed
+ */
+static bool update_shm_conn(Reader_conn& conn){
+        while(socket_read_avail(conn.fd)){
+                uint32_t magic = 0;
+                int ret = recv(conn.fd, &magic, sizeof magic, MSG_PEEK | MSG_DONTWAIT);
+                if(ret <= 0)
+                        return false;
+                if(ret < (int) sizeof magic || magic != IPC_FRAME_SHM_MAGIC)
+                        break; // regular frame header (width) - legacy writer
+
+                int fd = ipc_frame_shm_recv_fd(conn.fd);
+                if(fd == -1)
+                        return false;
+                Ipc_frame_shm *shm = ipc_frame_shm_map(fd);
+                close(fd);
+                if(!shm)
+                        return false;
+                ipc_frame_shm_free(conn.shm);
+                conn.shm = shm;
+                conn.acquired = false;
+        }
+
+        if(conn.shm && ipc_frame_shm_acquire(conn.shm))
+                conn.acquired = true;
 
-        reader->data_fd = accept(reader->listen_fd, nullptr, 0);
         return true;
 }
+#endif
+
+static void update_conns(struct Ipc_frame_reader *reader){
+        try_accept(reader);
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        for(auto it = reader->conns.begin(); it != reader->conns.end(); ){
+                if(!update_shm_conn(*it)){
+                        close_conn(*it);
+                        it = reader->conns.erase(it);
+                } else {
+                        ++it;
+                }
+        }
+#endif
+}
 
 bool ipc_frame_reader_has_frame(struct Ipc_frame_reader *reader){
-        if(reader->data_fd == INVALID_SOCKET && !try_accept(reader))
-                return false;
+        update_conns(reader);
+
+        for(const auto& conn : reader->conns){
+#ifdef IPC_FRAME_SHM_SUPPORTED
+                if(conn.shm){
+                        if(conn.acquired)
+                                return true;
+                        continue;
+                }
+#endif
+                if(socket_read_avail(conn.fd))
+                        return true;
+        }
 
-        return socket_read_avail(reader->data_fd);
+        return false;
 }
 
 bool ipc_frame_reader_is_connected(struct Ipc_frame_reader *reader){
-        return reader->data_fd != INVALID_SOCKET || try_accept(reader);
+        try_accept(reader);
+        return !reader->conns.empty();
 }
 
-static bool do_frame_read(Ipc_frame_reader *reader, Ipc_frame *dst){
+static bool do_frame_read(fd_t fd, Ipc_frame *dst){
         char header_buf[IPC_FRAME_HEADER_LEN];
 
-        if(blocking_read(reader->data_fd, header_buf, IPC_FRAME_HEADER_LEN) != IPC_FRAME_HEADER_LEN)
+        if(blocking_read(fd, header_buf, IPC_FRAME_HEADER_LEN) != IPC_FRAME_HEADER_LEN)
                 return false;
 
         if(!ipc_frame_parse_header(&dst->header, header_buf))
@@ -145,16 +242,63 @@ static bool do_frame_read(Ipc_frame_reader *reader, Ipc_frame *dst){
         if(!ipc_frame_reserve(dst, dst->header.data_len))
                 return false;
 
-        int read_data = blocking_read(reader->data_fd, dst->data, dst->header.data_len);
+        int read_data = blocking_read(fd, dst->data, dst->header.data_len);
 
         return read_data == dst->header.data_len;
 }
 
+#ifdef IPC_FRAME_SHM_SUPPORTED
+/**
+ * Reads the newest of the frames acquired from shared memory writers, the
+ * older ones are dropped.
+ */
+static bool read_newest_shm_frame(struct Ipc_frame_reader *reader, Ipc_frame *dst, bool *ret){
+        Reader_conn *newest = nullptr;
+        for(auto& conn : reader->conns){
+                if(!conn.acquired)
+                        continue;
+                if(!newest || ipc_frame_shm_timestamp(conn.shm) > ipc_frame_shm_timestamp(newest->shm))
+                        newest = &conn;
+                conn.acquired = false;
+        }
+
+        if(!newest)
+                return false;
+
+        *ret = ipc_frame_shm_read(newest->shm, dst);
+        return true;
+}
+#endif
+
 bool ipc_frame_reader_read(Ipc_frame_reader *reader, Ipc_frame *dst){
-        bool ret = do_frame_read(reader, dst);
+        update_conns(reader);
+
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        bool shm_ret = false;
+        if(read_newest_shm_frame(reader, dst, &shm_ret))
+                return shm_ret;
+#endif
+
+        // legacy writers - prefer the one having data, block on the first otherwise
+        auto conn = reader->conns.end();
+        for(auto it = reader->conns.begin(); it != reader->conns.end(); ++it){
+#ifdef IPC_FRAME_SHM_SUPPORTED
+                if(it->shm)
+                        continue;
+#endif
+                if(conn == reader->conns.end() || socket_read_avail(it->fd)){
+                        conn = it;
+                        if(socket_read_avail(it->fd))
+                                break;
+                }
+        }
+        if(conn == reader->conns.end())
+                return false;
+
+        bool ret = do_frame_read(conn->fd, dst);
         if(!ret){
-                CLOSESOCKET(reader->data_fd);
-                reader->data_fd = INVALID_SOCKET;
+                close_conn(*conn);
+                reader->conns.erase(conn);
         }
 
         return ret;
@@ -162,8 +306,43 @@ bool ipc_frame_reader_read(Ipc_frame_reader *reader, Ipc_frame *dst){
 
 struct Ipc_frame_writer{
         fd_t data_fd;
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        bool use_shm = false; ///< reader announced shared memory support
+        Ipc_frame_shm *shm = nullptr;
+#endif
 };
 
+#ifdef IPC_FRAME_SHM_SUPPORTED
+static bool wait_shm_hello(fd_t fd){
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if(poll(&pfd, 1, SHM_HELLO_TIMEOUT_MS) <= 0)
+                return false;
+
+        uint32_t hello = 0;
+        return blocking_read(fd, reinterpret_cast<char *>(&hello), sizeof hello) == sizeof hello
+                && hello == IPC_FRAME_SHM_MAGIC;
+}
+
+static bool shm_write(struct Ipc_frame_writer *writer, const struct Ipc_frame *f){
+        // the reader doesn't send anything else than the hello, so readable means closed
+        if(socket_read_avail(writer->data_fd))
+                return false;
+
+        if(!writer->shm || ipc_frame_shm_capacity(writer->shm) < (size_t) f->header.data_len){
+                ipc_frame_shm_free(writer->shm);
+                writer->shm = ipc_frame_shm_create(f->header.data_len);
+                if(!writer->shm
+                                || !ipc_frame_shm_send_fd(writer->data_fd, ipc_frame_shm_fd(writer->shm)))
+                {
+                        return false;
+                }
+        }
+
+        ipc_frame_shm_write(writer->shm, f);
+        return true;
+}
+#endif
+
 Ipc_frame_writer *ipc_frame_writer_new(const char *path){
         auto writer = new Ipc_frame_writer;
         writer->data_fd = INVALID_SOCKET;
@@ -187,12 +366,19 @@ Ipc_frame_writer *ipc_frame_writer_new(const char *path){
                 return nullptr;
         }
 
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        writer->use_shm = wait_shm_hello(writer->data_fd);
+#endif
+
         return writer;
 }
 
 void ipc_frame_writer_free(struct Ipc_frame_writer *writer){
         if(writer->data_fd != INVALID_SOCKET)
                 CLOSESOCKET(writer->data_fd);
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        ipc_frame_shm_free(writer->shm);
+#endif
 
         delete writer;
 }
@@ -214,6 +400,11 @@ void block_write(fd_t fd, void *buf, size_t size){
 } //anon namespace
 
 bool ipc_frame_writer_write(struct Ipc_frame_writer *writer, const struct Ipc_frame *f){
+#ifdef IPC_FRAME_SHM_SUPPORTED
+        if(writer->use_shm)
+                return shm_write(writer, f);
+#endif
+
         std::array<char, IPC_FRAME_HEADER_LEN> header;
 
         ipc_frame_write_header(&f->header, header.data());
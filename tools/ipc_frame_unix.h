@@ -9,6 +9,11 @@
 #define PLATFORM_TMP_DIR "/tmp/"
 #endif
 
+/*
+ * Reader listens on the socket and accepts any number of writers. On Linux
+ * both sides switch to shared memory (see ipc_frame_shm.h) if the peer
+ * supports it, the reader then gets the newest frame of all writers.
+ */
 struct Ipc_frame_reader;
 
 Ipc_frame_reader *ipc_frame_reader_new(const char *path);